@@ -0,0 +1,233 @@
+#include "arena.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "storage_engine.h"
+
+using namespace std;
+
+/*
+    Every allocation from arena_allocate is preceded by a header saying where it came from, so that
+    arena_free works no matter which arena (if any) is current when it is called.
+*/
+struct AllocationHeader {
+    u_int32_t tag;
+    u_int32_t unused;
+    u_int64_t size;
+};
+
+static_assert(sizeof(AllocationHeader) == Arena::ALIGNMENT, "allocation header must keep the alignment");
+
+static const u_int32_t ARENA_TAG = 0xA7E4A7E4;
+static const u_int32_t HEAP_TAG = 0x4EA94EA9;
+
+static thread_local Arena *current_arena = nullptr;
+
+static inline size_t align_up(size_t size) {
+    return (size + Arena::ALIGNMENT - 1) & ~(Arena::ALIGNMENT - 1);
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|         ARENA            |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+Arena::Arena(size_t first_chunk_size) : chunks(nullptr), cursor(nullptr), end(nullptr),
+                                        next_chunk_size(align_up(first_chunk_size)), used(0) {
+    reset_stats();
+}
+
+Arena::~Arena() {
+    while (chunks != nullptr) {
+        Chunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+    if (current_arena == this)
+        current_arena = nullptr;
+}
+
+/**
+    Bump-allocate from the current chunk, starting a bigger one if it is full
+    @param size  bytes wanted
+    @returns     16-byte aligned memory, valid until the next reset()
+*/
+void *Arena::allocate(size_t size) {
+    size = align_up(size);
+    if (cursor == nullptr || (size_t) (end - cursor) < size)
+        add_chunk(size);
+    void *p = cursor;
+    cursor += size;
+    used += size;
+    allocations++;
+    bytes += size;
+    if (used > peak)
+        peak = used;
+    return p;
+}
+
+// Start a new chunk big enough for min_size bytes
+void Arena::add_chunk(size_t min_size) {
+    size_t header_size = align_up(sizeof(Chunk));
+    while (next_chunk_size < min_size + header_size)
+        next_chunk_size *= 2;
+    Chunk *chunk = (Chunk *) malloc(next_chunk_size);
+    if (chunk == nullptr)
+        throw bad_alloc();
+    chunk->size = next_chunk_size;
+    chunk->next = chunks;
+    chunks = chunk;
+    cursor = (char *) chunk + header_size;
+    end = (char *) chunk + chunk->size;
+    next_chunk_size *= 2;
+    chunk_allocations++;
+}
+
+/**
+    Release everything allocated since the last reset. Keeps the newest chunk for reuse.
+*/
+void Arena::reset() {
+    if (chunks != nullptr) {
+        Chunk *chunk = chunks->next;
+        while (chunk != nullptr) {
+            Chunk *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+        chunks->next = nullptr;
+        cursor = (char *) chunks + align_up(sizeof(Chunk));
+        next_chunk_size = chunks->size * 2;
+    }
+    used = 0;
+    resets++;
+}
+
+/**
+    Check if memory was handed out by this arena
+    @param p  pointer to check
+    @returns  true if p lies in one of the arena's chunks
+*/
+bool Arena::owns(const void *p) const {
+    for (Chunk *chunk = chunks; chunk != nullptr; chunk = chunk->next)
+        if ((const char *) p >= (const char *) chunk && (const char *) p < (const char *) chunk + chunk->size)
+            return true;
+    return false;
+}
+
+/**
+    Format the allocation statistics on one line
+    @returns  the report (sizes in KB)
+*/
+string Arena::report() const {
+    size_t reserved = 0;
+    for (Chunk *chunk = chunks; chunk != nullptr; chunk = chunk->next)
+        reserved += chunk->size;
+    char line[200];
+    snprintf(line, sizeof(line), "arena: %llu allocations, %.1f KB allocated, %llu chunk mallocs, "
+                                 "%llu resets, peak %.1f KB, %.1f KB reserved",
+             (unsigned long long) allocations, bytes / 1024.0, (unsigned long long) chunk_allocations,
+             (unsigned long long) resets, peak / 1024.0, reserved / 1024.0);
+    return string(line);
+}
+
+void Arena::reset_stats() {
+    allocations = 0;
+    bytes = 0;
+    chunk_allocations = 0;
+    resets = 0;
+    peak = used;
+}
+
+Arena *Arena::current() {
+    return current_arena;
+}
+
+void Arena::set_current(Arena *arena) {
+    current_arena = arena;
+}
+
+/**
+    Allocate from the current arena, or from the heap if there is none
+    @param size  bytes wanted
+    @returns     16-byte aligned memory, to be released with arena_free
+*/
+void *arena_allocate(size_t size) {
+    AllocationHeader *header;
+    if (current_arena != nullptr) {
+        header = (AllocationHeader *) current_arena->allocate(sizeof(AllocationHeader) + size);
+        header->tag = ARENA_TAG;
+    } else {
+        header = (AllocationHeader *) malloc(sizeof(AllocationHeader) + size);
+        if (header == nullptr)
+            throw bad_alloc();
+        header->tag = HEAP_TAG;
+    }
+    header->size = size;
+    return header + 1;
+}
+
+/**
+    Release memory from arena_allocate. Arena memory is only given back by Arena::reset().
+    @param p  memory to release (nullptr is ignored)
+*/
+void arena_free(void *p) noexcept {
+    if (p == nullptr)
+        return;
+    AllocationHeader *header = (AllocationHeader *) p - 1;
+    if (header->tag == HEAP_TAG) {
+        header->tag = 0;
+        free(header);
+    }
+}
+
+/**
+ * Testing function for Arena.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_arena() {
+    Arena arena(1024);
+    void *heap_memory = arena_allocate(10);  // no arena yet
+    if (arena.owns(heap_memory))
+        return false;
+    {
+        ArenaScope scope(&arena);
+        char *a = (char *) arena_allocate(10);
+        char *b = (char *) arena_allocate(3000);  // needs a second, bigger chunk
+        if (!arena.owns(a) || !arena.owns(b) || ((size_t) a % Arena::ALIGNMENT) != 0
+            || ((size_t) b % Arena::ALIGNMENT) != 0)
+            return false;
+        arena_free(a);  // no-op
+
+        Handles handles;
+        for (BlockID i = 0; i < 1000; i++)
+            handles.push_back(Handle(i, 1));
+        ValueDict row;
+        row["a"] = Value(12);
+        row["b"] = Value("Hello!");
+        if (handles[999].first != 999 || row["b"].s != "Hello!")
+            return false;
+        {
+            ArenaScope heap_scope(nullptr);
+            void *long_lived = arena_allocate(10);
+            if (arena.owns(long_lived))
+                return false;
+            arena_free(long_lived);
+        }
+    }
+    arena_free(heap_memory);
+    if (Arena::current() != nullptr || arena.get_chunk_allocations() < 2 || arena.get_used() == 0)
+        return false;
+    u_int64_t chunks = arena.get_chunk_allocations();
+    arena.reset();
+    if (arena.get_used() != 0)
+        return false;
+
+    // a statement no bigger than the last one runs in the chunk kept by reset
+    {
+        ArenaScope scope(&arena);
+        for (int i = 0; i < 100; i++)
+            arena_allocate(10);
+    }
+    return arena.get_chunk_allocations() == chunks && arena.report().find("resets") != string::npos;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file arena.h - per-statement memory arena for the short-lived storage objects
+ *
+ * A select-and-project allocates a SlottedPage per block, a RecordIDs vector per block, a ValueDict
+ * per row and a marshal buffer per insert. Inside an ArenaScope all of these come out of one Arena by
+ * bumping a pointer, their deletes are no-ops, and the whole lot is released with Arena::reset() when
+ * the statement is done. Outside any scope the same calls fall back to the heap, so code that runs
+ * without an arena (tests, tools) keeps working unchanged.
+ *
+ * Memory from an arena must not outlive the statement: anything that has to survive (caches,
+ * catalog entries) is allocated under ArenaScope(nullptr).
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+
+/**
+ * @class Arena - bump allocator over a list of chunks, each twice the size of the one before
+ *
+ *      reset() frees every chunk but the newest (largest) one and rewinds into it, so a statement
+ *      that is no bigger than the previous one doesn't call malloc at all.
+ *      Not thread safe: each thread uses its own arena.
+ */
+class Arena {
+public:
+    static const size_t FIRST_CHUNK_SZ = 64 * 1024;
+    static const size_t ALIGNMENT = 16;
+
+    Arena(size_t first_chunk_size = FIRST_CHUNK_SZ);
+
+    virtual ~Arena();
+
+    Arena(const Arena &other) = delete;
+
+    Arena(Arena &&temp) = delete;
+
+    Arena &operator=(const Arena &other) = delete;
+
+    Arena &operator=(Arena &&temp) = delete;
+
+    virtual void *allocate(size_t size);
+
+    virtual void reset();
+
+    virtual bool owns(const void *p) const;
+
+    virtual size_t get_used() const { return used; }
+
+    virtual std::string report() const;
+
+    virtual void reset_stats();
+
+    virtual u_int64_t get_allocations() const { return allocations; }
+
+    virtual u_int64_t get_chunk_allocations() const { return chunk_allocations; }
+
+    static Arena *current();
+
+    static void set_current(Arena *arena);
+
+protected:
+    struct Chunk {
+        Chunk *next;
+        size_t size;
+    };
+
+    Chunk *chunks;  // newest first
+    char *cursor;
+    char *end;
+    size_t next_chunk_size;
+    size_t used;  // bytes handed out since the last reset
+
+    // statistics since the last reset_stats()
+    u_int64_t allocations;
+    u_int64_t bytes;
+    u_int64_t chunk_allocations;
+    u_int64_t resets;
+    size_t peak;
+
+    virtual void add_chunk(size_t min_size);
+};
+
+/**
+ * @class ArenaScope - makes the given arena the current one for this thread during its lifetime
+ *
+ *      ArenaScope(nullptr) sends allocations back to the heap, e.g. for long-lived objects built
+ *      while a statement runs.
+ */
+class ArenaScope {
+public:
+    ArenaScope(Arena *arena) : saved(Arena::current()) { Arena::set_current(arena); }
+
+    ~ArenaScope() { Arena::set_current(saved); }
+
+    ArenaScope(const ArenaScope &other) = delete;
+
+    ArenaScope &operator=(const ArenaScope &other) = delete;
+
+protected:
+    Arena *saved;
+};
+
+// Allocate from the current arena, or from the heap if there is none. Always 16-byte aligned.
+void *arena_allocate(size_t size);
+
+// Release memory from arena_allocate: returned to the heap if it came from there, else left for reset().
+void arena_free(void *p) noexcept;
+
+/**
+ * @class ArenaAllocator - standard allocator over arena_allocate/arena_free, for the storage containers
+ */
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator() noexcept {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n) { return static_cast<T *>(arena_allocate(n * sizeof(T))); }
+
+    void deallocate(T *p, size_t) noexcept { arena_free(p); }
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return true; }
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return false; }
+
+bool test_arena();
@@ -0,0 +1,433 @@
+/*
+	@file bench_storage.cpp - microbenchmarks for the heap storage engine hot paths
+
+	Build and run with:
+		$ make bench
+		$ ./bench_storage [-q] [-a] [-p] [-b block_size] [dbenvpath] > bench.json
+	Writes one JSON document to stdout with a result per benchmark. Each result has
+	the latency percentiles of the individual operations (in nanoseconds) and the
+	overall throughput. -q runs fewer iterations (for a quick smoke test), -b sets
+	the block size of the pages and tables (default 4096), -a runs each insert and
+	scan in a statement arena the way the shell does, -p gives the tables PAX pages.
+	HeapTable::insert_threads inserts the same rows on 1, 2, 4 and 8 threads at once.
+	If no dbenvpath is given, a fresh environment is made under /tmp, and removed at exit.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include "db_cxx.h"
+#include "heap_storage.h"
+
+using namespace std;
+
+DbEnv *_DB_ENV;
+
+typedef chrono::steady_clock Clock;
+
+static inline u_int64_t elapsed_ns(Clock::time_point start) {
+	return (u_int64_t) chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+/*
+	Latency samples for one benchmark and its JSON rendering
+*/
+class BenchResult {
+public:
+	BenchResult(const string &name, const string &params) : name(name), params(params), total_ns(0), bytes(0) {}
+
+	void add(u_int64_t ns) {
+		samples.push_back(ns);
+		total_ns += ns;
+	}
+
+	void add_bytes(u_int64_t n) { bytes += n; }
+
+	string to_json() {
+		sort(samples.begin(), samples.end());
+		double seconds = total_ns / 1e9;
+		char buffer[512];
+		snprintf(buffer, sizeof(buffer),
+				 "{\"benchmark\": \"%s\", \"params\": {%s}, \"samples\": %zu, \"mean_ns\": %.1f, "
+				 "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, "
+				 "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f}",
+				 name.c_str(), params.c_str(), samples.size(),
+				 samples.empty() ? 0.0 : (double) total_ns / samples.size(),
+				 percentile(0.50), percentile(0.90), percentile(0.99), percentile(1.0),
+				 seconds == 0 ? 0.0 : samples.size() / seconds,
+				 seconds == 0 ? 0.0 : bytes / seconds / (1024 * 1024));
+		return string(buffer);
+	}
+
+protected:
+	string name;
+	string params;
+	vector<u_int64_t> samples;
+	u_int64_t total_ns;
+	u_int64_t bytes;
+
+	unsigned long long percentile(double q) {
+		if (samples.empty())
+			return 0;
+		size_t i = (size_t) (q * (samples.size() - 1));
+		return samples[i];
+	}
+};
+
+/*
+	Exposes the row codec of HeapTable to the benchmarks
+*/
+class BenchHeapTable : public HeapTable {
+public:
+	BenchHeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+				   uint block_size) : HeapTable(table_name, column_names, column_attributes, block_size) {}
+
+	using HeapTable::marshal;
+	using HeapTable::unmarshal;
+};
+
+static vector<string> results;
+static mt19937 rng(5300);
+static uint block_size = DbBlock::BLOCK_SZ;
+static HeapFile::Layout layout = HeapFile::SLOTTED;
+static Arena *statement_arena = nullptr;  // set by -a
+
+static string params(uint record_size, double fill) {
+	char buffer[100];
+	snprintf(buffer, sizeof(buffer), "\"record_size\": %u, \"fill_factor\": %.2f", record_size, fill);
+	return buffer;
+}
+
+// Add records of record_size to a fresh page until fill of it is used, optionally timing each add
+static void fill_page(SlottedPage &page, uint record_size, double fill, BenchResult *result = nullptr) {
+	vector<char> record(record_size, 'x');
+	Dbt data(record.data(), record_size);
+	uint limit = (uint) (fill * block_size);
+	uint slot = block_size > 0x10000 ? 8 : 4;  // size of a record header
+	uint used = slot;
+	while (used + record_size + slot <= limit) {
+		Clock::time_point start = Clock::now();
+		page.add(&data);
+		if (result != nullptr) {
+			result->add(elapsed_ns(start));
+			result->add_bytes(record_size);
+		}
+		used += record_size + slot;
+	}
+}
+
+/*
+	SlottedPage::add/get/put/del/ids for one record size and fill factor
+*/
+static void bench_slotted_page(uint record_size, double fill, uint pages) {
+	vector<char> block(block_size);
+	BenchResult add("SlottedPage::add", params(record_size, fill));
+	BenchResult get("SlottedPage::get", params(record_size, fill));
+	BenchResult put("SlottedPage::put", params(record_size, fill));
+	BenchResult del("SlottedPage::del", params(record_size, fill));
+	BenchResult ids("SlottedPage::ids", params(record_size, fill));
+	vector<char> smaller(record_size / 2 + 1, 'y'), original(record_size, 'x');
+	Dbt smaller_data(smaller.data(), smaller.size()), original_data(original.data(), original.size());
+
+	for (uint p = 0; p < pages; p++) {
+		memset(block.data(), 0, block_size);
+		Dbt block_dbt(block.data(), block_size);
+		SlottedPage page(block_dbt, 1, true);
+		fill_page(page, record_size, fill, &add);
+
+		RecordIDs *record_ids = page.ids();
+		if (record_ids->empty()) {
+			delete record_ids;
+			continue;
+		}
+		for (uint i = 0; i < record_ids->size(); i++) {
+			RecordID id = (*record_ids)[rng() % record_ids->size()];
+			Clock::time_point start = Clock::now();
+			Dbt *data = page.get(id);
+			get.add(elapsed_ns(start));
+			get.add_bytes(data->get_size());
+			delete data;
+		}
+
+		// shrink then grow back, so both directions of slide() are exercised
+		for (uint i = 0; i < record_ids->size(); i++) {
+			RecordID id = (*record_ids)[rng() % record_ids->size()];
+			Clock::time_point start = Clock::now();
+			page.put(id, smaller_data);
+			put.add(elapsed_ns(start));
+			start = Clock::now();
+			page.put(id, original_data);
+			put.add(elapsed_ns(start));
+			put.add_bytes(smaller.size() + original.size());
+		}
+
+		Clock::time_point start = Clock::now();
+		RecordIDs *all = page.ids();
+		ids.add(elapsed_ns(start));
+		delete all;
+
+		shuffle(record_ids->begin(), record_ids->end(), rng);
+		for (RecordID id : *record_ids) {
+			start = Clock::now();
+			page.del(id);
+			del.add(elapsed_ns(start));
+			del.add_bytes(record_size);
+		}
+		delete record_ids;
+	}
+	results.push_back(add.to_json());
+	results.push_back(get.to_json());
+	results.push_back(put.to_json());
+	results.push_back(del.to_json());
+	results.push_back(ids.to_json());
+}
+
+static ColumnNames bench_column_names() {
+	ColumnNames column_names;
+	column_names.push_back("id");
+	column_names.push_back("name");
+	column_names.push_back("score");
+	column_names.push_back("note");
+	return column_names;
+}
+
+static ColumnAttributes bench_column_attributes() {
+	ColumnAttributes column_attributes;
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	return column_attributes;
+}
+
+static ValueDict bench_row(int i, uint text_size) {
+	ValueDict row;
+	row["id"] = Value(i);
+	row["name"] = Value(string(text_size, (char) ('a' + i % 26)));
+	row["score"] = Value(i * 7);
+	row["note"] = Value(string(text_size / 2, 'n'));
+	return row;
+}
+
+/*
+	HeapTable::marshal/unmarshal throughput for one text width
+*/
+static void bench_codec(uint text_size, uint rows) {
+	char buffer[100];
+	snprintf(buffer, sizeof(buffer), "\"text_size\": %u", text_size);
+	BenchResult marshal("HeapTable::marshal", buffer);
+	BenchResult unmarshal("HeapTable::unmarshal", buffer);
+	BenchHeapTable table("_bench_codec", bench_column_names(), bench_column_attributes(), block_size);
+
+	for (uint i = 0; i < rows; i++) {
+		ValueDict row = bench_row(i, text_size);
+		Clock::time_point start = Clock::now();
+		Dbt *data = table.marshal(&row);
+		marshal.add(elapsed_ns(start));
+		marshal.add_bytes(data->get_size());
+
+		start = Clock::now();
+		ValueDict *result = table.unmarshal(data);
+		unmarshal.add(elapsed_ns(start));
+		unmarshal.add_bytes(data->get_size());
+
+		delete result;
+		arena_free(data->get_data());
+		delete data;
+	}
+	results.push_back(marshal.to_json());
+	results.push_back(unmarshal.to_json());
+}
+
+/*
+	HeapTable::insert rows/sec and full-scan (select + project) rows/sec
+*/
+static void bench_table(uint text_size, uint rows, uint scans) {
+	char buffer[100];
+	snprintf(buffer, sizeof(buffer), "\"text_size\": %u, \"rows\": %u", text_size, rows);
+	BenchResult insert("HeapTable::insert", buffer);
+	BenchResult scan("HeapTable::scan", buffer);
+	BenchResult scan_rows("HeapTable::scan_row", buffer);
+
+	{
+		// get rid of the table left behind by an interrupted run in the same environment
+		HeapTable leftover("_bench_table", bench_column_names(), bench_column_attributes());
+		try {
+			leftover.open();
+			leftover.drop();
+		} catch (DbException &e) {
+			// nothing to drop
+		}
+	}
+	HeapTable table("_bench_table", bench_column_names(), bench_column_attributes(), block_size, layout);
+	table.create();
+	for (uint i = 0; i < rows; i++) {
+		ValueDict row = bench_row(i, text_size);
+		Clock::time_point start = Clock::now();
+		{
+			ArenaScope scope(statement_arena);
+			table.insert(&row);
+		}
+		if (statement_arena != nullptr)
+			statement_arena->reset();
+		insert.add(elapsed_ns(start));
+	}
+
+	for (uint s = 0; s < scans; s++) {
+		Clock::time_point start = Clock::now();
+		{
+			ArenaScope scope(statement_arena);
+			Handles *handles = table.select();
+			for (auto const &handle : *handles) {
+				Clock::time_point row_start = Clock::now();
+				ValueDict *row = table.project(handle);
+				scan_rows.add(elapsed_ns(row_start));
+				delete row;
+			}
+			delete handles;
+		}
+		if (statement_arena != nullptr)
+			statement_arena->reset();
+		scan.add(elapsed_ns(start));
+	}
+	table.drop();
+	results.push_back(insert.to_json());
+	results.push_back(scan.to_json());
+	results.push_back(scan_rows.to_json());
+}
+
+/*
+	HeapTable::insert rows/sec with the rows dealt out to several threads (see HeapAppender); each
+	sample is the average time per row of one run
+*/
+static void bench_concurrent(uint text_size, uint rows, uint threads) {
+	char buffer[100];
+	snprintf(buffer, sizeof(buffer), "\"text_size\": %u, \"rows\": %u, \"threads\": %u", text_size, rows, threads);
+	BenchResult insert("HeapTable::insert_threads", buffer);
+
+	vector<ValueDict *> batch;
+	for (uint i = 0; i < rows; i++)
+		batch.push_back(new ValueDict(bench_row(i, text_size)));
+	{
+		HeapTable leftover("_bench_concurrent", bench_column_names(), bench_column_attributes());
+		try {
+			leftover.open();
+			leftover.drop();
+		} catch (DbException &e) {
+			// nothing to drop
+		}
+	}
+	HeapTable table("_bench_concurrent", bench_column_names(), bench_column_attributes(), block_size, layout);
+	table.create();
+	Clock::time_point start = Clock::now();
+	table.insert(&batch, threads);
+	u_int64_t ns = elapsed_ns(start);
+	for (uint i = 0; i < rows; i++)
+		insert.add(ns / rows);
+	table.drop();
+	for (auto row : batch)
+		delete row;
+	results.push_back(insert.to_json());
+}
+
+/*
+	Remove an environment made for the run, with whatever Berkeley DB left in it
+*/
+static void remove_env(const string &home) {
+	DIR *dir = opendir(home.c_str());
+	if (dir != nullptr) {
+		for (struct dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+			string name = entry->d_name;
+			if (name != "." && name != "..")
+				unlink((home + "/" + name).c_str());
+		}
+		closedir(dir);
+	}
+	rmdir(home.c_str());
+}
+
+int main(int argc, char **argv) {
+	bool quick = false;
+	string envHome;
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "-q")
+			quick = true;
+		else if (string(argv[i]) == "-a")
+			statement_arena = new Arena();
+		else if (string(argv[i]) == "-p")
+			layout = HeapFile::PAX;
+		else if (string(argv[i]) == "-b" && i + 1 < argc)
+			block_size = (uint) atoi(argv[++i]);
+		else
+			envHome = argv[i];
+	}
+	bool made = envHome.empty();
+	if (made) {
+		char dir[] = "/tmp/bench_storageXXXXXX";
+		if (mkdtemp(dir) == nullptr) {
+			perror("mkdtemp");
+			return 1;
+		}
+		envHome = dir;
+	}
+
+	DbEnv env(0U);
+	env.set_message_stream(&cerr);
+	env.set_error_stream(&cerr);
+	try {
+		env.open(envHome.c_str(), DB_CREATE | DB_INIT_MPOOL, 0);
+	} catch (DbException &exc) {
+		cerr << "(bench_storage: " << exc.what() << ")" << endl;
+		if (made)
+			remove_env(envHome);
+		return 1;
+	}
+	_DB_ENV = &env;
+
+	uint pages = quick ? 20 : 2000;
+	uint rows = quick ? 500 : 50000;
+	uint scans = quick ? 2 : 5;
+	uint record_sizes[] = {16, 64, 256, 1024};
+	double fills[] = {0.5, 0.9, 0.98};
+
+	int status = EXIT_SUCCESS;
+	try {
+		for (uint record_size : record_sizes)
+			for (double fill : fills)
+				bench_slotted_page(record_size, fill, pages);
+		for (uint text_size : {8, 64, 512})
+			bench_codec(text_size, rows);
+		for (uint text_size : {8, 64})
+			bench_table(text_size, rows, scans);
+		for (uint threads : {1, 2, 4, 8})
+			bench_concurrent(64, rows, threads);
+	} catch (exception &e) {
+		cerr << "(bench_storage: " << e.what() << ")" << endl;
+		status = 1;
+	}
+
+	if (status == EXIT_SUCCESS) {
+		cout << "{\"block_size\": " << block_size << ", \"layout\": " << (layout == HeapFile::PAX ? "\"pax\"" : "\"slotted\"")
+			 << ", \"arena\": " << (statement_arena != nullptr ? "true" : "false")
+			 << ", \"results\": [" << endl;
+		for (uint i = 0; i < results.size(); i++)
+			cout << "  " << results[i] << (i + 1 < results.size() ? "," : "") << endl;
+		cout << "]}" << endl;
+	}
+	delete statement_arena;
+	try {
+		env.close(0);
+	} catch (DbException &exc) {
+		cerr << "(bench_storage: " << exc.what() << ")" << endl;
+	}
+	if (made)
+		remove_env(envHome);
+	return status;
+}
@@ -0,0 +1,74 @@
+#include "bloom_filter.h"
+#include <algorithm>
+
+using namespace std;
+
+BloomFilter::BloomFilter(u_int32_t values, u_int32_t max_bytes) {
+    u_int32_t bytes = (u_int32_t) (((u_int64_t) values * BITS_PER_VALUE + 7) / 8);
+    this->bits.assign(max((u_int32_t) MIN_BYTES, min(bytes, max_bytes)), 0);
+}
+
+BloomFilter::BloomFilter(const char *bytes, u_int32_t size) : bits(bytes, bytes + size) {
+}
+
+void BloomFilter::add(const string &value) {
+    u_int64_t h1, h2;
+    hash(value, h1, h2);
+    u_int64_t num_bits = this->bits.size() * 8;
+    for (u_int32_t i = 0; i < NUM_HASHES; i++) {
+        u_int64_t bit = (h1 + i * h2) % num_bits;
+        this->bits[bit / 8] |= (u_int8_t) (1 << (bit % 8));
+    }
+}
+
+bool BloomFilter::may_contain(const string &value) const {
+    u_int64_t h1, h2;
+    hash(value, h1, h2);
+    u_int64_t num_bits = this->bits.size() * 8;
+    for (u_int32_t i = 0; i < NUM_HASHES; i++) {
+        u_int64_t bit = (h1 + i * h2) % num_bits;
+        if (!(this->bits[bit / 8] & (1 << (bit % 8))))
+            return false;
+    }
+    return true;
+}
+
+// Two independent hashes of a value (FNV-1a from two offset bases); the second one is odd so the
+// probes don't all land on the same bit.
+void BloomFilter::hash(const string &value, u_int64_t &h1, u_int64_t &h2) {
+    const u_int64_t PRIME = 0x100000001b3ULL;
+    h1 = 0xcbf29ce484222325ULL;
+    h2 = 0x84222325cbf29ce4ULL;
+    for (unsigned char c: value) {
+        h1 = (h1 ^ c) * PRIME;
+        h2 = (h2 ^ c) * PRIME;
+    }
+    h2 |= 1;
+}
+
+/**
+ * Testing function for BloomFilter.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_bloom_filter() {
+    BloomFilter filter(1000, 4096);
+    if (filter.size() != 1250)
+        return false;
+    for (int i = 0; i < 1000; i++)
+        filter.add("value " + to_string(i));
+    for (int i = 0; i < 1000; i++)
+        if (!filter.may_contain("value " + to_string(i)))
+            return false;
+    int false_positives = 0;
+    for (int i = 1000; i < 11000; i++)
+        false_positives += filter.may_contain("value " + to_string(i));
+    if (false_positives > 200)  // about 1% expected
+        return false;
+
+    BloomFilter copy(filter.data(), filter.size());
+    for (int i = 0; i < 1000; i++)
+        if (!copy.may_contain("value " + to_string(i)))
+            return false;
+    BloomFilter small(1, 4096);
+    return small.size() == BloomFilter::MIN_BYTES;
+}
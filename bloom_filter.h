@@ -0,0 +1,67 @@
+/**
+ * @file bloom_filter.h - Bloom filters for the TEXT values of a heap file block
+ *
+ * A BloomFilter answers "might this block hold a row with this value?": never no when it does, and
+ * yes when it doesn't only now and then (the false positives). It is sized when it is built, at
+ * BITS_PER_VALUE bits for each value it is built for, and sets NUM_HASHES bits per value, picked by
+ * double hashing (two FNV-1a hashes of the value), which gives about 1% false positives while no
+ * more values than that have been added.
+ * Its bytes are just the bit array, so it can be stored as is and read back with the same hashes.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * @class BloomFilter - set membership with false positives, on strings
+ */
+class BloomFilter {
+public:
+    static const u_int32_t BITS_PER_VALUE = 10;
+    static const u_int32_t NUM_HASHES = 7;
+    static const u_int32_t MIN_BYTES = 8;
+
+    /**
+     * An empty filter.
+     * @param values     how many values it is meant for
+     * @param max_bytes  the most bytes it may take, whatever values says
+     */
+    BloomFilter(u_int32_t values, u_int32_t max_bytes);
+
+    // a filter from the bytes of another one
+    BloomFilter(const char *bytes, u_int32_t size);
+
+    virtual ~BloomFilter() {}
+
+    virtual void add(const std::string &value);
+
+    virtual bool may_contain(const std::string &value) const;
+
+    virtual u_int32_t size() const { return (u_int32_t) bits.size(); }
+
+    virtual const char *data() const { return (const char *) bits.data(); }
+
+protected:
+    std::vector<u_int8_t> bits;
+
+    static void hash(const std::string &value, u_int64_t &h1, u_int64_t &h2);
+};
+
+/**
+ * How well the Bloom filters of a table did at sparing scans blocks that can't have a value
+ */
+struct BloomStats {
+    u_int32_t blocks;  // with a filter
+    u_int64_t probes;  // filters asked
+    u_int64_t skipped;  // blocks not read because their filter said no
+    u_int64_t false_positives;  // blocks read because their filter said maybe, with no rows for the value
+
+    // of the blocks without the value, how many were read anyway
+    double false_positive_rate() const {
+        return false_positives + skipped == 0 ? 0.0 : (double) false_positives / (false_positives + skipped);
+    }
+};
+
+bool test_bloom_filter();
@@ -0,0 +1,970 @@
+#include "column_storage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <set>
+
+using namespace std;
+
+typedef u_int16_t u16;
+typedef u_int32_t u32;
+
+// per column of a row group record: encoding, first block, blocks, size
+static const u32 SEGMENT_INFO_SIZE = 1 + 3 * sizeof(u32);
+
+static void append_u32(string &bytes, u32 n) {
+    bytes.append((const char *) &n, sizeof(n));
+}
+
+static u32 read_u32(const string &bytes, size_t &offset) {
+    u32 n;
+    memcpy(&n, bytes.data() + offset, sizeof(n));
+    offset += sizeof(n);
+    return n;
+}
+
+// column tables with a last row group not written yet, and when its first row not written came in
+static map<ColumnTable *, chrono::steady_clock::time_point> buffering;
+
+/*
+            ----------------------
+~~~~~~~~~~~~|   COLUMN SEGMENT   |~~~~~~~~~~~~
+            ----------------------
+*/
+
+// Number of rows in the segment.
+u_int32_t ColumnSegment::size() const {
+    return this->data_type == ColumnAttribute::INT ? this->ints.size() : this->texts.size();
+}
+
+// Value of a row.
+Value ColumnSegment::get(u32 row) const {
+    if (this->data_type == ColumnAttribute::INT)
+        return Value(this->ints[row]);
+    return Value(this->texts[row]);
+}
+
+// Change the value of a row.
+void ColumnSegment::put(u32 row, const Value &value) {
+    if (this->data_type == ColumnAttribute::INT) {
+        this->ints[row] = value.n;
+    } else {
+        this->texts[row] = value.s;
+        this->dictionary.clear();
+        this->codes.clear();
+    }
+}
+
+// Add a row at the end.
+void ColumnSegment::append(const Value &value) {
+    if (this->data_type == ColumnAttribute::INT) {
+        this->ints.push_back(value.n);
+    } else {
+        this->texts.push_back(value.s);
+        this->dictionary.clear();
+        this->codes.clear();
+    }
+}
+
+// Clear the matches of the rows not equal to value. With the dictionary at hand, a value that
+// isn't in it rules out every row without a single comparison, and otherwise only codes are compared.
+void ColumnSegment::match(const Value &value, vector<bool> &matches) const {
+    if (value.data_type != this->data_type) {
+        matches.assign(matches.size(), false);
+    } else if (this->data_type == ColumnAttribute::INT) {
+        for (u32 row = 0; row < matches.size(); row++)
+            if (matches[row] && this->ints[row] != value.n)
+                matches[row] = false;
+    } else if (!this->codes.empty()) {
+        auto found = lower_bound(this->dictionary.begin(), this->dictionary.end(), value.s);
+        if (found == this->dictionary.end() || *found != value.s) {
+            matches.assign(matches.size(), false);
+            return;
+        }
+        u16 code = (u16) (found - this->dictionary.begin());
+        for (u32 row = 0; row < matches.size(); row++)
+            if (matches[row] && this->codes[row] != code)
+                matches[row] = false;
+    } else {
+        for (u32 row = 0; row < matches.size(); row++)
+            if (matches[row] && this->texts[row] != value.s)
+                matches[row] = false;
+    }
+}
+
+// Encode the segment: INTs at 4 bytes each; TEXTs as a dictionary and codes if that is
+// smaller than the plain values.
+ColumnSegment::Encoding ColumnSegment::encode(string &bytes) {
+    bytes.clear();
+    if (this->data_type == ColumnAttribute::INT) {
+        bytes.assign((const char *) this->ints.data(), this->ints.size() * sizeof(int32_t));
+        return PLAIN;
+    }
+
+    vector<string> distinct(this->texts);
+    sort(distinct.begin(), distinct.end());
+    distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+    size_t plain_size = 0, dictionary_size = sizeof(u32) + this->texts.size() * sizeof(u16);
+    for (auto const &text: this->texts)
+        plain_size += sizeof(u32) + text.size();
+    for (auto const &text: distinct)
+        dictionary_size += sizeof(u32) + text.size();
+
+    if (distinct.size() <= (size_t) UINT16_MAX + 1 && dictionary_size < plain_size) {
+        this->dictionary = move(distinct);
+        this->codes.clear();
+        for (auto const &text: this->texts)
+            this->codes.push_back((u16) (lower_bound(this->dictionary.begin(), this->dictionary.end(), text)
+                                         - this->dictionary.begin()));
+        append_u32(bytes, this->dictionary.size());
+        for (auto const &text: this->dictionary) {
+            append_u32(bytes, text.size());
+            bytes.append(text);
+        }
+        bytes.append((const char *) this->codes.data(), this->codes.size() * sizeof(u16));
+        return DICTIONARY;
+    }
+    this->dictionary.clear();
+    this->codes.clear();
+    for (auto const &text: this->texts) {
+        append_u32(bytes, text.size());
+        bytes.append(text);
+    }
+    return PLAIN;
+}
+
+// Read back an encoded segment of the given number of rows.
+void ColumnSegment::decode(const string &bytes, Encoding encoding, u32 rows) {
+    this->ints.clear();
+    this->texts.clear();
+    this->dictionary.clear();
+    this->codes.clear();
+    size_t offset = 0;
+    if (this->data_type == ColumnAttribute::INT) {
+        this->ints.resize(rows);
+        if (rows)
+            memcpy(this->ints.data(), bytes.data(), rows * sizeof(int32_t));
+    } else if (encoding == DICTIONARY) {
+        u32 entries = read_u32(bytes, offset);
+        for (u32 i = 0; i < entries; i++) {
+            u32 length = read_u32(bytes, offset);
+            this->dictionary.push_back(bytes.substr(offset, length));
+            offset += length;
+        }
+        this->codes.resize(rows);
+        if (rows)
+            memcpy(this->codes.data(), bytes.data() + offset, rows * sizeof(u16));
+        for (auto const &code: this->codes)
+            this->texts.push_back(this->dictionary[code]);
+    } else {
+        for (u32 row = 0; row < rows; row++) {
+            u32 length = read_u32(bytes, offset);
+            this->texts.push_back(bytes.substr(offset, length));
+            offset += length;
+        }
+    }
+}
+
+/*
+            ----------------------
+~~~~~~~~~~~~|   COLUMN TABLE     |~~~~~~~~~~~~
+            ----------------------
+*/
+
+const string ColumnTable::SEGMENTS_SUFFIX = ".segments";
+
+/**
+    Constructor
+    @param block_size  size of the blocks of its files if the table gets created
+*/
+ColumnTable::ColumnTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                         uint block_size) :
+        DbRelation(table_name, column_names, column_attributes),
+        segments_file(table_name + SEGMENTS_SUFFIX, block_size), loaded(false),
+        stats_id(StorageStats::table_id(table_name)) {
+    for (uint column = 0; column < this->column_names.size(); column++) {
+        this->column_files.push_back(new HeapFile(table_name + ".c" + to_string(column), block_size));
+        this->cached_segments.push_back(nullptr);
+        this->cached_groups.push_back(0);
+    }
+}
+
+ColumnTable::~ColumnTable() {
+    try {
+        write_tail();
+    } catch (DbException &e) {
+        // the files are gone; so are the rows
+    }
+    discard_tail();
+    forget_segments();
+    for (auto file: this->column_files)
+        delete file;
+}
+
+/**
+    Create the table's files
+*/
+void ColumnTable::create() {
+    if (get_row_group_size() > SlottedPage::max_record_size(this->segments_file.get_block_size()))
+        throw DbRelationError("too many columns for a column table with this block size");
+    this->segments_file.create();
+    for (auto file: this->column_files)
+        file->create();
+    discard_tail();
+    this->row_groups.clear();
+    forget_segments();
+    this->loaded = true;
+}
+
+/**
+    Create the table if it doesn't exist yet
+*/
+void ColumnTable::create_if_not_exists() {
+    try {
+        this->open();
+    } catch (DbException &e) {
+        this->create();
+    }
+}
+
+/**
+    Drop the table and its files
+*/
+void ColumnTable::drop() {
+    discard_tail();
+    this->segments_file.drop();
+    for (auto file: this->column_files)
+        file->drop();
+    this->row_groups.clear();
+    forget_segments();
+    this->loaded = false;
+}
+
+/**
+    Open an existing table, reading in its row groups the first time
+*/
+void ColumnTable::open() {
+    this->segments_file.open();
+    for (auto file: this->column_files)
+        file->open();
+    if (!this->loaded)
+        load();
+}
+
+/**
+    Close the table
+*/
+void ColumnTable::close() {
+    write_tail();
+    this->segments_file.close();
+    for (auto file: this->column_files)
+        file->close();
+    this->row_groups.clear();
+    forget_segments();
+    this->loaded = false;
+}
+
+/**
+    Execute: INSERT INTO <table_name> ( <row_keys> ) VALUES ( <row_values> )
+    The row goes into the last row group's segments in memory; they are written once the group is full.
+    @param row  a dictionary keyed by column names
+    @returns    a handle to the new row
+*/
+Handle ColumnTable::insert(const ValueDict *row) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    validate(row);
+    if (this->tail_segments.empty()) {
+        if (this->row_groups.empty() || this->row_groups.back().rows == ROWS_PER_GROUP)
+            new_row_group();
+        u32 group = this->row_groups.size() - 1;
+        vector<ColumnSegment *> segments;
+        for (uint column = 0; column < this->column_names.size(); column++) {
+            segments.push_back(get_segment(group, column));
+            this->cached_segments[column] = nullptr;  // the tail's now
+        }
+        this->tail_segments = segments;
+        buffering[this] = chrono::steady_clock::now();
+    }
+    for (uint column = 0; column < this->column_names.size(); column++)
+        this->tail_segments[column]->append(row->find(this->column_names[column])->second);
+    RowGroup &row_group = this->row_groups.back();
+    Handle handle(this->row_groups.size(), ++row_group.rows);
+    if (row_group.rows == ROWS_PER_GROUP)
+        write_tail();
+    return handle;
+}
+
+/**
+    Execute: INSERT INTO <table_name> ... for many rows, filling row groups a whole group at a time
+    @param rows  dictionaries keyed by column names
+*/
+void ColumnTable::insert(const vector<ValueDict *> *rows) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    for (auto const &row: *rows)
+        validate(row);
+    write_tail();
+    append(vector<const ValueDict *>(rows->begin(), rows->end()));
+}
+
+/**
+    Execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
+    Rewrites the segments of the changed columns in the row's group.
+    @param handle      the row to update
+    @param new_values  a dictionary keyed by column names for changing columns
+*/
+void ColumnTable::update(const Handle handle, const ValueDict *new_values) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    check_handle(handle);
+    write_tail();
+    vector<uint> columns;
+    for (auto const &column: *new_values) {
+        uint index = column_index(column.first);
+        if (column.second.data_type != this->column_attributes[index].get_data_type())
+            throw DbRelationError("wrong type of value for column " + column.first);
+        columns.push_back(index);
+    }
+    u32 group = handle.first - 1;
+    uint i = 0;
+    for (auto const &column: *new_values) {
+        get_segment(group, columns[i])->put(handle.second - 1, column.second);
+        put_segment(group, columns[i++]);
+    }
+    put_row_group(group);
+}
+
+/**
+    Execute: DELETE FROM <table_name> WHERE <handle>
+    The row is only marked deleted; VACUUM takes it out.
+    @param handle  the row to delete
+*/
+void ColumnTable::del(const Handle handle) {
+    Handles handles(1, handle);
+    del(&handles);
+}
+
+/**
+    Execute: DELETE FROM <table_name> WHERE <handle> IN <handles>
+    Each row group's record is written once.
+    @param handles  the rows to delete
+*/
+void ColumnTable::del(const Handles *handles) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    write_tail();
+    set<u32> groups;
+    for (auto const &handle: *handles) {
+        if (handle.first == 0 || handle.first > this->row_groups.size())
+            continue;
+        RowGroup &row_group = this->row_groups[handle.first - 1];
+        if (handle.second == 0 || handle.second > row_group.rows || row_group.deleted[handle.second - 1])
+            continue;
+        row_group.deleted[handle.second - 1] = true;
+        groups.insert(handle.first - 1);
+    }
+    for (auto const &group: groups)
+        put_row_group(group);
+}
+
+u_int64_t ColumnTable::estimate_row_count() {
+    this->open();
+    u_int64_t count = 0;
+    for (auto const &row_group: this->row_groups)
+        count += row_group.rows - std::count(row_group.deleted.begin(), row_group.deleted.end(), true);
+    return count;
+}
+
+/**
+    Conceptually, execute: SELECT <handle> FROM <table_name> WHERE 1
+    @returns  a pointer to a list of handles for qualifying rows (freed by caller)
+*/
+Handles *ColumnTable::select() {
+    return select(nullptr);
+}
+
+/**
+    Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+    @param where  column values a row has to equal to qualify (nullptr for all rows)
+    @returns      a pointer to a list of handles for qualifying rows (freed by caller)
+*/
+Handles *ColumnTable::select(const ValueDict *where) {
+    BlockID position = 0;
+    return select(where, SIZE_MAX, position);
+}
+
+/**
+    Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where> LIMIT <limit>, a few row
+    groups at a time. Only the segments of the columns in where are read.
+    @param where     column values a row has to equal to qualify (nullptr for all rows)
+    @param limit     how many handles are wanted
+    @param position  in: first row group to read + 1 (0 for the start of the table);
+                     out: first row group not read yet + 1, or 0 if the scan reached the end
+    @returns         a pointer to a list of handles for qualifying rows (freed by caller)
+*/
+Handles *ColumnTable::select(const ValueDict *where, size_t limit, BlockID &position) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    vector<uint> columns;
+    if (where != nullptr)
+        for (auto const &column: *where)
+            columns.push_back(column_index(column.first));
+
+    Handles *handles = new Handles();
+    for (u32 group = position > 0 ? position - 1 : 0; group < this->row_groups.size(); group++) {
+        if (handles->size() >= limit) {
+            position = group + 1;
+            return handles;
+        }
+        const RowGroup &row_group = this->row_groups[group];
+        vector<bool> matches(row_group.rows);
+        for (u32 row = 0; row < row_group.rows; row++)
+            matches[row] = !row_group.deleted[row];
+        if (where != nullptr) {
+            uint i = 0;
+            for (auto const &column: *where)
+                get_segment(group, columns[i++])->match(column.second, matches);
+        }
+        for (u32 row = 0; row < row_group.rows; row++)
+            if (matches[row])
+                handles->push_back(Handle(group + 1, row + 1));
+    }
+    position = 0;
+    return handles;
+}
+
+/**
+    Return a sequence of all values for handle (SELECT *).
+    @param handle  row to get values from
+    @returns       dictionary of values from row (keyed by all column names)
+*/
+ValueDict *ColumnTable::project(Handle handle) {
+    return project(handle, &this->column_names);
+}
+
+/**
+    Return a sequence of values for handle given by column_names (SELECT <column_names>).
+    Only the segments of these columns are read, and each only once for its whole row group.
+    @param handle        row to get values from
+    @param column_names  list of column names to project
+    @returns             dictionary of values from row (keyed by column_names)
+*/
+ValueDict *ColumnTable::project(Handle handle, const ColumnNames *column_names) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    vector<uint> columns;
+    for (auto const &column_name: *column_names)
+        columns.push_back(column_index(column_name));
+    check_handle(handle);
+    ValueDict *row = new ValueDict();
+    for (uint i = 0; i < columns.size(); i++)
+        (*row)[(*column_names)[i]] = get_segment(handle.first - 1, columns[i])->get(handle.second - 1);
+    return row;
+}
+
+/**
+    VACUUM: rewrite the row groups without their deleted rows, from the start of the table, and give
+    back the blocks of the column files left over. The packing never gets ahead of the row group being
+    read, so the table is rewritten in place. Every handle changes.
+    @returns  how many blocks were given back
+*/
+u_int32_t ColumnTable::vacuum() {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    write_tail();
+    uint num_columns = this->column_names.size();
+    vector<ColumnSegment *> pending;
+    for (uint column = 0; column < num_columns; column++)
+        pending.push_back(new ColumnSegment(this->column_attributes[column].get_data_type()));
+
+    // write the first count pending rows as the given row group
+    u32 packed = 0;
+    auto write_group = [&](u32 count) {
+        for (uint column = 0; column < num_columns; column++) {
+            ColumnSegment *segment = new ColumnSegment(this->column_attributes[column].get_data_type());
+            ColumnSegment *rest = new ColumnSegment(this->column_attributes[column].get_data_type());
+            for (u32 row = 0; row < pending[column]->size(); row++)
+                (row < count ? segment : rest)->append(pending[column]->get(row));
+            delete pending[column];
+            pending[column] = rest;
+            delete this->cached_segments[column];
+            this->cached_segments[column] = segment;
+            this->cached_groups[column] = packed;
+            put_segment(packed, column);
+        }
+        RowGroup &row_group = this->row_groups[packed];
+        row_group.rows = count;
+        row_group.deleted.assign(ROWS_PER_GROUP, false);
+        put_row_group(packed++);
+    };
+
+    u32 groups = this->row_groups.size();
+    for (u32 group = 0; group < groups; group++) {
+        const RowGroup &row_group = this->row_groups[group];
+        for (uint column = 0; column < num_columns; column++) {
+            ColumnSegment *segment = get_segment(group, column);
+            for (u32 row = 0; row < row_group.rows; row++)
+                if (!row_group.deleted[row])
+                    pending[column]->append(segment->get(row));
+        }
+        while (num_columns > 0 && pending[0]->size() >= ROWS_PER_GROUP)
+            write_group(ROWS_PER_GROUP);
+    }
+    if (num_columns > 0 && pending[0]->size() > 0)
+        write_group(pending[0]->size());
+    for (auto segment: pending)
+        delete segment;
+
+    // the row groups left over go, and so do the column file blocks only they used
+    for (u32 group = packed; group < groups; group++) {
+        Handle handle = this->row_groups[group].handle;
+        HeapPage *block = this->segments_file.get(handle.first);
+        block->del(handle.second);
+        this->segments_file.put(block);
+        delete block;
+    }
+    this->row_groups.resize(packed);
+    u32 freed = 0;
+    for (uint column = 0; column < num_columns; column++) {
+        BlockID last = 1;
+        for (auto const &row_group: this->row_groups) {
+            const SegmentInfo &info = row_group.segments[column];
+            last = max(last, info.first + info.blocks - 1);
+        }
+        HeapFile *file = this->column_files[column];
+        freed += file->get_last_block_id() - last;
+        file->truncate(last);
+    }
+    forget_segments();
+    return freed;
+}
+
+/**
+    Whether a table is stored by this engine (it has a .segments file)
+    @param table_name  the table
+    @returns           true if it is a column table
+*/
+bool ColumnTable::exists(Identifier table_name) {
+    HeapFile segments_file(table_name + SEGMENTS_SUFFIX);
+    try {
+        segments_file.open();
+    } catch (DbException &e) {
+        return false;
+    }
+    segments_file.close();
+    return true;
+}
+
+u_int32_t ColumnTable::checkpoint() {
+    u_int32_t count = 0;
+    while (!buffering.empty()) {
+        buffering.begin()->first->write_tail();
+        count++;
+    }
+    return count;
+}
+
+u_int32_t ColumnTable::flush_expired() {
+    auto expired = chrono::steady_clock::now() - chrono::milliseconds(HeapFile::flush_interval_ms);
+    vector<ColumnTable *> due;
+    for (auto const &table: buffering)
+        if (table.second <= expired)
+            due.push_back(table.first);
+    for (auto table: due)
+        table->write_tail();
+    return due.size();
+}
+
+/**
+    Read the row group records
+*/
+void ColumnTable::load() {
+    this->row_groups.clear();
+    forget_segments();
+    BlockIDs *block_ids = this->segments_file.block_ids();
+    for (auto const &block_id: *block_ids) {
+        HeapPage *block = this->segments_file.get(block_id);
+        RecordIDs *record_ids = block->ids();
+        for (auto const &record_id: *record_ids) {
+            Dbt *data = block->get(record_id);
+            string bytes((const char *) data->get_data(), data->get_size());
+            delete data;
+            RowGroup row_group;
+            row_group.handle = Handle(block_id, record_id);
+            size_t offset = 0;
+            row_group.rows = read_u32(bytes, offset);
+            for (u32 row = 0; row < ROWS_PER_GROUP; row++)
+                row_group.deleted.push_back((bytes[offset + row / 8] >> (row % 8)) & 1);
+            offset += ROWS_PER_GROUP / 8;
+            for (uint column = 0; column < this->column_names.size(); column++) {
+                SegmentInfo info;
+                info.encoding = (u_int8_t) bytes[offset++];
+                info.first = read_u32(bytes, offset);
+                info.blocks = read_u32(bytes, offset);
+                info.size = read_u32(bytes, offset);
+                row_group.segments.push_back(info);
+            }
+            this->row_groups.push_back(row_group);
+        }
+        delete record_ids;
+        delete block;
+    }
+    delete block_ids;
+    this->loaded = true;
+}
+
+// Position of a column in the table.
+uint ColumnTable::column_index(const Identifier &column_name) const {
+    auto found = find(this->column_names.begin(), this->column_names.end(), column_name);
+    if (found == this->column_names.end())
+        throw DbRelationError("unknown column " + column_name);
+    return found - this->column_names.begin();
+}
+
+// Check that a row to be inserted has a value of the right type for every column.
+void ColumnTable::validate(const ValueDict *row) const {
+    for (uint column = 0; column < this->column_names.size(); column++) {
+        auto found = row->find(this->column_names[column]);
+        if (found == row->end())
+            throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+        if (found->second.data_type != this->column_attributes[column].get_data_type())
+            throw DbRelationError("wrong type of value for column " + this->column_names[column]);
+    }
+}
+
+// Check that a handle is of a row that is there.
+void ColumnTable::check_handle(Handle handle) const {
+    if (handle.first == 0 || handle.first > this->row_groups.size() || handle.second == 0
+        || handle.second > this->row_groups[handle.first - 1].rows
+        || this->row_groups[handle.first - 1].deleted[handle.second - 1])
+        throw DbRelationError("no row at handle (" + to_string(handle.first) + ", " + to_string(handle.second) + ")");
+}
+
+// Add validated rows at the end of the table, filling up the last row group first.
+void ColumnTable::append(const vector<const ValueDict *> &rows) {
+    size_t next = 0;
+    while (next < rows.size()) {
+        if (this->row_groups.empty() || this->row_groups.back().rows == ROWS_PER_GROUP)
+            new_row_group();
+        u32 group = this->row_groups.size() - 1;
+        size_t count = min((size_t) (ROWS_PER_GROUP - this->row_groups[group].rows), rows.size() - next);
+        for (uint column = 0; column < this->column_names.size(); column++) {
+            ColumnSegment *segment = get_segment(group, column);
+            for (size_t i = next; i < next + count; i++)
+                segment->append(rows[i]->find(this->column_names[column])->second);
+            put_segment(group, column);
+        }
+        this->row_groups[group].rows += count;
+        put_row_group(group);
+        next += count;
+    }
+}
+
+// Start an empty row group at the end (written out with its first rows).
+void ColumnTable::new_row_group() {
+    RowGroup row_group;
+    row_group.handle = Handle(0, 0);
+    row_group.rows = 0;
+    row_group.deleted.assign(ROWS_PER_GROUP, false);
+    SegmentInfo info = {ColumnSegment::PLAIN, 0, 0, 0};
+    row_group.segments.assign(this->column_names.size(), info);
+    this->row_groups.push_back(row_group);
+}
+
+// Write a row group's record: rows (4 bytes), deleted rows (a bit each), then per column
+// the encoding (1 byte), first block, blocks and size of its segment (4 bytes each).
+void ColumnTable::put_row_group(u32 group) {
+    RowGroup &row_group = this->row_groups[group];
+    string bytes;
+    append_u32(bytes, row_group.rows);
+    string deleted(ROWS_PER_GROUP / 8, '\0');
+    for (u32 row = 0; row < ROWS_PER_GROUP; row++)
+        if (row_group.deleted[row])
+            deleted[row / 8] |= (char) (1 << (row % 8));
+    bytes.append(deleted);
+    for (auto const &info: row_group.segments) {
+        bytes.push_back((char) info.encoding);
+        append_u32(bytes, info.first);
+        append_u32(bytes, info.blocks);
+        append_u32(bytes, info.size);
+    }
+    Dbt data((void *) bytes.data(), bytes.size());
+
+    if (row_group.handle.first != 0) {
+        HeapPage *block = this->segments_file.get(row_group.handle.first);
+        block->put(row_group.handle.second, data);  // the same size, so it fits
+        this->segments_file.put(block);
+        delete block;
+        return;
+    }
+    HeapPage *block = this->segments_file.get(this->segments_file.get_last_block_id());
+    RecordID record_id;
+    try {
+        record_id = block->add(&data);
+    } catch (DbBlockNoRoomError &e) {
+        delete block;
+        block = this->segments_file.get_new();
+        record_id = block->add(&data);
+    }
+    this->segments_file.put(block);
+    row_group.handle = Handle(block->get_block_id(), record_id);
+    delete block;
+}
+
+// A column of a row group, decoded (owned by the table; good until another segment of the column is asked for).
+ColumnSegment *ColumnTable::get_segment(u32 group, uint column) {
+    if (!this->tail_segments.empty() && group == this->row_groups.size() - 1)
+        return this->tail_segments[column];
+    if (this->cached_segments[column] != nullptr && this->cached_groups[column] == group)
+        return this->cached_segments[column];
+    const SegmentInfo &info = this->row_groups[group].segments[column];
+    HeapFile *file = this->column_files[column];
+    u32 chunk = chunk_size(*file);
+    string bytes;
+    for (u32 offset = 0, i = 0; offset < info.size; offset += chunk, i++) {
+        HeapPage *block = file->get(info.first + i);
+        Dbt *data = block->get(1);
+        bytes.append((const char *) data->get_data(), data->get_size());
+        delete data;
+        delete block;
+    }
+    ColumnSegment *segment = new ColumnSegment(this->column_attributes[column].get_data_type());
+    segment->decode(bytes, (ColumnSegment::Encoding) info.encoding, info.size > 0 ? this->row_groups[group].rows : 0);
+    delete this->cached_segments[column];
+    this->cached_segments[column] = segment;
+    this->cached_groups[column] = group;
+    return segment;
+}
+
+// Write back the (cached) segment of a column of a row group, a chunk per block, over its old blocks
+// if it still fits there or they are the last ones in the file, and after the last block otherwise.
+// The row group's record has to be written after this.
+void ColumnTable::put_segment(u32 group, uint column) {
+    string bytes;
+    ColumnSegment::Encoding encoding = this->cached_segments[column]->encode(bytes);
+    SegmentInfo &info = this->row_groups[group].segments[column];
+    HeapFile *file = this->column_files[column];
+    u32 chunk = chunk_size(*file);
+    u32 needed = max((u32) 1, (u32) ((bytes.size() + chunk - 1) / chunk));
+    if (info.blocks == 0 && group == 0) {
+        info.first = 1;  // the block the file was created with
+    } else if (needed > info.blocks && (info.blocks == 0 || info.first + info.blocks - 1 != file->get_last_block_id())) {
+        info.first = file->get_last_block_id() + 1;
+        info.blocks = 0;
+    }
+    // each block is written from scratch, without reading what was there
+    char *block_bytes = (char *) arena_allocate(file->get_block_size());
+    Dbt block_data(block_bytes, file->get_block_size());
+    for (u32 i = 0; i < needed; i++) {
+        BlockID block_id = info.first + i;
+        if (block_id > file->get_last_block_id())
+            delete file->get_new();
+        size_t offset = (size_t) i * chunk;
+        Dbt data((void *) (bytes.data() + offset), min((size_t) chunk, bytes.size() - offset));
+        memset(block_bytes, 0, file->get_block_size());
+        HeapPage *block = file->make_page(block_data, block_id, true);
+        block->add(&data);
+        file->put(block);
+        delete block;
+    }
+    arena_free(block_bytes);
+    info.encoding = encoding;
+    info.blocks = max(info.blocks, needed);
+    info.size = bytes.size();
+}
+
+// Drop the decoded segments.
+void ColumnTable::forget_segments() {
+    for (uint column = 0; column < this->cached_segments.size(); column++) {
+        delete this->cached_segments[column];
+        this->cached_segments[column] = nullptr;
+    }
+}
+
+// Write the last row group's segments and record, if it has rows inserted one at a time only in memory.
+void ColumnTable::write_tail() {
+    if (this->tail_segments.empty())
+        return;
+    u32 group = this->row_groups.size() - 1;
+    for (uint column = 0; column < this->tail_segments.size(); column++) {
+        delete this->cached_segments[column];
+        this->cached_segments[column] = this->tail_segments[column];
+        this->cached_groups[column] = group;
+    }
+    this->tail_segments.clear();
+    buffering.erase(this);
+    for (uint column = 0; column < this->column_names.size(); column++)
+        put_segment(group, column);
+    put_row_group(group);
+}
+
+// Forget the last row group's rows not written yet (the table is going anyway).
+void ColumnTable::discard_tail() {
+    for (auto segment: this->tail_segments)
+        delete segment;
+    this->tail_segments.clear();
+    buffering.erase(this);
+}
+
+// Size of a row group's record.
+u_int32_t ColumnTable::get_row_group_size() const {
+    return sizeof(u32) + ROWS_PER_GROUP / 8 + this->column_names.size() * SEGMENT_INFO_SIZE;
+}
+
+// Bytes of a segment that go into each block of a column file.
+u_int32_t ColumnTable::chunk_size(HeapFile &file) const {
+    return SlottedPage::max_record_size(file.get_block_size());
+}
+
+/**
+ * Testing function for ColumnTable.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_column_storage() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    const char *colors[] = {"red", "green", "blue", "cyan", "magenta"};
+
+    ColumnTable table("_test_column_cpp", column_names, column_attributes);
+    table.create();
+    if (!ColumnTable::exists("_test_column_cpp") || ColumnTable::exists("_test_data_cpp"))
+        return false;
+    vector<ValueDict *> rows;
+    for (int i = 0; i < 2500; i++) {
+        ValueDict *row = new ValueDict();
+        (*row)["a"] = Value(i);
+        (*row)["b"] = Value(string(colors[i % 5]));
+        rows.push_back(row);
+    }
+    table.insert(&rows);
+    for (auto row: rows)
+        delete row;
+    ValueDict row;
+    row["a"] = Value(2500);
+    row["b"] = Value(string(10000, 'w'));  // bigger than a block
+    Handle big = table.insert(&row);
+    if (big != Handle(3, 453))
+        return false;
+    table.close();
+
+    ColumnTable reopened("_test_column_cpp", column_names, column_attributes);
+    Handles *handles = reopened.select();
+    if (handles->size() != 2501)
+        return false;
+    delete handles;
+
+    // only the columns asked for are read, once per row group (a full group of INTs takes two blocks)
+    ValueDict where;
+    where["b"] = Value("blue");
+    StorageStats::reset();
+    handles = reopened.select(&where);
+    if (handles->size() != 500)
+        return false;
+    ColumnNames just_a(1, "a");
+    for (auto const &handle: *handles) {
+        ValueDict *result = reopened.project(handle, &just_a);
+        if ((*result)["a"].n % 5 != 2)
+            return false;
+        delete result;
+    }
+    if (StorageStats::enabled() && (StorageStats::calls("_test_column_cpp.c0", STATS_HEAPFILE_GET) != 5
+                                    || StorageStats::calls("_test_column_cpp.c1", STATS_HEAPFILE_GET) != 5))
+        return false;
+    delete handles;
+    where["b"] = Value("purple");
+    handles = reopened.select(&where);
+    if (!handles->empty())
+        return false;
+    delete handles;
+    BlockID position = 0;
+    handles = reopened.select(nullptr, 10, position);
+    if (handles->size() != ColumnTable::ROWS_PER_GROUP || position != 2)
+        return false;
+    delete handles;
+
+    // updates, including one that outgrows the segment's blocks
+    ValueDict change;
+    change["b"] = Value(string(5000, 'u'));
+    reopened.update(Handle(1, 1), &change);
+    ValueDict *result = reopened.project(Handle(1, 1));
+    if ((*result)["a"].n != 0 || (*result)["b"].s != string(5000, 'u'))
+        return false;
+    delete result;
+    result = reopened.project(big);
+    if ((*result)["b"].s != string(10000, 'w'))
+        return false;
+    delete result;
+
+    // deletes only mark rows, vacuum packs the rest
+    handles = reopened.select();
+    Handles doomed;
+    for (auto const &handle: *handles)
+        if (handle.second % 2 == 0)
+            doomed.push_back(handle);
+    delete handles;
+    reopened.del(&doomed);
+    try {
+        reopened.project(doomed.front());
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    handles = reopened.select();
+    if (handles->size() != 2501 - doomed.size())
+        return false;
+    delete handles;
+    reopened.vacuum();
+    handles = reopened.select();
+    if (handles->size() != 2501 - doomed.size() || handles->back() != Handle(2, 227))
+        return false;
+    int previous = -1;
+    for (auto const &handle: *handles) {
+        result = reopened.project(handle);
+        int a = (*result)["a"].n;
+        if (a <= previous || (a % 1024) % 2 != 0
+            || (*result)["b"].s != (a == 0 ? string(5000, 'u') : a == 2500 ? string(10000, 'w') : colors[a % 5]))
+            return false;
+        previous = a;
+        delete result;
+    }
+    delete handles;
+
+    // rows inserted one at a time stay in memory until their group is full, or a checkpoint...
+    StorageStats::reset();
+    for (int i = 0; i < 10; i++) {
+        row["a"] = Value(3000 + i);
+        row["b"] = Value("late");
+        reopened.insert(&row);
+    }
+    if (StorageStats::enabled() && StorageStats::calls("_test_column_cpp.c0", STATS_HEAPFILE_PUT) != 0)
+        return false;
+    where.clear();
+    where["b"] = Value("late");
+    handles = reopened.select(&where);
+    if (handles->size() != 10 || handles->back() != Handle(2, 237))
+        return false;
+    delete handles;
+    // or until they have been there flush_interval_ms, the same as dirty blocks
+    u_int32_t flush_interval_ms = HeapFile::flush_interval_ms;
+    HeapFile::flush_interval_ms = 60000;
+    bool kept = ColumnTable::flush_expired() == 0;
+    HeapFile::flush_interval_ms = 0;
+    bool written = ColumnTable::flush_expired() == 1 && ColumnTable::checkpoint() == 0;
+    HeapFile::flush_interval_ms = flush_interval_ms;
+    if (!kept || !written)
+        return false;
+    reopened.close();
+    ColumnTable again("_test_column_cpp", column_names, column_attributes);
+    handles = again.select(&where);
+    if (handles->size() != 10)
+        return false;
+    delete handles;
+    again.drop();
+    return true;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file column_storage.h - column storage engine: each column of a table in a file of its own
+ *
+ * ColumnTable is a second implementation of DbRelation, for tables that are loaded in bulk and
+ * scanned a few columns at a time. Rows are grouped ROWS_PER_GROUP at a time, and each column of a
+ * row group is a segment, encoded on its own and stored as a run of blocks in <table>.c<n>
+ * (n the position of the column). <table>.segments has a record per row group: how many rows it
+ * has, which of them are deleted, and where each of its segments is and how it is encoded.
+ *      INT segments are fixed width, 4 bytes per row.
+ *      TEXT segments are plain (4-byte length and the characters, per row) or, when that is smaller,
+ *      a sorted dictionary of the distinct values and a 2-byte code per row.
+ * A handle is (row group + 1, row within the group + 1). select() only reads the segments of the
+ * columns in its where clause (and compares dictionary codes rather than strings), and project()
+ * only those of the columns asked for; either decodes a segment once for all the rows of its group
+ * (late materialization).
+ * Rows are only ever appended, to the last row group: insert() of one row adds it to that group's
+ * segments in memory, which are written once the group is full (or the table is closed, or written
+ * to any other way, or on checkpoint(), or by flush_expired() once the first of them has waited
+ * HeapFile::flush_interval_ms); insert() of many writes each segment once. del() just marks rows
+ * deleted and VACUUM rewrites the table without them. A segment that outgrows its blocks moves to the end of its file.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class ColumnSegment - one column of a row group, decoded
+ */
+class ColumnSegment {
+public:
+    enum Encoding {
+        PLAIN = 0,
+        DICTIONARY = 1
+    };
+
+    explicit ColumnSegment(ColumnAttribute::DataType data_type) : data_type(data_type) {}
+
+    virtual ~ColumnSegment() {}
+
+    virtual u_int32_t size() const;
+
+    virtual Value get(u_int32_t row) const;
+
+    virtual void put(u_int32_t row, const Value &value);
+
+    virtual void append(const Value &value);
+
+    /**
+     * Narrow down the rows equal to a value.
+     * @param value    the value to compare with
+     * @param matches  for each row, whether it qualifies so far; rows not equal to value are cleared
+     */
+    virtual void match(const Value &value, std::vector<bool> &matches) const;
+
+    /**
+     * Encode the segment the smaller way.
+     * @param bytes  gets the encoded segment
+     * @returns      the encoding picked
+     */
+    virtual Encoding encode(std::string &bytes);
+
+    virtual void decode(const std::string &bytes, Encoding encoding, u_int32_t rows);
+
+protected:
+    ColumnAttribute::DataType data_type;
+    std::vector<int32_t> ints;  // INT rows
+    std::vector<std::string> texts;  // TEXT rows
+    std::vector<std::string> dictionary;  // distinct TEXT values, sorted, while the codes are current
+    std::vector<u_int16_t> codes;  // each TEXT row's place in the dictionary
+};
+
+/**
+ * @class ColumnTable - column storage engine (implementation of DbRelation)
+ */
+class ColumnTable : public DbRelation {
+public:
+    static const u_int32_t ROWS_PER_GROUP = 1024;
+    static const std::string SEGMENTS_SUFFIX;
+
+    ColumnTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                uint block_size = DbBlock::BLOCK_SZ);
+
+    virtual ~ColumnTable();
+
+    ColumnTable(const ColumnTable &other) = delete;
+
+    ColumnTable(ColumnTable &&temp) = delete;
+
+    ColumnTable &operator=(const ColumnTable &other) = delete;
+
+    ColumnTable &operator=(ColumnTable &&temp) = delete;
+
+    virtual void create();
+
+    virtual void create_if_not_exists();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handle insert(const ValueDict *row);
+
+    /**
+     * Append many rows at once, writing each segment they go into once.
+     * @param rows  dictionaries keyed by column names
+     */
+    virtual void insert(const std::vector<ValueDict *> *rows);
+
+    virtual void update(const Handle handle, const ValueDict *new_values);
+
+    virtual void del(const Handle handle);
+
+    virtual void del(const Handles *handles);
+
+    virtual Handles *select();
+
+    virtual Handles *select(const ValueDict *where);
+
+    virtual Handles *select(const ValueDict *where, size_t limit, BlockID &position);
+
+    virtual ValueDict *project(Handle handle);
+
+    virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
+
+    virtual u_int32_t vacuum();
+
+    // the rows not deleted, as recorded for the row groups
+    virtual u_int64_t estimate_row_count();
+
+    // whether the named table is stored by this engine
+    static bool exists(Identifier table_name);
+
+    // write the row groups of every column table that rows inserted one at a time left in memory;
+    // returns how many were written
+    static u_int32_t checkpoint();
+
+    // the same for just the tables whose first row in memory came in flush_interval_ms ago or more,
+    // e.g. between statements
+    static u_int32_t flush_expired();
+
+protected:
+    // where a segment's blocks are and how it is encoded
+    struct SegmentInfo {
+        u_int8_t encoding;
+        BlockID first;
+        u_int32_t blocks;  // allocated to it
+        u_int32_t size;  // bytes used
+    };
+
+    // a row group, as recorded in the .segments file
+    struct RowGroup {
+        Handle handle;  // of its record, (0, 0) until written
+        u_int32_t rows;
+        std::vector<bool> deleted;
+        std::vector<SegmentInfo> segments;
+    };
+
+    HeapFile segments_file;
+    std::vector<HeapFile *> column_files;
+    std::vector<RowGroup> row_groups;
+    bool loaded;
+    std::vector<ColumnSegment *> cached_segments;  // the last segment decoded for each column
+    std::vector<u_int32_t> cached_groups;  // and which row group it belongs to
+    std::vector<ColumnSegment *> tail_segments;  // the last row group's, while rows added to it aren't written
+    int stats_id;
+
+    virtual void load();
+
+    virtual uint column_index(const Identifier &column_name) const;
+
+    virtual void validate(const ValueDict *row) const;
+
+    virtual void check_handle(Handle handle) const;
+
+    virtual void append(const std::vector<const ValueDict *> &rows);
+
+    virtual void new_row_group();
+
+    virtual void put_row_group(u_int32_t group);
+
+    virtual ColumnSegment *get_segment(u_int32_t group, uint column);
+
+    virtual void put_segment(u_int32_t group, uint column);
+
+    virtual void forget_segments();
+
+    virtual void write_tail();
+
+    virtual void discard_tail();
+
+    virtual u_int32_t get_row_group_size() const;
+
+    virtual u_int32_t chunk_size(HeapFile &file) const;
+};
+
+bool test_column_storage();
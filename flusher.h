@@ -0,0 +1,54 @@
+/**
+ * @file flusher.h - writing back, on another thread, what has waited too long to be written
+ *
+ * Heap files keep the blocks put into them in memory, and column tables the rows inserted into
+ * them one at a time, until they have waited HeapFile::flush_interval_ms (see flush_expired() of
+ * each). The shell checks that between statements; a Flusher also checks it every
+ * flush_interval_ms while the shell waits for the next statement, so nothing stays unwritten for
+ * long just because nobody is typing.
+ * Heap files are not to be used by two threads at once, so the Flusher only writes while the
+ * shell has said it is idle, and busy() waits for a write in progress to end.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "heap_storage.h"
+
+/**
+ * @class Flusher - calls flush_expired() every flush_interval_ms while the shell is idle
+ */
+class Flusher {
+public:
+    // start the thread, busy (not writing anything until idle())
+    Flusher();
+
+    // stops the thread
+    virtual ~Flusher();
+
+    Flusher(const Flusher &other) = delete;
+
+    Flusher &operator=(const Flusher &other) = delete;
+
+    // the caller stops using heap files until busy(), so the flusher may write back
+    virtual void idle();
+
+    // the caller is about to use heap files: returns once the flusher is not writing
+    virtual void busy();
+
+    // how many blocks and row groups the flusher has written
+    virtual u_int32_t get_written();
+
+protected:
+    bool idling;
+    bool stopping;
+    u_int32_t written;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread flusher;
+
+    virtual void flush_expired();
+};
+
+bool test_flusher();
@@ -1,14 +1,19 @@
 #include "heap_storage.h"
+#include "pax_page.h"
 #include <utility>
 #include <vector>
+#include <cstdint>
 #include <cstring>
 #include <exception>
 #include <map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 using namespace std;
 
 typedef u_int16_t u16;
-const unsigned int BLOCK_SZ = 4096;
+typedef u_int32_t u32;
 
 
 /*
@@ -18,12 +23,14 @@ const unsigned int BLOCK_SZ = 4096;
 */
 
 // Constructor
-SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(block, block_id, is_new) 
+SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : HeapPage(block, block_id, is_new) 
 {
+    // 2-byte header numbers can only address the first 64kB
+    this->header_width = this->get_block_size() > 0x10000 ? sizeof(u32) : sizeof(u16);
     if (is_new) 
     {
         this->num_records = 0;
-        this->end_free = DbBlock::BLOCK_SZ - 1;
+        this->end_free = this->get_block_size() - 1;
         put_header();
     } 
     else 
@@ -35,12 +42,13 @@ SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(bl
 // Add a new record to the block. Return its id.
 RecordID SlottedPage::add(const Dbt* data) 
 {
+    STATS_TIMER(STATS_SLOTTEDPAGE_ADD);
     if (!has_room(data->get_size()))
         throw DbBlockNoRoomError(" Not enough room for new record");
-    u16 id = ++this->num_records;
-    u16 size = (u16) data->get_size();
+    RecordID id = ++this->num_records;
+    u32 size = data->get_size();
     this->end_free -= size;
-    u16 loc = this->end_free + 1;
+    u32 loc = this->end_free + 1;
     put_header();
     put_header(id, size, loc);
     memcpy(this->address(loc), data->get_data(), size);
@@ -49,8 +57,8 @@ RecordID SlottedPage::add(const Dbt* data)
 
 // Get a record from the block. Return None if it has been deleted.
 Dbt* SlottedPage::get(RecordID record_id){
-	u16 size;
-    u16 loc;
+	u32 size;
+    u32 loc;
     get_header(size, loc, record_id);
 
     if (loc == 0) // make sure there's something there to actually get
@@ -62,8 +70,8 @@ Dbt* SlottedPage::get(RecordID record_id){
 // Compact the rest of the data in the block. But keep the record ids the same for everyone.
 void SlottedPage::del(RecordID record_id)
 {
-    u16 size;
-    u16 loc;
+    u32 size;
+    u32 loc;
     get_header(size,loc,record_id);
     
     if (loc == 0) // only update if there's something there
@@ -73,17 +81,53 @@ void SlottedPage::del(RecordID record_id)
     slide(loc, loc + size);
 }
 
+// Mark all the given record ids as deleted, then compact the block once: the remaining records
+// are packed against the end of the block in a single pass. Record ids stay the same.
+void SlottedPage::del(const RecordIDs *record_ids)
+{
+    STATS_TIMER(STATS_SLOTTEDPAGE_SLIDE);
+    for (auto const& record_id: *record_ids)
+        put_header(record_id, 0, 0);
+
+    // live records from the end of the block backwards, each moved as far back as it can go
+    vector<pair<u32, RecordID>> live;
+    for (u32 record_id = 1; record_id <= this->num_records; record_id++)
+    {
+        u32 size;
+        u32 loc;
+        get_header(size, loc, record_id);
+        if (loc != 0)
+            live.push_back(make_pair(loc, (RecordID) record_id));
+    }
+    sort(live.begin(), live.end(), [](const pair<u32, RecordID> &a, const pair<u32, RecordID> &b) {
+        return a.first > b.first;
+    });
+    u32 end = this->get_block_size();
+    for (auto const& record: live)
+    {
+        u32 size;
+        u32 loc;
+        get_header(size, loc, record.second);
+        end -= size;
+        if (end != loc)
+            memmove(this->address(end), this->address(loc), size);
+        put_header(record.second, size, end);
+    }
+    this->end_free = end - 1;
+    put_header();
+}
+
 // Replace the record with the given data.
 void SlottedPage::put(RecordID record_id, const Dbt &data)
 {
-	u16 size;
-    u16 loc;
-    u16 updated_size = (u16) data.get_size();
+	u32 size;
+    u32 loc;
+    u32 updated_size = data.get_size();
     get_header(size, loc, record_id);
 
     if (updated_size > size) 
     {
-        u16 extra_space = updated_size - size;
+        u32 extra_space = updated_size - size;
         if (!has_room(extra_space))
     		throw DbBlockNoRoomError(" Not enough room for enlarged record");
 
@@ -105,11 +149,11 @@ void SlottedPage::put(RecordID record_id, const Dbt &data)
 // Sequence of all non-deleted record ids.
 RecordIDs* SlottedPage::ids(void)
 {
-	u16 size;
-    u16 loc;
-    RecordIDs *ids = new vector<RecordID>();
+	u32 size;
+    u32 loc;
+    RecordIDs *ids = new RecordIDs();
 
-	for (RecordID i = 1; i <= this->num_records; i++)
+	for (u32 i = 1; i <= this->num_records; i++)
     {
 	    get_header(size, loc, i);
 	    
@@ -119,47 +163,62 @@ RecordIDs* SlottedPage::ids(void)
 	return ids;
 }
 
+// Size of the biggest record that fits into an empty block of the given size.
+u_int32_t SlottedPage::max_record_size(uint block_size)
+{
+    u32 header_width = block_size > 0x10000 ? sizeof(u32) : sizeof(u16);
+    return block_size - 1 - 4 * header_width;  // see has_room: block header plus the new record's header
+}
+
 // Calculate if we have room to store a record with given size. The size should include the 4 bytes
 // for the header, too, if this is an add.
-bool SlottedPage::has_room(u16 size) 
+bool SlottedPage::has_room(u32 size) 
 {
-    u16 available = this->end_free - (this->num_records + 2) * 4;
-    return size <= available;
+    if (this->num_records >= UINT16_MAX) // out of RecordIDs
+        return false;
+    // negative once the headers reach the data
+    long available = (long) this->end_free - (long) (this->num_records + 2) * 2 * this->header_width;
+    return available >= 0 && size <= (unsigned long) available;
 }
 
-// Get 2-byte integer at given offset in block.
-u16 SlottedPage::get_n(u16 offset) 
+// Get 2- or 4-byte integer (depending on the block size) at given offset in block.
+u32 SlottedPage::get_n(u32 offset) 
 {
-    return *(u16*)this->address(offset);
+    if (this->header_width == sizeof(u16))
+        return *(u16*)this->address(offset);
+    return *(u32*)this->address(offset);
 }
 
-// Put a 2-byte integer at given offset in block.
-void SlottedPage::put_n(u16 offset, u16 n) 
+// Put a 2- or 4-byte integer (depending on the block size) at given offset in block.
+void SlottedPage::put_n(u32 offset, u32 n) 
 {
-    *(u16*)this->address(offset) = n;
+    if (this->header_width == sizeof(u16))
+        *(u16*)this->address(offset) = (u16) n;
+    else
+        *(u32*)this->address(offset) = n;
 }
 
 // Make a void* pointer for a given offset into the data block.
-void* SlottedPage::address(u16 offset) 
+void* SlottedPage::address(u32 offset) 
 {
     return (void*)((char*)this->block.get_data() + offset);
 }
 
 // Store the size and offset for given id. For id of zero, store the block header.
-void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
+void SlottedPage::put_header(RecordID id, u32 size, u32 loc) {
     if (id == 0) { // called the put_header() version and using the default params
         size = this->num_records;
         loc = this->end_free;
     }
-    put_n(4*id, size);
-    put_n(4*id + 2, loc);
+    put_n(2 * this->header_width * id, size);
+    put_n(2 * this->header_width * id + this->header_width, loc);
 }
 
 // Get the headers size and location
-void SlottedPage::get_header(u16& size, u16& loc, RecordID id)
+void SlottedPage::get_header(u32& size, u32& loc, RecordID id)
 {
-    size = this->get_n(4 * id);
-    loc = this->get_n(4 * id + 2);
+    size = this->get_n(2 * this->header_width * id);
+    loc = this->get_n(2 * this->header_width * id + this->header_width);
 }
 
 /*
@@ -169,29 +228,26 @@ by sliding data that is to the left of start to the left.
 Also fix up any record headers whose data has slid. Assumes there is enough room if it is a left
 shift (end < start).
 */
-void SlottedPage::slide(u16 start, u16 end)
+void SlottedPage::slide(u32 start, u32 end)
 {
-    int move_over = end - start;   
+    STATS_TIMER(STATS_SLOTTEDPAGE_SLIDE);
+    long move_over = (long) end - (long) start;
     if (move_over == 0) // no space
         return; 
-    // set up slide
-    int space = start - (this->end_free + 1U);
-    void *destination = this->address((u16)(this->end_free + 1 + move_over));
-    void *from = this->address((u16)(this->end_free + 1));
-    char temp[space]; 
-    // copy
-    memcpy(temp, from, space);
-    memcpy(destination, temp, space);
+    // slide (the ranges overlap, and large blocks are too big to copy through the stack)
+    long space = (long) start - (this->end_free + 1L);
+    void *destination = this->address((u32)(this->end_free + 1 + move_over));
+    void *from = this->address(this->end_free + 1);
+    memmove(destination, from, space);
 
     // fix up headers
-    RecordIDs* record_ids = ids();
-    for (auto const& record_id : *record_ids) 
+    for (u32 record_id = 1; record_id <= this->num_records; record_id++)
     {
-		u16 size;
-        u16 loc;
+		u32 size;
+        u32 loc;
 		get_header(size, loc, record_id);
 
-		if (loc <= start) 
+		if (loc != 0 && loc <= start) 
         {
             loc += move_over;
 			put_header(record_id, size, loc);
@@ -199,7 +255,6 @@ void SlottedPage::slide(u16 start, u16 end)
 	}
     this->end_free += move_over;
     put_header();
-    delete record_ids;
 }
 
 /*
@@ -211,12 +266,64 @@ void SlottedPage::slide(u16 start, u16 end)
 // 	this->dbfilename = this->name + ".db";
 // }
 
+/*
+ * The blocks of a file put and not written back yet, shared by all the HeapFiles open on the file.
+ */
+struct DirtyBlocks {
+    map<BlockID, char *> blocks;  // in block order, the order they are written back in
+    chrono::steady_clock::time_point since;  // when the oldest of them was put
+    vector<HeapFile *> users;  // open on the file
+    vector<string> first;  // files written back before this one (see HeapFile::write_after())
+};
+
+static map<string, DirtyBlocks> dirty_files;  // by Berkeley DB file name
+
+/*
+ * What open() read from the file, as of the last time a HeapFile had it open.
+ */
+struct FileInfo {
+    u_int32_t last;
+    uint block_size;
+    HeapFile::Layout layout;
+    ColumnAttributes column_attributes;
+};
+
+static map<string, FileInfo> file_infos;  // by Berkeley DB file name
+
+static list<HeapFile *> open_files;  // with a Berkeley DB handle open, most recently used first
+
+u_int32_t HeapFile::flush_interval_ms = 1000;
+
+u_int32_t HeapFile::max_open_handles = 128;
+
+atomic<u_int64_t> HeapFile::pages_read(0);
+
+atomic<u_int64_t> HeapFile::page_hits(0);
+
+mutex HeapFile::latch;
+
+// Nothing put is lost with the object, even if the file was never closed.
+HeapFile::~HeapFile() {
+    if (this->dirty != nullptr) {
+        try {
+            this->flush();
+        } catch (DbException &e) {
+            // the file is gone; so are its blocks
+        }
+        this->detach();
+    }
+    if (this->db != nullptr)
+        this->close_handle();
+    delete[] this->fresh;
+    delete[] this->copy;
+}
+
 // Create the physical file
 void HeapFile::create(){
     //cout << "HeapFile creation" << endl;
     this->db_open(DB_CREATE | DB_EXCL);
     //cout << "db opened" << endl;
-    SlottedPage* block = this->get_new();
+    HeapPage* block = this->get_new();
     this->put(block);
     delete block;
 }
@@ -237,24 +344,104 @@ void HeapFile::db_open(uint flags) {
     //     //return;
     // }
     //this->dbfilename = filepath + '/' + name + ".db";
-    this->db.set_re_len(DbBlock::BLOCK_SZ);
-    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
-    //cout << "Comes here" << endl;
-    if(flags) {
-        //cout << "Comes 0" << endl;
-        this->last = 0;
+    if(flags & DB_CREATE) {
+        if(this->block_size < DbBlock::MIN_BLOCK_SZ || this->block_size > DbBlock::MAX_BLOCK_SZ)
+            throw DbRelationError("block size must be from " + to_string(DbBlock::MIN_BLOCK_SZ) + " to "
+                                  + to_string(DbBlock::MAX_BLOCK_SZ) + " bytes");
+        if(this->layout == PAX && this->column_attributes.empty())
+            throw DbRelationError("a PAX heap file needs its column types");
+    }
+    auto known = file_infos.find(this->dbfilename);
+    if(flags == 0 && known != file_infos.end()) {
+        // opened before: the handle can wait until a block is needed
+        this->last = known->second.last;
+        this->block_size = known->second.block_size;
+        this->layout = known->second.layout;
+        this->column_attributes = known->second.column_attributes;
     } else {
-        //cout << "Comes 999" << endl;
-        DB_BTREE_STAT* db_bt_stat;
-        this->db.stat(nullptr, &db_bt_stat, DB_FAST_STAT);
-        this->last = db_bt_stat->bt_ndata;
+        this->open_handle(flags);
+        // an existing file brings its own record length (our block size) in its metadata
+        u_int32_t re_len;
+        this->db->get_re_len(&re_len);
+        this->block_size = re_len;
+        //cout << "Comes here" << endl;
+        if(flags) {
+            //cout << "Comes 0" << endl;
+            this->last = 0;
+        } else {
+            //cout << "Comes 999" << endl;
+            DB_BTREE_STAT* db_bt_stat;
+            this->db->stat(nullptr, &db_bt_stat, DB_FAST_STAT);
+            u_int32_t records = db_bt_stat->bt_ndata;
+            free(db_bt_stat);
+            this->last = this->find_last(records);
+            // the first block tells the layout (and, for PAX, the column types it was laid out for)
+            if(this->last > 0) {
+                vector<char> first(this->block_size);
+                this->read(1, first.data());
+                Dbt data(first.data(), this->block_size);
+                this->layout = PaxPage::is_pax(data) ? PAX : SLOTTED;
+                if(this->layout == PAX)
+                    this->column_attributes = PaxPage::get_column_attributes(data);
+            }
+        }
     }
+    this->reserved = 0;
+    this->last_opened = this->last;
+    this->dirty = &dirty_files[this->dbfilename];
+    this->dirty->users.push_back(this);
+    for (auto const& filename: this->written_after)
+        if (find(this->dirty->first.begin(), this->dirty->first.end(), filename) == this->dirty->first.end())
+            this->dirty->first.push_back(filename);
     this->closed = false;
 }
 
+Db &HeapFile::handle() {
+    if (this->closed)
+        throw DbRelationError(this->name + " is not open");
+    if (this->db == nullptr)
+        this->open_handle();
+    else if (this->used != open_files.begin())
+        open_files.splice(open_files.begin(), open_files, this->used);
+    return *this->db;
+}
+
+void HeapFile::open_handle(uint flags) {
+    while (!open_files.empty() && open_files.size() >= max((u32) 1, max_open_handles))
+        open_files.back()->close_handle();
+    Db *db = new Db(_DB_ENV, 0);
+    if (flags & DB_CREATE)
+        db->set_re_len(this->block_size);
+    try {
+        db->open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
+    } catch (DbException &e) {
+        delete db;  // a Berkeley DB handle can't be reused after a failed open
+        throw;
+    }
+    this->db = db;
+    open_files.push_front(this);
+    this->used = open_files.begin();
+}
+
+// Pages of the file stay good: get() reads blocks into a buffer of its own.
+void HeapFile::close_handle() {
+    this->db->close(0);
+    delete this->db;
+    this->db = nullptr;
+    open_files.erase(this->used);
+}
+
+u_int32_t HeapFile::open_handles() {
+    return (u_int32_t) open_files.size();
+}
+
 // Drop the physical file, close but don't set to true
 void HeapFile::drop(void) {
+   this->reserved = 0;  // no need to give them back
+   if (this->dirty != nullptr)
+       this->discard(0);  // nor to write anything back
    close();
+   file_infos.erase(this->dbfilename);
    Db db(_DB_ENV, 0);
    db.remove(this->dbfilename.c_str(), nullptr, 0);
 }
@@ -266,16 +453,153 @@ void HeapFile::open(){
 
 // Closes the physical file, close and set to true
 void HeapFile::close(){
-    this->db.close(0);
+    if (this->closed)
+        return;
+    this->flush();
+    this->release();
+    this->detach();
+    if (this->db != nullptr)
+        this->close_handle();
+    // what open() would read again; a file some other HeapFile changed meanwhile keeps what that one left
+    auto known = file_infos.find(this->dbfilename);
+    if (known == file_infos.end() || this->last != this->last_opened) {
+        FileInfo &info = file_infos[this->dbfilename];
+        info.last = this->last;
+        info.block_size = this->block_size;
+        info.layout = this->layout;
+        info.column_attributes = this->column_attributes;
+    }
     this->closed = true;
+    delete[] this->fresh;
+    this->fresh = nullptr;
+    delete[] this->copy;
+    this->copy = nullptr;
 }
 
-// Write a block back to the database file.
+// Put a block back: keep a copy to write back later (see flush()), which get() hands out meanwhile.
 void HeapFile::put(DbBlock* block)
 {
-    BlockID id = block->get_block_id();
-    Dbt key(&id, sizeof(id));
-    this->db.put(nullptr, &key, block->get_block(), 0);
+    STATS_TABLE_SCOPE(this->stats_id);
+    STATS_TIMER(STATS_HEAPFILE_PUT);
+    if (this->dirty == nullptr)
+        throw DbRelationError(this->name + " is not open");
+    map<BlockID, char *> &blocks = this->dirty->blocks;
+    auto found = blocks.find(block->get_block_id());
+    if (found == blocks.end()) {
+        if (blocks.size() >= MAX_DIRTY_BLOCKS)
+            this->flush();  // make room
+        if (blocks.empty())
+            this->dirty->since = chrono::steady_clock::now();
+        found = blocks.emplace(block->get_block_id(), new char[this->block_size]).first;
+    }
+    std::memcpy(found->second, block->get_data(), this->block_size);
+    if (chrono::steady_clock::now() - this->dirty->since >= chrono::milliseconds(flush_interval_ms))
+        this->flush();
+}
+
+// Write the dirty blocks back in block order; they stay dirty if Berkeley DB fails.
+u_int32_t HeapFile::flush()
+{
+    if (this->dirty == nullptr || this->dirty->blocks.empty())
+        return 0;
+    u_int32_t count = this->flush_first();
+    STATS_TABLE_SCOPE(this->stats_id);
+    map<BlockID, char *> &blocks = this->dirty->blocks;
+    for (auto const& block: blocks) {
+        STATS_TIMER(STATS_HEAPFILE_WRITE);
+        BlockID block_id = block.first;
+        Dbt key(&block_id, sizeof(block_id));
+        Dbt data(block.second, this->block_size);
+        this->handle().put(nullptr, &key, &data, 0);
+    }
+    count += (u_int32_t) blocks.size();
+    this->discard(0);
+    return count;
+}
+
+// Write back the files this one is written after; returns how many blocks that took.
+u_int32_t HeapFile::flush_first()
+{
+    u_int32_t count = 0;
+    for (auto const& name: this->dirty->first) {
+        auto found = dirty_files.find(name);
+        if (found != dirty_files.end() && !found->second.blocks.empty())
+            count += found->second.users.front()->flush();
+    }
+    return count;
+}
+
+void HeapFile::write_after(const string &name)
+{
+    string filename = name + ".db";
+    if (filename == this->dbfilename
+        || find(this->written_after.begin(), this->written_after.end(), filename) != this->written_after.end())
+        return;
+    this->written_after.push_back(filename);
+    if (this->dirty != nullptr)
+        this->dirty->first.push_back(filename);
+}
+
+void HeapFile::write_back(BlockID block_id)
+{
+    if (this->dirty == nullptr)
+        return;
+    map<BlockID, char *> &blocks = this->dirty->blocks;
+    if (blocks.find(block_id) == blocks.end())
+        return;
+    this->flush_first();
+    STATS_TABLE_SCOPE(this->stats_id);
+    STATS_TIMER(STATS_HEAPFILE_WRITE);
+    auto found = blocks.find(block_id);
+    Dbt key(&block_id, sizeof(block_id));
+    Dbt data(found->second, this->block_size);
+    this->handle().put(nullptr, &key, &data, 0);
+    delete[] found->second;
+    blocks.erase(found);
+}
+
+u_int32_t HeapFile::dirty_count() const
+{
+    return this->dirty == nullptr ? 0 : (u_int32_t) this->dirty->blocks.size();
+}
+
+u_int32_t HeapFile::checkpoint()
+{
+    u_int32_t count = 0;
+    for (auto& file: dirty_files)
+        if (!file.second.blocks.empty())
+            count += file.second.users.front()->flush();
+    return count;
+}
+
+u_int32_t HeapFile::flush_expired()
+{
+    auto now = chrono::steady_clock::now();
+    u_int32_t count = 0;
+    for (auto& file: dirty_files)
+        if (!file.second.blocks.empty() && now - file.second.since >= chrono::milliseconds(flush_interval_ms))
+            count += file.second.users.front()->flush();
+    return count;
+}
+
+void HeapFile::detach()
+{
+    vector<HeapFile *> &users = this->dirty->users;
+    users.erase(find(users.begin(), users.end(), this));
+    if (users.empty()) {
+        this->discard(0);
+        dirty_files.erase(this->dbfilename);
+    }
+    this->dirty = nullptr;
+}
+
+void HeapFile::discard(BlockID last)
+{
+    if (this->dirty == nullptr)
+        return;
+    map<BlockID, char *> &blocks = this->dirty->blocks;
+    for (auto block = blocks.upper_bound(last); block != blocks.end(); block = blocks.erase(block))
+        delete[] block->second;
 }
 
 // Sequence of all block ids.
@@ -287,32 +611,143 @@ BlockIDs* HeapFile::block_ids()
     return blocks;    
 }
 
+// Give back all blocks after the given one (their contents are gone). Berkeley DB keeps their
+// record numbers, as deleted records at the end of the file, which open() knows to leave out.
+void HeapFile::truncate(BlockID last)
+{
+    this->discard(last);
+    for (BlockID block_id = this->last + this->reserved; block_id > last; block_id--) {
+        Dbt key(&block_id, sizeof(block_id));
+        this->handle().del(nullptr, &key, 0);
+    }
+    this->last = last;
+    this->reserved = 0;
+}
+
 // Get a block from the database file.
-SlottedPage* HeapFile::get(BlockID block_id)
+HeapPage* HeapFile::get(BlockID block_id)
+{
+    STATS_TABLE_SCOPE(this->stats_id);
+    STATS_TIMER(STATS_HEAPFILE_GET);
+    if (this->dirty != nullptr) {
+        auto found = this->dirty->blocks.find(block_id);
+        if (found != this->dirty->blocks.end()) {
+            // a copy, good until the next get() like a Berkeley DB buffer, so put() is free to let go of the block
+            if (this->copy == nullptr)
+                this->copy = new char[this->block_size];
+            std::memcpy(this->copy, found->second, this->block_size);
+            page_hits.fetch_add(1, memory_order_relaxed);
+            Dbt data(this->copy, this->block_size);
+            return this->make_page(data, block_id);
+        }
+    }
+    // into a buffer of the file's, so the handle may be closed while the page is in use
+    if (this->copy == nullptr)
+        this->copy = new char[this->block_size];
+    if (!this->read(block_id, this->copy))
+        throw DbRelationError("block " + to_string(block_id) + " of " + this->name + " is not on file");
+    pages_read.fetch_add(1, memory_order_relaxed);
+    Dbt data(this->copy, this->block_size);
+    return this->make_page(data, block_id);
+}
+
+/**
+    Read a block from Berkeley DB
+    @param block_id  the block
+    @param buffer    gets the block (block_size bytes)
+    @returns         false if the file has no such block: never written, or given back (see truncate())
+*/
+bool HeapFile::read(BlockID block_id, char *buffer)
 {
     Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
-    this->db.get(nullptr, &key, &data, 0);
-    SlottedPage* slotted_page = new SlottedPage(data, block_id, false);
-    return slotted_page;
+    Dbt data(buffer, this->block_size);
+    data.set_ulen(this->block_size);
+    data.set_flags(DB_DBT_USERMEM);
+    Db &db = this->closed ? *this->db : this->handle();  // still being opened (see db_open())
+    int result = db.get(nullptr, &key, &data, 0);
+    return result != DB_NOTFOUND && result != DB_KEYEMPTY;
+}
+
+/**
+    The last block on file. Berkeley DB counts the blocks given back too: a RECNO file that doesn't
+    renumber keeps their record numbers, as deleted records. Those are all at the end of the file
+    (blocks are only ever given back from the end, and put on file again from there), so the last
+    block still there is found by bisection.
+    @param records  how many records Berkeley DB counts
+    @returns        the last block, 0 if there is none
+*/
+BlockID HeapFile::find_last(u_int32_t records)
+{
+    vector<char> buffer(this->block_size);
+    BlockID low = 0, high = records;  // blocks 1 through low are on file, none after high is
+    while (low < high) {
+        BlockID middle = high - (high - low) / 2;
+        if (this->read(middle, buffer.data()))
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+// Wrap a block of this file in the page class for its layout.
+HeapPage* HeapFile::make_page(Dbt &block, BlockID block_id, bool is_new)
+{
+    if(this->layout == PAX)
+        return new PaxPage(block, block_id, is_new, &this->column_attributes);
+    return new SlottedPage(block, block_id, is_new);
+}
+
+// Size of the biggest record that fits into an empty block of this file.
+u_int32_t HeapFile::max_record_size()
+{
+    if(this->layout == PAX)
+        return PaxPage::max_record_size(this->block_size, this->column_attributes);
+    return SlottedPage::max_record_size(this->block_size);
 }
 
 // Allocate a new block for the database file.
 // Returns the new empty DbBlock that is managing the records in this block and its block id.
-SlottedPage* HeapFile::get_new(void) 
+// The block is already on file (see reserve()), so it is just initialized again in memory; the
+// page is good until the next get_new().
+HeapPage* HeapFile::get_new(void) 
 {
-    char block[DbBlock::BLOCK_SZ];
-    std::memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
+    STATS_TABLE_SCOPE(this->stats_id);
+    STATS_TIMER(STATS_HEAPFILE_GET_NEW);
+    if (this->reserved == 0)
+        this->reserve();
+    this->reserved--;
+    std::memset(this->fresh, 0, this->block_size);
+    Dbt data(this->fresh, this->block_size);
+    return this->make_page(data, ++this->last, true);
+}
 
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
+// Put empty blocks on file after the last one, as many as there are blocks already (so a small
+// file at most doubles) but no more than EXTENT_BLOCKS.
+void HeapFile::reserve()
+{
+    if (this->fresh == nullptr)
+        this->fresh = new char[this->block_size];
+    std::memset(this->fresh, 0, this->block_size);
+    Dbt data(this->fresh, this->block_size);
+    delete this->make_page(data, this->last + 1, true);  // an empty page is the same in every block
+    u32 count = max((u32) 1, min((u32) EXTENT_BLOCKS, this->last));
+    for (BlockID block_id = this->last + 1; block_id <= this->last + count; block_id++) {
+        Dbt key(&block_id, sizeof(block_id));
+        this->handle().put(nullptr, &key, &data, 0);
+    }
+    this->reserved = count;
+}
 
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage* page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // write it out with initialization applied
-    this->db.get(nullptr, &key, &data, 0);
-    return page;
+// Give back the blocks reserved and not handed out, so the file ends with its last block.
+// Berkeley DB keeps the blocks' record numbers, as deleted records (see find_last()).
+void HeapFile::release()
+{
+    for (BlockID block_id = this->last + this->reserved; block_id > this->last; block_id--) {
+        Dbt key(&block_id, sizeof(block_id));
+        this->handle().del(nullptr, &key, 0);
+    }
+    this->reserved = 0;
 }
 
 /*
@@ -323,10 +758,33 @@ SlottedPage* HeapFile::get_new(void)
 
 /**
     Constructor
+    @param block_size  size of the blocks if the table gets created (see DbBlock::MIN_BLOCK_SZ, MAX_BLOCK_SZ)
+    @param layout      page layout if the table gets created
 */
 
-HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes) :
-	DbRelation(table_name, column_names, column_attributes), file(table_name) {
+HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                     uint block_size, HeapFile::Layout layout) :
+	HeapTable(table_name, column_names, column_attributes,
+	          new HeapFile(table_name, block_size, layout, column_attributes)) {
+}
+
+HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                     HeapFile *file) :
+	DbRelation(table_name, column_names, column_attributes), file(*file),
+	stats_id(StorageStats::table_id(table_name)), overflow(nullptr), vacuum_cursor(1), bloom_file(nullptr),
+	blooms_loaded(false), bloom_stats() {
+    for (uint i = 0; i < column_names.size(); i++)
+        if (column_attributes[i].get_data_type() == ColumnAttribute::INT)
+            this->zone_columns.push_back(column_names[i]);
+    // rows point into these, so they go to Berkeley DB first
+    this->file.write_after(table_name + ".overflow");
+    this->file.write_after(table_name + ".bloom");
+}
+
+HeapTable::~HeapTable() {
+    delete this->overflow;
+    delete this->bloom_file;
+    delete &this->file;
 }
 
 /**
@@ -336,6 +794,9 @@ HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttr
 
 void HeapTable::create(){
     this->file.create();
+    this->zones.clear();
+    this->append_pages.clear();
+    this->new_zone(1);
 }
 
 /**
@@ -353,7 +814,16 @@ void HeapTable::create_if_not_exists() {
     Drop a table
 */
 void HeapTable::drop() {
+    HeapFile *overflow = this->get_overflow(false);
+    if (overflow != nullptr) {
+        overflow->drop();
+        delete overflow;
+        this->overflow = nullptr;
+    }
+    this->drop_bloom_filter();
     this->file.drop();
+    this->zones.clear();
+    this->append_pages.clear();
 }
 
 /**
@@ -368,6 +838,15 @@ void HeapTable::open() {
 */
 void HeapTable::close() {
     file.close();
+    this->zones.clear();  // somebody else may change the file before it is opened again
+    this->append_pages.clear();
+    delete this->bloom_file;
+    this->bloom_file = nullptr;
+    this->blooms_loaded = false;
+    this->bloom_columns.clear();
+    this->blooms.clear();
+    if (this->overflow != nullptr)
+        this->overflow->close();
 }
 
 /**
@@ -376,25 +855,355 @@ void HeapTable::close() {
     @returns    a handle to the new row
 */
 Handle HeapTable::insert(const ValueDict *row) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    ValueDict *full_row = this->validate(row);
+    Handle handle = this->append(full_row);
+    delete full_row;
+    return handle;
+}
+
+/**
+    Execute: INSERT INTO <table_name> ... for many rows. They go where append() would put them, one
+    after the other, but the last block stays in hand while rows still fit into it: it is put back
+    once it is full (or the rows run out), not once per row. Every row is checked first, so a row
+    the table won't take leaves the table as it was.
+    @param rows  dictionaries keyed by column names
+*/
+void HeapTable::insert(const vector<ValueDict *> *rows) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    this->load_blooms();
+    vector<ValueDict *> full_rows;
+    try {
+        for (auto const &row: *rows)
+            full_rows.push_back(this->validate(row));
+    } catch (...) {
+        for (auto full_row: full_rows)
+            delete full_row;
+        throw;
+    }
+    HeapPage *block = nullptr;
+    size_t next = 0;  // the first of full_rows not done with
+    try {
+        for (; next < full_rows.size(); next++) {
+            ValueDict *full_row = full_rows[next];
+            Dbt *data = nullptr;
+            bool added = false;
+            try {
+                data = this->marshal(full_row);
+                if (block == nullptr)
+                    block = this->file.get(this->file.get_last_block_id());
+                BlockID last = block->get_block_id();
+                try {
+                    block->add(data);
+                } catch (DbBlockNoRoomError &e) {
+                    this->file.put(block);
+                    delete block;
+                    block = nullptr;
+                    block = this->file.get_new();
+                    block->add(data);
+                }
+                added = true;
+                BlockID block_id = block->get_block_id();
+                if (block_id > last)
+                    this->new_zone(block_id);
+                BlockZone *zone = this->get_zone(block_id);
+                if (zone != nullptr) {
+                    widen_zone(*zone, this->zone_columns, *full_row);
+                    zone->live++;
+                }
+                if (block_id > last)
+                    this->build_bloom(last);  // the block before is full
+                else
+                    this->add_to_bloom(block_id, *full_row);
+            } catch (...) {
+                if (data != nullptr) {
+                    if (!added)
+                        this->discard_overflow(data);
+                    arena_free(data->get_data());
+                    delete data;
+                }
+                delete full_row;
+                throw;
+            }
+            arena_free(data->get_data());
+            delete data;
+            delete full_row;
+        }
+        if (block != nullptr)
+            this->file.put(block);
+    } catch (...) {
+        delete block;
+        for (size_t i = next + 1; i < full_rows.size(); i++)
+            delete full_rows[i];
+        throw;
+    }
+    delete block;
+}
+
+/**
+    Execute: INSERT INTO <table_name> ... for many rows, on several threads at once. Each thread
+    inserts a run of the rows (so each block gets rows that were together) with a HeapAppender of
+    its own. If any thread fails, the others still finish and the first failure is thrown.
+    @param rows     dictionaries keyed by column names
+    @param threads  how many threads to insert on
+*/
+void HeapTable::insert(const vector<ValueDict *> *rows, uint threads) {
     this->open();
-    return this->append(this->validate(row));
+    threads = max(1u, min(threads, (uint) rows->size()));
+    size_t run = (rows->size() + threads - 1) / threads;
+    vector<exception_ptr> failures(threads);
+    vector<thread> writers;
+    for (uint i = 0; i < threads; i++)
+        writers.push_back(thread([this, rows, run, i, &failures]() {
+            try {
+                HeapAppender appender(*this);
+                for (size_t r = i * run; r < min(rows->size(), (i + 1) * run); r++)
+                    appender.insert((*rows)[r]);
+                appender.finish();
+            } catch (...) {
+                failures[i] = current_exception();
+            }
+        }));
+    for (auto &writer: writers)
+        writer.join();
+    for (auto const &failure: failures)
+        if (failure)
+            rethrow_exception(failure);
 }
 
 /**
     Execute: UPDATE INTO <table_name> SET <new_valus> WHERE <handle>
+    The row is rewritten in its page if it still fits there. Otherwise it moves to another page
+    and its old slot becomes a forwarding stub, so the handle stays valid.
     @param handle     the row to update
     @param new_values a dictionary keyd by column names for changing columns
 */
 void HeapTable::update(const Handle handle, const ValueDict *new_values) {
-    cout << "Not Implemented" << endl;
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    ValueDict *row = this->project(handle);
+    for (auto const& column: *new_values) {
+        if (row->find(column.first) == row->end()) {
+            delete row;
+            throw DbRelationError("unknown column " + column.first);
+        }
+        (*row)[column.first] = column.second;
+    }
+    Dbt *data;
+    try {
+        data = this->marshal(row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    BlockZone *zone = this->get_zone(handle.first);
+    if (zone != nullptr)
+        widen_zone(*zone, this->zone_columns, *row);
+    try {
+        this->load_blooms();
+        for (auto const& column: *new_values)
+            if (find(this->bloom_columns.begin(), this->bloom_columns.end(), column.first) != this->bloom_columns.end()) {
+                this->add_to_bloom(handle.first, *row);
+                break;
+            }
+    } catch (...) {
+        delete row;
+        arena_free(data->get_data());
+        delete data;
+        throw;
+    }
+    delete row;
+
+    // only one page of the file can be held at a time (Berkeley DB reuses the buffer), so each
+    // step below lets go of its page before getting the next one
+    HeapPage *block = this->file.get(handle.first);
+    Dbt *old = block->get(handle.second);
+    Handle location = handle;
+    if (*(u_int8_t*) old->get_data() == RECORD_FORWARD) {
+        location = get_forward(old);
+        delete old;
+        delete block;
+        block = this->file.get(location.first);
+        old = block->get(location.second);
+    }
+    // its out-of-line values are freed once the new record is in place, so a failure leaves the row as it was
+    string replaced((char *) old->get_data(), old->get_size());
+    delete old;
+    delete block;
+    block = nullptr;
+
+    Dbt *moved = nullptr;
+    bool stored = false;  // whether the row now reads as the new record
+    try {
+        block = this->file.get(handle.first);
+        if (location == handle) {
+            try {
+                block->put(handle.second, *data);
+                this->file.put(block);
+                stored = true;
+            } catch (DbBlockNoRoomError &e) {
+                delete block;
+                block = nullptr;
+                moved = moved_record(data, handle);
+                Handle target = append_record(this->file, moved);
+                this->file.write_back(target.first);  // before the stub pointing at it
+                this->forward(handle, target);
+                stored = true;
+            }
+        } else {
+            // back home if there is room for it now, which does away with the stub
+            try {
+                block->put(handle.second, *data);
+                this->file.put(block);
+                stored = true;
+                this->file.write_back(handle.first);  // before the moved record is gone
+                delete block;
+                block = nullptr;
+                block = this->file.get(location.first);
+                block->del(location.second);
+                this->file.put(block);
+            } catch (DbBlockNoRoomError &e) {
+                delete block;
+                block = nullptr;
+                moved = moved_record(data, handle);
+                block = this->file.get(location.first);
+                try {
+                    block->put(location.second, *moved);
+                    this->file.put(block);
+                    stored = true;
+                } catch (DbBlockNoRoomError &e) {
+                    delete block;
+                    block = nullptr;
+                    Handle target = append_record(this->file, moved);
+                    this->file.write_back(target.first);
+                    this->forward(handle, target);  // straight to the new place, no chain
+                    stored = true;
+                    this->file.write_back(handle.first);
+                    block = this->file.get(location.first);
+                    block->del(location.second);
+                    this->file.put(block);
+                }
+            }
+        }
+    } catch (...) {
+        delete block;
+        if (moved != nullptr) {
+            arena_free(moved->get_data());
+            delete moved;
+        }
+        if (!stored)
+            this->discard_overflow(data);
+        arena_free(data->get_data());
+        delete data;
+        throw;
+    }
+    delete block;
+    if (moved != nullptr) {
+        arena_free(moved->get_data());
+        delete moved;
+    }
+    arena_free(data->get_data());
+    delete data;
+    Dbt replaced_data(&replaced[0], (u_int32_t) replaced.size());
+    this->free_chains(this->overflow_chains(&replaced_data), location.first);  // where the old record was
 }
 
 /**
     Execute: DELETE FROM <table_name> WHERE <handle>
+    A moved row is deleted along with its forwarding stub, and out-of-line values with the row.
     @param handle     the row to delete
 */
 void HeapTable::del(const Handle handle) {
-    cout << "Not Implemented" << endl;
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    HeapPage *block = this->file.get(handle.first);
+    Dbt *data = block->get(handle.second);
+    if (data == nullptr) {
+        delete block;
+        return;
+    }
+    vector<Handle> chains;
+    BlockID record_block = handle.first;  // where the record pointing at the chains is
+    if (*(u_int8_t*) data->get_data() == RECORD_FORWARD) {
+        Handle moved = get_forward(data);
+        delete data;
+        delete block;
+        block = this->file.get(moved.first);
+        data = block->get(moved.second);
+        if (data != nullptr) {
+            chains = this->overflow_chains(data);
+            record_block = moved.first;
+            delete data;
+            block->del(moved.second);
+            this->file.put(block);
+        }
+        delete block;
+        block = this->file.get(handle.first);
+    } else {
+        chains = this->overflow_chains(data);
+        delete data;
+    }
+    block->del(handle.second);
+    this->file.put(block);
+    delete block;
+    this->free_chains(chains, record_block);
+    this->vacuum_cursor = min(this->vacuum_cursor, handle.first);
+    BlockZone *zone = this->get_zone(handle.first);
+    if (zone != nullptr)
+        zone->live--;
+}
+
+/**
+    Execute: DELETE FROM <table_name> WHERE <handle> IN <handles>
+    The handles are grouped by block, and each block has all its rows taken out (and is compacted
+    and written back) once. Moved rows are deleted the same way after their stubs.
+    @param handles  the rows to delete
+*/
+void HeapTable::del(const Handles *handles) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    map<BlockID, RecordIDs> by_block;
+    for (auto const& handle: *handles)
+        by_block[handle.first].push_back(handle.second);
+
+    for (int pass = 0; pass < 2 && !by_block.empty(); pass++) {
+        map<BlockID, RecordIDs> moved;  // where forwarded rows of this pass live
+        for (auto& block_records: by_block) {
+            RecordIDs& record_ids = block_records.second;
+            sort(record_ids.begin(), record_ids.end());
+            record_ids.erase(unique(record_ids.begin(), record_ids.end()), record_ids.end());
+            HeapPage* block = this->file.get(block_records.first);
+            RecordIDs gone;
+            vector<Handle> chains;
+            for (auto const& record_id: record_ids) {
+                Dbt* data = block->get(record_id);
+                if (data == nullptr)
+                    continue;
+                if (*(u_int8_t*) data->get_data() == RECORD_FORWARD) {
+                    Handle target = get_forward(data);
+                    moved[target.first].push_back(target.second);
+                } else {
+                    vector<Handle> record_chains = this->overflow_chains(data);
+                    chains.insert(chains.end(), record_chains.begin(), record_chains.end());
+                }
+                delete data;
+                gone.push_back(record_id);
+            }
+            if (!gone.empty()) {
+                block->del(&gone);
+                this->file.put(block);
+                this->vacuum_cursor = min(this->vacuum_cursor, block_records.first);
+                BlockZone *zone = pass == 0 ? this->get_zone(block_records.first) : nullptr;
+                if (zone != nullptr)
+                    zone->live -= gone.size();  // the second pass only takes out moved rows, homed elsewhere
+            }
+            delete block;
+            this->free_chains(chains, block_records.first);
+        }
+        by_block = move(moved);  // moved rows are never forwarded again, so a second pass ends it
+    }
 }
 
 /**
@@ -402,33 +1211,231 @@ void HeapTable::del(const Handle handle) {
      @returns  a pointer to a list of handles for qualifying rows (caller frees)
 */
 Handles* HeapTable::select() {
+    return select(nullptr);
+}
+
+/**
+    Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+    Only the columns named in where are decoded (so big TEXT values stored out of
+    line are only fetched if the predicate is on them).
+    @param where  column values a row has to equal to qualify (nullptr for all rows)
+    @returns      a pointer to a list of handles for qualifying rows (freed by caller)
+*/
+Handles* HeapTable::select(const ValueDict *where) {
+    BlockID position = 0;
+    return select(where, SIZE_MAX, position);
+}
+
+/**
+    Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where> LIMIT <limit>, one
+    stretch of a scan at a time: blocks are read in order starting at position, and no more
+    blocks are read once limit rows qualified (the block that reached the limit is finished).
+    @param where     column values a row has to equal to qualify (nullptr for all rows)
+    @param limit     how many handles are wanted
+    @param position  in: first block to read (0 for the start of the table);
+                     out: first block not read yet, or 0 if the scan reached the end
+    @returns         a pointer to a list of handles for qualifying rows (freed by caller)
+*/
+Handles* HeapTable::select(const ValueDict *where, size_t limit, BlockID &position) {
+    return select(where, nullptr, limit, position);
+}
+
+/**
+    Like select(where, limit, position), skipping the blocks whose zones (see HeapTable) show they
+    have no rows within the ranges or equal to the INT values in where. Blocks not in the zone map
+    yet are mapped as they are read.
+    @param ranges  bounds on INT columns (nullptr for none)
+*/
+Handles* HeapTable::select(const ValueDict *where, const IntRanges *ranges, size_t limit, BlockID &position) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    ColumnNames where_columns;
+    IntRanges bounds = this->zone_bounds(where, ranges);
+    if (where != nullptr)
+        for (auto const& column: *where)
+            where_columns.push_back(column.first);
+    vector<bool> wanted = this->wanted_columns(&where_columns);
+    ColumnNames mapped_columns = where_columns;  // what mapping a block decodes
+    for (auto const& column_name: this->zone_columns)
+        if (where == nullptr || where->find(column_name) == where->end())
+            mapped_columns.push_back(column_name);
+    vector<bool> mapped = this->wanted_columns(&mapped_columns);
+    vector<pair<uint, string>> probes;  // (position in bloom_columns, value) of the TEXT equalities
+    if (where != nullptr)
+        for (auto const& column: *where)
+            if (column.second.data_type == ColumnAttribute::TEXT) {
+                this->load_blooms();
+                auto found = find(this->bloom_columns.begin(), this->bloom_columns.end(), column.first);
+                if (found != this->bloom_columns.end())
+                    probes.push_back(make_pair(found - this->bloom_columns.begin(), column.second.s));
+            }
+
     Handles* handles = new Handles();
     BlockIDs* block_ids = file.block_ids();
+    BlockID next = 0;
     for (auto const& block_id: *block_ids) {
-        SlottedPage* block = file.get(block_id);
+        if (block_id < position)
+            continue;
+        if (handles->size() >= limit) {
+            next = block_id;
+            break;
+        }
+        BlockZone *zone = this->get_zone(block_id);
+        if (this->skip_block(zone, &bounds))
+            continue;
+        bool probed = false;
+        if (!probes.empty()) {
+            auto bloom = this->blooms.find(block_id);
+            if (bloom != this->blooms.end()) {
+                probed = true;
+                this->bloom_stats.probes++;
+                bool maybe = true;
+                for (auto const& probe: probes)
+                    maybe = maybe && bloom->second.filters[probe.first].may_contain(probe.second);
+                if (!maybe) {
+                    this->bloom_stats.skipped++;
+                    continue;
+                }
+            }
+        }
+        size_t before = handles->size();
+        bool mapping = zone == nullptr && !bounds.empty();
+        if (mapping) {
+            this->new_zone(block_id);
+            zone = this->get_zone(block_id);
+        }
+        const ColumnNames &names = mapping ? mapped_columns : where_columns;
+        // a row, once decoded: counted into the zone being mapped, and checked against where
+        auto consider = [&](Handle handle, Dbt *data) {
+            ValueDict* row = unmarshal(data, &names);
+            if (mapping) {
+                widen_zone(*zone, this->zone_columns, *row);
+                zone->live++;
+            }
+            bool matches = true;
+            if (where != nullptr)
+                for (auto const& column: *where)
+                    matches = matches && row->at(column.first) == column.second;
+            if (matches)
+                handles->push_back(handle);
+            delete row;
+        };
+
+        HeapPage* block = file.get(block_id);
         RecordIDs* record_ids = block->ids();
-        for (auto const& record_id: *record_ids)
-            handles->push_back(Handle(block_id, record_id));
+        vector<pair<Handle, Handle>> forwarded;  // (home, where the row is now) of moved rows to check
+        for (auto const& record_id: *record_ids) {
+            Handle handle(block_id, record_id);
+            Dbt* data = block->get_columns(record_id, mapping ? mapped : wanted);
+            u_int8_t kind = *(u_int8_t*) data->get_data();
+            if (kind == RECORD_MOVED) {
+                // listed under its home handle
+            } else if (where == nullptr && !mapping) {
+                handles->push_back(handle);
+            } else if (kind == RECORD_FORWARD) {
+                forwarded.push_back(make_pair(handle, get_forward(data)));
+            } else {
+                consider(handle, data);
+            }
+            delete data;
+        }
         delete record_ids;
         delete block;
+
+        // the moved rows are on other pages, which can only be read once this one is let go
+        for (auto const& moved: forwarded) {
+            block = file.get(moved.second.first);
+            Dbt* data = block->get_columns(moved.second.second, mapping ? mapped : wanted);
+            consider(moved.first, data);
+            delete data;
+            delete block;
+        }
+        if (probed && handles->size() == before)
+            this->bloom_stats.false_positives++;
     }
     delete block_ids;
+    position = next;
     return handles;
 }
 
-Handles* HeapTable::select(const ValueDict *where) {
-    Handles* handles = new Handles();
-    BlockIDs* block_ids = file.block_ids();
-    for (auto const& block_id: *block_ids) {
-        SlottedPage* block = file.get(block_id);
-        RecordIDs* record_ids = block->ids();
-        for (auto const& record_id: *record_ids)
-            handles->push_back(Handle(block_id, record_id));
+/**
+    The rows of some blocks, as select() and project() would find them, for scans split into morsels
+    that run on several threads at once (see MorselScheduler). The blocks not skipped by their zones
+    are copied out under HeapFile::latch, and their rows decoded from the copies without it; only rows
+    that live on another page or have TEXT values out of line are projected under the latch.
+    @param first         first block to read
+    @param last          last block to read (those past the end of the table are left out)
+    @param where         column values a row has to equal to qualify (nullptr for all rows)
+    @param ranges        bounds on INT columns the rows wanted lie within (nullptr for none)
+    @param column_names  columns to return
+    @param rows          gets the qualifying rows, keyed by column_names
+*/
+void HeapTable::scan_blocks(BlockID first, BlockID last, const ValueDict *where, const IntRanges *ranges,
+                            const ColumnNames *column_names, vector<ValueDict> &rows) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    ColumnNames names = *column_names;  // decoded: those returned, and those where checks
+    if (where != nullptr)
+        for (auto const& column: *where)
+            if (find(names.begin(), names.end(), column.first) == names.end())
+                names.push_back(column.first);
+    vector<bool> wanted = this->wanted_columns(&names);
+    IntRanges bounds = this->zone_bounds(where, ranges);
+    uint block_size = this->file.get_block_size();
+    vector<char> copies;
+    vector<BlockID> copied;
+    {
+        lock_guard<mutex> lock(HeapFile::latch);
+        last = min(last, this->file.get_last_block_id());
+        for (BlockID block_id = first; block_id <= last; block_id++) {
+            if (this->skip_block(this->get_zone(block_id), &bounds))
+                continue;
+            HeapPage *block = this->file.get(block_id);
+            char *bytes = (char *) block->get_data();
+            copies.insert(copies.end(), bytes, bytes + block_size);
+            copied.push_back(block_id);
+            delete block;
+        }
+    }
+
+    // a row decoded: checked against where, and kept without the columns only where wanted
+    auto keep = [&](ValueDict *row) {
+        bool matches = true;
+        if (where != nullptr)
+            for (auto const& column: *where)
+                matches = matches && row->at(column.first) == column.second;
+        if (matches) {
+            for (size_t i = column_names->size(); i < names.size(); i++)
+                row->erase(names[i]);
+            rows.push_back(move(*row));
+        }
+        delete row;
+    };
+    vector<Handle> elsewhere;  // rows that need more than their block
+    for (size_t i = 0; i < copied.size(); i++) {
+        Dbt data(&copies[i * block_size], block_size);
+        HeapPage *block = this->file.make_page(data, copied[i]);
+        RecordIDs *record_ids = block->ids();
+        for (auto const& record_id: *record_ids) {
+            Dbt *record = block->get_columns(record_id, wanted);
+            u_int8_t kind = *(u_int8_t*) record->get_data();
+            if (kind == RECORD_FORWARD || (kind == RECORD_ROW && !this->inline_record(record, wanted)))
+                elsewhere.push_back(Handle(copied[i], record_id));
+            else if (kind == RECORD_ROW)
+                keep(this->unmarshal(record, &names));  // a moved row is listed under its home handle
+            delete record;
+        }
         delete record_ids;
         delete block;
     }
-    delete block_ids;
-    return handles;
+    if (!elsewhere.empty()) {
+        lock_guard<mutex> lock(HeapFile::latch);
+        for (auto const& handle: elsewhere)
+            keep(this->project(handle, &names));
+    }
+}
+
+BlockID HeapTable::get_last_block_id() {
+    this->open();
+    return this->file.get_last_block_id();
 }
 
 /**
@@ -437,11 +1444,43 @@ Handles* HeapTable::select(const ValueDict *where) {
     @returns       dictionary of values from row (keyed by all column names)
 */
 ValueDict* HeapTable::project(Handle handle){
+    return project(handle, &this->column_names);
+}
+
+/**
+    Return a sequence of values for handle given by column_names (SELECT <column_names>).
+    Columns that aren't asked for are skipped without being decoded.
+    @param handle        row to get values from
+    @param column_names  list of column names to project
+    @returns             dictionary of values from row (keyed by column_names)
+*/
+ValueDict* HeapTable::project(Handle handle, const ColumnNames *column_names){
+    STATS_TABLE_SCOPE(this->stats_id);
+    for (auto const& column_name: *column_names)
+        if (find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+            throw DbRelationError("unknown column " + column_name);
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
-    SlottedPage* block = file.get(block_id);
-    Dbt* data = block->get(record_id);
-    ValueDict* row = unmarshal(data);
+    vector<bool> wanted = this->wanted_columns(column_names);
+    HeapPage* block = file.get(block_id);
+    Dbt* data = block->get_columns(record_id, wanted);
+    if (data != nullptr && *(u_int8_t*) data->get_data() == RECORD_FORWARD) {
+        Handle moved = get_forward(data);
+        delete data;
+        delete block;
+        block = file.get(moved.first);
+        data = block->get_columns(moved.second, wanted);
+        if (data == nullptr || *(u_int8_t*) data->get_data() != RECORD_MOVED) {
+            delete data;
+            delete block;
+            throw DbRelationError("forwarded row of " + this->table_name + " is missing");
+        }
+    }
+    if (data == nullptr) {
+        delete block;
+        throw DbRelationError("no row at handle (" + to_string(block_id) + ", " + to_string(record_id) + ")");
+    }
+    ValueDict* row = unmarshal(data, column_names);
 
     // Testing element stored in row after unmarshal
     // for(auto const& column_name : this->column_names) {
@@ -449,41 +1488,508 @@ ValueDict* HeapTable::project(Handle handle){
     //     cout << itr->first << " : " << itr->second.s << endl;
     // }
     delete data;
+    delete block;
     return row;
 }
 
-ValueDict* HeapTable::project(Handle handle, const ColumnNames *column_names){
-    // NotImplemented
-    return NULL;
+/**
+    Which of the table's columns are in column_names, for HeapPage::get_columns.
+    @param column_names  columns to read
+    @returns             a flag for each column of the table
+*/
+vector<bool> HeapTable::wanted_columns(const ColumnNames *column_names) const {
+    vector<bool> wanted;
+    for (auto const& column_name: this->column_names)
+        wanted.push_back(find(column_names->begin(), column_names->end(), column_name) != column_names->end());
+    return wanted;
 }
 
 /**
-    Check if all the columns all the columns are there and fill in any missing column
-    @param row the row neeed to be verified
-    @return the checked and filled row
+    The bounds a scan can skip blocks by: the ranges, narrowed by the INT equalities of a where clause
+    on zone columns.
+    @param where   column values the rows wanted equal (nullptr for none)
+    @param ranges  bounds on INT columns (nullptr for none)
+    @returns       the bounds, by column
 */
-ValueDict* HeapTable::validate(const ValueDict *row){
-    ValueDict* full_row = new ValueDict();
-
-    for(auto const& column_name : this->column_names) {
-        ValueDict::const_iterator itr = row->find(column_name);
-        Value value;
-        if(itr == row->end()) {
-            throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
-        } else {
-            value = itr->second;
+IntRanges HeapTable::zone_bounds(const ValueDict *where, const IntRanges *ranges) const {
+    IntRanges bounds;
+    if (ranges != nullptr)
+        bounds = *ranges;
+    if (where != nullptr)
+        for (auto const& column: *where) {
+            if (column.second.data_type != ColumnAttribute::INT
+                || find(this->zone_columns.begin(), this->zone_columns.end(), column.first) == this->zone_columns.end())
+                continue;
+            auto bound = bounds.insert(make_pair(column.first, make_pair(column.second.n, column.second.n)));
+            bound.first->second.first = max(bound.first->second.first, column.second.n);
+            bound.first->second.second = min(bound.first->second.second, column.second.n);
         }
+    return bounds;
+}
 
-        full_row->insert(pair<Identifier, Value>(itr->first, itr->second));
-    }
+// The zone of a block, or nullptr if it isn't known.
+HeapTable::BlockZone *HeapTable::get_zone(BlockID block_id) {
+    if (block_id > this->zones.size() || !this->zones[block_id - 1].known)
+        return nullptr;
+    return &this->zones[block_id - 1];
+}
 
-    return full_row;
+// Start the zone of a block with no rows.
+void HeapTable::new_zone(BlockID block_id) {
+    if (this->zones.size() < block_id)
+        this->zones.resize(block_id, BlockZone{false, 0, {}, {}});
+    uint n = this->zone_columns.size();
+    this->zones[block_id - 1] = BlockZone{true, 0, vector<int32_t>(n, INT32_MAX), vector<int32_t>(n, INT32_MIN)};
 }
 
-/**
-    Append a row into table
-    @param row that will be appended
-    @return Handle store the pair of (block_id of the block it added, record_id)
+// Stop trusting the zone of a block (its rows changed in ways not worth tracking).
+void HeapTable::forget_zone(BlockID block_id) {
+    if (block_id <= this->zones.size())
+        this->zones[block_id - 1].known = false;
+}
+
+// Take the INT values of a row (with at least the zone columns) into a zone.
+void HeapTable::widen_zone(BlockZone &zone, const ColumnNames &zone_columns, const ValueDict &row) {
+    for (uint i = 0; i < zone_columns.size(); i++) {
+        int32_t n = row.at(zone_columns[i]).n;
+        zone.min[i] = min(zone.min[i], n);
+        zone.max[i] = max(zone.max[i], n);
+    }
+}
+
+/**
+    Whether a scan can pass a block by without reading it.
+    @param zone    the block's zone (nullptr if unknown)
+    @param ranges  bounds on INT columns the rows wanted lie within
+    @returns       true if the block is home to no rows, or to none within the ranges
+*/
+bool HeapTable::skip_block(const BlockZone *zone, const IntRanges *ranges) const {
+    if (zone == nullptr)
+        return false;
+    if (zone->live == 0)
+        return true;
+    for (uint i = 0; i < this->zone_columns.size(); i++) {
+        auto range = ranges->find(this->zone_columns[i]);
+        if (range != ranges->end() && (zone->max[i] < range->second.first || zone->min[i] > range->second.second))
+            return true;
+    }
+    return false;
+}
+
+/**
+    Start keeping Bloom filters on some TEXT columns, in a new <table_name>.bloom, and build them
+    for every block but the last one (which gets its filters when it is full).
+    @param column_names  the TEXT columns
+*/
+void HeapTable::create_bloom_filter(const ColumnNames &column_names) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    if (column_names.empty())
+        throw DbRelationError("a Bloom filter needs columns");
+    for (auto const& column_name: column_names) {
+        auto found = find(this->column_names.begin(), this->column_names.end(), column_name);
+        if (found == this->column_names.end())
+            throw DbRelationError("unknown column " + column_name);
+        if (this->column_attributes[found - this->column_names.begin()].get_data_type() != ColumnAttribute::TEXT)
+            throw DbRelationError("only TEXT columns can have a Bloom filter, not " + column_name);
+    }
+    this->open();
+    this->drop_bloom_filter();
+    this->bloom_file = new HeapFile(this->table_name + ".bloom", this->file.get_block_size());
+    this->bloom_file->create();
+    string header;
+    u_int16_t count = (u_int16_t) column_names.size();
+    header.append((const char *) &count, sizeof(count));
+    for (auto const& column_name: column_names) {
+        u_int16_t size = (u_int16_t) column_name.size();
+        header.append((const char *) &size, sizeof(size));
+        header += column_name;
+    }
+    Dbt data((void *) header.data(), header.size());
+    append_record(*this->bloom_file, &data);
+    this->bloom_columns = column_names;
+    this->blooms_loaded = true;
+    this->bloom_stats = BloomStats();
+    for (BlockID block_id = 1; block_id < this->file.get_last_block_id(); block_id++)
+        this->build_bloom(block_id);
+}
+
+void HeapTable::drop_bloom_filter() {
+    this->load_blooms();
+    if (this->bloom_file != nullptr) {
+        this->bloom_file->drop();
+        delete this->bloom_file;
+        this->bloom_file = nullptr;
+    }
+    this->bloom_columns.clear();
+    this->blooms.clear();
+}
+
+ColumnNames HeapTable::get_bloom_columns(BloomStats *stats) {
+    this->load_blooms();
+    if (stats != nullptr) {
+        *stats = this->bloom_stats;
+        stats->blocks = (u_int32_t) this->blooms.size();
+    }
+    return this->bloom_columns;
+}
+
+// Read the Bloom filters of the table, if it has any.
+void HeapTable::load_blooms() {
+    if (this->blooms_loaded)
+        return;
+    this->blooms_loaded = true;
+    HeapFile *bloom_file = new HeapFile(this->table_name + ".bloom", this->file.get_block_size());
+    try {
+        bloom_file->open();
+    } catch (DbException &e) {
+        delete bloom_file;  // no filters
+        return;
+    }
+    this->bloom_file = bloom_file;
+    BlockIDs *block_ids = bloom_file->block_ids();
+    for (auto const& block_id: *block_ids) {
+        HeapPage *block = bloom_file->get(block_id);
+        RecordIDs *record_ids = block->ids();
+        for (auto const& record_id: *record_ids) {
+            Dbt *data = block->get(record_id);
+            const char *bytes = (const char *) data->get_data();
+            u32 offset = 0;
+            if (block_id == 1 && record_id == 1) {
+                u16 count = *(u16 *) bytes;
+                offset += sizeof(u16);
+                for (u16 i = 0; i < count; i++) {
+                    u16 size = *(u16 *) (bytes + offset);
+                    offset += sizeof(u16);
+                    this->bloom_columns.push_back(string(bytes + offset, size));
+                    offset += size;
+                }
+            } else {
+                BlockBloom bloom;
+                bloom.handle = Handle(block_id, record_id);
+                BlockID bloom_block = *(u32 *) bytes;
+                offset += sizeof(u32);
+                for (uint i = 0; i < this->bloom_columns.size(); i++) {
+                    u16 size = *(u16 *) (bytes + offset);
+                    offset += sizeof(u16);
+                    bloom.filters.push_back(BloomFilter(bytes + offset, size));
+                    offset += size;
+                }
+                this->blooms[bloom_block] = bloom;
+            }
+            delete data;
+        }
+        delete record_ids;
+        delete block;
+    }
+    delete block_ids;
+}
+
+// Build the Bloom filters of a block from the rows it is home to.
+void HeapTable::build_bloom(BlockID block_id) {
+    if (this->bloom_columns.empty())
+        return;
+    vector<bool> wanted = this->wanted_columns(&this->bloom_columns);
+    vector<ValueDict *> rows;
+    vector<Handle> forwarded;
+    HeapPage *block = this->file.get(block_id);
+    RecordIDs *record_ids = block->ids();
+    for (auto const& record_id: *record_ids) {
+        Dbt *data = block->get_columns(record_id, wanted);
+        u_int8_t kind = *(u_int8_t*) data->get_data();
+        if (kind == RECORD_ROW)
+            rows.push_back(this->unmarshal(data, &this->bloom_columns));
+        else if (kind == RECORD_FORWARD)
+            forwarded.push_back(get_forward(data));
+        delete data;
+    }
+    delete record_ids;
+    delete block;
+    for (auto const& moved: forwarded) {
+        block = this->file.get(moved.first);
+        Dbt *data = block->get_columns(moved.second, wanted);
+        rows.push_back(this->unmarshal(data, &this->bloom_columns));
+        delete data;
+        delete block;
+    }
+
+    // all the filters have to fit into one record of the bloom file
+    uint n = this->bloom_columns.size();
+    u32 max_bytes = (this->bloom_file->max_record_size() - sizeof(u32)) / n - sizeof(u16);
+    auto found = this->blooms.find(block_id);
+    BlockBloom bloom;
+    bloom.handle = found != this->blooms.end() ? found->second.handle : Handle(0, 0);
+    for (uint i = 0; i < n; i++) {
+        BloomFilter filter((u32) rows.size(), max_bytes);
+        for (auto const& row: rows)
+            filter.add(row->at(this->bloom_columns[i]).s);
+        bloom.filters.push_back(filter);
+    }
+    for (auto row: rows)
+        delete row;
+    if (found != this->blooms.end() && found->second.filters[0].size() != bloom.filters[0].size()) {
+        this->drop_bloom(block_id);  // a different size doesn't fit into the old record
+        bloom.handle = Handle(0, 0);
+    }
+    this->put_bloom(block_id, bloom);
+}
+
+// Add a row that came to a block to the block's Bloom filters, if it has them.
+void HeapTable::add_to_bloom(BlockID block_id, const ValueDict &row) {
+    auto found = this->blooms.find(block_id);
+    if (found == this->blooms.end())
+        return;
+    for (uint i = 0; i < this->bloom_columns.size(); i++)
+        found->second.filters[i].add(row.at(this->bloom_columns[i]).s);
+    this->put_bloom(block_id, found->second);
+}
+
+// Write the Bloom filters of a block to the bloom file (in their old record, if they have one).
+void HeapTable::put_bloom(BlockID block_id, BlockBloom &bloom) {
+    string record((const char *) &block_id, sizeof(block_id));
+    for (auto const& filter: bloom.filters) {
+        u16 size = (u16) filter.size();
+        record.append((const char *) &size, sizeof(size));
+        record.append(filter.data(), filter.size());
+    }
+    Dbt data((void *) record.data(), record.size());
+    if (bloom.handle.first == 0) {
+        bloom.handle = append_record(*this->bloom_file, &data);
+    } else {
+        HeapPage *block = this->bloom_file->get(bloom.handle.first);
+        block->put(bloom.handle.second, data);
+        this->bloom_file->put(block);
+        delete block;
+    }
+    this->blooms[block_id] = bloom;
+}
+
+// Forget the Bloom filters of a block (which is going away).
+void HeapTable::drop_bloom(BlockID block_id) {
+    auto found = this->blooms.find(block_id);
+    if (found == this->blooms.end())
+        return;
+    Handle handle = found->second.handle;
+    HeapPage *block = this->bloom_file->get(handle.first);
+    block->del(handle.second);
+    this->bloom_file->put(block);
+    delete block;
+    this->blooms.erase(found);
+}
+
+u_int64_t HeapTable::estimate_row_count() {
+    this->open();
+    auto records = [this](BlockID block_id) {
+        HeapPage *block = this->file.get(block_id);
+        RecordIDs *record_ids = block->ids();
+        u_int64_t count = record_ids->size();
+        delete record_ids;
+        delete block;
+        return count;
+    };
+    BlockID last = this->file.get_last_block_id();
+    if (last <= 1)
+        return last == 0 ? 0 : records(1);
+    return records(1) * (last - 1) + records(last);
+}
+
+/**
+    VACUUM, offline: copy all rows, in block order, into densely packed blocks from the start of
+    the file and give back the blocks left over. Forwarding stubs go away and moved rows become
+    plain rows where they are, so every handle changes. The packing never gets ahead of the block
+    being read, so the file can be rewritten in place.
+    @returns  how many blocks were given back
+*/
+u_int32_t HeapTable::vacuum() {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    BlockID last = this->file.get_last_block_id();
+    uint block_size = this->file.get_block_size();
+    char *bytes = (char *) arena_allocate(block_size);
+    memset(bytes, 0, block_size);
+    Dbt packed_data(bytes, block_size);
+    HeapPage *packed = this->file.make_page(packed_data, 1, true);
+    for (BlockID block_id = 1; block_id <= last; block_id++) {
+        // copied out, since the block may be overwritten before its rows are all placed
+        vector<string> records;
+        HeapPage *block = this->file.get(block_id);
+        RecordIDs *record_ids = block->ids();
+        for (auto const& record_id: *record_ids) {
+            Dbt *data = block->get(record_id);
+            char *record = (char *) data->get_data();
+            u_int8_t kind = *(u_int8_t*) record;
+            if (kind == RECORD_ROW)
+                records.push_back(string(record, data->get_size()));
+            else if (kind == RECORD_MOVED)
+                records.push_back(string(1, (char) RECORD_ROW) + string(record + FORWARD_SIZE, data->get_size() - FORWARD_SIZE));
+            delete data;
+        }
+        delete record_ids;
+        delete block;
+
+        for (auto const& record: records) {
+            Dbt data((void *) record.data(), record.size());
+            try {
+                packed->add(&data);
+            } catch (DbBlockNoRoomError &e) {
+                this->file.put(packed);
+                BlockID next = packed->get_block_id() + 1;
+                delete packed;
+                memset(bytes, 0, block_size);
+                packed = this->file.make_page(packed_data, next, true);
+                packed->add(&data);
+            }
+        }
+    }
+    this->file.put(packed);
+    BlockID packed_last = packed->get_block_id();
+    delete packed;
+    arena_free(bytes);
+    this->file.truncate(packed_last);
+    this->vacuum_cursor = 1;
+    this->zones.clear();
+    this->append_pages.clear();
+    ColumnNames bloom_columns = this->get_bloom_columns();
+    if (!bloom_columns.empty())
+        this->create_bloom_filter(bloom_columns);
+    return last - packed_last;
+}
+
+/**
+    VACUUM, online: move rows from the last block into room in earlier blocks, and give the last
+    block back once it is empty, until no earlier block has room (or max_rows rows moved).
+    A moved-away row from the end just moves again (its stub is repointed, so its handle stays);
+    any other row gets a new handle, reported in relocated. A stub at the end brings its row
+    back to the new place in one piece.
+    @param max_rows   how many rows this step may move
+    @param relocated  gets (old handle, new handle) of every row that moved (nullptr if nobody cares)
+    @returns          true if there is more to do
+*/
+bool HeapTable::vacuum_step(size_t max_rows, Relocations *relocated) {
+    STATS_TABLE_SCOPE(this->stats_id);
+    this->open();
+    for (size_t moved = 0; moved < max_rows; moved++) {
+        BlockID last = this->file.get_last_block_id();
+        HeapPage *block = this->file.get(last);
+        RecordIDs *record_ids = block->ids();
+        if (record_ids->empty()) {
+            delete record_ids;
+            delete block;
+            if (last == 1)
+                return false;
+            this->file.truncate(last - 1);
+            if (this->zones.size() >= last)
+                this->zones.resize(last - 1);
+            this->append_pages.erase(remove(this->append_pages.begin(), this->append_pages.end(), last),
+                                     this->append_pages.end());
+            this->drop_bloom(last);
+            continue;
+        }
+        Handle from(last, record_ids->front());
+        delete record_ids;
+        Dbt *data = block->get(from.second);
+        string record((char *) data->get_data(), data->get_size());
+        delete data;
+        delete block;
+
+        u_int8_t kind = *(u_int8_t*) record.data();
+        Handle moved_row(0, 0);  // the row a stub points at, which comes along
+        if (kind == RECORD_FORWARD) {
+            Dbt stub((void *) record.data(), record.size());
+            moved_row = get_forward(&stub);
+            block = this->file.get(moved_row.first);
+            data = block->get(moved_row.second);
+            record = string(1, (char) RECORD_ROW)
+                     + string((char *) data->get_data() + FORWARD_SIZE, data->get_size() - FORWARD_SIZE);
+            delete data;
+            delete block;
+        }
+        Dbt row((void *) record.data(), record.size());
+        Handle to = this->vacuum_place(&row, last);
+        if (to.first == 0)
+            return false;  // no room before the last block
+        this->file.write_back(to.first);  // before anything pointing at it, or the row's old places, changes
+
+        if (kind == RECORD_MOVED) {
+            Handle home = get_forward(&row);
+            this->forward(home, to);
+            this->file.write_back(home.first);  // before the record it pointed at is gone
+        } else {
+            if (relocated != nullptr)
+                relocated->push_back(make_pair(from, to));
+            this->forget_zone(to.first);
+            BlockZone *zone = this->get_zone(last);
+            if (zone != nullptr)
+                zone->live--;
+            this->load_blooms();
+            if (this->blooms.find(to.first) != this->blooms.end()) {
+                ValueDict *values = this->unmarshal(&row, &this->bloom_columns);
+                this->add_to_bloom(to.first, *values);
+                delete values;
+            }
+        }
+        block = this->file.get(last);
+        block->del(from.second);
+        this->file.put(block);
+        delete block;
+        if (moved_row.first != 0) {
+            this->file.write_back(last);  // the stub goes before the row it pointed at
+            block = this->file.get(moved_row.first);
+            block->del(moved_row.second);
+            this->file.put(block);
+            delete block;
+        }
+    }
+    return true;
+}
+
+/**
+    Add a record to the first block before last with room for it, starting at vacuum_cursor
+    @param data  the record
+    @param last  the block being emptied
+    @returns     where the record went, or (0, 0) if no block before last has room
+*/
+Handle HeapTable::vacuum_place(const Dbt *data, BlockID last) {
+    for (; this->vacuum_cursor < last; this->vacuum_cursor++) {
+        HeapPage *block = this->file.get(this->vacuum_cursor);
+        try {
+            RecordID record_id = block->add(data);
+            this->file.put(block);
+            delete block;
+            return Handle(this->vacuum_cursor, record_id);
+        } catch (DbBlockNoRoomError &e) {
+            delete block;
+        }
+    }
+    return Handle(0, 0);
+}
+
+/**
+    Check if all the columns all the columns are there and fill in any missing column
+    @param row the row neeed to be verified
+    @return the checked and filled row
+*/
+ValueDict* HeapTable::validate(const ValueDict *row){
+    ValueDict* full_row = new ValueDict();
+
+    for(auto const& column_name : this->column_names) {
+        ValueDict::const_iterator itr = row->find(column_name);
+        Value value;
+        if(itr == row->end()) {
+            throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+        } else {
+            value = itr->second;
+        }
+
+        full_row->insert(pair<Identifier, Value>(itr->first, itr->second));
+    }
+
+    return full_row;
+}
+
+/**
+    Append a row into table
+    @param row that will be appended
+    @return Handle store the pair of (block_id of the block it added, record_id)
 */
 Handle HeapTable::append(const ValueDict *row){
     // Testing element stored in row
@@ -491,84 +1997,471 @@ Handle HeapTable::append(const ValueDict *row){
     //     cout << itr->first << " : " << itr->second.s << endl;
     // }
     Dbt *data = this->marshal(row);
-    SlottedPage *block = this->file.get(this->file.get_last_block_id());
+    BlockID last = this->file.get_last_block_id();
+    Handle handle;
+    try {
+        handle = append_record(this->file, data);
+    } catch (...) {
+        this->discard_overflow(data);
+        arena_free(data->get_data());
+        delete data;
+        throw;
+    }
+    arena_free(data->get_data());
+    delete data;
+    if (handle.first > last)
+        this->new_zone(handle.first);  // a new block, with nothing but this row in it
+    BlockZone *zone = this->get_zone(handle.first);
+    if (zone != nullptr) {
+        widen_zone(*zone, this->zone_columns, *row);
+        zone->live++;
+    }
+    this->load_blooms();
+    if (handle.first > last)
+        this->build_bloom(last);  // the block before is full
+    else
+        this->add_to_bloom(handle.first, *row);
+    return handle;
+}
+
+/**
+    Add a record to the last block of a heap file, or to a new block if it doesn't fit there
+    @param file  file to add to
+    @param data  the record
+    @return      where the record went
+*/
+Handle HeapTable::append_record(HeapFile &file, const Dbt *data) {
+    HeapPage *block = file.get(file.get_last_block_id());
     RecordID record_id;
     try{
         record_id = block->add(data);
     } catch(DbBlockNoRoomError &e){
-        block = this->file.get_new();
+        delete block;
+        block = file.get_new();
         record_id = block->add(data);
     }
-    this->file.put(block);
-    delete data;
+    file.put(block);
+    Handle handle(block->get_block_id(), record_id);
     delete block;
-    Handle handle(this->file.get_last_block_id(), record_id);
     return handle;
 }
 
+/**
+    The side file holding TEXT values too big to keep in their rows. It is opened on first use
+    and only created when the first such value is stored.
+    @param create  create the file if it doesn't exist yet
+    @return        the overflow file, or nullptr if there is none and create is false
+*/
+HeapFile *HeapTable::get_overflow(bool create) {
+    if (this->overflow != nullptr)
+        return this->overflow;
+    string name = this->table_name + ".overflow";
+    HeapFile *overflow = new HeapFile(name, this->file.get_block_size());
+    try {
+        overflow->open();
+    } catch (DbException &e) {
+        delete overflow; // a Berkeley DB handle can't be reused after a failed open
+        if (!create)
+            return nullptr;
+        overflow = new HeapFile(name, this->file.get_block_size());
+        overflow->create();
+    }
+    this->overflow = overflow;
+    return overflow;
+}
+
+/**
+    Store a TEXT value out of line as a chain of overflow records, each holding the handle
+    of the next chunk (block id 0 ends the chain) followed by as much of the value as fits
+    into an empty block.
+    @param value  the text to store
+    @return       handle of the first chunk
+*/
+Handle HeapTable::put_overflow(const string &value) {
+    HeapFile *overflow = this->get_overflow(true);
+    const uint link_size = sizeof(u32) + sizeof(u16);
+    uint chunk_size = SlottedPage::max_record_size(overflow->get_block_size()) - link_size;
+    uint chunks = value.empty() ? 1 : (value.size() + chunk_size - 1) / chunk_size;
+    char *bytes = (char *) arena_allocate(link_size + chunk_size);
+    Handle next(0, 0);
+
+    // write the chain back to front so that each chunk can point at the one after it
+    for (uint chunk = chunks; chunk-- > 0;) {
+        uint offset = chunk * chunk_size;
+        uint size = min((uint) value.size() - offset, chunk_size);
+        *(u32*) bytes = next.first;
+        *(u16*) (bytes + sizeof(u32)) = next.second;
+        memcpy(bytes + link_size, value.data() + offset, size);
+        Dbt data(bytes, link_size + size);
+        try {
+            next = append_record(*overflow, &data);
+        } catch (...) {
+            arena_free(bytes);
+            this->free_chain(next);  // the chunks after this one
+            throw;
+        }
+    }
+    arena_free(bytes);
+    return next;
+}
+
+/**
+    Read back a TEXT value stored by put_overflow
+    @param first   handle of the first chunk
+    @param length  total length of the value
+    @return        the text
+*/
+string HeapTable::get_overflow(Handle first, u32 length) {
+    HeapFile *overflow = this->get_overflow(false);
+    if (overflow == nullptr)
+        throw DbRelationError("missing overflow file for " + this->table_name);
+    const uint link_size = sizeof(u32) + sizeof(u16);
+    string value;
+    value.reserve(length);
+    Handle next = first;
+    while (next.first != 0) {
+        HeapPage *block = overflow->get(next.first);
+        Dbt *data = block->get(next.second);
+        char *bytes = (char *) data->get_data();
+        value.append(bytes + link_size, data->get_size() - link_size);
+        next = Handle(*(u32*) bytes, *(u16*) (bytes + sizeof(u32)));
+        delete data;
+        delete block;
+    }
+    if (value.size() != length)
+        throw DbRelationError("overflow chain of " + this->table_name + " is damaged");
+    return value;
+}
+
+/**
+    Find the overflow chains of all out-of-line TEXT values of a record
+    @param data  the record (a row, or a moved row)
+    @returns     the handle of the first chunk of each chain
+*/
+vector<Handle> HeapTable::overflow_chains(const Dbt *data) const {
+    char *bytes = (char *) data->get_data();
+    uint offset = *(u_int8_t*) bytes == RECORD_MOVED ? FORWARD_SIZE : ROW_HEADER_SIZE;
+    vector<Handle> chains;
+    for (auto const& column_attribute: this->column_attributes) {
+        if (column_attribute.get_data_type() == ColumnAttribute::DataType::INT) {
+            offset += sizeof(int32_t);
+            continue;
+        }
+        u16 size = *(u16*) (bytes + offset);
+        offset += sizeof(u16);
+        if (size == OVERFLOW_TEXT) {
+            chains.push_back(Handle(*(u32*) (bytes + offset + sizeof(u32)), *(u16*) (bytes + offset + 2 * sizeof(u32))));
+            offset += 2 * sizeof(u32) + sizeof(u16);
+        } else {
+            offset += size;
+        }
+    }
+    return chains;
+}
+
+/**
+    Delete the overflow chunks of all out-of-line TEXT values of a record that is not in the table
+    (see free_chains for one that was)
+    @param data  the record (a row, or a moved row)
+*/
+void HeapTable::free_overflow(const Dbt *data) {
+    for (auto const& first: this->overflow_chains(data))
+        this->free_chain(first);
+}
+
+/**
+    Delete the overflow chains of a record taken out of a block, once that block is written back
+    without it (so a crash can't leave the record pointing at chunks that are gone)
+    @param chains    the record's chains, from overflow_chains
+    @param block_id  the block the record was in, already put
+*/
+void HeapTable::free_chains(const vector<Handle> &chains, BlockID block_id) {
+    if (chains.empty())
+        return;
+    this->file.write_back(block_id);
+    for (auto const& first: chains)
+        this->free_chain(first);
+}
+
+/**
+    Delete a chain of overflow chunks
+    @param first  handle of the first chunk (block id 0 for no chain at all)
+*/
+void HeapTable::free_chain(Handle first) {
+    if (first.first == 0)
+        return;
+    HeapFile *overflow = this->get_overflow(false);
+    if (overflow == nullptr)
+        throw DbRelationError("missing overflow file for " + this->table_name);
+    Handle next = first;
+    while (next.first != 0) {
+        HeapPage *block = overflow->get(next.first);
+        Dbt *chunk = block->get(next.second);
+        if (chunk == nullptr) {
+            delete block;
+            throw DbRelationError("overflow chain of " + this->table_name + " is damaged");
+        }
+        char *link = (char *) chunk->get_data();
+        Handle after(*(u32*) link, *(u16*) (link + sizeof(u32)));
+        delete chunk;
+        block->del(next.second);
+        overflow->put(block);
+        delete block;
+        next = after;
+    }
+}
+
+/**
+    Delete the overflow chunks of a record that never made it into the table, keeping quiet about
+    any failure to do so (the caller has a better one to report)
+    @param data  the record, as marshal() made it
+*/
+void HeapTable::discard_overflow(const Dbt *data) {
+    try {
+        this->free_overflow(data);
+    } catch (exception &e) {
+        // the chunks are lost
+    }
+}
+
+/**
+    The handle stored in a forwarding stub or in the header of a moved row
+    @param data  the record
+    @return      where the stub points, or the moved row's home
+*/
+Handle HeapTable::get_forward(const Dbt *data) {
+    char *bytes = (char *) data->get_data();
+    return Handle(*(u32*) (bytes + 1), *(u16*) (bytes + 1 + sizeof(u32)));
+}
+
+/**
+    Write the FORWARD_SIZE bytes of a forwarding stub, or of the header of a moved row
+    @param bytes   where to write
+    @param kind    RECORD_FORWARD or RECORD_MOVED
+    @param handle  the moved row (for a stub) or its home (for a moved row)
+*/
+void HeapTable::put_forward(char *bytes, RecordKind kind, Handle handle) {
+    *(u_int8_t*) bytes = kind;
+    *(u32*) (bytes + 1) = handle.first;
+    *(u16*) (bytes + 1 + sizeof(u32)) = handle.second;
+}
+
+/**
+    The moved-row version of a marshaled row
+    caller responsible for freeing the returned Dbt and, with arena_free, its data.
+    @param data  the row as marshal made it
+    @param home  the row's handle
+    @return      the record to store away from home
+*/
+Dbt *HeapTable::moved_record(const Dbt *data, Handle home) {
+    uint size = data->get_size() - ROW_HEADER_SIZE;
+    char *bytes = (char *) arena_allocate(FORWARD_SIZE + size);
+    put_forward(bytes, RECORD_MOVED, home);
+    memcpy(bytes + FORWARD_SIZE, (char *) data->get_data() + ROW_HEADER_SIZE, size);
+    return new Dbt(bytes, FORWARD_SIZE + size);
+}
+
+/**
+    Turn a row's home slot into a stub pointing at where the row is now. Rows are never
+    smaller than a stub, so this always fits.
+    @param home   the row's handle
+    @param moved  where it went
+*/
+void HeapTable::forward(Handle home, Handle moved) {
+    char stub[FORWARD_SIZE];
+    put_forward(stub, RECORD_FORWARD, moved);
+    Dbt data(stub, FORWARD_SIZE);
+    HeapPage *block = this->file.get(home.first);
+    block->put(home.second, data);
+    this->file.put(block);
+    delete block;
+}
+
 /**
     return the bits to go into the file
-    caller responsible for freeing the returned Dbt and its enclosed ret->get_data().
+    caller responsible for freeing the returned Dbt and, with arena_free, its enclosed ret->get_data().
+    The record starts with its kind (RECORD_ROW) and is padded to at least FORWARD_SIZE bytes so
+    that a forwarding stub can always take its place. Each INT is 4 bytes. Each TEXT is a 2-byte length and the characters, or, if the value is
+    stored out of line, the length OVERFLOW_TEXT followed by the 4-byte real length and the
+    handle (4-byte block id, 2-byte record id) of its first overflow chunk.
 */
 Dbt* HeapTable::marshal(const ValueDict *row) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
-    uint offset = 0;
+    STATS_TABLE_SCOPE(this->stats_id);
+    STATS_TIMER(STATS_HEAPTABLE_MARSHAL);
+    const uint pointer_size = sizeof(u16) + sizeof(u32) + sizeof(u32) + sizeof(u16);
+    // leave room for the moved-row header, so that the row fits into an empty block either way
+    uint max_size = this->file.max_record_size() - (FORWARD_SIZE - ROW_HEADER_SIZE);
+
+    // size the row up first, moving long TEXT values out of line (longest first) until the row fits
+    vector<bool> out_of_line(this->column_names.size(), false);
+    uint size = ROW_HEADER_SIZE;
     uint col_num = 0;
     for (auto const& column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
+        ColumnAttribute ca = this->column_attributes[col_num];
+        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+            size += sizeof(int32_t);
+        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+            uint length = row->find(column_name)->second.s.length();
+            out_of_line[col_num] = length >= OVERFLOW_TEXT || length > max_size / 2;
+            size += out_of_line[col_num] ? pointer_size : sizeof(u16) + length;
+        } else {
+            throw DbRelationError("Only know how to marshal INT and TEXT");
+        }
+        col_num++;
+    }
+    while (size > max_size) {
+        int longest = -1;
+        uint longest_length = 0;
+        for (col_num = 0; col_num < this->column_names.size(); col_num++) {
+            if (this->column_attributes[col_num].get_data_type() != ColumnAttribute::DataType::TEXT
+                || out_of_line[col_num])
+                continue;
+            uint length = row->find(this->column_names[col_num])->second.s.length();
+            if (length + sizeof(u16) > pointer_size && length >= longest_length) {
+                longest = col_num;
+                longest_length = length;
+            }
+        }
+        if (longest < 0)
+            throw DbBlockNoRoomError("row does not fit into a block");
+        out_of_line[longest] = true;
+        size -= sizeof(u16) + longest_length;
+        size += pointer_size;
+    }
+
+    if (size < FORWARD_SIZE)
+        size = FORWARD_SIZE;
+    char *bytes = (char *) arena_allocate(size);
+    memset(bytes, 0, size);
+    *(u_int8_t*) bytes = RECORD_ROW;
+    uint offset = ROW_HEADER_SIZE;
+    col_num = 0;
+    for (auto const& column_name: this->column_names) {
+        ColumnAttribute ca = this->column_attributes[col_num];
         ValueDict::const_iterator column = row->find(column_name);
-        Value value = column->second;
+        const Value &value = column->second;
         if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
             *(int32_t*) (bytes + offset) = value.n;
             offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+        } else if (out_of_line[col_num]) {
+            Handle first;
+            try {
+                first = put_overflow(value.s);
+            } catch (...) {
+                Dbt written(bytes, size);  // the values before this one (the rest is still zero)
+                this->discard_overflow(&written);
+                arena_free(bytes);
+                throw;
+            }
+            *(u16*) (bytes + offset) = OVERFLOW_TEXT;
+            *(u32*) (bytes + offset + sizeof(u16)) = value.s.length();
+            *(u32*) (bytes + offset + sizeof(u16) + sizeof(u32)) = first.first;
+            *(u16*) (bytes + offset + sizeof(u16) + 2 * sizeof(u32)) = first.second;
+            offset += pointer_size;
+        } else {
             //cout << "This col name is " << column_name << endl;
-            uint size = value.s.length();
-            *(u16*) (bytes + offset) = size;
+            uint length = value.s.length();
+            *(u16*) (bytes + offset) = length;
             offset += sizeof(u16);
-            memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-        } else {
-            throw DbRelationError("Only know how to marshal INT and TEXT");
+            memcpy(bytes+offset, value.s.c_str(), length); // assume ascii for now
+            offset += length;
         }
+        col_num++;
     }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
+    Dbt *data = new Dbt(bytes, size);
     return data;
 }
 
+/**
+    Whether marshal() keeps all of a row in the row: no TEXT value is long enough to go out of
+    line, and the row fits into a block as it is.
+    @param row  the row (all columns)
+    @return     true if marshaling it doesn't touch the overflow file
+*/
+bool HeapTable::inline_row(const ValueDict *row) {
+    uint max_size = this->file.max_record_size() - (FORWARD_SIZE - ROW_HEADER_SIZE);
+    uint size = ROW_HEADER_SIZE;
+    uint col_num = 0;
+    for (auto const& column_name: this->column_names) {
+        if (this->column_attributes[col_num++].get_data_type() == ColumnAttribute::DataType::TEXT) {
+            uint length = row->find(column_name)->second.s.length();
+            if (length >= OVERFLOW_TEXT || length > max_size / 2)
+                return false;
+            size += sizeof(u16) + length;
+        } else {
+            size += sizeof(int32_t);
+        }
+    }
+    return size <= max_size;
+}
+
+/**
+    Whether unmarshal() decodes a row record from the record alone: none of the columns wanted has
+    its value out of line.
+    @param data    the record (RECORD_ROW)
+    @param wanted  for each column of the table, whether it is decoded
+    @return        true if decoding it doesn't touch the overflow file
+*/
+bool HeapTable::inline_record(const Dbt *data, const vector<bool> &wanted) {
+    const char *bytes = (const char *) data->get_data();
+    uint offset = ROW_HEADER_SIZE;
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++) {
+        if (this->column_attributes[col_num].get_data_type() != ColumnAttribute::DataType::TEXT) {
+            offset += sizeof(int32_t);
+            continue;
+        }
+        u16 size = *(const u16 *) (bytes + offset);
+        offset += sizeof(u16);
+        if (size == OVERFLOW_TEXT && wanted[col_num])
+            return false;
+        offset += size == OVERFLOW_TEXT ? OVERFLOW_POINTER_SIZE : size;
+    }
+    return true;
+}
+
 /**
     unparse the dits from file 
     return row converrted from the bit
+    @param data          the marshaled row
+    @param column_names  columns to decode (nullptr for all); the others are skipped, so
+                         their overflow chunks are never read
 */
-ValueDict* HeapTable::unmarshal(Dbt *data){
-    ValueDict* row = new ValueDict();
+ValueDict* HeapTable::unmarshal(Dbt *data, const ColumnNames *column_names){
+    STATS_TABLE_SCOPE(this->stats_id);
+    STATS_TIMER(STATS_HEAPTABLE_UNMARSHAL);
     char *bytes = (char*)data->get_data();
-    uint offset = 0;
+    u_int8_t kind = *(u_int8_t*) bytes;
+    if (kind == RECORD_FORWARD)
+        throw DbRelationError("a forwarding stub has no columns");
+    uint offset = kind == RECORD_MOVED ? FORWARD_SIZE : ROW_HEADER_SIZE;
+    ValueDict* row = new ValueDict();
     uint col_num = 0;
-    Value value;
-
 
     for(auto const& column_name: this->column_names) {
 
         ColumnAttribute col_attr = this->column_attributes[col_num++];
-        value.data_type = col_attr.get_data_type();
+        bool wanted = column_names == nullptr
+                      || find(column_names->begin(), column_names->end(), column_name) != column_names->end();
 
         if(col_attr.get_data_type() == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t*)(bytes + offset);
+            if (wanted)
+                row->insert(make_pair(column_name, Value(*(int32_t*)(bytes + offset))));
             offset += sizeof(int32_t);
-            row->insert(make_pair(column_name, value.n));
         } else if(col_attr.get_data_type() == ColumnAttribute::DataType::TEXT) {
             u16 size = *(u16*)(bytes + offset);
             offset += sizeof(u16);
-            char* text = new char[size];
-            memcpy(text, bytes + offset, size);
-            string text_string(text);
-            value.s = text_string;
-            offset += size;
-            row->insert(make_pair(column_name, value.s));
+            if (size == OVERFLOW_TEXT) {
+                if (wanted) {
+                    u32 length = *(u32*)(bytes + offset);
+                    Handle first(*(u32*)(bytes + offset + sizeof(u32)), *(u16*)(bytes + offset + 2 * sizeof(u32)));
+                    row->insert(make_pair(column_name, Value(get_overflow(first, length))));
+                }
+                offset += 2 * sizeof(u32) + sizeof(u16);
+            } else {
+                if (wanted)
+                    row->insert(make_pair(column_name, Value(string(bytes + offset, size))));
+                offset += size;
+            }
         } else {
             throw DbRelationError("Only know how to unmarshal INT and TEXT");
         }
@@ -577,6 +2470,122 @@ ValueDict* HeapTable::unmarshal(Dbt *data){
     return row;
 }
 
+/*
+            ----------------------
+~~~~~~~~~~~~|   HEAPAPPENDER      |~~~~~~~~~~~~
+            ----------------------
+*/
+
+HeapAppender::HeapAppender(HeapTable &table) : table(table), buffer(nullptr), page(nullptr), zoned(false),
+                                               zone(), filtered(false) {
+    lock_guard<mutex> lock(HeapFile::latch);
+    this->table.open();
+    this->table.load_blooms();
+    this->buffer = new char[this->table.file.get_block_size()];
+}
+
+HeapAppender::~HeapAppender() {
+    try {
+        this->finish();
+    } catch (exception &e) {
+        delete this->page;  // its rows are lost
+    }
+    delete[] this->buffer;
+}
+
+Handle HeapAppender::insert(const ValueDict *row) {
+    STATS_TABLE_SCOPE(this->table.stats_id);
+    ValueDict *full_row = this->table.validate(row);
+    Dbt *data = nullptr;
+    bool added = false;
+    bool inline_row = this->table.inline_row(full_row);
+    Handle handle;
+    try {
+        if (inline_row) {
+            data = this->table.marshal(full_row);
+        } else {
+            lock_guard<mutex> lock(HeapFile::latch);
+            data = this->table.marshal(full_row);
+        }
+        if (this->page == nullptr)
+            this->claim(false);
+        try {
+            handle.second = this->page->add(data);
+        } catch (DbBlockNoRoomError &e) {
+            this->give_back(true);
+            this->claim(true);  // any row marshal() makes fits into an empty block
+            handle.second = this->page->add(data);
+        }
+        added = true;
+        handle.first = this->page->get_block_id();
+        if (this->zoned) {
+            HeapTable::widen_zone(this->zone, this->table.zone_columns, *full_row);
+            this->zone.live++;
+        }
+    } catch (...) {
+        if (data != nullptr) {
+            if (!added && !inline_row) {
+                lock_guard<mutex> lock(HeapFile::latch);
+                this->table.discard_overflow(data);
+            }
+            arena_free(data->get_data());
+            delete data;
+        }
+        delete full_row;
+        throw;
+    }
+    arena_free(data->get_data());
+    delete data;
+    delete full_row;
+    return handle;
+}
+
+void HeapAppender::finish() {
+    if (this->page != nullptr)
+        this->give_back(false);
+}
+
+// Make a page the append page: a part-filled one given back, or (if there is none, or new_block) a new one.
+void HeapAppender::claim(bool new_block) {
+    lock_guard<mutex> lock(HeapFile::latch);
+    HeapFile &file = this->table.file;
+    HeapPage *page;
+    if (!new_block && !this->table.append_pages.empty()) {
+        page = file.get(this->table.append_pages.back());
+        this->table.append_pages.pop_back();
+    } else {
+        page = file.get_new();
+        this->table.new_zone(page->get_block_id());
+    }
+    BlockID block_id = page->get_block_id();
+    std::memcpy(this->buffer, page->get_data(), file.get_block_size());
+    delete page;
+    HeapTable::BlockZone *zone = this->table.get_zone(block_id);
+    this->zoned = zone != nullptr;
+    if (this->zoned)
+        this->zone = *zone;
+    this->filtered = this->table.blooms.find(block_id) != this->table.blooms.end();
+    ArenaScope scope(nullptr);  // the page outlives the statement
+    Dbt data(this->buffer, file.get_block_size());
+    this->page = file.make_page(data, block_id);
+}
+
+// Put the append page back, with its zone; a full one gets its Bloom filters, a part-filled one may be claimed again.
+void HeapAppender::give_back(bool full) {
+    lock_guard<mutex> lock(HeapFile::latch);
+    BlockID block_id = this->page->get_block_id();
+    this->table.file.put(this->page);
+    delete this->page;
+    this->page = nullptr;
+    HeapTable::BlockZone *zone = this->table.get_zone(block_id);
+    if (zone != nullptr && this->zoned)
+        *zone = this->zone;
+    if (full || this->filtered)
+        this->table.build_bloom(block_id);  // a filtered page missed the rows added since
+    if (!full)
+        this->table.append_pages.push_back(block_id);
+}
+
 /**
  * Print out given failure message and return false.
  * @param message reason for failure
@@ -680,6 +2689,51 @@ bool test_slotted_page() {
     return true;
 }
 
+/*
+ * A heap table whose file fails to put blocks while told to, for the error paths
+ */
+class FailingHeapFile : public HeapFile {
+public:
+    FailingHeapFile(string name) : HeapFile(name), failing(false) {}
+
+    virtual void put(DbBlock *block) {
+        if (this->failing)
+            throw DbRelationError("put failed");
+        HeapFile::put(block);
+    }
+
+    bool failing;
+};
+
+class FailingHeapTable : public HeapTable {
+public:
+    FailingHeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes) :
+            HeapTable(table_name, column_names, column_attributes, new FailingHeapFile(table_name)) {}
+
+    void fail_puts(bool failing) { ((FailingHeapFile &) this->file).failing = failing; }
+};
+
+// how many records a heap file has
+static size_t count_records(string name) {
+    HeapFile file(name);
+    file.open();
+    size_t count = 0;
+    for (BlockID block_id = 1; block_id <= file.get_last_block_id(); block_id++) {
+        HeapPage *page = file.get(block_id);
+        RecordIDs *record_ids = page->ids();
+        count += record_ids->size();
+        delete record_ids;
+        delete page;
+    }
+    file.close();
+    return count;
+}
+
+// as if the process started over: the next open of a heap file reads what it knows from the file
+static void forget_file(string name) {
+    file_infos.erase(name + ".db");
+}
+
 bool test_heap_storage(){
     ColumnNames column_names;
 	column_names.push_back("a");
@@ -720,11 +2774,735 @@ bool test_heap_storage(){
     //cout << value.n << endl;
     if (value.s != "Hello!")
 		return false;
+    delete handles;
+    delete result;
+
+    // a value much bigger than a block goes to the overflow file and is only read when asked for
+    ValueDict big_row;
+    big_row["a"] = Value(-1);
+    big_row["b"] = Value(string(100000, 'y'));
+    table.insert(&big_row);
+    ValueDict where;
+    where["a"] = Value(-1);
+    handles = table.select(&where);
+    if (handles->size() != 1)
+        return false;
+    ColumnNames just_a(1, "a");
+    result = table.project(handles->front(), &just_a);
+    if (result->size() != 1 || (*result)["a"].n != -1)
+        return false;
+    delete result;
+    result = table.project(handles->front());
+    if ((*result)["b"].s != big_row["b"].s)
+        return false;
+    delete result;
+    delete handles;
+
+    // an insert that fails once its long value is out of line leaves no chunks behind
+    FailingHeapTable failing("_test_failing_cpp", column_names, column_attributes);
+    failing.create();
+    failing.insert(&big_row);
+    size_t chunks = count_records("_test_failing_cpp.overflow");
+    failing.fail_puts(true);
+    try {
+        failing.insert(&big_row);
+        return false;
+    } catch (DbRelationError &e) {
+        // expected: the row's block can't be put
+    }
+    failing.fail_puts(false);
+    if (chunks == 0 || count_records("_test_failing_cpp.overflow") != chunks)
+        return false;
+
+    // so does an update that fails, and the row keeps its old value (and the chunks holding it)
+    handles = failing.select();
+    ValueDict bigger;
+    bigger["b"] = Value(string(150000, 'z'));
+    failing.fail_puts(true);
+    try {
+        failing.update(handles->front(), &bigger);
+        return false;
+    } catch (DbRelationError &e) {
+        // expected: the row's block can't be put
+    }
+    failing.fail_puts(false);
+    result = failing.project(handles->front());
+    if ((*result)["b"].s != big_row["b"].s || count_records("_test_failing_cpp.overflow") != chunks)
+        return false;
+    delete result;
+    failing.update(handles->front(), &bigger);
+    result = failing.project(handles->front());
+    if ((*result)["b"].s != bigger["b"].s)
+        return false;
+    delete result;
+    delete handles;
+    failing.drop();
+
+    // a scan inside a statement arena takes its blocks, record ids and rows from there
+    Arena arena;
+    {
+        ArenaScope scope(&arena);
+        handles = table.select();
+        for (auto const& handle: *handles) {
+            result = table.project(handle);
+            delete result;
+        }
+        if (handles->size() != 2)
+            return false;
+        delete handles;
+    }
+    if (arena.get_allocations() == 0)
+        return false;
+    arena.reset();
+
     table.drop();
+    HeapFile dropped_overflow("_test_data_cpp.overflow");
+    try {
+        dropped_overflow.open();
+        return false;
+    } catch (DbException &e) {
+        // dropped along with the table
+    }
+    cout << "overflow ok" << endl;
+
+    // updates: in place while the row fits, otherwise moved behind a forwarding stub
+    HeapTable updated("_test_update_cpp", column_names, column_attributes);
+    updated.create();
+    row["b"] = Value(string(100, 'u'));
+    for (int i = 0; i < 30; i++) {
+        row["a"] = Value(i);
+        updated.insert(&row);
+    }
+    Handle target(1, 5);
+    ValueDict change;
+    change["a"] = Value(-5);
+    updated.update(target, &change);
+    change.clear();
+    change["b"] = Value(string(1000, 'v'));
+    updated.update(target, &change);  // no longer fits into block 1
+    result = updated.project(target);
+    if ((*result)["a"].n != -5 || (*result)["b"].s != change["b"].s)
+        return false;
+    delete result;
+    handles = updated.select();
+    if (handles->size() != 30 || count(handles->begin(), handles->end(), target) != 1)
+        return false;
+    delete handles;
+    handles = updated.select(&change);
+    if (handles->size() != 1 || handles->front() != target)
+        return false;
+    delete handles;
+    for (int i = 30; i < 50; i++) {
+        row["a"] = Value(i);
+        updated.insert(&row);  // fill up block 2 behind the moved row
+    }
+    change["b"] = Value(string(2000, 'w'));
+    updated.update(target, &change);  // moves on to block 3, the stub follows
+    HeapFile raw("_test_update_cpp");
+    raw.open();
+    HeapPage *page = raw.get(2);
+    RecordIDs *record_ids = page->ids();
+    if (record_ids->size() != 20)
+        return false;
+    delete record_ids;
+    delete page;
+    change["b"] = Value("short");
+    updated.update(target, &change);  // back home
+    page = raw.get(3);
+    record_ids = page->ids();
+    if (!record_ids->empty())
+        return false;
+    delete record_ids;
+    delete page;
+    raw.close();
+    result = updated.project(target);
+    if ((*result)["a"].n != -5 || (*result)["b"].s != "short")
+        return false;
+    delete result;
+    try {
+        change["c"] = Value(1);
+        updated.update(target, &change);
+        return false;
+    } catch (DbRelationError &e) {
+        // expected: no such column
+    }
+
+    // deleting every other row writes each block once
+    handles = updated.select();
+    Handles doomed;
+    for (size_t i = 0; i < handles->size(); i += 2)
+        doomed.push_back((*handles)[i]);
+    StorageStats::reset("_test_update_cpp");
+    updated.del(&doomed);
+    if (StorageStats::enabled() && StorageStats::calls("_test_update_cpp", STATS_HEAPFILE_PUT) != 2)
+        return false;
+    delete handles;
+    handles = updated.select();
+    if (handles->size() != 25)
+        return false;
+    for (auto const& handle: *handles) {
+        result = updated.project(handle);
+        if ((*result)["a"].n % 2 != 1 && (*result)["a"].n != -5)
+            return false;
+        delete result;
+    }
+    delete handles;
+
+    // online vacuum: rows from the end move up, a few at a time, until the table fits in block 1
+    Relocations relocated;
+    while (updated.vacuum_step(4, &relocated))
+        continue;
+    handles = updated.select();
+    if (handles->size() != 25 || relocated.empty())
+        return false;
+    for (auto const& handle: *handles)
+        if (handle.first != 1)
+            return false;
+    for (auto const& moved: relocated)
+        if (find(handles->begin(), handles->end(), moved.second) == handles->end())
+            return false;
+    delete handles;
+
+    // offline vacuum: everything packed again from the start
+    for (int i = 100; i < 200; i++) {
+        row["a"] = Value(i);
+        updated.insert(&row);
+    }
+    handles = updated.select();
+    doomed.clear();
+    for (size_t i = 0; i < handles->size(); i++)
+        if (i % 4 != 0)
+            doomed.push_back((*handles)[i]);
+    updated.del(&doomed);
+    delete handles;
+    if (updated.vacuum() == 0)
+        return false;
+    handles = updated.select();
+    if (handles->size() != 32 || handles->back().first != 1)
+        return false;
+    delete handles;
+    updated.close();  // the blocks given back are still counted by Berkeley DB
+    forget_file("_test_update_cpp");
+    updated.open();
+    if (updated.get_last_block_id() != 1)
+        return false;
+    handles = updated.select();
+    if (handles->size() != 32)
+        return false;
+    delete handles;
+    updated.drop();
+    cout << "update ok" << endl;
+
+    // big blocks need 4-byte offsets, and the block size has to come back from the file
+    HeapTable big_table("_test_big_blocks_cpp", column_names, column_attributes, 128 * 1024);
+    big_table.create();
+    row["b"] = Value(string(60000, 'x'));
+    for (int i = 0; i < 5; i++) {
+        row["a"] = Value(i);
+        big_table.insert(&row);
+    }
+    big_table.close();
+    HeapTable reopened("_test_big_blocks_cpp", column_names, column_attributes);
+    reopened.open();
+    handles = reopened.select();
+    if (handles->size() != 5 || handles->back().first != 3)
+        return false;
+    result = reopened.project(handles->back());
+    if ((*result)["a"].n != 4 || (*result)["b"].s != string(60000, 'x'))
+        return false;
+    delete handles;
+    delete result;
+    reopened.drop();
+    cout << "big blocks ok" << endl;
+
+    // the same operations on PAX pages, and the layout has to come back from the file
+    HeapTable pax("_test_pax_cpp", column_names, column_attributes, DbBlock::BLOCK_SZ, HeapFile::PAX);
+    pax.create();
+    for (int i = 0; i < 300; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(string(i % 20, 'p'));
+        pax.insert(&row);
+    }
+    row["a"] = Value(-1);
+    row["b"] = Value(string(100000, 'o'));
+    pax.insert(&row);
+    pax.close();
+    HeapTable pax_reopened("_test_pax_cpp", column_names, column_attributes);
+    pax_reopened.open();
+    where.clear();
+    where["a"] = Value(150);
+    handles = pax_reopened.select(&where);
+    if (handles->size() != 1)
+        return false;
+    change.clear();
+    change["b"] = Value(string(1500, 'q'));
+    pax_reopened.update(handles->front(), &change);  // no room left in its page
+    result = pax_reopened.project(handles->front(), &just_a);
+    if (result->size() != 1 || (*result)["a"].n != 150)
+        return false;
+    delete result;
+    result = pax_reopened.project(handles->front());
+    if ((*result)["b"].s != string(1500, 'q'))
+        return false;
+    delete result;
+    delete handles;
+    handles = pax_reopened.select();
+    if (handles->size() != 301)
+        return false;
+    doomed.clear();
+    for (auto const& handle: *handles) {
+        result = pax_reopened.project(handle, &just_a);
+        if ((*result)["a"].n % 3 != 0)
+            doomed.push_back(handle);
+        delete result;
+    }
+    delete handles;
+    pax_reopened.del(&doomed);
+    if (pax_reopened.vacuum() == 0)
+        return false;
+    handles = pax_reopened.select();
+    if (handles->size() != 100)
+        return false;
+    for (auto const& handle: *handles) {
+        result = pax_reopened.project(handle);
+        int a = (*result)["a"].n;
+        if (a % 3 != 0 || (*result)["b"].s != (a == 150 ? string(1500, 'q') : string(a % 20, 'p')))
+            return false;
+        delete result;
+    }
+    delete handles;
+    pax_reopened.drop();
+    cout << "pax ok" << endl;
+
+    // clustered values: a range scan only reads the blocks whose zones overlap it
+    HeapTable zoned("_test_zones_cpp", column_names, column_attributes);
+    zoned.create();
+    for (int i = 0; i < 2000; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(string(50, 'z'));
+        zoned.insert(&row);
+    }
+    IntRanges ranges;
+    ranges["a"] = make_pair(1000, 1009);
+    StorageStats::reset();
+    BlockID position = 0;
+    handles = zoned.select(nullptr, &ranges, SIZE_MAX, position);
+    u_int64_t gets = StorageStats::calls("_test_zones_cpp", STATS_HEAPFILE_GET);
+    if (StorageStats::enabled() && (gets == 0 || gets > 2))
+        return false;
+    int in_range = 0;
+    for (auto const& handle: *handles) {
+        result = zoned.project(handle, &just_a);
+        in_range += (*result)["a"].n >= 1000 && (*result)["a"].n <= 1009;
+        delete result;
+    }
+    if (in_range != 10 || handles->size() > 200)
+        return false;
+    Handle first = handles->front();
+    delete handles;
+    where.clear();
+    where["a"] = Value(5000);
+    handles = zoned.select(&where);
+    if (!handles->empty())
+        return false;
+    delete handles;
+    change.clear();
+    change["a"] = Value(5000);  // widens the zone of the row's block
+    zoned.update(first, &change);
+    handles = zoned.select(&where);
+    if (handles->size() != 1 || handles->front() != first)
+        return false;
+    delete handles;
+    zoned.del(first);
+    handles = zoned.select(&where);
+    if (!handles->empty())
+        return false;
+    delete handles;
+
+    // after the table is opened again, the first range scan maps every block and the next one skips
+    zoned.close();
+    zoned.open();
+    ranges["a"] = make_pair(1500, 1500);
+    for (int scan = 0; scan < 2; scan++) {
+        StorageStats::reset();
+        handles = zoned.select(nullptr, &ranges, SIZE_MAX, position);
+        gets = StorageStats::calls("_test_zones_cpp", STATS_HEAPFILE_GET);
+        if (StorageStats::enabled() && (scan == 0 ? gets < 10 : gets != 1))
+            return false;
+        delete handles;
+    }
+    zoned.drop();
+    cout << "zones ok" << endl;
+
+    // a needle among distinct strings: the Bloom filters leave only a few blocks to read
+    HeapTable bloomed("_test_bloom_cpp", column_names, column_attributes);
+    bloomed.create();
+    for (int i = 0; i < 1000; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("value " + to_string(i) + string(40, '.'));
+        bloomed.insert(&row);
+    }
+    bloomed.create_bloom_filter(ColumnNames(1, "b"));
+    for (int i = 1000; i < 2000; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("value " + to_string(i) + string(40, '.'));
+        bloomed.insert(&row);  // filters for the blocks as they fill up
+    }
+    BloomStats bloom_stats;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int needle: {17, 1717}) {
+            where.clear();
+            where["b"] = Value("value " + to_string(needle) + string(40, '.'));
+            StorageStats::reset();
+            handles = bloomed.select(&where);
+            gets = StorageStats::calls("_test_bloom_cpp", STATS_HEAPFILE_GET);
+            if (handles->size() != 1 || (StorageStats::enabled() && gets > 4))
+                return false;
+            result = bloomed.project(handles->front(), &just_a);
+            if ((*result)["a"].n != needle)
+                return false;
+            delete result;
+            delete handles;
+        }
+        if (bloomed.get_bloom_columns(&bloom_stats) != ColumnNames(1, "b") || bloom_stats.blocks < 20
+            || bloom_stats.skipped < 2 * (bloom_stats.blocks - 2) || bloom_stats.false_positive_rate() > 0.1)
+            return false;
+        bloomed.close();  // the filters come back from the file
+        bloomed.open();
+    }
+    change.clear();
+    change["b"] = Value(string("needle"));
+    bloomed.update(Handle(1, 1), &change);
+    where.clear();
+    where["b"] = Value(string("needle"));
+    handles = bloomed.select(&where);
+    if (handles->size() != 1 || handles->front() != Handle(1, 1))
+        return false;
+    delete handles;
+    bloomed.vacuum();
+    handles = bloomed.select(&where);
+    if (handles->size() != 1)
+        return false;
+    delete handles;
+    bloomed.drop_bloom_filter();
+    if (!bloomed.get_bloom_columns().empty())
+        return false;
+    bloomed.drop();
+    cout << "blooms ok" << endl;
+
+    // blocks are reserved an extent at a time, and those not handed out are given back on close
+    HeapFile extents("_test_extents_cpp");
+    extents.create();
+    for (int i = 0; i < 99; i++) {
+        HeapPage *page = extents.get_new();
+        extents.put(page);
+        delete page;
+    }
+    BlockIDs *extent_ids = extents.block_ids();
+    if (extents.get_last_block_id() != 100 || extent_ids->size() != 100)
+        return false;
+    delete extent_ids;
+    extents.close();
+    extents.open();
+    if (extents.get_last_block_id() != 100)
+        return false;
+    extents.close();  // Berkeley DB still counts the blocks given back, up to the end of the extent
+    forget_file("_test_extents_cpp");
+    extents.open();
+    if (extents.get_last_block_id() != 100)
+        return false;
+    delete extents.get_new();
+    extents.truncate(50);
+    extents.close();
+    extents.open();
+    if (extents.get_last_block_id() != 50)
+        return false;
+    extents.close();
+    forget_file("_test_extents_cpp");
+    extents.open();
+    if (extents.get_last_block_id() != 50)
+        return false;
+    try {
+        delete extents.get(51);
+        return false;
+    } catch (DbRelationError &e) {
+        // expected: given back
+    }
+    delete extents.get_new();  // over the record given back
+    if (extents.get_last_block_id() != 51)
+        return false;
+    extents.drop();
+    cout << "extents ok" << endl;
+
+    // put() leaves blocks dirty, readers see them anyway, and they are written back in one go
+    u_int32_t flush_interval_ms = HeapFile::flush_interval_ms;
+    HeapFile::flush_interval_ms = 60 * 1000;
+    HeapFile written("_test_write_back_cpp");
+    written.create();
+    HeapFile reader("_test_write_back_cpp");
+    reader.open();
+    page = written.get(1);
+    char text[] = "not on file yet";
+    Dbt record(text, sizeof(text));
+    page->add(&record);
+    written.put(page);
+    delete page;
+    page = reader.get(1);
+    record_ids = page->ids();
+    if (written.dirty_count() != 1 || reader.dirty_count() != 1 || record_ids->size() != 1)
+        return false;
+    delete record_ids;
+    delete page;
+    for (u_int32_t i = 0; i < HeapFile::MAX_DIRTY_BLOCKS + 10; i++) {
+        page = written.get_new();
+        written.put(page);
+        delete page;
+    }
+    if (written.dirty_count() != 11)  // the first MAX_DIRTY_BLOCKS went when the file needed room
+        return false;
+    written.truncate(HeapFile::MAX_DIRTY_BLOCKS + 5);
+    if (written.dirty_count() != 5 || written.flush() != 5 || written.dirty_count() != 0)
+        return false;
+    reader.close();
+    page = written.get(1);
+    page->add(&record);
+    written.put(page);
+    delete page;
+    written.close();  // writes it back
+    written.open();
+    page = written.get(1);
+    record_ids = page->ids();
+    if (written.dirty_count() != 0 || record_ids->size() != 2)
+        return false;
+    delete record_ids;
+    delete page;
+    written.drop();
+
+    // an insert-heavy table writes each block about once, not once per row
+    StorageStats::reset();
+    HeapTable inserted("_test_write_back_table_cpp", column_names, column_attributes);
+    inserted.create();
+    row["b"] = Value(string(50, 'w'));
+    for (int i = 0; i < 1000; i++) {
+        row["a"] = Value(i);
+        inserted.insert(&row);
+    }
+    if (StorageStats::enabled()
+        && StorageStats::calls("_test_write_back_table_cpp", STATS_HEAPFILE_WRITE) * 20
+           > StorageStats::calls("_test_write_back_table_cpp", STATS_HEAPFILE_PUT))
+        return false;
+    if (HeapFile::checkpoint() == 0 || HeapFile::checkpoint() != 0)
+        return false;
+    inserted.close();
+    inserted.open();
+    handles = inserted.select();
+    if (handles->size() != 1000)
+        return false;
+    delete handles;
+    inserted.drop();
+
+    // rows are written back after the overflow chunks they point at, a moved row before its stub
+    HeapTable ordered("_test_write_order_cpp", column_names, column_attributes);
+    ordered.create();
+    row["a"] = Value(0);
+    row["b"] = Value(string(10000, 'o'));  // out of line
+    ordered.insert(&row);
+    HeapFile ordered_file("_test_write_order_cpp"), ordered_overflow("_test_write_order_cpp.overflow");
+    ordered_file.open();
+    ordered_overflow.open();
+    if (ordered_overflow.dirty_count() == 0 || ordered_file.flush() <= 1 || ordered_overflow.dirty_count() != 0)
+        return false;
+    row["b"] = Value(string(50, 'o'));
+    for (int i = 1; i < 100; i++) {
+        row["a"] = Value(i);
+        ordered.insert(&row);
+    }
+    ordered_file.flush();
+    change.clear();
+    change["b"] = Value(string(1000, 'm'));
+    ordered.update(Handle(1, 2), &change);  // no longer fits into block 1
+    if (ordered_file.dirty_count() != 1)  // just the stub: the block the row moved to is written
+        return false;
+    result = ordered.project(Handle(1, 2));
+    if ((*result)["b"].s != string(1000, 'm'))
+        return false;
+    delete result;
+    ordered.del(Handle(1, 1));  // the row goes before its chunks do
+    if (ordered_file.dirty_count() != 0 || ordered_overflow.dirty_count() == 0)
+        return false;
+    ordered_overflow.flush();
+    row["a"] = Value(100);
+    row["b"] = Value(string(10000, 'o'));
+    Handles overflowed = {ordered.insert(&row)};
+    ordered_file.flush();
+    ordered.del(&overflowed);
+    if (ordered_file.dirty_count() != 0 || ordered_overflow.dirty_count() == 0)
+        return false;
+    ordered_overflow.close();
+    ordered_file.close();
+    ordered.drop();
+    HeapFile::flush_interval_ms = flush_interval_ms;
+    cout << "write-back ok" << endl;
+
+    // no more Berkeley DB handles open than allowed, however many tables are in use
+    u_int32_t max_open_handles = HeapFile::max_open_handles;
+    HeapFile::max_open_handles = 2;
+    vector<HeapTable *> many;
+    for (int t = 0; t < 5; t++) {
+        many.push_back(new HeapTable("_test_handles_cpp_" + to_string(t), column_names, column_attributes));
+        many.back()->create();
+    }
+    for (int i = 0; i < 50; i++) {
+        row["a"] = Value(i);
+        many[i % 5]->insert(&row);
+        if (HeapFile::open_handles() > 2)
+            return false;
+    }
+    for (int t = 0; t < 5; t++)
+        many[t]->close();
+    u_int32_t open_handles = HeapFile::open_handles();
+    for (int t = 0; t < 5; t++)
+        many[t]->open();  // nothing to ask Berkeley DB yet
+    if (HeapFile::open_handles() != open_handles)
+        return false;
+    for (int t = 0; t < 5; t++) {
+        handles = many[t]->select();
+        if (handles->size() != 10 || HeapFile::open_handles() > 2)
+            return false;
+        delete handles;
+        many[t]->drop();
+        delete many[t];
+    }
+    HeapFile::max_open_handles = max_open_handles;
+    cout << "handles ok" << endl;
+
+    // many rows at once: the same rows, zones and Bloom filters as one at a time, far fewer puts
+    HeapTable bulk("_test_bulk_cpp", column_names, column_attributes);
+    bulk.create();
+    bulk.create_bloom_filter(ColumnNames(1, "b"));
+    vector<ValueDict *> bulk_rows;
+    for (int i = 0; i < 2000; i++) {
+        ValueDict *bulk_row = new ValueDict();
+        (*bulk_row)["a"] = Value(i);
+        (*bulk_row)["b"] = Value("value " + to_string(i) + string(i == 1234 ? 5000 : 40, '.'));  // one overflows
+        bulk_rows.push_back(bulk_row);
+    }
+    StorageStats::reset();
+    bulk.insert(&bulk_rows);
+    if (StorageStats::enabled() && StorageStats::calls("_test_bulk_cpp", STATS_HEAPFILE_PUT) * 10 > 2000)
+        return false;
+    where.clear();
+    where["b"] = Value("value 1717" + string(40, '.'));
+    handles = bulk.select(&where);
+    if (handles->size() != 1)
+        return false;
+    delete handles;
+    where["b"] = Value("value 1234" + string(5000, '.'));
+    handles = bulk.select(&where);
+    if (handles->size() != 1)
+        return false;
+    delete handles;
+    IntRanges bulk_ranges;
+    bulk_ranges["a"] = make_pair(100, 119);
+    position = 0;
+    handles = bulk.select(nullptr, &bulk_ranges, SIZE_MAX, position);
+    if (handles->size() < 20 || handles->size() > 200)
+        return false;
+    delete handles;
+    handles = bulk.select();
+    if (handles->size() != 2000)
+        return false;
+    delete handles;
+    // a row the table won't take, after others it would: none of them go in
+    for (int i = 0; i < 2000; i++)
+        (*bulk_rows[i])["b"] = Value("again " + to_string(i));
+    bulk_rows[1500]->erase("b");
+    try {
+        bulk.insert(&bulk_rows);
+        return false;
+    } catch (DbRelationError &e) {
+        // expected: no NULLs yet
+    }
+    for (auto bulk_row: bulk_rows)
+        delete bulk_row;
+    handles = bulk.select();
+    if (handles->size() != 2000)
+        return false;
+    delete handles;
+    bulk.drop();
+    cout << "bulk insert ok" << endl;
+
+    // the same rows on four threads, twice: all there, findable by zone and filter, few blocks part-filled
+    HeapTable concurrent("_test_concurrent_cpp", column_names, column_attributes);
+    concurrent.create();
+    concurrent.create_bloom_filter(ColumnNames(1, "b"));
+    const int CONCURRENT_ROWS = 4000, WRITERS = 4;
+    vector<ValueDict *> concurrent_rows;
+    for (int i = 0; i < CONCURRENT_ROWS; i++) {
+        ValueDict *concurrent_row = new ValueDict();
+        (*concurrent_row)["a"] = Value(i);
+        (*concurrent_row)["b"] = Value("value " + to_string(i) + string(i == 2345 ? 5000 : 40, '.'));
+        concurrent_rows.push_back(concurrent_row);
+    }
+    concurrent.insert(&concurrent_rows, WRITERS);
+    concurrent.insert(&concurrent_rows, WRITERS);
+    for (auto concurrent_row: concurrent_rows)
+        delete concurrent_row;
+    handles = concurrent.select();
+    if (handles->size() != 2 * CONCURRENT_ROWS)
+        return false;
+    BlockID concurrent_last = 0;
+    vector<int> seen(CONCURRENT_ROWS, 0);
+    for (auto const &handle: *handles) {
+        concurrent_last = max(concurrent_last, handle.first);
+        ValueDict *concurrent_row = concurrent.project(handle);
+        int a = (*concurrent_row)["a"].n;
+        if (a < 0 || a >= CONCURRENT_ROWS || (*concurrent_row)["b"].s.compare(0, 6, "value ") != 0)
+            return false;
+        seen[a]++;
+        delete concurrent_row;
+    }
+    delete handles;
+    if (count(seen.begin(), seen.end(), 2) != CONCURRENT_ROWS)
+        return false;
+    HeapTable serial("_test_serial_cpp", column_names, column_attributes);
+    serial.create();
+    for (int i = 0; i < 2 * CONCURRENT_ROWS; i++) {
+        row["a"] = Value(i % CONCURRENT_ROWS);
+        row["b"] = Value("value " + to_string(i % CONCURRENT_ROWS) + string(i % CONCURRENT_ROWS == 2345 ? 5000 : 40, '.'));
+        serial.insert(&row);
+    }
+    handles = serial.select();
+    BlockID serial_last = handles->back().first;
+    delete handles;
+    serial.drop();
+    if (concurrent_last > serial_last + WRITERS)
+        return false;
+    where.clear();
+    where["b"] = Value("value 3141" + string(40, '.'));
+    handles = concurrent.select(&where);
+    if (handles->size() != 2)
+        return false;
+    delete handles;
+    IntRanges concurrent_ranges;
+    concurrent_ranges["a"] = make_pair(100, 119);
+    position = 0;
+    handles = concurrent.select(nullptr, &concurrent_ranges, SIZE_MAX, position);
+    if (handles->size() < 40)
+        return false;
+    delete handles;
+    concurrent.drop();
+    cout << "concurrent inserts ok" << endl;
 
     cout << "Test slotted page" << endl;
     if(!test_slotted_page())
         return false;
+    cout << "Test pax page" << endl;
+    if(!test_pax_page())
+        return false;
+    cout << "Test bloom filter" << endl;
+    if(!test_bloom_filter())
+        return false;
     return true;
     //return test_slotted_page();
 }
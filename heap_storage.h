@@ -1,7 +1,54 @@
 #pragma once
 
+#include <list>
+#include <mutex>
 #include "db_cxx.h"
 #include "storage_engine.h"
+#include "storage_stats.h"
+#include "bloom_filter.h"
+
+/**
+ * Records of a heap table (see HeapTable) start with their kind: a row, a forwarding stub (just the
+ * handle the row moved to), or a moved row (the handle of its home, then the row). Then come the
+ * columns: an INT is 4 bytes, a TEXT is a 2-byte length and the characters, or OVERFLOW_TEXT and
+ * OVERFLOW_POINTER_SIZE bytes (4-byte length, handle of the first chunk) for a value stored out of line.
+ */
+enum RecordKind {
+    RECORD_ROW = 0,
+    RECORD_FORWARD = 1,
+    RECORD_MOVED = 2
+};
+const uint ROW_HEADER_SIZE = 1;
+const uint FORWARD_SIZE = 1 + sizeof(u_int32_t) + sizeof(u_int16_t);  // a stub, also the header of a moved row
+const u_int16_t OVERFLOW_TEXT = UINT16_MAX;
+const uint OVERFLOW_POINTER_SIZE = 2 * sizeof(u_int32_t) + sizeof(u_int16_t);
+
+/**
+ * @class HeapPage - a block of a heap file, whichever way it lays its records out
+ */
+class HeapPage : public DbBlock {
+public:
+    HeapPage(Dbt &block, BlockID block_id, bool is_new = false) : DbBlock(block, block_id, is_new) {}
+
+    virtual ~HeapPage() {}
+
+    using DbBlock::del;
+
+    // delete several records at once
+    virtual void del(const RecordIDs *record_ids) {
+        for (auto const &record_id: *record_ids)
+            del(record_id);
+    }
+
+    /**
+     * Get a record of which only some columns will be looked at. Pages that keep the columns
+     * apart only copy those, and leave the others zero (an INT 0, an empty TEXT).
+     * @param record_id  which record to get
+     * @param columns    for each column of the table, whether it is needed
+     * @returns          the record, or nullptr if it has been deleted (freed by caller)
+     */
+    virtual Dbt *get_columns(RecordID record_id, const std::vector<bool> &columns) { return get(record_id); }
+};
 
 /**
  * @class SlottedPage - heap file implementation of DbBlock.
@@ -15,9 +62,12 @@
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
+        Blocks larger than 64kB can't address their data with 2 bytes, so their headers use
+        4-byte numbers instead (bytes 0x00 - 0x03: number of records, 0x04 - 0x07: end of free space,
+        0x08 - 0x0B: size of record 1, etc.). The width follows from the block size alone.
  *
  */
-class SlottedPage : public DbBlock {
+class SlottedPage : public HeapPage {
 public:
     SlottedPage(Dbt &block, BlockID block_id, bool is_new = false);
 
@@ -41,42 +91,87 @@ public:
 
     virtual void del(RecordID record_id);
 
+    virtual void del(const RecordIDs *record_ids);
+
     virtual RecordIDs *ids(void);
 
+    static u_int32_t max_record_size(uint block_size);
+
 protected:
-    u_int16_t num_records;
-    u_int16_t end_free;
+    u_int32_t num_records;
+    u_int32_t end_free;
+    u_int32_t header_width;  // bytes per header number: 2, or 4 for blocks above 64kB
 
-    virtual void get_header(u_int16_t &size, u_int16_t &loc, RecordID id = 0);
+    virtual void get_header(u_int32_t &size, u_int32_t &loc, RecordID id = 0);
 
-    virtual void put_header(RecordID id = 0, u_int16_t size = 0, u_int16_t loc = 0);
+    virtual void put_header(RecordID id = 0, u_int32_t size = 0, u_int32_t loc = 0);
 
-    virtual bool has_room(u_int16_t size);
+    virtual bool has_room(u_int32_t size);
 
-    virtual void slide(u_int16_t start, u_int16_t end);
+    virtual void slide(u_int32_t start, u_int32_t end);
 
-    virtual u_int16_t get_n(u_int16_t offset);
+    virtual u_int32_t get_n(u_int32_t offset);
 
-    virtual void put_n(u_int16_t offset, u_int16_t n);
+    virtual void put_n(u_int32_t offset, u_int32_t n);
 
-    virtual void *address(u_int16_t offset);
+    virtual void *address(u_int32_t offset);
 };
 
+struct DirtyBlocks;  // see heap_storage.cpp
+
 /**
  * @class HeapFile - heap file implementation of DbFile
  *
  * Heap file organization. Built on top of Berkeley DB RecNo file. There is one of our
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
         for buffer management and file management.
-        Uses SlottedPage for storing records within blocks.
+        Uses SlottedPage for storing records within blocks, or PaxPage (see pax_page.h) if the
+        file was created with the PAX layout; open() tells which from the first block.
+        New blocks are put on file an extent at a time, empty, and handed out by get_new() from
+        memory; blocks reserved but not handed out yet are given back when the file is closed.
+        Blocks given back (by close() or truncate()) stay in the RECNO file as deleted records,
+        counted by Berkeley DB, so open() finds the last block by looking for the last one still there.
+        put() doesn't write the block to Berkeley DB either: it keeps a copy, dirty, and get()
+        hands that copy out until it is written back, all dirty blocks of the file at once in block
+        order, by flush(). That happens when the file has MAX_DIRTY_BLOCKS dirty blocks and needs
+        another, when its oldest dirty block is flush_interval_ms old, on close(), and for every
+        file on checkpoint() (flush_expired() does only the files due; the shell calls it between
+        statements, and a Flusher while the shell is idle). The dirty blocks belong to
+        the file, not to the HeapFile object, so every HeapFile open on it reads the same blocks.
+        A file can be written back after others (write_after()): its flush() writes theirs first.
+        Within a file, write_back() writes one block ahead of the rest, for a block that another
+        one is about to point into.
+        Opening a file doesn't open a Berkeley DB handle: that waits until a block is read or
+        written, and then the handle stays open only while it is among the max_open_handles used
+        most recently by any heap file; the others are closed and opened again when next needed.
+        What open() learns from Berkeley DB (last block, block size, layout) is remembered when the
+        file is closed, so opening it again doesn't ask again.
  */
 class HeapFile : public DbFile {
 public:
-    HeapFile(std::string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0) {
+    static const u_int32_t EXTENT_BLOCKS = 64;  // the most blocks reserved at a time
+    static const u_int32_t MAX_DIRTY_BLOCKS = 256;  // the most blocks of a file put and not written back
+    static u_int32_t flush_interval_ms;  // how long a block may stay dirty (0 writes every put through)
+    static u_int32_t max_open_handles;  // the most Berkeley DB handles open at a time, over all heap files
+    static std::atomic<u_int64_t> pages_read;  // blocks get() read from Berkeley DB, over all heap files
+    static std::atomic<u_int64_t> page_hits;  // blocks get() had in memory instead
+    static std::mutex latch;  // held by each thread using heap files while others do too (see HeapAppender)
+
+    enum Layout {
+        SLOTTED,  // whole records next to each other
+        PAX  // each column in a minipage of its own; needs the column types at create()
+    };
+
+    HeapFile(std::string name, uint block_size = DbBlock::BLOCK_SZ, Layout layout = SLOTTED,
+             const ColumnAttributes &column_attributes = ColumnAttributes()) : DbFile(name), dbfilename(""),
+                                 last(0), closed(true), block_size(block_size), layout(layout),
+                                 column_attributes(column_attributes), db(nullptr),
+                                 stats_id(StorageStats::table_id(name)), reserved(0), fresh(nullptr),
+                                 dirty(nullptr), copy(nullptr), last_opened(0) {
         this->dbfilename = this->name + ".db";
     }
 
-    virtual ~HeapFile() {}
+    virtual ~HeapFile();
 
     HeapFile(const HeapFile &other) = delete;
 
@@ -94,34 +189,149 @@ public:
 
     virtual void close(void);
 
-    virtual SlottedPage *get_new(void);
+    virtual HeapPage *get_new(void);
 
-    virtual SlottedPage *get(BlockID block_id);
+    virtual HeapPage *get(BlockID block_id);
+
+    virtual HeapPage *make_page(Dbt &block, BlockID block_id, bool is_new = false);
 
     virtual void put(DbBlock *block);
 
     virtual BlockIDs *block_ids();
 
+    virtual void truncate(BlockID last);
+
     virtual u_int32_t get_last_block_id() { return last; }
 
+    virtual uint get_block_size() { return block_size; }
+
+    virtual Layout get_layout() { return layout; }
+
+    virtual u_int32_t max_record_size();
+
+    /**
+     * Write the dirty blocks of the file back to Berkeley DB.
+     * @returns  how many blocks were written
+     */
+    virtual u_int32_t flush();
+
+    /**
+     * Have the dirty blocks of another file written back before this one's, from now on (e.g. a
+     * table's after those of the files its rows point into).
+     * @param name  the other file's name
+     */
+    virtual void write_after(const std::string &name);
+
+    /**
+     * Write a dirty block back now, after the files this one is written after, so that a block
+     * put later can point into it.
+     * @param block_id  the block (nothing to do if it isn't dirty)
+     */
+    virtual void write_back(BlockID block_id);
+
+    // how many blocks of the file are dirty
+    virtual u_int32_t dirty_count() const;
+
+    /**
+     * Write back the dirty blocks of every open heap file.
+     * @returns  how many blocks were written
+     */
+    static u_int32_t checkpoint();
+
+    // write back the files whose oldest dirty block is flush_interval_ms old, e.g. between statements
+    static u_int32_t flush_expired();
+
+    // how many Berkeley DB handles heap files have open
+    static u_int32_t open_handles();
+
 protected:
     std::string dbfilename;
     u_int32_t last;
     bool closed;
-    Db db;
+    uint block_size;  // chosen at create(), read back from the file by open()
+    Layout layout;  // the same
+    ColumnAttributes column_attributes;  // what a PAX page is laid out for
+    Db *db;  // nullptr until a block is needed, and again once the handle is closed to make room
+    int stats_id;
+    u_int32_t reserved;  // empty blocks on file after the last one, for get_new() to hand out
+    char *fresh;  // the block get_new() handed out last
+    DirtyBlocks *dirty;  // of this file, shared with the other HeapFiles open on it; nullptr while closed
+    char *copy;  // the block get() handed out last
+    u_int32_t last_opened;  // last when the file was opened
+    std::list<HeapFile *>::iterator used;  // where the handle is in the open handles, most recently used first
+    std::vector<std::string> written_after;  // Berkeley DB names of the files given to write_after()
 
     virtual void db_open(uint flags = 0);
+
+    // the Berkeley DB handle, opened if need be
+    virtual Db &handle();
+
+    // open a Berkeley DB handle, closing the least recently used one if there are max_open_handles
+    virtual void open_handle(uint flags = 0);
+
+    virtual void close_handle();
+
+    virtual void reserve();
+
+    virtual void release();
+
+    virtual bool read(BlockID block_id, char *buffer);
+
+    virtual BlockID find_last(u_int32_t records);
+
+    virtual u_int32_t flush_first();
+
+    // stop sharing the dirty blocks of the file, throwing them away if nobody else is open on it
+    virtual void detach();
+
+    // throw away the dirty blocks after the given one
+    virtual void discard(BlockID last);
 };
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
+ *
+ *      The block size is fixed when the table is created (big blocks for scan-heavy tables,
+ *      small ones for tables with many point lookups); opening an existing table uses the
+ *      size recorded in its file no matter what was passed to the constructor. So is the page
+ *      layout: PAX pages for tables mostly read a few columns at a time, slotted pages otherwise.
+ *
+ *      TEXT values too long to sit comfortably in a row (or in a block at all) are stored out of
+ *      line in a side heap file, <table_name>.overflow, as a chain of chunks; the row only keeps
+ *      the length and a handle to the first chunk. The chunks are read only when that column
+ *      is projected or compared.
+ *
+ *      Every record starts with a kind byte. An update that no longer fits into the row's page
+ *      moves the row to another page (as a RECORD_MOVED record that remembers its home) and
+ *      leaves a RECORD_FORWARD stub with the new location behind, so the row keeps its handle.
+ *      Forwarding never goes more than one hop: moving a moved row again repoints the stub, and
+ *      an update that fits back into the home page collapses the stub and the moved record.
+ *
+ *      VACUUM packs the rows into as few blocks as they need and gives the rest back, either all
+ *      at once (vacuum(), which renumbers every row), or a few rows at a time while the table is
+ *      in use (vacuum_step(), which moves rows from the last block into room further up and
+ *      reports their new handles).
+ *
+ *      A zone map keeps, for each block, how many rows it is home to and the smallest and largest
+ *      value of every INT column among them. A scan with ranges (or INT equalities in its where
+ *      clause) skips the blocks whose zones can't match without reading them, and one that does
+ *      read a block not yet mapped maps it on the way. Inserts, updates and deletes keep the zones
+ *      current (a zone only ever widens, so it may be wider than its rows); VACUUM forgets them.
+ *      The zone map lives in memory only: after the table is opened again scans learn it anew.
+ *
+ *      Optionally, some TEXT columns also get a Bloom filter per block, built when the block fills
+ *      up (the table moves on to a new one) and kept in <table_name>.bloom, a record per block after
+ *      one naming the columns. A scan with an equality on such a column skips the blocks whose
+ *      filter rules the value out. Rows that later land in a block with a filter are added to it;
+ *      VACUUM builds the filters again.
  */
 
 class HeapTable : public DbRelation {
 public:
-    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
+    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+              uint block_size = DbBlock::BLOCK_SZ, HeapFile::Layout layout = HeapFile::SLOTTED);
 
-    virtual ~HeapTable() {}
+    virtual ~HeapTable();
 
     HeapTable(const HeapTable &other) = delete;
 
@@ -143,28 +353,216 @@ public:
 
     virtual Handle insert(const ValueDict *row);
 
+    // rows appended as by insert(row), with each block put once instead of once per row
+    virtual void insert(const std::vector<ValueDict *> *rows);
+
+    /**
+     * Insert rows on several threads at once, each with a HeapAppender of its own.
+     * @param rows     the rows, dealt out to the threads in runs
+     * @param threads  how many threads to insert on
+     */
+    virtual void insert(const std::vector<ValueDict *> *rows, uint threads);
+
     virtual void update(const Handle handle, const ValueDict *new_values);
 
     virtual void del(const Handle handle);
 
+    virtual void del(const Handles *handles);
+
     virtual Handles *select();
 
     virtual Handles *select(const ValueDict *where);
 
+    virtual Handles *select(const ValueDict *where, size_t limit, BlockID &position);
+
+    virtual Handles *select(const ValueDict *where, const IntRanges *ranges, size_t limit, BlockID &position);
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
+    virtual u_int32_t vacuum();
+
+    virtual bool vacuum_step(size_t max_rows, Relocations *relocated = nullptr);
+
+    // the records of the first and last blocks, as if the blocks in between were like the first
+    virtual u_int64_t estimate_row_count();
+
+    /**
+     * The qualifying rows of some blocks, safe to call from several threads at once (see MorselScheduler).
+     * @param first         first block to read
+     * @param last          last block to read
+     * @param where         column values a row has to equal (nullptr for all rows)
+     * @param ranges        bounds on INT columns the rows wanted lie within (nullptr for none)
+     * @param column_names  columns to return
+     * @param rows          gets the rows
+     */
+    virtual void scan_blocks(BlockID first, BlockID last, const ValueDict *where, const IntRanges *ranges,
+                             const ColumnNames *column_names, std::vector<ValueDict> &rows);
+
+    virtual BlockID get_last_block_id();
+
+    /**
+     * Keep Bloom filters on some TEXT columns, replacing any the table has, and build them for the
+     * blocks already full.
+     * @param column_names  the TEXT columns
+     */
+    virtual void create_bloom_filter(const ColumnNames &column_names);
+
+    virtual void drop_bloom_filter();
+
+    /**
+     * The columns with Bloom filters.
+     * @param stats  if not nullptr, gets how well the filters did since the table was opened
+     * @returns      the columns (none if the table has no filters)
+     */
+    virtual ColumnNames get_bloom_columns(BloomStats *stats = nullptr);
+
 protected:
-    HeapFile file;
+    friend class HeapAppender;
+
+    HeapFile &file;  // owned by the table
+    int stats_id;
+    HeapFile *overflow;
+    BlockID vacuum_cursor;  // online vacuum: blocks before this one have no room for rows from the end
+
+    // what the zone map knows about a block
+    struct BlockZone {
+        bool known;  // whether the rest is (until then, the block has to be read)
+        u_int32_t live;  // rows whose handle is in this block
+        std::vector<int32_t> min, max;  // of each INT column (in zone_columns order) over those rows
+    };
+    ColumnNames zone_columns;  // the INT columns
+    std::vector<BlockZone> zones;  // block n is zones[n - 1]
+
+    // the Bloom filters of a block, one per bloom column, and the record they are stored in
+    struct BlockBloom {
+        Handle handle;
+        std::vector<BloomFilter> filters;
+    };
+    HeapFile *bloom_file;  // nullptr if there is none (or it hasn't been looked for yet)
+    bool blooms_loaded;
+    ColumnNames bloom_columns;
+    std::map<BlockID, BlockBloom> blooms;
+    BloomStats bloom_stats;
+
+    std::vector<BlockID> append_pages;  // part-filled pages appenders gave back, for the next one to claim
 
     virtual ValueDict *validate(const ValueDict *row);
 
     virtual Handle append(const ValueDict *row);
 
+    static Handle append_record(HeapFile &file, const Dbt *data);
+
+    virtual HeapFile *get_overflow(bool create);
+
+    virtual Handle put_overflow(const std::string &value);
+
+    virtual std::string get_overflow(Handle first, u_int32_t length);
+
     virtual Dbt *marshal(const ValueDict *row);
 
-    virtual ValueDict *unmarshal(Dbt *data);
+    // whether marshal() keeps all the values of a row in the row, none in the overflow file
+    virtual bool inline_row(const ValueDict *row);
+
+    // whether unmarshal() needs nothing but a row record to decode the columns wanted
+    virtual bool inline_record(const Dbt *data, const std::vector<bool> &wanted);
+
+    static Dbt *moved_record(const Dbt *data, Handle home);
+
+    static Handle get_forward(const Dbt *data);
+
+    static void put_forward(char *bytes, RecordKind kind, Handle handle);
+
+    virtual void forward(Handle home, Handle moved);
+
+    virtual Handle vacuum_place(const Dbt *data, BlockID last);
+
+    virtual std::vector<Handle> overflow_chains(const Dbt *data) const;
+
+    virtual void free_overflow(const Dbt *data);
+
+    virtual void free_chains(const std::vector<Handle> &chains, BlockID block_id);
+
+    virtual void free_chain(Handle first);
+
+    virtual void discard_overflow(const Dbt *data);
+
+    virtual ValueDict *unmarshal(Dbt *data, const ColumnNames *column_names = nullptr);
+
+    virtual std::vector<bool> wanted_columns(const ColumnNames *column_names) const;
+
+    virtual BlockZone *get_zone(BlockID block_id);
+
+    virtual void new_zone(BlockID block_id);
+
+    virtual void forget_zone(BlockID block_id);
+
+    static void widen_zone(BlockZone &zone, const ColumnNames &zone_columns, const ValueDict &row);
+
+    virtual IntRanges zone_bounds(const ValueDict *where, const IntRanges *ranges) const;
+
+    virtual bool skip_block(const BlockZone *zone, const IntRanges *ranges) const;
+
+    virtual void load_blooms();
+
+    virtual void build_bloom(BlockID block_id);
+
+    virtual void add_to_bloom(BlockID block_id, const ValueDict &row);
+
+    virtual void put_bloom(BlockID block_id, BlockBloom &bloom);
+
+    virtual void drop_bloom(BlockID block_id);
+
+    // for engines keeping the blocks elsewhere (see MemoryTable); the table takes over the file
+    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes, HeapFile *file);
+};
+
+/**
+ * @class HeapAppender - inserts rows into a heap table while other appenders do too, each on a thread of its own
+ *
+ *      Each appender fills an append page of its own: a block it claims from the table (a part-filled
+ *      one another appender gave back, or a new one off the end of the file) and copies into a
+ *      buffer nobody else touches, so adding a row to it takes no latch. HeapFile::latch is only
+ *      held while a page is claimed (the file's last block moves on under it) and while a page is
+ *      given back (put to the file, along with its zone and, once it is full, its Bloom filters),
+ *      so writers meet once per block rather than once per row. Rows with TEXT values stored out of
+ *      line are marshaled under the latch too, since the overflow file is shared.
+ *      The page is given back when it is full, and by finish(). While appenders are at work, every
+ *      other use of heap files has to hold the latch too; in particular, the table is theirs alone.
+ */
+class HeapAppender {
+public:
+    HeapAppender(HeapTable &table);
+
+    // finishes, if that wasn't done (losing any error: call finish() to get them)
+    virtual ~HeapAppender();
+
+    HeapAppender(const HeapAppender &other) = delete;
+
+    HeapAppender &operator=(const HeapAppender &other) = delete;
+
+    /**
+     * Insert a row into the append page, claiming another one if it is full.
+     * @param row  the row (all columns)
+     * @returns    the row's handle
+     */
+    virtual Handle insert(const ValueDict *row);
+
+    // give the append page back to the table; the next insert() claims one again
+    virtual void finish();
+
+protected:
+    HeapTable &table;
+    char *buffer;  // the append page's block
+    HeapPage *page;  // nullptr while there is none
+    bool zoned;  // whether the table knows the page's zone
+    HeapTable::BlockZone zone;  // the page's zone, given back with it
+    bool filtered;  // whether the page had Bloom filters when claimed
+
+    virtual void claim(bool new_block);
+
+    virtual void give_back(bool full);
 };
 
 bool test_heap_storage();
\ No newline at end of file
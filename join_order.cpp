@@ -0,0 +1,334 @@
+#include "join_order.h"
+#include <algorithm>
+
+using namespace std;
+
+// the input with a column
+static uint input_of(const Identifier &column_name, const vector<QueryOperator *> &inputs) {
+    for (uint i = 0; i < inputs.size(); i++) {
+        const ColumnNames &column_names = inputs[i]->get_column_names();
+        if (find(column_names.begin(), column_names.end(), column_name) != column_names.end())
+            return i;
+    }
+    throw DbRelationError("no input of the join has a column " + column_name);
+}
+
+static ColumnAttribute::DataType data_type(const Identifier &column_name, const QueryOperator *input) {
+    const ColumnNames &column_names = input->get_column_names();
+    return input->get_column_attributes()[find(column_names.begin(), column_names.end(), column_name)
+                                          - column_names.begin()].get_data_type();
+}
+
+JoinOrder::JoinOrder(const vector<QueryOperator *> &inputs, const vector<JoinPredicate> &predicates) :
+        inputs(inputs), predicates(predicates) {
+    if (inputs.empty())
+        throw DbRelationError("nothing to join");
+    if (inputs.size() > MAX_INPUTS)
+        throw DbRelationError("can't join more than " + std::to_string(MAX_INPUTS) + " inputs");
+    for (auto input: inputs)
+        this->input_rows.push_back(max(1.0, input->estimate_rows()));
+    for (auto const &predicate: predicates) {
+        uint left = input_of(predicate.left, inputs), right = input_of(predicate.right, inputs);
+        if (left == right)
+            throw DbRelationError("can't join " + predicate.left + " to " + predicate.right + ", of the same input");
+        if (data_type(predicate.left, inputs[left]) != data_type(predicate.right, inputs[right]))
+            throw DbRelationError("can't join " + predicate.left + " to " + predicate.right + ", of another type");
+        this->predicate_inputs.push_back(make_pair(left, right));
+        pair<uint, uint> ends = minmax(left, right);
+        if (find(this->joined_inputs.begin(), this->joined_inputs.end(), ends) == this->joined_inputs.end())
+            this->joined_inputs.push_back(ends);
+    }
+    for (uint i = 0; i < inputs.size(); i++)
+        this->costs[(InputSet) 1 << i] = 0;
+    if (inputs.size() <= MAX_EXHAUSTIVE)
+        order_exhaustively();
+    else
+        order_greedily();
+}
+
+QueryOperator *JoinOrder::plan() {
+    try {
+        return plan(all());
+    } catch (...) {
+        for (auto input: this->inputs)
+            delete input;  // those not in a join yet (the others went with it)
+        throw;
+    }
+}
+
+string JoinOrder::to_string() const {
+    return to_string(all());
+}
+
+// Rows expected from joining a set of inputs: all pairs, thinned out once for each two inputs joined
+// by predicates among them
+double JoinOrder::rows(InputSet set) const {
+    double result = 1;
+    for (uint i = 0; i < this->inputs.size(); i++)
+        if (set & ((InputSet) 1 << i))
+            result *= this->input_rows[i];
+    for (auto const &ends: this->joined_inputs)
+        if ((set & ((InputSet) 1 << ends.first)) && (set & ((InputSet) 1 << ends.second)))
+            result /= min(this->input_rows[ends.first], this->input_rows[ends.second]);
+    return max(1.0, result);
+}
+
+// Whether a predicate joins the two sets
+bool JoinOrder::connected(InputSet left, InputSet right) const {
+    for (auto const &ends: this->predicate_inputs) {
+        InputSet first = (InputSet) 1 << ends.first, second = (InputSet) 1 << ends.second;
+        if (((left & first) && (right & second)) || ((left & second) && (right & first)))
+            return true;
+    }
+    return false;
+}
+
+// Every set of inputs, smaller sets first (a subset is a smaller number), from its cheapest split
+void JoinOrder::order_exhaustively() {
+    for (InputSet set = 1; set <= all(); set++) {
+        if ((set & (set - 1)) == 0)
+            continue;  // a single input
+        InputSet lowest = set & ~(set - 1);
+        double set_rows = rows(set);
+        for (int cross = 0; cross < 2 && this->splits.count(set) == 0; cross++)
+            for (InputSet left = (set - 1) & set; left != 0; left = (left - 1) & set) {
+                InputSet right = set & ~left;
+                if (!(left & lowest) || (!cross && !connected(left, right)))
+                    continue;  // each split once, with a predicate if there is any
+                double cost = this->costs.at(left) + this->costs.at(right) + set_rows;
+                if (this->splits.count(set) == 0 || cost < this->costs[set]) {
+                    this->splits[set] = make_pair(left, right);
+                    this->costs[set] = cost;
+                }
+            }
+    }
+}
+
+// Join the two sets giving the fewest rows, until all inputs are in one
+void JoinOrder::order_greedily() {
+    vector<InputSet> sets;
+    for (uint i = 0; i < this->inputs.size(); i++)
+        sets.push_back((InputSet) 1 << i);
+    while (sets.size() > 1) {
+        size_t best_left = 0, best_right = 0;
+        double best_rows = 0;
+        for (int cross = 0; cross < 2 && best_left == best_right; cross++)
+            for (size_t left = 0; left < sets.size(); left++)
+                for (size_t right = left + 1; right < sets.size(); right++) {
+                    if (!cross && !connected(sets[left], sets[right]))
+                        continue;
+                    double set_rows = rows(sets[left] | sets[right]);
+                    if (best_left == best_right || set_rows < best_rows) {
+                        best_left = left;
+                        best_right = right;
+                        best_rows = set_rows;
+                    }
+                }
+        InputSet set = sets[best_left] | sets[best_right];
+        this->splits[set] = make_pair(sets[best_left], sets[best_right]);
+        this->costs[set] = this->costs.at(sets[best_left]) + this->costs.at(sets[best_right]) + best_rows;
+        sets[best_left] = set;
+        sets.erase(sets.begin() + best_right);
+    }
+}
+
+// The joins of a set, probing with the side expected to be bigger and hashing the other one
+QueryOperator *JoinOrder::plan(InputSet set) {
+    auto split = this->splits.find(set);
+    if (split == this->splits.end()) {
+        uint i = 0;
+        while (set != ((InputSet) 1 << i))
+            i++;
+        QueryOperator *input = this->inputs[i];
+        this->inputs[i] = nullptr;  // the join's now
+        return input;
+    }
+    InputSet probe = split->second.first, build = split->second.second;
+    if (rows(build) > rows(probe))
+        swap(probe, build);
+    ColumnNames probe_keys, build_keys;
+    for (uint i = 0; i < this->predicates.size(); i++) {
+        InputSet left = (InputSet) 1 << this->predicate_inputs[i].first;
+        InputSet right = (InputSet) 1 << this->predicate_inputs[i].second;
+        if ((probe & left) && (build & right)) {
+            probe_keys.push_back(this->predicates[i].left);
+            build_keys.push_back(this->predicates[i].right);
+        } else if ((probe & right) && (build & left)) {
+            probe_keys.push_back(this->predicates[i].right);
+            build_keys.push_back(this->predicates[i].left);
+        }
+    }
+    double selectivity = rows(set) / (rows(probe) * rows(build));
+    QueryOperator *probe_plan = plan(probe), *build_plan;
+    try {
+        build_plan = plan(build);
+    } catch (...) {
+        delete probe_plan;
+        throw;
+    }
+    return new HashJoin(probe_plan, build_plan, probe_keys, build_keys, selectivity);  // frees both if it throws
+}
+
+string JoinOrder::to_string(InputSet set) const {
+    auto split = this->splits.find(set);
+    if (split == this->splits.end()) {
+        uint i = 0;
+        while (set != ((InputSet) 1 << i))
+            i++;
+        return std::to_string(i);
+    }
+    InputSet probe = split->second.first, build = split->second.second;
+    if (rows(build) > rows(probe))
+        swap(probe, build);
+    return "(" + to_string(probe) + " " + to_string(build) + ")";
+}
+
+QueryOperator *order_joins(const vector<QueryOperator *> &inputs, const vector<JoinPredicate> &predicates) {
+    bool planning = false;
+    try {
+        JoinOrder order(inputs, predicates);
+        planning = true;
+        return order.plan();  // which frees the inputs if it fails
+    } catch (...) {
+        if (!planning)
+            for (auto input: inputs)
+                delete input;
+        throw;
+    }
+}
+
+/**
+ * @class Numbers - test input: rows <name>.id = 0, 1, ... and <name>.ref = id % refs
+ */
+class Numbers : public QueryOperator {
+public:
+    static int alive;  // how many there are
+
+    Numbers(const string &name, int count, int refs) : count(count), refs(refs), id(0) {
+        alive++;
+        this->column_names.push_back(name + ".id");
+        this->column_names.push_back(name + ".ref");
+        this->column_attributes.assign(2, ColumnAttribute(ColumnAttribute::INT));
+    }
+
+    virtual ~Numbers() { alive--; }
+
+    virtual void open() { id = 0; }
+
+    virtual bool next(ValueDict &row) {
+        row.clear();
+        if (id == count)
+            return false;
+        row[column_names[0]] = Value(id);
+        row[column_names[1]] = Value(id % refs);
+        id++;
+        return true;
+    }
+
+    virtual void close() {}
+
+    virtual string describe() const { return "Numbers"; }
+
+    virtual double estimate_rows() const { return count; }
+
+protected:
+    int count, refs, id;
+};
+
+int Numbers::alive = 0;
+
+// rows of a plan, each checked to join <table>.ref to <table + 1>.id along a chain of tables t0, t1, ...
+static int chain_rows(QueryOperator *plan, int tables) {
+    int rows = 0;
+    ValueDict row;
+    plan->open();
+    while (plan->next(row)) {
+        for (int i = 0; i + 1 < tables; i++)
+            if (row["t" + to_string(i) + ".ref"].n != row["t" + to_string(i + 1) + ".id"].n)
+                return -1;
+        rows++;
+    }
+    plan->close();
+    return rows;
+}
+
+/**
+ * Test JoinOrder: the cheapest order of a few inputs, a good enough one of many, and their joins
+ */
+bool test_join_order() {
+    // t0 (1000 rows) -> t1 (100) -> t2 (10): joining t1 with t2 first keeps the intermediate result small
+    vector<QueryOperator *> inputs;
+    inputs.push_back(new Numbers("t2", 10, 1));
+    inputs.push_back(new Numbers("t0", 1000, 100));
+    inputs.push_back(new Numbers("t1", 100, 10));
+    vector<JoinPredicate> predicates;
+    predicates.push_back(JoinPredicate("t0.ref", "t1.id"));
+    predicates.push_back(JoinPredicate("t2.id", "t1.ref"));
+    JoinOrder order(inputs, predicates);
+    if (order.to_string() != "(1 (2 0))" || order.cost() != 1100)
+        return false;
+    QueryOperator *plan = order.plan();
+    if (chain_rows(plan, 3) != 1000 || plan->estimate_rows() != 1000
+        || plan->describe() != "HashJoin on t0.ref = t1.id, hashing the second input")
+        return false;
+    delete plan;
+
+    // too many inputs to try every order: still no cross products, still the right rows
+    inputs.clear();
+    predicates.clear();
+    const int TABLES = (int) JoinOrder::MAX_EXHAUSTIVE + 2;
+    for (int i = 0; i < TABLES; i++) {
+        int count = 50 - 3 * i, next_count = 50 - 3 * (i + 1);
+        inputs.push_back(new Numbers("t" + to_string(i), count, next_count));
+        if (i > 0)
+            predicates.push_back(JoinPredicate("t" + to_string(i - 1) + ".ref", "t" + to_string(i) + ".id"));
+    }
+    plan = order_joins(inputs, predicates);
+    if (chain_rows(plan, TABLES) != 50)
+        return false;
+    delete plan;
+
+    // a composite key thins the rows out no more than one of its columns would
+    inputs.clear();
+    inputs.push_back(new Numbers("t0", 100, 10));
+    inputs.push_back(new Numbers("t1", 10, 10));
+    predicates.clear();
+    predicates.push_back(JoinPredicate("t0.ref", "t1.id"));
+    predicates.push_back(JoinPredicate("t0.ref", "t1.ref"));
+    plan = order_joins(inputs, predicates);
+    if (plan->estimate_rows() != 100 || chain_rows(plan, 2) != 100)
+        return false;
+    delete plan;
+
+    // nothing to join on: every row with every row
+    inputs.clear();
+    inputs.push_back(new Numbers("a", 3, 1));
+    inputs.push_back(new Numbers("b", 4, 1));
+    plan = order_joins(inputs, vector<JoinPredicate>());
+    if (chain_rows(plan, 0) != 12)
+        return false;
+    delete plan;
+
+    inputs.clear();
+    inputs.push_back(new Numbers("a", 3, 1));
+    inputs.push_back(new Numbers("b", 4, 1));
+    try {
+        order_joins(inputs, vector<JoinPredicate>(1, JoinPredicate("a.id", "c.id")));
+        return false;
+    } catch (DbRelationError &e) {
+        // no such column; the inputs are gone with the join
+    }
+
+    // a join that can't be made (two inputs with the same columns) takes those made before it along
+    inputs.clear();
+    inputs.push_back(new Numbers("a", 3, 1));
+    inputs.push_back(new Numbers("b", 4, 1));
+    inputs.push_back(new Numbers("a", 5, 1));
+    try {
+        order_joins(inputs, vector<JoinPredicate>(1, JoinPredicate("a.ref", "b.id")));
+        return false;
+    } catch (DbRelationError &e) {
+        // both inputs of a join have a column a.id
+    }
+    return Numbers::alive == 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file join_order.h - picks the order to join tables in, by how many rows each join is expected to make
+ *
+ * The inputs of a join are plan operators (a scan and filter of each table) and the predicates
+ * are equalities between a column of one input and a column of another. Each input is expected to
+ * produce estimate_rows() rows; an equality between two columns is expected to keep one pair of
+ * rows in as many as the smaller of their inputs has rows (as a foreign key to a key would: each
+ * row of the bigger input finds its one row of the smaller); several equalities between the same
+ * two inputs (a composite key) keep as many as one would. An order costs the rows of all the
+ * joins it makes, the last one included (all orders make the same last one, so that only breaks ties).
+ * Pages read are left out of the cost: every input is scanned once, and joins are hashed in
+ * memory rather than read back from disk, so the pages come to the same in every order.
+ * Up to MAX_EXHAUSTIVE inputs, the cheapest order of all is found by dynamic programming over the
+ * sets of inputs: the cheapest way to join a set is the cheapest split of it into two sets already
+ * joined. Beyond that, the two joined sets giving the fewest rows are joined until one is left.
+ * Either way, sets are only joined without a predicate between them (a cross product) when there
+ * is no other way. Each join hashes the side expected to be smaller.
+ */
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "query_operators.h"
+
+/**
+ * @class JoinPredicate - <column> = <column>, the columns of two different inputs
+ */
+class JoinPredicate {
+public:
+    JoinPredicate(Identifier left, Identifier right) : left(left), right(right) {}
+
+    virtual ~JoinPredicate() {}
+
+    Identifier left;
+    Identifier right;
+};
+
+/**
+ * @class JoinOrder - the cheapest tree of HashJoins over some inputs it can find
+ */
+class JoinOrder {
+public:
+    static const size_t MAX_EXHAUSTIVE = 10;  // inputs to try every order of
+    static const size_t MAX_INPUTS = 64;
+
+    /**
+     * Pick the order.
+     * @param inputs      operators to join (still the caller's until plan())
+     * @param predicates  equalities between their columns
+     */
+    JoinOrder(const std::vector<QueryOperator *> &inputs, const std::vector<JoinPredicate> &predicates);
+
+    virtual ~JoinOrder() {}
+
+    JoinOrder(const JoinOrder &other) = delete;
+
+    JoinOrder &operator=(const JoinOrder &other) = delete;
+
+    // the tree of joins, which owns the inputs from now on (to be called once; the inputs and the
+    // joins built so far are freed if one of the joins can't be made)
+    virtual QueryOperator *plan();
+
+    // rows of all the joins of the order picked
+    virtual double cost() const { return costs.at(all()); }
+
+    // the order picked, e.g. "((0 2) 1)" for the first input joined with the third, then with the
+    // second; the second of each pair is the one hashed
+    virtual std::string to_string() const;
+
+protected:
+    typedef u_int64_t InputSet;  // bit i for inputs[i]
+
+    std::vector<QueryOperator *> inputs;
+    std::vector<double> input_rows;
+    std::vector<JoinPredicate> predicates;
+    std::vector<std::pair<uint, uint> > predicate_inputs;  // of the left and right columns
+    std::vector<std::pair<uint, uint> > joined_inputs;  // each pair of inputs some predicate joins, once
+    std::map<InputSet, std::pair<InputSet, InputSet> > splits;  // how each set joined is made
+    std::map<InputSet, double> costs;  // of making each set joined
+
+    virtual InputSet all() const { return inputs.size() == MAX_INPUTS ? ~(InputSet) 0 : ((InputSet) 1 << inputs.size()) - 1; }
+
+    virtual double rows(InputSet set) const;
+
+    virtual bool connected(InputSet left, InputSet right) const;
+
+    virtual void order_exhaustively();
+
+    virtual void order_greedily();
+
+    virtual QueryOperator *plan(InputSet set);
+
+    virtual std::string to_string(InputSet set) const;
+};
+
+/**
+ * The join of some inputs, in the cheapest order found.
+ * @param inputs      operators to join (the join owns them; they are freed if it can't be made)
+ * @param predicates  equalities between their columns
+ * @returns           the join (freed by caller)
+ */
+QueryOperator *order_joins(const std::vector<QueryOperator *> &inputs, const std::vector<JoinPredicate> &predicates);
+
+bool test_join_order();
@@ -0,0 +1,254 @@
+#include "memory_storage.h"
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+/*
+            ------------------
+~~~~~~~~~~~~|   MEMORYFILE   |~~~~~~~~~~~~
+            ------------------
+*/
+
+/**
+    Constructor
+    @param budget  bytes of blocks to keep in memory before spilling to a Berkeley DB file
+*/
+MemoryFile::MemoryFile(string name, uint block_size, size_t budget) :
+        HeapFile(name, block_size), budget(budget), created(false), spilled(false) {
+}
+
+MemoryFile::~MemoryFile() {
+    free_blocks();
+}
+
+// Start out with one empty block, as HeapFile::create does.
+void MemoryFile::create(void) {
+    if (this->created)
+        throw DbRelationError(this->name + " already exists");
+    if (this->block_size < DbBlock::MIN_BLOCK_SZ || this->block_size > DbBlock::MAX_BLOCK_SZ)
+        throw DbRelationError("block size must be from " + to_string(DbBlock::MIN_BLOCK_SZ) + " to "
+                              + to_string(DbBlock::MAX_BLOCK_SZ) + " bytes");
+    this->created = true;
+    this->last = 0;
+    delete this->get_new();
+}
+
+// Throw the blocks away (and the file, if they were spilled).
+void MemoryFile::drop(void) {
+    if (this->spilled)
+        HeapFile::drop();
+    free_blocks();
+    this->created = false;
+    this->spilled = false;
+    this->last = 0;
+}
+
+// Nothing to open unless spilled; like a HeapFile, fail with a DbException if there is no such file.
+void MemoryFile::open(void) {
+    if (this->spilled)
+        HeapFile::open();
+    else if (!this->created)
+        throw DbException((this->name + " does not exist").c_str(), ENOENT);
+}
+
+// The blocks stay unless they have been spilled (the file has them all).
+void MemoryFile::close(void) {
+    if (!this->spilled)
+        return;
+    HeapFile::close();
+    free_blocks();
+}
+
+// A new empty block, spilling first if it wouldn't fit into the budget.
+HeapPage *MemoryFile::get_new(void) {
+    if (!this->spilled && (this->last + 1) * (size_t) this->block_size > this->budget)
+        spill();
+    if (this->spilled)
+        return HeapFile::get_new();
+    char *block = new char[this->block_size];
+    memset(block, 0, this->block_size);
+    this->blocks.push_back(block);
+    Dbt data(block, this->block_size);
+    return this->make_page(data, ++this->last, true);
+}
+
+// The block itself, not a copy: changes to the page are changes to the block.
+HeapPage *MemoryFile::get(BlockID block_id) {
+    if (this->spilled)
+        return HeapFile::get(block_id);
+    page_hits.fetch_add(1, std::memory_order_relaxed);
+    Dbt data(this->blocks[block_id - 1], this->block_size);
+    return this->make_page(data, block_id);
+}
+
+// Only pages not from get() or get_new() (e.g. built with make_page) need their bytes copied.
+void MemoryFile::put(DbBlock *block) {
+    if (this->spilled) {
+        HeapFile::put(block);
+        return;
+    }
+    char *bytes = this->blocks[block->get_block_id() - 1];
+    if (block->get_data() != bytes)
+        memcpy(bytes, block->get_data(), this->block_size);
+}
+
+void MemoryFile::truncate(BlockID last) {
+    if (this->spilled) {
+        HeapFile::truncate(last);
+        return;
+    }
+    while (this->blocks.size() > last) {
+        delete[] this->blocks.back();
+        this->blocks.pop_back();
+    }
+    this->last = last;
+}
+
+// Write the blocks to a new Berkeley DB file, which has them from now on.
+void MemoryFile::spill() {
+    BlockID last = this->last;
+    this->db_open(DB_CREATE | DB_EXCL);
+    for (BlockID block_id = 1; block_id <= last; block_id++) {
+        Dbt key(&block_id, sizeof(block_id));
+        Dbt data(this->blocks[block_id - 1], this->block_size);
+        this->handle().put(nullptr, &key, &data, 0);
+    }
+    this->last = last;
+    this->spilled = true;
+}
+
+void MemoryFile::free_blocks() {
+    for (auto block: this->blocks)
+        delete[] block;
+    this->blocks.clear();
+}
+
+/*
+            ------------------
+~~~~~~~~~~~~|   MEMORYTABLE  |~~~~~~~~~~~~
+            ------------------
+*/
+
+/**
+    Constructor
+    @param budget      bytes of blocks to keep in memory before spilling to a Berkeley DB file
+    @param block_size  size of the blocks (see DbBlock::MIN_BLOCK_SZ, MAX_BLOCK_SZ)
+*/
+MemoryTable::MemoryTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                         size_t budget, uint block_size) :
+        HeapTable(table_name, column_names, column_attributes, new MemoryFile(table_name, block_size, budget)),
+        budget(budget) {
+}
+
+bool MemoryTable::is_spilled() const {
+    return static_cast<const MemoryFile &>(this->file).is_spilled();
+}
+
+void MemoryTable::create_bloom_filter(const ColumnNames &column_names) {
+    throw DbRelationError("memory tables have no Bloom filters");
+}
+
+/**
+    The overflow file, kept in memory like the table.
+    @param create  create the file if it doesn't exist yet
+    @return        the overflow file, or nullptr if there is none and create is false
+*/
+HeapFile *MemoryTable::get_overflow(bool create) {
+    if (this->overflow == nullptr && create) {
+        this->overflow = new MemoryFile(this->table_name + ".overflow", this->file.get_block_size(), this->budget);
+        this->overflow->create();
+    }
+    return this->overflow;
+}
+
+/**
+    Test MemoryTable: the same results as a HeapTable, no Berkeley DB file until the budget is used up
+*/
+bool test_memory_storage() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+
+    StorageStats::reset();
+    MemoryTable table("_test_memory_cpp", column_names, column_attributes, 4 * DbBlock::BLOCK_SZ);
+    table.create_if_not_exists();
+    ValueDict row;
+    for (int i = 0; i < 100; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(string(10, 'a' + i % 26));
+        table.insert(&row);
+    }
+    row["a"] = Value(100);
+    row["b"] = Value(string(10000, 'x'));  // out of line, in the memory overflow file
+    Handle big = table.insert(&row);
+    if (table.is_spilled())
+        return false;
+    HeapFile file("_test_memory_cpp");
+    try {
+        file.open();
+        return false;
+    } catch (DbException &e) {
+        // no Berkeley DB file while the blocks fit into the budget
+    }
+    if (StorageStats::enabled() && StorageStats::calls("_test_memory_cpp", STATS_HEAPFILE_PUT) != 0)
+        return false;
+
+    ValueDict where;
+    where["b"] = Value(string(10000, 'x'));
+    Handles *handles = table.select(&where);
+    if (handles->size() != 1 || handles->at(0) != big)
+        return false;
+    delete handles;
+    ValueDict change;
+    change["b"] = Value(string(300, 'y'));
+    table.update(Handle(1, 1), &change);
+    ValueDict *result = table.project(Handle(1, 1));
+    if ((*result)["a"].n != 0 || (*result)["b"].s != string(300, 'y'))
+        return false;
+    delete result;
+
+    // past the budget, the blocks go to a file and the table carries on as before
+    for (int i = 101; i < 1000; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(string(10, 'a' + i % 26));
+        table.insert(&row);
+    }
+    if (!table.is_spilled())
+        return false;
+    where.clear();
+    where["b"] = Value(string(10, 'c'));
+    handles = table.select(&where);
+    if (handles->size() != 39)
+        return false;
+    table.del(handles);
+    delete handles;
+    table.vacuum();
+    handles = table.select();
+    if (handles->size() != 1000 - 39)
+        return false;
+    delete handles;
+    table.close();
+    table.open();
+    where.clear();
+    where["a"] = Value(100);
+    handles = table.select(&where);
+    if (handles->size() != 1)
+        return false;
+    result = table.project(handles->at(0));
+    if ((*result)["b"].s != string(10000, 'x'))
+        return false;
+    delete result;
+    delete handles;
+    table.drop();
+    try {
+        file.open();
+        return false;
+    } catch (DbException &e) {
+        // dropped along with the table
+    }
+    return true;
+}
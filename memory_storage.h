@@ -0,0 +1,105 @@
+/**
+ * @file memory_storage.h - memory storage engine: heap tables whose blocks stay in RAM
+ *
+ * MemoryTable is a HeapTable for temporary tables and intermediate results. It stores the same
+ * slotted pages, records and overflow chains as a HeapTable (and so inserts, selects, projects,
+ * updates, deletes and vacuums the same way), but keeps the blocks in memory, in a MemoryFile,
+ * so rows that never need to reach disk don't pay for opening a Berkeley DB file and writing
+ * every block to it. Pages handed out by a MemoryFile are the blocks themselves; putting a block
+ * back costs nothing.
+ * A MemoryFile grows until its blocks would take more than its budget; it then spills: writes the
+ * blocks it has so far to a Berkeley DB file of the same name (<table>.db) and from then on works
+ * just like a HeapFile. Nothing of a memory table survives the object, spilled or not.
+ */
+#pragma once
+
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class MemoryFile - heap file kept in memory until it gets too big
+ */
+class MemoryFile : public HeapFile {
+public:
+    static const size_t DEFAULT_BUDGET = 16 * 1024 * 1024;
+
+    MemoryFile(std::string name, uint block_size = DbBlock::BLOCK_SZ, size_t budget = DEFAULT_BUDGET);
+
+    virtual ~MemoryFile();
+
+    MemoryFile(const MemoryFile &other) = delete;
+
+    MemoryFile(MemoryFile &&temp) = delete;
+
+    MemoryFile &operator=(const MemoryFile &other) = delete;
+
+    MemoryFile &operator=(MemoryFile &&temp) = delete;
+
+    virtual void create(void);
+
+    virtual void drop(void);
+
+    virtual void open(void);
+
+    virtual void close(void);
+
+    virtual HeapPage *get_new(void);
+
+    virtual HeapPage *get(BlockID block_id);
+
+    virtual void put(DbBlock *block);
+
+    virtual void truncate(BlockID last);
+
+    // whether the blocks have gone to a Berkeley DB file
+    virtual bool is_spilled() const { return spilled; }
+
+protected:
+    std::vector<char *> blocks;  // block n is blocks[n - 1]; kept after a spill until close() (pages may still use them)
+    size_t budget;
+    bool created;
+    bool spilled;
+
+    virtual void spill();
+
+    virtual void free_blocks();
+};
+
+/**
+ * @class MemoryTable - memory storage engine (implementation of DbRelation, by way of HeapTable)
+ *
+ *      Its overflow file (for long TEXT values) is a MemoryFile too, with a budget of its own. It
+ *      has no Bloom filters.
+ */
+class MemoryTable : public HeapTable {
+public:
+    MemoryTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                size_t budget = MemoryFile::DEFAULT_BUDGET, uint block_size = DbBlock::BLOCK_SZ);
+
+    virtual ~MemoryTable() {}
+
+    MemoryTable(const MemoryTable &other) = delete;
+
+    MemoryTable(MemoryTable &&temp) = delete;
+
+    MemoryTable &operator=(const MemoryTable &other) = delete;
+
+    MemoryTable &operator=(MemoryTable &&temp) = delete;
+
+    // whether the table's blocks have gone to a Berkeley DB file
+    virtual bool is_spilled() const;
+
+    // no Bloom filters: they would live in a Berkeley DB file
+    virtual void create_bloom_filter(const ColumnNames &column_names);
+
+protected:
+    size_t budget;
+
+    using HeapTable::get_overflow;
+
+    virtual HeapFile *get_overflow(bool create);
+
+    virtual void load_blooms() { this->blooms_loaded = true; }
+};
+
+bool test_memory_storage();
@@ -0,0 +1,298 @@
+#include "morsel.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <map>
+#include <thread>
+#include "heap_storage.h"
+
+using namespace std;
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|     MORSEL SCHEDULER     |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+uint MorselScheduler::max_workers = max(1u, thread::hardware_concurrency());
+
+MorselScheduler::MorselScheduler(uint workers) : workers(max(1u, workers)), deques(this->workers),
+                                                 latches(this->workers), failed(false), steals(0) {
+}
+
+void MorselScheduler::run(BlockID last, const function<void(const Morsel &, uint)> &task) {
+    u_int64_t morsels = (last + MORSEL_BLOCKS - 1) / MORSEL_BLOCKS;
+    for (uint worker = 0; worker < workers; worker++) {
+        deques[worker].clear();
+        u_int64_t from = morsels * worker / workers, to = morsels * (worker + 1) / workers;
+        for (u_int64_t morsel = from; morsel < to; morsel++) {
+            BlockID first = (BlockID) (morsel * MORSEL_BLOCKS + 1);
+            deques[worker].push_back(Morsel(first, min(last, first + MORSEL_BLOCKS - 1)));
+        }
+    }
+    failed = false;
+    steals = 0;
+    vector<exception_ptr> failures(workers);
+    vector<thread> threads;
+    for (uint worker = 1; worker < workers; worker++)
+        threads.push_back(thread(&MorselScheduler::work, this, worker, cref(task), ref(failures[worker])));
+    work(0, task, failures[0]);
+    for (auto &thread: threads)
+        thread.join();
+    for (auto const &failure: failures)
+        if (failure)
+            rethrow_exception(failure);
+}
+
+// The next morsel for a worker: the front of its own deque, else the back of another's
+bool MorselScheduler::take(uint worker, Morsel &morsel) {
+    for (uint i = 0; i < workers; i++) {
+        uint victim = (worker + i) % workers;
+        lock_guard<mutex> lock(latches[victim]);
+        deque<Morsel> &morsels = deques[victim];
+        if (morsels.empty())
+            continue;
+        if (victim == worker) {
+            morsel = morsels.front();
+            morsels.pop_front();
+        } else {
+            morsel = morsels.back();
+            morsels.pop_back();
+            steals++;
+        }
+        return true;
+    }
+    return false;
+}
+
+// A worker's loop: morsels until there are none left, or a task failed
+void MorselScheduler::work(uint worker, const function<void(const Morsel &, uint)> &task, exception_ptr &failure) {
+    try {
+        Morsel morsel(0, 0);
+        while (!failed && take(worker, morsel))
+            task(morsel, worker);
+    } catch (...) {
+        failure = current_exception();
+        failed = true;
+    }
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|    PARALLEL AGGREGATE    |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+/**
+    @param workers  most threads to aggregate on (at least 2 to aggregate on morsels)
+    see HashAggregate for the others
+*/
+ParallelAggregate::ParallelAggregate(QueryOperator *child, const ColumnNames &group_by,
+                                     const vector<AggregateSpec> &aggregates, const ColumnNames &input_names,
+                                     const ColumnAttributes &input_attributes, uint workers, size_t memory_budget) :
+        HashAggregate(child, group_by, aggregates, input_names, input_attributes, memory_budget), workers(workers),
+        steals(0) {
+}
+
+/**
+    Aggregate all of the input, on morsels if it is worth it
+*/
+void ParallelAggregate::open() {
+    steals = 0;
+    if (!parallel(child, workers)) {
+        HashAggregate::open();
+        return;
+    }
+    vector<QueryOperator *> stages;
+    TableScan *scan = pipeline(child, stages);
+    HeapTable *table = scan->heap_table();
+    table->open();
+    vector<HashAggregate *> partials;
+    size_t opened = 0;
+    try {
+        for (; opened < stages.size(); opened++)
+            stages[opened]->open_stream();
+        MorselScheduler scheduler(workers);
+        for (uint worker = 0; worker < scheduler.get_workers(); worker++)
+            partials.push_back(new HashAggregate(nullptr, group_by, aggregates, input_names, input_attributes,
+                                                 memory_budget / scheduler.get_workers()));
+        scheduler.run(table->get_last_block_id(), [&](const Morsel &morsel, uint worker) {
+            vector<ValueDict> rows, next_rows;
+            scan->scan_blocks(morsel.first, morsel.last, rows);
+            for (auto stage: stages) {
+                next_rows.clear();
+                for (auto const &row: rows)
+                    stage->stream(row, next_rows);
+                rows.swap(next_rows);
+            }
+            for (auto const &row: rows)
+                partials[worker]->consume(row);
+        });
+        steals = scheduler.get_steals();
+        for (auto partial: partials)
+            merge(*partial);
+    } catch (...) {
+        for (auto partial: partials)
+            delete partial;
+        while (opened > 0)
+            stages[--opened]->close_stream();
+        throw;
+    }
+    for (auto partial: partials)
+        delete partial;
+    for (auto stage: stages)
+        stage->close_stream();
+    finish_input();
+}
+
+string ParallelAggregate::describe() const {
+    string result = "Parallel" + HashAggregate::describe();
+    if (parallel(child, workers))
+        result += " on " + to_string(workers) + " workers, morsels of " + to_string(MorselScheduler::MORSEL_BLOCKS)
+                  + " blocks";
+    return result;
+}
+
+bool ParallelAggregate::parallel(const QueryOperator *input, uint workers) {
+    vector<QueryOperator *> stages;
+    TableScan *scan = pipeline(input, stages);
+    return workers > 1 && scan != nullptr && scan->heap_table() != nullptr
+           && scan->heap_table()->get_last_block_id() >= MIN_BLOCKS;
+}
+
+/**
+    Follow an input down to its scan through operators that stream (instrumented or not).
+    @param input   the input
+    @param stages  gets the operators above the scan, the one next to it first
+    @returns       the scan, or nullptr if some operator doesn't stream
+*/
+TableScan *ParallelAggregate::pipeline(const QueryOperator *input, vector<QueryOperator *> &stages) {
+    stages.clear();
+    QueryOperator *op = const_cast<QueryOperator *>(input);
+    while (op != nullptr) {
+        while (dynamic_cast<Instrument *>(op) != nullptr)
+            op = dynamic_cast<Instrument *>(op)->get_wrapped();
+        TableScan *scan = dynamic_cast<TableScan *>(op);
+        if (scan != nullptr) {
+            reverse(stages.begin(), stages.end());
+            return scan;
+        }
+        if (!op->streams())
+            return nullptr;
+        stages.push_back(op);
+        op = op->get_child();
+    }
+    return nullptr;
+}
+
+/**
+ * Test MorselScheduler and ParallelAggregate: every morsel once, stolen when a worker is slow, and
+ * the same groups as aggregating the ordinary way
+ */
+bool test_morsel() {
+    // a slow first share: the other workers take it over
+    const BlockID BLOCKS = 1000;
+    const uint WORKERS = 4;
+    vector<atomic<int>> seen(BLOCKS + 1);
+    for (auto &count: seen)
+        count = 0;
+    MorselScheduler scheduler(WORKERS);
+    scheduler.run(BLOCKS, [&](const Morsel &morsel, uint worker) {
+        if (morsel.first <= BLOCKS / WORKERS)
+            this_thread::sleep_for(chrono::milliseconds(2));
+        for (BlockID block_id = morsel.first; block_id <= morsel.last; block_id++)
+            seen[block_id]++;
+    });
+    if (seen[0] != 0 || scheduler.get_steals() == 0)
+        return false;
+    for (BlockID block_id = 1; block_id <= BLOCKS; block_id++)
+        if (seen[block_id] != 1)
+            return false;
+    try {
+        scheduler.run(BLOCKS, [](const Morsel &morsel, uint worker) {
+            if (morsel.first > BLOCKS / 2)
+                throw DbRelationError("morsel failed");
+        });
+        return false;
+    } catch (DbRelationError &e) {
+        // the first failure comes out of run()
+    }
+
+    // a table of a few hundred blocks, joined to a small one and grouped, on morsels and not
+    ColumnNames column_names = {"id", "g", "note"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable facts("_test_morsel_facts", column_names, column_attributes);
+    facts.create();
+    vector<ValueDict *> rows;
+    for (int i = 0; i < 20000; i++) {
+        ValueDict *row = new ValueDict();
+        (*row)["id"] = Value(i);
+        (*row)["g"] = Value(i % 7);
+        (*row)["note"] = Value("note " + to_string(i) + string(i == 777 ? 5000 : 20, '.'));  // one out of line
+        rows.push_back(row);
+    }
+    facts.insert(&rows);
+    for (auto row: rows)
+        delete row;
+    ColumnNames dimension_names = {"g", "name"};
+    ColumnAttributes dimension_attributes = {ColumnAttribute(ColumnAttribute::INT),
+                                             ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable dimension("_test_morsel_dimension", dimension_names, dimension_attributes);
+    dimension.create();
+    for (int g = 0; g < 5; g++) {
+        ValueDict row;
+        row["g"] = Value(g);
+        row["name"] = Value("group " + to_string(g % 3));
+        dimension.insert(&row);
+    }
+
+    bool ok = true;
+    for (int instrumented = 0; instrumented < 2 && ok; instrumented++) {
+        map<string, pair<int, int>> results[2];  // name -> (count, sum of id), the ordinary way and on morsels
+        for (int run = 0; run < 2; run++) {
+            ColumnNames scan_names = {"id", "g"};
+            QueryOperator *probe = new Filter(new TableScan(facts, nullptr, &scan_names),
+                                              vector<Comparison>(1, Comparison("id", Comparison::GE, Value(100))));
+            probe = new Projection(probe, scan_names, {"f.id", "f.g"});
+            QueryOperator *build = new Projection(new TableScan(dimension), dimension_names, {"d.g", "d.name"});
+            QueryOperator *join = new HashJoin(probe, build, {"f.g"}, {"d.g"});
+            if (instrumented)
+                join = instrument(join);
+            vector<AggregateSpec> aggregates = {AggregateSpec(AggregateSpec::COUNT, "", "n"),
+                                                AggregateSpec(AggregateSpec::SUM, "f.id", "total")};
+            HashAggregate *aggregate;
+            if (run == 0)
+                aggregate = new HashAggregate(join, {"d.name"}, aggregates, join->get_column_names(),
+                                              join->get_column_attributes());
+            else
+                aggregate = new ParallelAggregate(join, {"d.name"}, aggregates, join->get_column_names(),
+                                                  join->get_column_attributes(), WORKERS);
+            if (run == 1 && !ParallelAggregate::parallel(join, WORKERS))
+                ok = false;
+            aggregate->open();
+            ValueDict row;
+            while (aggregate->next(row))
+                results[run][row["d.name"].s] = make_pair(row["n"].n, row["total"].n);
+            aggregate->close();
+            delete aggregate;
+        }
+        ok = ok && results[0].size() == 3 && results[0] == results[1];
+    }
+
+    // the out-of-line note comes out of a morsel too
+    ColumnNames note_names = {"id", "note"};
+    TableScan scan(facts, nullptr, &note_names);
+    scan.open();
+    vector<ValueDict> notes;
+    for (BlockID block_id = 1; block_id <= facts.get_last_block_id(); block_id += MorselScheduler::MORSEL_BLOCKS)
+        scan.scan_blocks(block_id, block_id + MorselScheduler::MORSEL_BLOCKS - 1, notes);
+    ok = ok && notes.size() == 20000;
+    for (auto const &note: notes)
+        if (note.at("id").n == 777)
+            ok = ok && note.at("note").s.size() == string("note 777").size() + 5000;
+    scan.close();
+    facts.drop();
+    dimension.drop();
+    return ok;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file morsel.h - morsel-driven parallel execution: a heap table scanned a few blocks at a time on
+ * worker threads, each running the whole pipeline above the scan on its morsels
+ *
+ * A MorselScheduler splits blocks 1 through n into morsels of MORSEL_BLOCKS blocks and deals them
+ * out to its workers, a contiguous share each, in a deque per worker. A worker takes its morsels
+ * from the front of its own deque; once that is empty it steals from the back of the others', so a
+ * worker stuck on slow morsels (big rows, rows that match everything) has its share taken over
+ * rather than holding up the query while the others sit idle.
+ * A ParallelAggregate is a HashAggregate whose input runs on morsels: each worker scans its morsel
+ * (TableScan::scan_blocks), streams the rows through the operators above the scan (filters,
+ * projections, the probes of hash joins, see QueryOperator::stream) and aggregates them into a
+ * partial aggregate of its own; the partials are merged once all morsels are done.
+ */
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "query_operators.h"
+
+/**
+ * @class Morsel - blocks first through last of a heap table
+ */
+class Morsel {
+public:
+    Morsel(BlockID first, BlockID last) : first(first), last(last) {}
+
+    virtual ~Morsel() {}
+
+    BlockID first;
+    BlockID last;
+};
+
+/**
+ * @class MorselScheduler - runs a task on every morsel of a table, on worker threads that steal work
+ */
+class MorselScheduler {
+public:
+    static const uint MORSEL_BLOCKS = 4;
+    static uint max_workers;  // the most workers a query gets (by default, one per core)
+
+    /**
+     * @param workers  threads to run the tasks on (the calling thread being one of them)
+     */
+    MorselScheduler(uint workers);
+
+    virtual ~MorselScheduler() {}
+
+    MorselScheduler(const MorselScheduler &other) = delete;
+
+    MorselScheduler &operator=(const MorselScheduler &other) = delete;
+
+    /**
+     * Run a task on every morsel of blocks 1 through last, and wait for them all.
+     * @param last  the last block
+     * @param task  called with a morsel and the worker running it (0 to workers - 1)
+     * @throws      what the first task to fail threw (the workers take no more morsels after it)
+     */
+    virtual void run(BlockID last, const std::function<void(const Morsel &, uint)> &task);
+
+    virtual uint get_workers() const { return workers; }
+
+    // morsels taken from another worker's deque, during the last run()
+    virtual u_int64_t get_steals() const { return steals; }
+
+protected:
+    uint workers;
+    std::vector<std::deque<Morsel>> deques;  // a worker's morsels
+    std::vector<std::mutex> latches;  // one per deque
+    std::atomic<bool> failed;
+    std::atomic<u_int64_t> steals;
+
+    virtual bool take(uint worker, Morsel &morsel);
+
+    virtual void work(uint worker, const std::function<void(const Morsel &, uint)> &task,
+                      std::exception_ptr &failure);
+};
+
+/**
+ * @class ParallelAggregate - HashAggregate with its input run on morsels by a MorselScheduler
+ *
+ *      Works on an input made of operators that stream (see QueryOperator::stream) down to a
+ *      TableScan of a heap table of at least MIN_BLOCKS blocks, the probe inputs of hash joins being
+ *      followed down (their build inputs are hashed before the morsels start, the ordinary way).
+ *      Any other input is aggregated the ordinary way too. Each worker's partial gets an equal share
+ *      of the memory budget.
+ */
+class ParallelAggregate : public HashAggregate {
+public:
+    static const BlockID MIN_BLOCKS = 4 * MorselScheduler::MORSEL_BLOCKS;
+
+    ParallelAggregate(QueryOperator *child, const ColumnNames &group_by, const std::vector<AggregateSpec> &aggregates,
+                      const ColumnNames &input_names, const ColumnAttributes &input_attributes,
+                      uint workers = MorselScheduler::max_workers, size_t memory_budget = DEFAULT_MEMORY_BUDGET);
+
+    virtual ~ParallelAggregate() {}
+
+    virtual void open();
+
+    virtual std::string describe() const;
+
+    /**
+     * Whether aggregating an input with more than one worker is worth it, i.e. the input streams
+     * down to a big enough heap table.
+     * @param input    the input
+     * @param workers  the workers there would be
+     */
+    static bool parallel(const QueryOperator *input, uint workers = MorselScheduler::max_workers);
+
+    // morsels stolen by a worker from another while the input was aggregated (0 if it was done the ordinary way)
+    virtual u_int64_t get_steals() const { return steals; }
+
+protected:
+    uint workers;
+    u_int64_t steals;
+
+    static TableScan *pipeline(const QueryOperator *input, std::vector<QueryOperator *> &stages);
+};
+
+bool test_morsel();
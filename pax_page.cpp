@@ -0,0 +1,406 @@
+#include "pax_page.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+typedef u_int16_t u16;
+typedef u_int32_t u32;
+
+// minipages before the columns: record kind, link
+static const uint KIND_MINIPAGE = 0;
+static const uint LINK_MINIPAGE = 1;
+static const uint FIRST_COLUMN_MINIPAGE = 2;
+static const u32 LINK_SIZE = FORWARD_SIZE - 1;
+static const u32 TEXT_ENTRY_SIZE = 2 * sizeof(u32);  // offset and size in the variable area
+static const u32 MIN_CAPACITY = 8;
+
+// Constructor
+PaxPage::PaxPage(Dbt &block, BlockID block_id, bool is_new, const ColumnAttributes *column_attributes) :
+        HeapPage(block, block_id, is_new) {
+    if (is_new) {
+        for (auto const &column_attribute: *column_attributes)
+            this->data_types.push_back(column_attribute.get_data_type());
+        this->num_records = 0;
+        this->capacity = 0;
+        this->var_start = this->get_block_size();
+        this->layout();
+        *(u32 *) this->address(0) = MAGIC;
+        *(u16 *) this->address(4 * sizeof(u32)) = (u16) this->data_types.size();
+        for (uint i = 0; i < this->data_types.size(); i++)
+            *(u_int8_t *) this->address(4 * sizeof(u32) + sizeof(u16) + i) = (u_int8_t) this->data_types[i];
+        put_header();
+    } else {
+        for (auto const &column_attribute: get_column_attributes(block))
+            this->data_types.push_back(column_attribute.get_data_type());
+        this->num_records = *(u32 *) this->address(sizeof(u32));
+        this->capacity = *(u32 *) this->address(2 * sizeof(u32));
+        this->var_start = *(u32 *) this->address(3 * sizeof(u32));
+        this->layout();
+    }
+}
+
+PaxPage::~PaxPage() {
+    for (auto bytes: this->assembled)
+        arena_free(bytes);
+}
+
+// Add a new record to the block. Return its id.
+RecordID PaxPage::add(const Dbt *data) {
+    STATS_TIMER(STATS_SLOTTEDPAGE_ADD);
+    Fields fields;
+    split(data, fields);
+    if (this->num_records >= UINT16_MAX || !reserve(this->num_records + 1, fields.text_size, 0))
+        throw DbBlockNoRoomError(" Not enough room for new record");
+    RecordID id = (RecordID) ++this->num_records;
+    put_fields(id, fields);
+    put_header();
+    return id;
+}
+
+// Get a record from the block, put back together from its minipages. Return None if it has been deleted.
+Dbt *PaxPage::get(RecordID record_id) {
+    return assemble(record_id, nullptr);
+}
+
+// Get a record with only the given columns filled in, reading just their minipages.
+Dbt *PaxPage::get_columns(RecordID record_id, const vector<bool> &columns) {
+    return assemble(record_id, &columns);
+}
+
+// Replace the record with the given data. The page is left as it was if there isn't room.
+void PaxPage::put(RecordID record_id, const Dbt &data) {
+    Fields fields;
+    split(&data, fields);
+    if (!reserve(this->num_records, fields.text_size, record_id))
+        throw DbBlockNoRoomError(" Not enough room for enlarged record");
+    put_fields(record_id, fields);
+    put_header();
+}
+
+// Mark the given record_id as deleted. Its TEXT bytes are reclaimed by the next compaction.
+void PaxPage::del(RecordID record_id) {
+    if (record_id == 0 || record_id > this->num_records)
+        return;
+    *(u_int8_t *) slot(KIND_MINIPAGE, record_id) = SLOT_FREE;
+}
+
+// Sequence of all non-deleted record ids.
+RecordIDs *PaxPage::ids(void) {
+    RecordIDs *ids = new RecordIDs();
+    char *kinds = slot(KIND_MINIPAGE, 1);
+    for (u32 i = 0; i < this->num_records; i++)
+        if ((u_int8_t) kinds[i] != SLOT_FREE)
+            ids->push_back((RecordID) (i + 1));
+    return ids;
+}
+
+// Whether a block read from a heap file is a PAX page.
+bool PaxPage::is_pax(const Dbt &block) {
+    return block.get_size() >= sizeof(u32) && *(u32 *) block.get_data() == MAGIC;
+}
+
+// The column types a PAX page was laid out for.
+ColumnAttributes PaxPage::get_column_attributes(const Dbt &block) {
+    char *bytes = (char *) block.get_data();
+    u16 num_columns = *(u16 *) (bytes + 4 * sizeof(u32));
+    ColumnAttributes column_attributes;
+    for (uint i = 0; i < num_columns; i++)
+        column_attributes.push_back(ColumnAttribute(
+                (ColumnAttribute::DataType) *(u_int8_t *) (bytes + 4 * sizeof(u32) + sizeof(u16) + i)));
+    return column_attributes;
+}
+
+// Size of the biggest row (as HeapTable marshals it) that fits into an empty PAX page.
+// A row takes its slot in every minipage plus its TEXT bytes; its kind and INTs are in the slot.
+u_int32_t PaxPage::max_record_size(uint block_size, const ColumnAttributes &column_attributes) {
+    u32 text_entries = 0;
+    for (auto const &column_attribute: column_attributes)
+        if (column_attribute.get_data_type() == ColumnAttribute::TEXT)
+            text_entries += TEXT_ENTRY_SIZE;
+    return block_size - get_header_size(column_attributes.size()) - text_entries;
+}
+
+// Bytes before the first minipage.
+u_int32_t PaxPage::get_header_size(uint num_columns) {
+    u32 size = 4 * sizeof(u32) + sizeof(u16) + num_columns;
+    return (size + 3) / 4 * 4;
+}
+
+// Work out the minipage widths and offsets from the column types.
+void PaxPage::layout() {
+    this->widths.clear();
+    this->widths.push_back(1);
+    this->widths.push_back(LINK_SIZE);
+    for (auto const &data_type: this->data_types)
+        this->widths.push_back(data_type == ColumnAttribute::INT ? sizeof(int32_t) : TEXT_ENTRY_SIZE);
+    this->minipage_offsets.clear();
+    this->slot_width = 0;
+    for (auto const &width: this->widths) {
+        this->minipage_offsets.push_back(this->slot_width);
+        this->slot_width += width;
+    }
+    this->header_size = get_header_size(this->data_types.size());
+}
+
+// Take a record apart into what goes into each minipage.
+void PaxPage::split(const Dbt *data, Fields &fields) const {
+    const char *bytes = (const char *) data->get_data();
+    fields.kind = *(const u_int8_t *) bytes;
+    fields.link = fields.kind == RECORD_ROW ? nullptr : bytes + 1;
+    fields.text_size = 0;
+    u32 offset = fields.kind == RECORD_ROW ? ROW_HEADER_SIZE : FORWARD_SIZE;
+    for (auto const &data_type: this->data_types) {
+        if (fields.kind == RECORD_FORWARD) {
+            fields.values.push_back(nullptr);
+            fields.sizes.push_back(0);
+            continue;
+        }
+        u32 size = sizeof(int32_t);
+        if (data_type == ColumnAttribute::TEXT) {
+            u16 length = *(const u16 *) (bytes + offset);
+            size = sizeof(u16) + (length == OVERFLOW_TEXT ? OVERFLOW_POINTER_SIZE : length);
+            fields.text_size += size;
+        }
+        fields.values.push_back(bytes + offset);
+        fields.sizes.push_back(size);
+        offset += size;
+    }
+}
+
+// Put a record back together from its minipages, with all columns or only the given ones.
+Dbt *PaxPage::assemble(RecordID record_id, const vector<bool> *columns) {
+    if (record_id == 0 || record_id > this->num_records)
+        return nullptr;
+    u_int8_t kind = *(u_int8_t *) slot(KIND_MINIPAGE, record_id);
+    if (kind == SLOT_FREE)
+        return nullptr;
+    u32 size = kind == RECORD_ROW ? ROW_HEADER_SIZE : FORWARD_SIZE;
+    if (kind != RECORD_FORWARD)
+        for (uint i = 0; i < this->data_types.size(); i++) {
+            if (this->data_types[i] == ColumnAttribute::INT)
+                size += sizeof(int32_t);
+            else if (columns != nullptr && !(*columns)[i])
+                size += sizeof(u16);
+            else
+                size += ((u32 *) slot(FIRST_COLUMN_MINIPAGE + i, record_id))[1];
+        }
+    if (size < FORWARD_SIZE)
+        size = FORWARD_SIZE;  // rows are padded to stub size, as they came in
+
+    char *bytes = (char *) arena_allocate(size);
+    memset(bytes, 0, size);
+    this->assembled.push_back(bytes);
+    *(u_int8_t *) bytes = kind;
+    u32 offset = ROW_HEADER_SIZE;
+    if (kind != RECORD_ROW) {
+        memcpy(bytes + 1, slot(LINK_MINIPAGE, record_id), LINK_SIZE);
+        offset = FORWARD_SIZE;
+    }
+    if (kind != RECORD_FORWARD)
+        for (uint i = 0; i < this->data_types.size(); i++) {
+            bool wanted = columns == nullptr || (*columns)[i];
+            char *entry = slot(FIRST_COLUMN_MINIPAGE + i, record_id);
+            if (this->data_types[i] == ColumnAttribute::INT) {
+                if (wanted)
+                    memcpy(bytes + offset, entry, sizeof(int32_t));
+                offset += sizeof(int32_t);
+            } else if (wanted) {
+                u32 text_size = ((u32 *) entry)[1];
+                memcpy(bytes + offset, this->address(((u32 *) entry)[0]), text_size);
+                offset += text_size;
+            } else {
+                offset += sizeof(u16);  // an empty TEXT
+            }
+        }
+    return new Dbt(bytes, size);
+}
+
+// Make sure there are at least slots slots and text_size free bytes in the variable area
+// (not counting the TEXT bytes of the record being replaced, if any). Returns false, with
+// nothing changed, if the page can't hold that.
+bool PaxPage::reserve(u32 slots, u32 text_size, RecordID replacing) {
+    u32 block_size = this->get_block_size();
+    if (slots <= this->capacity && this->header_size + this->capacity * this->slot_width + text_size <= this->var_start)
+        return true;
+
+    u32 live = 0;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        if (record_id == replacing || *(u_int8_t *) slot(KIND_MINIPAGE, record_id) == SLOT_FREE)
+            continue;
+        for (uint i = 0; i < this->data_types.size(); i++)
+            if (this->data_types[i] == ColumnAttribute::TEXT)
+                live += ((u32 *) slot(FIRST_COLUMN_MINIPAGE + i, record_id))[1];
+    }
+    u32 needed_slots = max(slots, this->capacity);
+    if ((u_int64_t) this->header_size + (u_int64_t) needed_slots * this->slot_width + live + text_size > block_size)
+        return false;
+
+    compact(replacing);
+    if (slots > this->capacity) {
+        u32 most = (this->var_start - text_size - this->header_size) / this->slot_width;
+        relayout(min(max(slots, max(2 * this->capacity, MIN_CAPACITY)), most));
+    }
+    return true;
+}
+
+// Pack the live TEXT values against the end of the block, dropping those of replacing.
+void PaxPage::compact(RecordID replacing) {
+    u32 block_size = this->get_block_size();
+    u32 used = block_size - this->var_start;
+    char *copy = (char *) arena_allocate(used > 0 ? used : 1);
+    memcpy(copy, this->address(this->var_start), used);
+    u32 end = block_size;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        if (*(u_int8_t *) slot(KIND_MINIPAGE, record_id) == SLOT_FREE)
+            continue;
+        for (uint i = 0; i < this->data_types.size(); i++) {
+            if (this->data_types[i] != ColumnAttribute::TEXT)
+                continue;
+            u32 *entry = (u32 *) slot(FIRST_COLUMN_MINIPAGE + i, record_id);
+            if (record_id == replacing)
+                entry[1] = 0;
+            if (entry[1] == 0)
+                continue;
+            end -= entry[1];
+            memcpy(this->address(end), copy + (entry[0] - this->var_start), entry[1]);
+            entry[0] = end;
+        }
+    }
+    arena_free(copy);
+    this->var_start = end;
+    put_header();
+}
+
+// Spread the minipages out for more slots each (new_capacity is at least the current one).
+void PaxPage::relayout(u32 new_capacity) {
+    for (uint minipage = this->widths.size(); minipage-- > 1;)
+        memmove(this->address(this->header_size + new_capacity * this->minipage_offsets[minipage]),
+                this->address(this->header_size + this->capacity * this->minipage_offsets[minipage]),
+                this->num_records * this->widths[minipage]);
+    this->capacity = new_capacity;
+    put_header();
+}
+
+// Write a record's minipage entries and TEXT values (there is room, see reserve).
+void PaxPage::put_fields(RecordID record_id, const Fields &fields) {
+    *(u_int8_t *) slot(KIND_MINIPAGE, record_id) = fields.kind;
+    char *link = slot(LINK_MINIPAGE, record_id);
+    if (fields.link != nullptr)
+        memcpy(link, fields.link, LINK_SIZE);
+    else
+        memset(link, 0, LINK_SIZE);
+    for (uint i = 0; i < this->data_types.size(); i++) {
+        char *entry = slot(FIRST_COLUMN_MINIPAGE + i, record_id);
+        if (this->data_types[i] == ColumnAttribute::INT) {
+            if (fields.values[i] != nullptr)
+                memcpy(entry, fields.values[i], sizeof(int32_t));
+            else
+                memset(entry, 0, sizeof(int32_t));
+        } else {
+            u32 size = fields.sizes[i];
+            if (size > 0) {
+                this->var_start -= size;
+                memcpy(this->address(this->var_start), fields.values[i], size);
+            }
+            ((u32 *) entry)[0] = size > 0 ? this->var_start : 0;
+            ((u32 *) entry)[1] = size;
+        }
+    }
+}
+
+// Store the record count, capacity and start of the variable area.
+void PaxPage::put_header() {
+    *(u32 *) this->address(sizeof(u32)) = this->num_records;
+    *(u32 *) this->address(2 * sizeof(u32)) = this->capacity;
+    *(u32 *) this->address(3 * sizeof(u32)) = this->var_start;
+}
+
+// Where a record's entry in the given minipage is.
+char *PaxPage::slot(uint minipage, RecordID record_id) {
+    return (char *) this->address(this->header_size + this->capacity * this->minipage_offsets[minipage]
+                                  + (record_id - 1) * this->widths[minipage]);
+}
+
+// Make a void* pointer for a given offset into the data block.
+void *PaxPage::address(u32 offset) {
+    return (void *) ((char *) this->block.get_data() + offset);
+}
+
+/**
+ * Testing function for PaxPage.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_pax_page() {
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    char blank_space[DbBlock::BLOCK_SZ];
+    memset(blank_space, 0, sizeof(blank_space));
+    Dbt block_dbt(blank_space, sizeof(blank_space));
+    PaxPage page(block_dbt, 1, true, &column_attributes);
+    if (!PaxPage::is_pax(block_dbt) || PaxPage::get_column_attributes(block_dbt).size() != 2)
+        return false;
+
+    // rows as HeapTable marshals them: kind, INT, TEXT (2-byte length and characters)
+    auto row = [](int32_t n, const string &s) {
+        string bytes(1, (char) RECORD_ROW);
+        bytes.append((const char *) &n, sizeof(n));
+        u16 length = s.size();
+        bytes.append((const char *) &length, sizeof(length));
+        return bytes + s;
+    };
+    vector<string> rows;
+    for (int i = 0; i < 100; i++) {
+        rows.push_back(row(i, string(i % 7, 'a' + i % 26)));
+        Dbt data((void *) rows.back().data(), rows.back().size());
+        if (page.add(&data) != i + 1)  // the slots are spread out a few times on the way
+            return false;
+    }
+    for (int i = 0; i < 100; i++) {
+        Dbt *data = page.get(i + 1);
+        string expected = rows[i];
+        if (expected.size() < FORWARD_SIZE)
+            expected.resize(FORWARD_SIZE, '\0');
+        if (string((char *) data->get_data(), data->get_size()) != expected)
+            return false;
+        delete data;
+    }
+
+    // just the INT column
+    Dbt *data = page.get_columns(50, vector<bool>{true, false});
+    if (*(int32_t *) ((char *) data->get_data() + 1) != 49 || *(u16 *) ((char *) data->get_data() + 5) != 0)
+        return false;
+    delete data;
+
+    // growing, deleting (and compacting to make room), running out of room
+    rows[9] = row(-9, string(1000, 'z'));
+    Dbt bigger((void *) rows[9].data(), rows[9].size());
+    page.put(10, bigger);
+    page.del(11);
+    RecordIDs *record_ids = page.ids();
+    if (record_ids->size() != 99 || page.get(11) != nullptr)
+        return false;
+    delete record_ids;
+    data = page.get(10);
+    if (string((char *) data->get_data(), data->get_size()) != rows[9])
+        return false;
+    delete data;
+    string too_big = row(0, string(500, 'x'));
+    Dbt too_big_data((void *) too_big.data(), too_big.size());
+    try {
+        page.add(&too_big_data);
+        return false;
+    } catch (DbBlockNoRoomError &e) {
+        // expected
+    }
+    for (RecordID id = 1; id <= 100; id++)
+        if (id != 10)
+            page.del(id);
+    page.add(&too_big_data);  // fits once the rest is gone
+    data = page.get(10);
+    if (string((char *) data->get_data(), data->get_size()) != rows[9])
+        return false;
+    delete data;
+    return true;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file pax_page.h - PAX (partition attributes across) pages for heap files
+ *
+ * A PaxPage holds the same records as a SlottedPage, but stores each column of them in a minipage
+ * of its own, so that reading one column of every record touches only that column's bytes.
+ * Layout (all numbers 4 bytes unless noted):
+ *      0x00: MAGIC, 0x04: number of records, 0x08: capacity (slots each minipage has room for),
+ *      0x0C: start of the variable area, 0x10: number of columns (2 bytes), then one byte per
+ *      column with its data type, padded to a multiple of 4.
+ *      Then the fixed-width minipages, each with capacity slots, in this order:
+ *          record kind (1 byte, SLOT_FREE once deleted),
+ *          link (6 bytes: the handle a stub points at, or the home of a moved row),
+ *          one per column: an INT (4 bytes) or a TEXT's location in the variable area (offset, size).
+ *      The variable area, at the end of the block and growing down, holds the TEXT values exactly
+ *      as they are in the row (length first, or the overflow pointer).
+ * When the slots run out, the minipages are spread out to make room for more (doubling the
+ * capacity while space allows); deleted TEXT bytes are reclaimed by compacting the variable area
+ * when space runs out.
+ * The column types are in the page itself, so a page can be read without knowing its table.
+ */
+#pragma once
+
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class PaxPage - heap file block with a minipage per column
+ */
+class PaxPage : public HeapPage {
+public:
+    static const u_int32_t MAGIC = 0x01584150;  // "PAX\1", more records than any slotted page can hold
+    static const u_int8_t SLOT_FREE = 0xFF;
+
+    // column_attributes are needed (only) for a new page
+    PaxPage(Dbt &block, BlockID block_id, bool is_new = false, const ColumnAttributes *column_attributes = nullptr);
+
+    virtual ~PaxPage();
+
+    PaxPage(const PaxPage &other) = delete;
+
+    PaxPage(PaxPage &&temp) = delete;
+
+    PaxPage &operator=(const PaxPage &other) = delete;
+
+    PaxPage &operator=(PaxPage &temp) = delete;
+
+    using HeapPage::del;
+
+    virtual RecordID add(const Dbt *data);
+
+    virtual Dbt *get(RecordID record_id);
+
+    virtual Dbt *get_columns(RecordID record_id, const std::vector<bool> &columns);
+
+    virtual void put(RecordID record_id, const Dbt &data);
+
+    virtual void del(RecordID record_id);
+
+    virtual RecordIDs *ids(void);
+
+    static bool is_pax(const Dbt &block);
+
+    static ColumnAttributes get_column_attributes(const Dbt &block);
+
+    static u_int32_t max_record_size(uint block_size, const ColumnAttributes &column_attributes);
+
+protected:
+    // a record taken apart into its minipage entries (pointing into the record)
+    struct Fields {
+        u_int8_t kind;
+        const char *link;  // nullptr for a row
+        std::vector<const char *> values;  // nullptr for the columns of a stub
+        std::vector<u_int32_t> sizes;
+        u_int32_t text_size;  // bytes needed in the variable area
+    };
+
+    std::vector<ColumnAttribute::DataType> data_types;
+    std::vector<u_int32_t> minipage_offsets;  // of each minipage, per slot of capacity
+    std::vector<u_int32_t> widths;  // bytes per slot of each minipage
+    u_int32_t header_size;
+    u_int32_t slot_width;  // bytes of all minipages per slot
+    u_int32_t num_records;
+    u_int32_t capacity;
+    u_int32_t var_start;
+    std::vector<char *> assembled;  // records handed out by get(), freed with the page
+
+    static u_int32_t get_header_size(uint num_columns);
+
+    virtual void layout();
+
+    virtual void split(const Dbt *data, Fields &fields) const;
+
+    virtual Dbt *assemble(RecordID record_id, const std::vector<bool> *columns);
+
+    virtual bool reserve(u_int32_t slots, u_int32_t text_size, RecordID replacing);
+
+    virtual void compact(RecordID replacing);
+
+    virtual void relayout(u_int32_t new_capacity);
+
+    virtual void put_fields(RecordID record_id, const Fields &fields);
+
+    virtual void put_header();
+
+    virtual char *slot(uint minipage, RecordID record_id);
+
+    virtual void *address(u_int32_t offset);
+};
+
+bool test_pax_page();
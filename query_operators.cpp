@@ -0,0 +1,1568 @@
+#include "query_operators.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <unistd.h>
+#include "memory_storage.h"
+
+using namespace std;
+
+// SQL literal for a value, as shown in describe()
+static string value_to_string(const Value &value) {
+    if (value.data_type == ColumnAttribute::INT)
+        return to_string(value.n);
+    return "'" + value.s + "'";
+}
+
+// Type of the named column in a schema
+static ColumnAttribute attribute_of(const Identifier &column_name, const ColumnNames &column_names,
+                                    const ColumnAttributes &column_attributes) {
+    for (uint i = 0; i < column_names.size(); i++)
+        if (column_names[i] == column_name)
+            return column_attributes[i];
+    throw DbRelationError("unknown column " + column_name);
+}
+
+// Name for a temporary table that no other statement or process will pick
+static Identifier temporary_table_name(const string &prefix) {
+    static atomic<u_int32_t> counter(0);
+    return prefix + to_string(getpid()) + "_" + to_string(counter++);
+}
+
+double QueryOperator::estimate_rows() const {
+    QueryOperator *child = get_child();
+    return child == nullptr ? 0 : child->estimate_rows();
+}
+
+vector<QueryOperator *> QueryOperator::get_inputs() const {
+    QueryOperator *child = get_child();
+    return child == nullptr ? vector<QueryOperator *>() : vector<QueryOperator *>(1, child);
+}
+
+void QueryOperator::set_inputs(const vector<QueryOperator *> &inputs) {
+    if (!inputs.empty())
+        set_child(inputs.front());
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|        TABLE SCAN        |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+TableScan::TableScan(DbRelation &relation, const ValueDict *where, const ColumnNames *column_names) :
+        relation(relation), where(nullptr), limit(SIZE_MAX), handles(nullptr), position(0), resume(0),
+        batch(FIRST_BATCH), started(false) {
+    if (where != nullptr && !where->empty())
+        this->where = new ValueDict(*where);
+    this->column_names = column_names != nullptr ? *column_names : relation.get_column_names();
+    for (auto const &column_name: this->column_names)
+        this->column_attributes.push_back(attribute_of(column_name, relation.get_column_names(),
+                                                       relation.get_column_attributes()));
+}
+
+TableScan::~TableScan() {
+    close();
+    delete where;
+}
+
+void TableScan::open() {
+    relation.open();
+    delete handles;
+    handles = nullptr;
+    position = 0;
+    resume = 0;
+    batch = limit != SIZE_MAX && limit > FIRST_BATCH ? limit : FIRST_BATCH;
+    started = false;
+}
+
+// get the next batch of handles from the relation; false at the end of the scan
+bool TableScan::fetch() {
+    do {
+        if (started && resume == 0)
+            return false;
+        delete handles;
+        handles = relation.select(where, ranges.empty() ? nullptr : &ranges, batch, resume);
+        started = true;
+        position = 0;
+        batch = batch < MAX_BATCH / 2 ? batch * 2 : MAX_BATCH;
+    } while (handles->empty());
+    return true;
+}
+
+bool TableScan::next(ValueDict &row) {
+    row.clear();
+    if (handles == nullptr || position >= handles->size())
+        if (!fetch())
+            return false;
+    ValueDict *values = relation.project((*handles)[position++], &column_names);
+    row = move(*values);
+    delete values;
+    return true;
+}
+
+void TableScan::close() {
+    delete handles;
+    handles = nullptr;
+}
+
+HeapTable *TableScan::heap_table() const {
+    return dynamic_cast<HeapTable *>(&relation);
+}
+
+void TableScan::scan_blocks(BlockID first, BlockID last, vector<ValueDict> &rows) const {
+    heap_table()->scan_blocks(first, last, where, ranges.empty() ? nullptr : &ranges, &column_names, rows);
+}
+
+string TableScan::describe() const {
+    string result = "TableScan " + relation.get_table_name();
+    if (where != nullptr) {
+        string separator = " where ";
+        for (auto const &column: *where) {
+            result += separator + column.first + " = " + value_to_string(column.second);
+            separator = " AND ";
+        }
+    }
+    string separator = " skipping blocks outside ";
+    for (auto const &range: ranges) {
+        result += separator + range.first + " in [" + to_string(range.second.first) + ", "
+                  + to_string(range.second.second) + "]";
+        separator = " AND ";
+    }
+    return result;
+}
+
+// the rows of the relation, times the selectivity of each equality the scan checks
+double TableScan::estimate_rows() const {
+    double rows = (double) relation.estimate_row_count();
+    if (where != nullptr)
+        for (auto const &column: *where)
+            rows *= Comparison(column.first, Comparison::EQ, column.second).selectivity();
+    return rows;
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|          FILTER          |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+/**
+    Evaluate the comparison on a row
+    @param row  row holding the column
+    @returns    true if the row's value compares as required to the literal
+*/
+bool Comparison::matches(const ValueDict &row) const {
+    const Value &actual = row.at(column_name);
+    switch (op) {
+        case EQ:
+            return actual == value;
+        case NE:
+            return actual != value;
+        case LT:
+            return actual < value;
+        case LE:
+            return !(value < actual);
+        case GT:
+            return value < actual;
+        case GE:
+            return !(actual < value);
+    }
+    return false;
+}
+
+// the usual guesses without statistics on the values: few rows equal a given value, a third fall in a range
+double Comparison::selectivity() const {
+    switch (op) {
+        case EQ:
+            return 0.1;
+        case NE:
+            return 0.9;
+        default:
+            return 1.0 / 3;
+    }
+}
+
+string Comparison::to_string() const {
+    static const char *OP_NAMES[] = {"=", "<>", "<", "<=", ">", ">="};
+    return column_name + " " + OP_NAMES[op] + " " + value_to_string(value);
+}
+
+Filter::Filter(QueryOperator *child, const vector<Comparison> &comparisons) : child(child), comparisons(comparisons) {
+    this->column_names = child->get_column_names();
+    this->column_attributes = child->get_column_attributes();
+}
+
+Filter::~Filter() {
+    delete child;
+}
+
+void Filter::open() {
+    child->open();
+}
+
+bool Filter::next(ValueDict &row) {
+    while (child->next(row))
+        if (matches(row))
+            return true;
+    return false;
+}
+
+void Filter::stream(const ValueDict &row, vector<ValueDict> &rows) const {
+    if (matches(row))
+        rows.push_back(row);
+}
+
+// whether a row satisfies all the comparisons
+bool Filter::matches(const ValueDict &row) const {
+    for (auto const &comparison: comparisons)
+        if (!comparison.matches(row))
+            return false;
+    return true;
+}
+
+void Filter::close() {
+    child->close();
+}
+
+string Filter::describe() const {
+    string result = "Filter";
+    string separator = " ";
+    for (auto const &comparison: comparisons) {
+        result += separator + comparison.to_string();
+        separator = " AND ";
+    }
+    return result;
+}
+
+double Filter::estimate_rows() const {
+    double rows = child->estimate_rows();
+    for (auto const &comparison: comparisons)
+        rows *= comparison.selectivity();
+    return rows;
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|        PROJECTION        |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+Projection::Projection(QueryOperator *child, const ColumnNames &input_names, const ColumnNames &output_names) :
+        child(child), input_names(input_names) {
+    this->column_names = output_names;
+    for (auto const &column_name: input_names)
+        this->column_attributes.push_back(attribute_of(column_name, child->get_column_names(),
+                                                       child->get_column_attributes()));
+}
+
+Projection::~Projection() {
+    delete child;
+}
+
+void Projection::open() {
+    child->open();
+}
+
+bool Projection::next(ValueDict &row) {
+    row.clear();
+    if (!child->next(input_row))
+        return false;
+    for (uint i = 0; i < input_names.size(); i++)
+        row[column_names[i]] = input_row.at(input_names[i]);
+    return true;
+}
+
+void Projection::close() {
+    child->close();
+    input_row.clear();
+}
+
+void Projection::stream(const ValueDict &row, vector<ValueDict> &rows) const {
+    rows.push_back(ValueDict());
+    for (uint i = 0; i < input_names.size(); i++)
+        rows.back()[column_names[i]] = row.at(input_names[i]);
+}
+
+string Projection::describe() const {
+    string result = "Projection";
+    string separator = " ";
+    for (uint i = 0; i < input_names.size(); i++) {
+        result += separator + input_names[i];
+        if (column_names[i] != input_names[i])
+            result += " AS " + column_names[i];
+        separator = ", ";
+    }
+    return result;
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|      HASH AGGREGATE      |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+string AggregateSpec::function_name(Function function) {
+    static const char *NAMES[] = {"COUNT", "SUM", "MIN", "MAX", "AVG"};
+    return NAMES[function];
+}
+
+/**
+    @param child             input rows (nullptr for a partial fed through consume())
+    @param group_by          group columns (none for a single group over all rows)
+    @param aggregates        aggregates to compute per group
+    @param input_names       the columns of the input rows
+    @param input_attributes  their types
+    @param memory_budget     bytes of groups to keep in memory before spilling to partitions
+*/
+HashAggregate::HashAggregate(QueryOperator *child, const ColumnNames &group_by, const vector<AggregateSpec> &aggregates,
+                             const ColumnNames &input_names, const ColumnAttributes &input_attributes,
+                             size_t memory_budget) :
+        child(child), group_by(group_by), aggregates(aggregates), memory_budget(memory_budget), memory_used(0),
+        depth(0), emitted(0), spilled_rows(0), done_input(false) {
+    // partitions only need the columns that are grouped on or aggregated
+    for (auto const &column_name: group_by)
+        if (find(this->input_names.begin(), this->input_names.end(), column_name) == this->input_names.end()) {
+            this->input_names.push_back(column_name);
+            this->input_attributes.push_back(attribute_of(column_name, input_names, input_attributes));
+        }
+    for (auto const &aggregate: aggregates) {
+        if (aggregate.column_name.empty())
+            continue;
+        ColumnAttribute attribute = attribute_of(aggregate.column_name, input_names, input_attributes);
+        if ((aggregate.function == AggregateSpec::SUM || aggregate.function == AggregateSpec::AVG)
+            && attribute.get_data_type() != ColumnAttribute::INT)
+            throw DbRelationError(AggregateSpec::function_name(aggregate.function) + " needs an INT column, not "
+                                  + aggregate.column_name);
+        if (find(this->input_names.begin(), this->input_names.end(), aggregate.column_name)
+            == this->input_names.end()) {
+            this->input_names.push_back(aggregate.column_name);
+            this->input_attributes.push_back(attribute);
+        }
+    }
+
+    this->column_names = group_by;
+    for (auto const &column_name: group_by)
+        this->column_attributes.push_back(attribute_of(column_name, input_names, input_attributes));
+    // a merged group spills as its key, then per aggregate the count, the sum (in two halves), min and max
+    this->group_names = group_by;
+    this->group_attributes = this->column_attributes;
+    for (uint i = 0; i < aggregates.size(); i++) {
+        string suffix = "(" + to_string(i) + ")";
+        ColumnAttribute number(ColumnAttribute::INT);
+        ColumnAttribute value = aggregates[i].column_name.empty() ? number
+                                : attribute_of(aggregates[i].column_name, input_names, input_attributes);
+        this->group_names.insert(this->group_names.end(), {"count" + suffix, "sum_high" + suffix, "sum_low" + suffix,
+                                                           "min" + suffix, "max" + suffix});
+        this->group_attributes.insert(this->group_attributes.end(), {number, number, number, value, value});
+    }
+    for (auto const &aggregate: aggregates) {
+        this->column_names.push_back(aggregate.output_name);
+        if (aggregate.function == AggregateSpec::MIN || aggregate.function == AggregateSpec::MAX)
+            this->column_attributes.push_back(attribute_of(aggregate.column_name, input_names, input_attributes));
+        else
+            this->column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    }
+}
+
+HashAggregate::~HashAggregate() {
+    drop_partitions();
+    delete child;
+}
+
+/**
+    Aggregate all of the input (this is where the work happens)
+*/
+void HashAggregate::open() {
+    if (child != nullptr) {
+        child->open();
+        ValueDict row;
+        while (child->next(row))
+            consume(row);
+        child->close();
+    }
+    finish_input();
+}
+
+bool HashAggregate::next(ValueDict &row) {
+    row.clear();
+    while (emitted >= groups.size())
+        if (!load_next_partition())
+            return false;
+    output(groups[emitted++], row);
+    return true;
+}
+
+void HashAggregate::close() {
+    drop_partitions();
+    clear_groups();
+}
+
+string HashAggregate::describe() const {
+    string result = "HashAggregate";
+    string separator = " group by ";
+    for (auto const &column_name: group_by) {
+        result += separator + column_name;
+        separator = ", ";
+    }
+    separator = group_by.empty() ? " " : ": ";
+    for (auto const &aggregate: aggregates) {
+        result += separator + AggregateSpec::function_name(aggregate.function) + "("
+                  + (aggregate.column_name.empty() ? "*" : aggregate.column_name) + ")";
+        separator = ", ";
+    }
+    return result;
+}
+
+// one row without GROUP BY; otherwise a group per ten input rows, for want of better
+double HashAggregate::estimate_rows() const {
+    if (group_by.empty())
+        return 1;
+    double rows = child == nullptr ? (double) groups.size() : child->estimate_rows();
+    return rows < 1 ? rows : max(1.0, rows / 10);
+}
+
+/**
+    Add one input row to its group (or to a partition, if its group is new and memory is full)
+    @param row  values for at least the grouped and aggregated columns
+*/
+void HashAggregate::consume(const ValueDict &row) {
+    vector<Value> key;
+    key.reserve(group_by.size());
+    for (auto const &column_name: group_by)
+        key.push_back(row.at(column_name));
+    size_t hash = hash_key(key);
+    long found = find_group(key, hash);
+    if (found >= 0) {
+        accumulate(groups[found], row);
+        return;
+    }
+    size_t cost = group_cost(key);
+    if (memory_used + cost > memory_budget && depth < MAX_SPILL_DEPTH && !groups.empty()) {
+        spill(row, hash);
+        return;
+    }
+    memory_used += cost;
+    accumulate(add_group(key, hash), row);
+}
+
+/**
+    Fold a partial aggregate (of the same query) into this one. The partial is left empty.
+    @param partial  aggregate fed with consume() from another share of the input
+*/
+void HashAggregate::merge(HashAggregate &partial) {
+    for (auto &other: partial.groups)
+        merge_group(other.key, other.hash, other.accumulators);
+    partial.clear_groups();
+
+    // the partial's spilled rows and groups may belong to groups that are in memory here, so they are merged too
+    for (uint i = 0; i < partial.partitions.size() || i < partial.group_partitions.size(); i++) {
+        Partition partition = {i < partial.partitions.size() ? partial.partitions[i] : nullptr,
+                               i < partial.group_partitions.size() ? partial.group_partitions[i] : nullptr, 0};
+        if (partition.rows != nullptr || partition.groups != nullptr)
+            partial.pending.push_back(partition);
+    }
+    partial.partitions.clear();
+    partial.group_partitions.clear();
+    for (auto &entry: partial.pending) {
+        load_rows(entry.rows);
+        load_groups(entry.groups);
+    }
+    partial.drop_partitions();
+}
+
+// What a group takes in memory: the group, its slots, its accumulators and its key
+size_t HashAggregate::group_cost(const vector<Value> &key) const {
+    size_t cost = sizeof(Group) + 2 * sizeof(u_int32_t) + aggregates.size() * sizeof(Accumulator);
+    for (auto const &value: key)
+        cost += sizeof(Value) + value.s.size();
+    return cost;
+}
+
+/**
+    Fold the accumulators of a group of another aggregate into the group here, adding the group
+    if it is new and fits into memory, or spilling it if it doesn't (as consume() does with rows)
+    @param key           the group's key
+    @param hash          its hash
+    @param accumulators  what the other aggregate has for it
+*/
+void HashAggregate::merge_group(const vector<Value> &key, size_t hash, const vector<Accumulator> &accumulators) {
+    long found = find_group(key, hash);
+    if (found < 0) {
+        size_t cost = group_cost(key);
+        if (memory_used + cost > memory_budget && depth < MAX_SPILL_DEPTH && !groups.empty()) {
+            spill_group(key, hash, accumulators);
+            return;
+        }
+        memory_used += cost;
+        add_group(key, hash).accumulators = accumulators;
+        return;
+    }
+    Group &group = groups[found];
+    for (uint i = 0; i < aggregates.size(); i++) {
+        Accumulator &into = group.accumulators[i];
+        const Accumulator &from = accumulators[i];
+        if (from.count > 0 && (into.count == 0 || from.min < into.min))
+            into.min = from.min;
+        if (from.count > 0 && (into.count == 0 || into.max < from.max))
+            into.max = from.max;
+        into.count += from.count;
+        into.sum += from.sum;
+    }
+}
+
+// Mix the hashes of the key values (splitmix64 finalizer), so that all bits are usable
+size_t HashAggregate::hash_key(const vector<Value> &key) const {
+    u_int64_t hash = 0x9E3779B97F4A7C15ULL;
+    for (auto const &value: key) {
+        hash ^= value.data_type == ColumnAttribute::INT ? (u_int64_t) (u_int32_t) value.n : std::hash<string>()(value.s);
+        hash ^= hash >> 30;
+        hash *= 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 27;
+        hash *= 0x94D049BB133111EBULL;
+        hash ^= hash >> 31;
+    }
+    return (size_t) hash;
+}
+
+// Index of the group with the given key, or -1
+long HashAggregate::find_group(const vector<Value> &key, size_t hash) const {
+    if (slots.empty())
+        return -1;
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; slots[i] != 0; i = (i + 1) & mask) {
+        const Group &group = groups[slots[i] - 1];
+        if (group.hash == hash && group.key == key)
+            return (long) slots[i] - 1;
+    }
+    return -1;
+}
+
+HashAggregate::Group &HashAggregate::add_group(const vector<Value> &key, size_t hash) {
+    if ((groups.size() + 1) * 2 > slots.size())
+        grow_slots();
+    Group group;
+    group.key = key;
+    group.accumulators.resize(aggregates.size());
+    group.hash = hash;
+    groups.push_back(move(group));
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    while (slots[i] != 0)
+        i = (i + 1) & mask;
+    slots[i] = (u_int32_t) groups.size();
+    return groups.back();
+}
+
+// Double the slot array (kept at most half full) and reinsert every group
+void HashAggregate::grow_slots() {
+    size_t size = slots.empty() ? 16 : slots.size() * 2;
+    slots.assign(size, 0);
+    size_t mask = size - 1;
+    for (u_int32_t g = 0; g < groups.size(); g++) {
+        size_t i = groups[g].hash & mask;
+        while (slots[i] != 0)
+            i = (i + 1) & mask;
+        slots[i] = g + 1;
+    }
+}
+
+void HashAggregate::accumulate(Group &group, const ValueDict &row) {
+    for (uint i = 0; i < aggregates.size(); i++) {
+        Accumulator &accumulator = group.accumulators[i];
+        const AggregateSpec &aggregate = aggregates[i];
+        if (aggregate.column_name.empty()) {
+            accumulator.count++;
+            continue;
+        }
+        const Value &value = row.at(aggregate.column_name);
+        if (accumulator.count == 0 || value < accumulator.min)
+            accumulator.min = value;
+        if (accumulator.count == 0 || accumulator.max < value)
+            accumulator.max = value;
+        accumulator.count++;
+        if (value.data_type == ColumnAttribute::INT)
+            accumulator.sum += value.n;
+    }
+}
+
+/**
+    Write a row to its partition
+*/
+void HashAggregate::spill(const ValueDict &row, size_t hash) {
+    lock_guard<mutex> lock(HeapFile::latch);  // partials spill from worker threads (see ParallelAggregate)
+    ValueDict values;
+    for (auto const &column_name: input_names)
+        values[column_name] = row.at(column_name);
+    partition_for(partitions, hash, input_names, input_attributes)->insert(&values);
+    spilled_rows++;
+}
+
+/**
+    Write a merged group to its partition of groups
+*/
+void HashAggregate::spill_group(const vector<Value> &key, size_t hash, const vector<Accumulator> &accumulators) {
+    lock_guard<mutex> lock(HeapFile::latch);
+    ValueDict values;
+    uint column = 0;
+    for (auto const &value: key)
+        values[group_names[column++]] = value;
+    for (uint i = 0; i < aggregates.size(); i++) {
+        const Accumulator &accumulator = accumulators[i];
+        bool text = group_attributes[column + 3].get_data_type() == ColumnAttribute::TEXT;  // min and max
+        Value nothing = text ? Value("") : Value(0);
+        values[group_names[column++]] = Value((int32_t) accumulator.count);
+        values[group_names[column++]] = Value((int32_t) ((u_int64_t) accumulator.sum >> 32));
+        values[group_names[column++]] = Value((int32_t) (u_int32_t) accumulator.sum);
+        values[group_names[column++]] = accumulator.count > 0 ? accumulator.min : nothing;
+        values[group_names[column++]] = accumulator.count > 0 ? accumulator.max : nothing;
+    }
+    partition_for(group_partitions, hash, group_names, group_attributes)->insert(&values);
+    spilled_rows++;
+}
+
+/**
+    The partition a group goes to, picked by the hash bits for the current depth (the low bits
+    place groups in the slot array, so partitions use the high ones), created if need be
+    @param partitions  the partitions (of rows or of merged groups) for the current depth
+    @param hash        the group's hash
+    @param names       the columns of a partition
+    @param attributes  their types
+*/
+DbRelation *HashAggregate::partition_for(vector<DbRelation *> &partitions, size_t hash, const ColumnNames &names,
+                                         const ColumnAttributes &attributes) {
+    if (partitions.empty())
+        partitions.assign(NUM_PARTITIONS, nullptr);
+    uint partition = (uint) ((u_int64_t) hash >> (60 - 4 * depth)) % NUM_PARTITIONS;
+    if (partitions[partition] == nullptr) {
+        MemoryTable *table = new MemoryTable(temporary_table_name("_tmp_agg_"), names, attributes,
+                                             memory_budget / NUM_PARTITIONS);
+        table->create();
+        partitions[partition] = table;
+    }
+    return partitions[partition];
+}
+
+// Consume the rows of a partition (nullptr for none)
+void HashAggregate::load_rows(DbRelation *partition) {
+    if (partition == nullptr)
+        return;
+    Handles *handles = partition->select();
+    for (auto const &handle: *handles) {
+        ValueDict *row = partition->project(handle);
+        consume(*row);
+        delete row;
+    }
+    delete handles;
+}
+
+// Merge the groups of a partition of merged groups (nullptr for none)
+void HashAggregate::load_groups(DbRelation *partition) {
+    if (partition == nullptr)
+        return;
+    Handles *handles = partition->select();
+    vector<Value> key(group_by.size());
+    vector<Accumulator> accumulators(aggregates.size());
+    for (auto const &handle: *handles) {
+        ValueDict *row = partition->project(handle);
+        uint column = 0;
+        for (auto &value: key)
+            value = (*row)[group_names[column++]];
+        for (auto &accumulator: accumulators) {
+            accumulator.count = (*row)[group_names[column++]].n;
+            u_int64_t high = (u_int32_t) (*row)[group_names[column++]].n;
+            u_int64_t low = (u_int32_t) (*row)[group_names[column++]].n;
+            accumulator.sum = (int64_t) (high << 32 | low);
+            accumulator.min = (*row)[group_names[column++]];
+            accumulator.max = (*row)[group_names[column++]];
+        }
+        merge_group(key, hash_key(key), accumulators);
+        delete row;
+    }
+    delete handles;
+}
+
+// Queue the partitions written while consuming, and give a global aggregate of no rows its one row
+void HashAggregate::finish_input() {
+    for (uint i = 0; i < partitions.size() || i < group_partitions.size(); i++) {
+        Partition partition = {i < partitions.size() ? partitions[i] : nullptr,
+                               i < group_partitions.size() ? group_partitions[i] : nullptr, depth + 1};
+        if (partition.rows != nullptr || partition.groups != nullptr)
+            pending.push_back(partition);
+    }
+    partitions.clear();
+    group_partitions.clear();
+    if (!done_input && group_by.empty() && groups.empty() && pending.empty())
+        add_group(vector<Value>(), hash_key(vector<Value>()));
+    done_input = true;
+}
+
+/**
+    Replace the groups in memory with those of the next spilled partition
+    @returns  false if there are no partitions left
+*/
+bool HashAggregate::load_next_partition() {
+    if (pending.empty())
+        return false;
+    Partition partition = pending.back();
+    clear_groups();
+    depth = partition.depth;
+    pending.pop_back();
+    load_rows(partition.rows);
+    load_groups(partition.groups);
+    for (auto table: {partition.rows, partition.groups})
+        if (table != nullptr) {
+            table->drop();
+            delete table;
+        }
+    finish_input();
+    return true;
+}
+
+void HashAggregate::clear_groups() {
+    groups.clear();
+    slots.clear();
+    memory_used = 0;
+    emitted = 0;
+}
+
+void HashAggregate::drop_partitions() {
+    for (auto const &entry: pending) {
+        partitions.push_back(entry.rows);
+        partitions.push_back(entry.groups);
+    }
+    pending.clear();
+    partitions.insert(partitions.end(), group_partitions.begin(), group_partitions.end());
+    group_partitions.clear();
+    for (auto partition: partitions)
+        if (partition != nullptr) {
+            partition->drop();
+            delete partition;
+        }
+    partitions.clear();
+}
+
+// The result row for a group; aggregates over no values (other than COUNT) are left out, i.e. NULL
+void HashAggregate::output(const Group &group, ValueDict &row) const {
+    for (uint i = 0; i < group_by.size(); i++)
+        row[group_by[i]] = group.key[i];
+    for (uint i = 0; i < aggregates.size(); i++) {
+        const Accumulator &accumulator = group.accumulators[i];
+        const AggregateSpec &aggregate = aggregates[i];
+        if (aggregate.function == AggregateSpec::COUNT) {
+            row[aggregate.output_name] = Value((int32_t) accumulator.count);
+            continue;
+        }
+        if (accumulator.count == 0)
+            continue;
+        switch (aggregate.function) {
+            case AggregateSpec::SUM:
+                if (accumulator.sum > INT32_MAX || accumulator.sum < INT32_MIN)
+                    throw DbRelationError("SUM(" + aggregate.column_name + ") does not fit into an INT");
+                row[aggregate.output_name] = Value((int32_t) accumulator.sum);
+                break;
+            case AggregateSpec::AVG:
+                row[aggregate.output_name] = Value((int32_t) (accumulator.sum / accumulator.count));
+                break;
+            case AggregateSpec::MIN:
+                row[aggregate.output_name] = accumulator.min;
+                break;
+            case AggregateSpec::MAX:
+                row[aggregate.output_name] = accumulator.max;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|           SORT           |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+/**
+    @param child          input rows
+    @param sort_keys      ORDER BY terms, most significant first
+    @param memory_budget  bytes of rows to buffer before writing a run
+    @param top_n          only the first top_n rows are wanted (< 0 for all)
+*/
+Sort::Sort(QueryOperator *child, const vector<SortKey> &sort_keys, size_t memory_budget, long top_n) :
+        child(child), sort_keys(sort_keys), memory_budget(memory_budget), top_n(top_n), buffer_memory(0),
+        emitted(0), runs_written(0), merging(false) {
+    this->column_names = child->get_column_names();
+    this->column_attributes = child->get_column_attributes();
+    for (auto const &sort_key: sort_keys)
+        attribute_of(sort_key.column_name, column_names, column_attributes);  // complain about unknown columns
+}
+
+Sort::~Sort() {
+    close();
+    delete child;
+}
+
+/**
+    Read all of the input, leaving it sorted in memory or in runs ready to be merged
+*/
+void Sort::open() {
+    close();
+    child->open();
+    ValueDict row;
+    u_int64_t sequence = 0;
+    while (child->next(row))
+        add(row, sequence++);
+    child->close();
+
+    if (top_n >= 0) {
+        sort_heap(buffer.begin(), buffer.end());
+        return;
+    }
+    sort(buffer.begin(), buffer.end());
+    if (spilled.empty())
+        return;
+
+    // the earliest runs are merged first and replaced by the result, so equal keys stay in input order
+    while (spilled.size() + 1 > MAX_FAN_IN) {
+        vector<DbRelation *> first(spilled.begin(), spilled.begin() + MAX_FAN_IN);
+        spilled.erase(spilled.begin(), spilled.begin() + MAX_FAN_IN);
+        spilled.insert(spilled.begin(), merge_runs(first));
+    }
+    start_merge(spilled, &buffer);
+    merging = true;
+}
+
+bool Sort::next(ValueDict &row) {
+    row.clear();
+    if (!merging) {
+        if (emitted >= buffer.size())
+            return false;
+        row = move(buffer[emitted++].row);
+        return true;
+    }
+    int winner = tree[0];
+    if (runs[winner].exhausted)
+        return false;
+    row = move(runs[winner].head.row);
+    advance(runs[winner]);
+    replay(winner);
+    return true;
+}
+
+void Sort::close() {
+    end_merge();
+    for (auto table: spilled) {
+        table->drop();
+        delete table;
+    }
+    spilled.clear();
+    buffer.clear();
+    buffer_memory = 0;
+    emitted = 0;
+    merging = false;
+}
+
+string Sort::describe() const {
+    string result = "Sort by";
+    string separator = " ";
+    for (auto const &sort_key: sort_keys) {
+        result += separator + sort_key.column_name + (sort_key.descending ? " DESC" : "");
+        separator = ", ";
+    }
+    if (top_n >= 0)
+        result += " (top " + to_string(top_n) + ")";
+    return result;
+}
+
+double Sort::estimate_rows() const {
+    double rows = child->estimate_rows();
+    return top_n >= 0 ? min(rows, (double) top_n) : rows;
+}
+
+/**
+    Encode the sort columns of a row so that byte-wise comparison of two keys gives their ORDER BY
+    order: INTs as big-endian with the sign bit flipped, TEXTs with 0 bytes escaped as 0 0xFF and
+    terminated by 0 0, and every byte of a DESC column inverted.
+    @param row  row with the sort columns
+    @returns    the key
+*/
+string Sort::normalized_key(const ValueDict &row) const {
+    string key;
+    for (auto const &sort_key: sort_keys) {
+        const Value &value = row.at(sort_key.column_name);
+        size_t start = key.size();
+        if (value.data_type == ColumnAttribute::INT) {
+            u_int32_t bits = (u_int32_t) value.n ^ 0x80000000U;
+            for (int shift = 24; shift >= 0; shift -= 8)
+                key += (char) (bits >> shift);
+        } else {
+            for (char c: value.s) {
+                key += c;
+                if (c == '\0')
+                    key += '\xFF';
+            }
+            key += '\0';
+            key += '\0';
+        }
+        if (sort_key.descending)
+            for (size_t i = start; i < key.size(); i++)
+                key[i] = ~key[i];
+    }
+    return key;
+}
+
+// Buffer a row: into the bounded heap for top-N, else into the current run (writing it out when full)
+void Sort::add(ValueDict &row, u_int64_t sequence) {
+    Entry entry;
+    entry.key = normalized_key(row);
+    entry.sequence = sequence;
+    entry.row = move(row);
+    if (top_n >= 0) {
+        // a max-heap of the best top_n rows so far: the worst of them is at the front
+        if (buffer.size() < (size_t) top_n) {
+            buffer.push_back(move(entry));
+            push_heap(buffer.begin(), buffer.end());
+        } else if (top_n > 0 && entry < buffer.front()) {
+            pop_heap(buffer.begin(), buffer.end());
+            buffer.back() = move(entry);
+            push_heap(buffer.begin(), buffer.end());
+        }
+        return;
+    }
+    size_t cost = sizeof(Entry) + entry.key.size();
+    for (auto const &column: entry.row)
+        cost += 64 + column.first.size() + column.second.s.size();
+    if (buffer_memory + cost > memory_budget && !buffer.empty())
+        spill_buffer();
+    buffer.push_back(move(entry));
+    buffer_memory += cost;
+}
+
+void Sort::spill_buffer() {
+    sort(buffer.begin(), buffer.end());
+    spilled.push_back(write_run(buffer));
+    buffer.clear();
+    buffer_memory = 0;
+}
+
+// Write sorted rows to a new temporary table
+DbRelation *Sort::write_run(vector<Entry> &entries) {
+    MemoryTable *table = new MemoryTable(temporary_table_name("_tmp_sort_"), column_names, column_attributes,
+                                         memory_budget / MAX_FAN_IN);
+    table->create();
+    for (auto const &entry: entries)
+        table->insert(&entry.row);
+    runs_written++;
+    return table;
+}
+
+// Merge runs into one new run; the given runs are dropped
+DbRelation *Sort::merge_runs(vector<DbRelation *> &tables) {
+    MemoryTable *merged = new MemoryTable(temporary_table_name("_tmp_sort_"), column_names, column_attributes,
+                                          memory_budget / MAX_FAN_IN);
+    merged->create();
+    start_merge(tables, nullptr);
+    for (int winner = tree[0]; !runs[winner].exhausted; winner = tree[0]) {
+        merged->insert(&runs[winner].head.row);
+        advance(runs[winner]);
+        replay(winner);
+    }
+    end_merge();
+    runs_written++;
+    return merged;
+}
+
+/**
+    Set up the loser tree over the given runs (which then belong to the merge) and, last, the
+    sorted entries still in memory
+*/
+void Sort::start_merge(vector<DbRelation *> &tables, vector<Entry> *memory) {
+    for (auto table: tables) {
+        Run run = {table, table->select(), 0, nullptr, Entry(), false};
+        runs.push_back(move(run));
+    }
+    tables.clear();
+    if (memory != nullptr) {
+        Run run = {nullptr, nullptr, 0, memory, Entry(), false};
+        runs.push_back(move(run));
+    }
+    for (auto &run: runs)
+        advance(run);
+
+    // play the initial tournament bottom up: leaves are at k..2k-1, node n plays 2n against 2n+1
+    int k = (int) runs.size();
+    tree.assign(k, 0);
+    vector<int> winners(2 * k);
+    for (int i = 0; i < k; i++)
+        winners[k + i] = i;
+    for (int n = k - 1; n >= 1; n--) {
+        int a = winners[2 * n], b = winners[2 * n + 1];
+        winners[n] = beats(a, b) ? a : b;
+        tree[n] = beats(a, b) ? b : a;
+    }
+    tree[0] = k == 1 ? 0 : winners[1];
+}
+
+// Load the next row of a run into its head
+void Sort::advance(Run &run) {
+    if (run.memory != nullptr) {
+        if (run.position < run.memory->size())
+            run.head = move((*run.memory)[run.position++]);
+        else
+            run.exhausted = true;
+        return;
+    }
+    if (run.position < run.handles->size()) {
+        ValueDict *row = run.table->project((*run.handles)[run.position++]);
+        run.head.row = move(*row);
+        delete row;
+        run.head.key = normalized_key(run.head.row);
+    } else {
+        run.exhausted = true;
+    }
+}
+
+// Does the head of run a come before the head of run b? Exhausted runs lose; ties go to the earlier run.
+bool Sort::beats(int a, int b) const {
+    if (runs[a].exhausted)
+        return false;
+    if (runs[b].exhausted)
+        return true;
+    int compared = runs[a].head.key.compare(runs[b].head.key);
+    return compared < 0 || (compared == 0 && a < b);
+}
+
+// After the winner's run advanced, replay its matches from its leaf up to the root
+void Sort::replay(int run) {
+    int k = (int) runs.size();
+    int winner = run;
+    for (int n = (run + k) / 2; n >= 1; n /= 2)
+        if (beats(tree[n], winner))
+            swap(tree[n], winner);
+    tree[0] = winner;
+}
+
+void Sort::end_merge() {
+    for (auto &run: runs) {
+        delete run.handles;
+        if (run.table != nullptr) {
+            run.table->drop();
+            delete run.table;
+        }
+    }
+    runs.clear();
+    tree.clear();
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|          LIMIT           |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+Limit::Limit(QueryOperator *child, u_int64_t limit, u_int64_t offset) : child(child), limit(limit), offset(offset),
+                                                                          produced(0) {
+    this->column_names = child->get_column_names();
+    this->column_attributes = child->get_column_attributes();
+}
+
+Limit::~Limit() {
+    delete child;
+}
+
+void Limit::open() {
+    child->open();
+    produced = 0;
+    ValueDict row;
+    for (u_int64_t skipped = 0; skipped < offset && child->next(row); skipped++);
+}
+
+bool Limit::next(ValueDict &row) {
+    row.clear();
+    if (produced >= limit || !child->next(row))
+        return false;
+    produced++;
+    return true;
+}
+
+void Limit::close() {
+    child->close();
+}
+
+string Limit::describe() const {
+    return "Limit " + to_string(limit) + (offset > 0 ? " offset " + to_string(offset) : "");
+}
+
+double Limit::estimate_rows() const {
+    return min((double) limit, max(0.0, child->estimate_rows() - offset));
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|       MATERIALIZE        |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+/**
+    @param child          the input
+    @param memory_budget  bytes of rows to keep in memory before the temporary table goes to a file
+*/
+Materialize::Materialize(QueryOperator *child, size_t memory_budget) : child(child), memory_budget(memory_budget),
+                                                                       table(nullptr), scan(nullptr) {
+    this->column_names = child->get_column_names();
+    this->column_attributes = child->get_column_attributes();
+}
+
+Materialize::~Materialize() {
+    close();
+    delete child;
+}
+
+/**
+    Read all of the input into the temporary table
+*/
+void Materialize::open() {
+    close();
+    table = new MemoryTable(temporary_table_name("_tmp_rows_"), column_names, column_attributes, memory_budget);
+    table->create();
+    child->open();
+    ValueDict row;
+    while (child->next(row))
+        table->insert(&row);
+    child->close();
+    scan = new TableScan(*table);
+    scan->open();
+}
+
+bool Materialize::next(ValueDict &row) {
+    row.clear();
+    return scan != nullptr && scan->next(row);
+}
+
+void Materialize::close() {
+    delete scan;
+    scan = nullptr;
+    if (table != nullptr) {
+        table->drop();
+        delete table;
+        table = nullptr;
+    }
+}
+
+string Materialize::describe() const {
+    return "Materialize";
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|        HASH JOIN         |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+HashJoin::HashJoin(QueryOperator *probe, QueryOperator *build, const ColumnNames &probe_keys,
+                   const ColumnNames &build_keys, double selectivity) :
+        probe(probe), build(build), probe_keys(probe_keys), build_keys(build_keys), selectivity(selectivity),
+        matches(nullptr), position(0) {
+    try {
+        this->column_names = probe->get_column_names();
+        this->column_attributes = probe->get_column_attributes();
+        const ColumnNames &build_names = build->get_column_names();
+        for (uint i = 0; i < build_names.size(); i++) {
+            if (find(this->column_names.begin(), this->column_names.end(), build_names[i]) != this->column_names.end())
+                throw DbRelationError("both inputs of a join have a column " + build_names[i]);
+            this->column_names.push_back(build_names[i]);
+            this->column_attributes.push_back(build->get_column_attributes()[i]);
+        }
+        for (uint i = 0; i < probe_keys.size(); i++)
+            if (attribute_of(probe_keys[i], probe->get_column_names(), probe->get_column_attributes()).get_data_type()
+                != attribute_of(build_keys[i], build_names, build->get_column_attributes()).get_data_type())
+                throw DbRelationError("can't join " + probe_keys[i] + " to " + build_keys[i] + ", of another type");
+    } catch (...) {
+        delete probe;
+        delete build;
+        throw;
+    }
+}
+
+HashJoin::~HashJoin() {
+    delete probe;
+    delete build;
+}
+
+void HashJoin::open() {
+    open_stream();
+    probe->open();
+    matches = nullptr;
+    position = 0;
+}
+
+// hash the whole build input
+void HashJoin::open_stream() {
+    table.clear();
+    build->open();
+    ValueDict row;
+    while (build->next(row))
+        table[key(row, build_keys)].push_back(row);
+    build->close();
+}
+
+void HashJoin::stream(const ValueDict &row, vector<ValueDict> &rows) const {
+    auto found = table.find(key(row, probe_keys));
+    if (found == table.end())
+        return;
+    for (auto const &match: found->second) {
+        rows.push_back(row);
+        for (auto const &column: match)
+            rows.back()[column.first] = column.second;
+    }
+}
+
+void HashJoin::close_stream() {
+    table.clear();
+}
+
+bool HashJoin::next(ValueDict &row) {
+    row.clear();
+    while (matches == nullptr || position >= matches->size()) {
+        if (!probe->next(probe_row))
+            return false;
+        auto found = table.find(key(probe_row, probe_keys));
+        matches = found == table.end() ? nullptr : &found->second;
+        position = 0;
+    }
+    row = probe_row;
+    for (auto const &column: (*matches)[position++])
+        row[column.first] = column.second;
+    return true;
+}
+
+void HashJoin::close() {
+    probe->close();
+    close_stream();
+    matches = nullptr;
+}
+
+string HashJoin::describe() const {
+    string result = probe_keys.empty() ? "HashJoin (cross product)" : "HashJoin on";
+    string separator = " ";
+    for (uint i = 0; i < probe_keys.size(); i++) {
+        result += separator + probe_keys[i] + " = " + build_keys[i];
+        separator = " AND ";
+    }
+    return result + ", hashing the second input";
+}
+
+void HashJoin::set_inputs(const vector<QueryOperator *> &inputs) {
+    probe = inputs.at(0);
+    build = inputs.at(1);
+}
+
+double HashJoin::estimate_rows() const {
+    return probe->estimate_rows() * build->estimate_rows() * selectivity;
+}
+
+// the key values of a row, each tagged with its type so different values never run together
+string HashJoin::key(const ValueDict &row, const ColumnNames &key_names) {
+    string result;
+    for (auto const &key_name: key_names) {
+        const Value &value = row.at(key_name);
+        if (value.data_type == ColumnAttribute::INT) {
+            result += 'i';
+            result.append((const char *) &value.n, sizeof(value.n));
+        } else {
+            u_int32_t size = (u_int32_t) value.s.size();
+            result += 't';
+            result.append((const char *) &size, sizeof(size));
+            result += value.s;
+        }
+    }
+    return result;
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|        INSTRUMENT        |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+Instrument::Instrument(QueryOperator *wrapped) : rows(0), loops(0), pages_read(0), page_hits(0), wall_ns(0),
+                                                 cpu_ns(0), wrapped(wrapped) {
+    this->column_names = wrapped->get_column_names();
+    this->column_attributes = wrapped->get_column_attributes();
+}
+
+Instrument::~Instrument() {
+    delete wrapped;
+}
+
+void Instrument::open() {
+    Mark start = mark();
+    wrapped->open();
+    loops++;
+    add_since(start);
+}
+
+bool Instrument::next(ValueDict &row) {
+    Mark start = mark();
+    bool more = wrapped->next(row);
+    rows += more;
+    add_since(start);
+    return more;
+}
+
+void Instrument::close() {
+    Mark start = mark();
+    wrapped->close();
+    add_since(start);
+}
+
+string Instrument::report() const {
+    char text[200];
+    snprintf(text, sizeof(text), "actual rows %llu, loops %llu, pages read %llu, hits %llu, time %.3f ms, CPU %.3f ms",
+             (unsigned long long) rows, (unsigned long long) loops, (unsigned long long) pages_read,
+             (unsigned long long) page_hits, wall_ns / 1e6, cpu_ns / 1e6);
+    return text;
+}
+
+Instrument::Mark Instrument::mark() const {
+    Mark now;
+    now.pages_read = HeapFile::pages_read.load(memory_order_relaxed);
+    now.page_hits = HeapFile::page_hits.load(memory_order_relaxed);
+    now.wall_ns = (u_int64_t) chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    now.cpu_ns = (u_int64_t) cpu.tv_sec * 1000000000 + cpu.tv_nsec;
+    return now;
+}
+
+void Instrument::add_since(const Mark &start) {
+    Mark end = mark();
+    pages_read += end.pages_read - start.pages_read;
+    page_hits += end.page_hits - start.page_hits;
+    wall_ns += end.wall_ns - start.wall_ns;
+    cpu_ns += end.cpu_ns - start.cpu_ns;
+}
+
+QueryOperator *instrument(QueryOperator *plan) {
+    vector<QueryOperator *> inputs = plan->get_inputs();
+    if (!inputs.empty()) {
+        for (auto &input: inputs)
+            input = instrument(input);
+        plan->set_inputs(inputs);
+    }
+    return new Instrument(plan);
+}
+
+// the line of an operator, then those of its inputs, each indented one step further
+static void explain(const QueryOperator *op, const string &indent, string &text) {
+    char estimate[32];
+    snprintf(estimate, sizeof(estimate), "%.0f", op->estimate_rows());
+    text += (text.empty() ? "" : "\n") + indent + (indent.empty() ? "" : "-> ") + op->describe()
+            + "  (rows ~" + estimate;
+    const Instrument *instrumented = dynamic_cast<const Instrument *>(op);
+    if (instrumented != nullptr)
+        text += "; " + instrumented->report();
+    text += ")";
+    for (auto input: op->get_inputs())
+        explain(input, indent + "  ", text);
+}
+
+string explain(const QueryOperator *plan) {
+    string text;
+    explain(plan, "", text);
+    return text;
+}
+
+/**
+ * Testing function for the query operators.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_query_operators() {
+    ColumnNames column_names;
+    column_names.push_back("g");
+    column_names.push_back("x");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("_test_operators_cpp", column_names, column_attributes);
+    table.create();
+    const int ROWS = 1000, GROUPS = 37;
+    ValueDict row;
+    for (int i = 0; i < ROWS; i++) {
+        row["g"] = Value("g" + to_string(i % GROUPS));
+        row["x"] = Value(i);
+        table.insert(&row);
+    }
+
+    vector<AggregateSpec> aggregates;
+    aggregates.push_back(AggregateSpec(AggregateSpec::COUNT, "", "n"));
+    aggregates.push_back(AggregateSpec(AggregateSpec::SUM, "x", "total"));
+    aggregates.push_back(AggregateSpec(AggregateSpec::MIN, "x", "low"));
+    aggregates.push_back(AggregateSpec(AggregateSpec::MAX, "x", "high"));
+    aggregates.push_back(AggregateSpec(AggregateSpec::AVG, "x", "mean"));
+
+    // whether an aggregate grouped by g has the right groups
+    auto right_groups = [&](HashAggregate &grouped) {
+        int groups = 0, rows = 0;
+        while (grouped.next(row)) {
+            int g = atoi(row["g"].s.c_str() + 1);
+            int n = row["n"].n;
+            int expected_sum = 0;
+            for (int i = g; i < ROWS; i += GROUPS)
+                expected_sum += i;
+            if (n != (ROWS - g + GROUPS - 1) / GROUPS || row["total"].n != expected_sum || row["low"].n != g
+                || row["mean"].n != expected_sum / n)
+                return false;
+            groups++;
+            rows += n;
+        }
+        return groups == GROUPS && rows == ROWS;
+    };
+
+    // a tiny budget forces most groups through the spill partitions
+    HashAggregate grouped(new TableScan(table), ColumnNames(1, "g"), aggregates, column_names, column_attributes, 2000);
+    grouped.open();
+    if (!right_groups(grouped) || grouped.get_spilled_rows() == 0)
+        return false;
+    grouped.close();
+
+    // no GROUP BY over a filter that keeps nothing: one row, COUNT 0, SUM NULL
+    vector<Comparison> nothing(1, Comparison("x", Comparison::LT, Value(0)));
+    HashAggregate empty(new Filter(new TableScan(table), nothing), ColumnNames(), aggregates, column_names,
+                        column_attributes);
+    empty.open();
+    if (!empty.next(row) || row["n"].n != 0 || row.count("total") != 0 || empty.next(row))
+        return false;
+    empty.close();
+
+    // partials over two halves of the input, merged
+    HashAggregate total(nullptr, ColumnNames(), aggregates, column_names, column_attributes);
+    HashAggregate half(nullptr, ColumnNames(), aggregates, column_names, column_attributes);
+    TableScan scan(table);
+    scan.open();
+    for (int i = 0; scan.next(row); i++)
+        (i % 2 == 0 ? total : half).consume(row);
+    scan.close();
+    total.merge(half);
+    total.open();
+    if (!total.next(row) || row["n"].n != ROWS || row["total"].n != ROWS * (ROWS - 1) / 2 || row["high"].n != ROWS - 1)
+        return false;
+    total.close();
+
+    // grouped partials merged within a tiny budget: the groups that don't fit are spilled, not kept
+    HashAggregate merged(nullptr, ColumnNames(1, "g"), aggregates, column_names, column_attributes, 2000);
+    vector<HashAggregate *> shares;
+    for (int i = 0; i < 3; i++)
+        shares.push_back(new HashAggregate(nullptr, ColumnNames(1, "g"), aggregates, column_names, column_attributes));
+    scan.open();
+    for (int i = 0; scan.next(row); i++)
+        shares[i % 3]->consume(row);
+    scan.close();
+    for (auto share: shares) {
+        merged.merge(*share);
+        delete share;
+    }
+    if (merged.get_spilled_rows() == 0 || merged.get_group_count() >= (size_t) GROUPS)
+        return false;
+    merged.open();
+    if (!right_groups(merged))
+        return false;
+    merged.close();
+
+    // WHERE x >= 10 AND g = 'g3', projected and renamed
+    ValueDict where;
+    where["g"] = Value("g3");
+    vector<Comparison> comparisons(1, Comparison("x", Comparison::GE, Value(10)));
+    Projection projection(new Filter(new TableScan(table, &where), comparisons), ColumnNames(1, "x"),
+                          ColumnNames(1, "y"));
+    projection.open();
+    if (!projection.next(row) || row.size() != 1 || row["y"].n != 40)
+        return false;
+    projection.close();
+
+    // ORDER BY g DESC, x with a budget small enough for well over MAX_FAN_IN runs
+    vector<SortKey> sort_keys;
+    sort_keys.push_back(SortKey("g", true));
+    sort_keys.push_back(SortKey("x"));
+    Sort sorted(new TableScan(table), sort_keys, 1000);
+    sorted.open();
+    if (sorted.get_run_count() <= Sort::MAX_FAN_IN)
+        return false;
+    ValueDict previous;
+    int rows = 0;
+    while (sorted.next(row)) {
+        if (rows > 0 && (previous["g"].s < row["g"].s || (previous["g"].s == row["g"].s && previous["x"].n > row["x"].n)))
+            return false;
+        previous = row;
+        rows++;
+    }
+    if (rows != ROWS)
+        return false;
+    sorted.close();
+
+    // ORDER BY x DESC LIMIT 3 OFFSET 2 keeps five rows, nothing spilled
+    Limit top(new Sort(new TableScan(table), vector<SortKey>(1, SortKey("x", true)), 1000, 5), 3, 2);
+    top.open();
+    for (int expected = ROWS - 3; expected > ROWS - 6; expected--)
+        if (!top.next(row) || row["x"].n != expected)
+            return false;
+    if (top.next(row))
+        return false;
+    top.close();
+
+    // LIMIT 3 straight off a scan reads the first page once, plus once per row to project it
+    if (StorageStats::enabled()) {
+        StorageStats::reset(table.get_table_name());
+        Limit first(new TableScan(table), 3);
+        first.open();
+        for (int expected = 0; expected < 3; expected++)
+            if (!first.next(row) || row["x"].n != expected)
+                return false;
+        if (first.next(row) || StorageStats::calls(table.get_table_name(), STATS_HEAPFILE_GET) != 1 + 3)
+            return false;
+        first.close();
+    }
+
+    // EXPLAIN ANALYZE of WHERE x >= 10 LIMIT 3: the scan has to read 13 rows for the 3
+    QueryOperator *plan = instrument(new Limit(new Filter(new TableScan(table), comparisons), 3));
+    plan->open();
+    while (plan->next(row))
+        continue;
+    plan->close();
+    Instrument *limited = dynamic_cast<Instrument *>(plan);
+    Instrument *filtered = dynamic_cast<Instrument *>(plan->get_child());
+    Instrument *scanned = dynamic_cast<Instrument *>(filtered->get_child());
+    if (limited->rows != 3 || limited->loops != 1 || filtered->rows != 3 || scanned->rows != 13
+        || scanned->pages_read + scanned->page_hits == 0 || limited->wall_ns < scanned->wall_ns)
+        return false;
+    if (scanned->estimate_rows() < ROWS / 2 || scanned->estimate_rows() > ROWS * 2 || limited->estimate_rows() != 3)
+        return false;
+    string text = explain(plan);
+    if (text.find("Limit 3  (rows ~3; actual rows 3, loops 1") != 0 || text.find("\n  -> Filter x >= 10") == string::npos
+        || text.find("\n    -> TableScan _test_operators_cpp  (rows ~") == string::npos
+        || text.find("actual rows 13,") == string::npos)
+        return false;
+    delete plan;
+
+    // INSERT INTO t SELECT * FROM t: the materialized scan doesn't see the rows inserted behind it
+    Materialize copied(new TableScan(table), 1000);
+    copied.open();
+    int copies = 0;
+    while (copied.next(row) && copies <= ROWS) {
+        table.insert(&row);
+        copies++;
+    }
+    copied.close();
+    Handles *handles = table.select();
+    if (copies != ROWS || handles->size() != (size_t) 2 * ROWS)
+        return false;
+    delete handles;
+
+    table.drop();
+    return true;
+}
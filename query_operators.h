@@ -0,0 +1,708 @@
+/**
+ * @file query_operators.h - the pull-based operators the executor builds query plans from
+ *
+ * Each operator produces rows (ValueDicts keyed by its output column names) one at a time:
+ *      open(), then next(row) until it returns false, then close()
+ * and owns its input operator. The plan for
+ *      SELECT g, COUNT(*) FROM t WHERE a = 1 AND b > 2 GROUP BY g
+ * is HashAggregate(Filter(TableScan(t, where a = 1), b > 2), group by g, COUNT(*)).
+ * Aggregation and sorting keep their working set within a memory budget and spill the rest to
+ * temporary tables (named _tmp_*, see MemoryTable), which they drop again when closed. Those stay in
+ * memory too, up to a budget of their own, before they go to Berkeley DB files.
+ * A join of several tables is a tree of HashJoins over a scan (and filter) per table, ordered by
+ * order_joins() (see join_order.h).
+ * explain() prints a plan as a tree, with how many rows each operator is expected to produce; a
+ * plan wrapped by instrument() (EXPLAIN ANALYZE) also tells what each operator actually did.
+ * Operators that work a row at a time (Filter, Projection, the probe side of a HashJoin) can also be
+ * run without pulling: stream() passes them one row at a time, from any thread. That is how a
+ * ParallelAggregate runs its input on morsels of a heap table (see morsel.h).
+ */
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "storage_engine.h"
+
+class HeapTable;
+
+/**
+ * @class QueryOperator - abstract base of all plan operators
+ */
+class QueryOperator {
+public:
+    QueryOperator() {}
+
+    virtual ~QueryOperator() {}
+
+    QueryOperator(const QueryOperator &other) = delete;
+
+    QueryOperator &operator=(const QueryOperator &other) = delete;
+
+    virtual void open() = 0;
+
+    /**
+     * Produce the next row.
+     * @param row  cleared and filled with the row's values
+     * @returns    false when there are no more rows (row is then left empty)
+     */
+    virtual bool next(ValueDict &row) = 0;
+
+    virtual void close() = 0;
+
+    virtual const ColumnNames &get_column_names() const { return column_names; }
+
+    virtual const ColumnAttributes &get_column_attributes() const { return column_attributes; }
+
+    // one line describing this operator (without its input), for EXPLAIN-style output
+    virtual std::string describe() const = 0;
+
+    virtual QueryOperator *get_child() const { return nullptr; }
+
+    // replace the input, for operators that have one (the old input is no longer theirs to delete)
+    virtual void set_child(QueryOperator *child) {}
+
+    // all the inputs, for operators with more than one (get_child() is the first)
+    virtual std::vector<QueryOperator *> get_inputs() const;
+
+    // replace all the inputs, as set_child()
+    virtual void set_inputs(const std::vector<QueryOperator *> &inputs);
+
+    // about how many rows this operator produces, for EXPLAIN
+    virtual double estimate_rows() const;
+
+    // whether the operator can stream() rows instead of pulling them from its input
+    virtual bool streams() const { return false; }
+
+    // get ready to stream(), without opening the input (which is never pulled from)
+    virtual void open_stream() {}
+
+    /**
+     * What the operator makes of one row of its input; may be called from several threads at once.
+     * @param row   an input row
+     * @param rows  gets the rows it makes of it (none, one or more)
+     */
+    virtual void stream(const ValueDict &row, std::vector<ValueDict> &rows) const {}
+
+    virtual void close_stream() {}
+
+protected:
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+};
+
+/**
+ * @class TableScan - rows of a relation matching an equality where-clause, restricted to some columns
+ *
+ *      Handles are fetched from the relation a batch at a time, starting with a small batch and
+ *      doubling it, so a consumer that stops early (a LIMIT) only makes the relation read the first
+ *      few pages. A limit hint makes the first batch exactly as big as the consumer will need.
+ *      Ranges on INT columns (the consumer filters by them itself) let the relation skip blocks.
+ */
+class TableScan : public QueryOperator {
+public:
+    static const size_t FIRST_BATCH = 1;
+    static const size_t MAX_BATCH = 64 * 1024;
+
+    TableScan(DbRelation &relation, const ValueDict *where = nullptr, const ColumnNames *column_names = nullptr);
+
+    virtual ~TableScan();
+
+    virtual void open();
+
+    virtual bool next(ValueDict &row);
+
+    virtual void close();
+
+    virtual std::string describe() const;
+
+    // the consumer wants at most this many rows (it may still ask for more)
+    virtual void set_limit(size_t limit) { this->limit = limit; }
+
+    // the rows wanted lie within these bounds (the scan may still return others)
+    virtual void set_ranges(const IntRanges &ranges) { this->ranges = ranges; }
+
+    virtual double estimate_rows() const;
+
+    // the relation if it is a heap table, which can be scanned a few blocks at a time (or nullptr)
+    virtual HeapTable *heap_table() const;
+
+    /**
+     * The rows next() would produce from some blocks of a heap table; may be called from several threads at once.
+     * @param first  first block
+     * @param last   last block
+     * @param rows   gets the rows
+     */
+    virtual void scan_blocks(BlockID first, BlockID last, std::vector<ValueDict> &rows) const;
+
+    virtual DbRelation &get_relation() const { return relation; }
+
+protected:
+    DbRelation &relation;
+    ValueDict *where;
+    IntRanges ranges;
+    size_t limit;
+    Handles *handles;  // the current batch
+    size_t position;  // within the batch
+    BlockID resume;  // where the relation continues the scan for the next batch, 0 once it is done
+    size_t batch;  // size of the next batch
+    bool started;
+
+    virtual bool fetch();
+};
+
+/**
+ * @class Comparison - one <column> <op> <literal> predicate
+ */
+class Comparison {
+public:
+    enum Op {
+        EQ, NE, LT, LE, GT, GE
+    };
+
+    Comparison(Identifier column_name, Op op, Value value) : column_name(column_name), op(op), value(value) {}
+
+    virtual ~Comparison() {}
+
+    virtual bool matches(const ValueDict &row) const;
+
+    virtual std::string to_string() const;
+
+    // the share of rows expected to satisfy a comparison like this one
+    virtual double selectivity() const;
+
+    Identifier column_name;
+    Op op;
+    Value value;
+};
+
+/**
+ * @class Filter - passes on the rows of its input that satisfy all of its comparisons
+ */
+class Filter : public QueryOperator {
+public:
+    Filter(QueryOperator *child, const std::vector<Comparison> &comparisons);
+
+    virtual ~Filter();
+
+    virtual void open();
+
+    virtual bool next(ValueDict &row);
+
+    virtual void close();
+
+    virtual std::string describe() const;
+
+    virtual QueryOperator *get_child() const { return child; }
+
+    virtual void set_child(QueryOperator *child) { this->child = child; }
+
+    virtual double estimate_rows() const;
+
+    virtual bool streams() const { return true; }
+
+    virtual void stream(const ValueDict &row, std::vector<ValueDict> &rows) const;
+
+protected:
+    QueryOperator *child;
+    std::vector<Comparison> comparisons;
+
+    virtual bool matches(const ValueDict &row) const;
+};
+
+/**
+ * @class Projection - picks (and optionally renames) columns of its input
+ */
+class Projection : public QueryOperator {
+public:
+    Projection(QueryOperator *child, const ColumnNames &input_names, const ColumnNames &output_names);
+
+    virtual ~Projection();
+
+    virtual void open();
+
+    virtual bool next(ValueDict &row);
+
+    virtual void close();
+
+    virtual std::string describe() const;
+
+    virtual QueryOperator *get_child() const { return child; }
+
+    virtual void set_child(QueryOperator *child) { this->child = child; }
+
+    virtual bool streams() const { return true; }
+
+    virtual void stream(const ValueDict &row, std::vector<ValueDict> &rows) const;
+
+protected:
+    QueryOperator *child;
+    ColumnNames input_names;
+    ValueDict input_row;
+};
+
+/**
+ * @class AggregateSpec - one aggregate to compute, e.g. SUM(price) AS total
+ */
+class AggregateSpec {
+public:
+    enum Function {
+        COUNT, SUM, MIN, MAX, AVG
+    };
+
+    // column_name is empty for COUNT(*)
+    AggregateSpec(Function function, Identifier column_name, Identifier output_name) : function(function),
+            column_name(column_name), output_name(output_name) {}
+
+    virtual ~AggregateSpec() {}
+
+    static std::string function_name(Function function);
+
+    Function function;
+    Identifier column_name;
+    Identifier output_name;
+};
+
+/**
+ * @class HashAggregate - GROUP BY with COUNT/SUM/MIN/MAX/AVG in one pass over its input
+ *
+ *      Groups live in an open-addressing hash table (linear probing) keyed by the group columns.
+ *      When the table would grow past the memory budget, rows of groups not yet in memory are
+ *      hash-partitioned into temporary heap tables instead, and each partition is aggregated on
+ *      its own once the input is used up (partitioning again if a partition is still too big).
+ *      Groups in memory and groups in partitions never overlap, so each group comes out once.
+ *
+ *      For parallel scans each thread aggregates its share into its own HashAggregate with
+ *      consume() and the partials are combined with merge() before the results are read. Groups
+ *      merged in count against the budget like any other; those that don't fit are spilled as they
+ *      are (their accumulators, not their rows) into partitions of their own, which are read back
+ *      along with the rows of the same partition.
+ *      SUM is added up in 64 bits and must fit into an INT at the end; AVG of INTs is an INT
+ *      (truncated, as in SQL Server).
+ */
+class HashAggregate : public QueryOperator {
+public:
+    static const size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+    static const uint NUM_PARTITIONS = 16;
+    static const uint MAX_SPILL_DEPTH = 4;
+
+    // child may be nullptr for a partial fed with consume()
+    HashAggregate(QueryOperator *child, const ColumnNames &group_by, const std::vector<AggregateSpec> &aggregates,
+                  const ColumnNames &input_names, const ColumnAttributes &input_attributes,
+                  size_t memory_budget = DEFAULT_MEMORY_BUDGET);
+
+    virtual ~HashAggregate();
+
+    virtual void open();
+
+    virtual bool next(ValueDict &row);
+
+    virtual void close();
+
+    virtual std::string describe() const;
+
+    virtual QueryOperator *get_child() const { return child; }
+
+    virtual void set_child(QueryOperator *child) { this->child = child; }
+
+    virtual double estimate_rows() const;
+
+    virtual void consume(const ValueDict &row);
+
+    virtual void merge(HashAggregate &partial);
+
+    virtual size_t get_group_count() const { return groups.size(); }
+
+    // rows, and groups of merged partials, written to partitions
+    virtual u_int64_t get_spilled_rows() const { return spilled_rows; }
+
+protected:
+    struct Accumulator {
+        int64_t count;
+        int64_t sum;
+        Value min;
+        Value max;
+
+        Accumulator() : count(0), sum(0) {}
+    };
+
+    struct Group {
+        std::vector<Value> key;
+        std::vector<Accumulator> accumulators;
+        size_t hash;
+    };
+
+    // the spilled rows and merged groups of the same groups, waiting to be aggregated
+    struct Partition {
+        DbRelation *rows;  // nullptr if there are none
+        DbRelation *groups;  // the same
+        uint depth;
+    };
+
+    QueryOperator *child;
+    ColumnNames group_by;
+    std::vector<AggregateSpec> aggregates;
+    ColumnNames input_names;  // the input columns this aggregate reads (what partitions store)
+    ColumnAttributes input_attributes;
+    ColumnNames group_names;  // the key and accumulators of a group (what partitions of merged groups store)
+    ColumnAttributes group_attributes;
+    size_t memory_budget;
+    size_t memory_used;
+    std::vector<Group> groups;
+    std::vector<u_int32_t> slots;  // index into groups + 1, 0 for empty
+    uint depth;  // how many times the rows being aggregated now were partitioned
+    std::vector<DbRelation *> partitions;  // spilled rows for the current depth
+    std::vector<DbRelation *> group_partitions;  // spilled merged groups for the current depth
+    std::vector<Partition> pending;  // partitions waiting to be aggregated
+    size_t emitted;
+    u_int64_t spilled_rows;
+    bool done_input;
+
+    virtual size_t hash_key(const std::vector<Value> &key) const;
+
+    virtual long find_group(const std::vector<Value> &key, size_t hash) const;
+
+    virtual Group &add_group(const std::vector<Value> &key, size_t hash);
+
+    virtual size_t group_cost(const std::vector<Value> &key) const;
+
+    virtual void merge_group(const std::vector<Value> &key, size_t hash, const std::vector<Accumulator> &accumulators);
+
+    virtual void grow_slots();
+
+    virtual void accumulate(Group &group, const ValueDict &row);
+
+    virtual void spill(const ValueDict &row, size_t hash);
+
+    virtual void spill_group(const std::vector<Value> &key, size_t hash, const std::vector<Accumulator> &accumulators);
+
+    virtual DbRelation *partition_for(std::vector<DbRelation *> &partitions, size_t hash, const ColumnNames &names,
+                                      const ColumnAttributes &attributes);
+
+    virtual void load_rows(DbRelation *partition);
+
+    virtual void load_groups(DbRelation *partition);
+
+    virtual void finish_input();
+
+    virtual bool load_next_partition();
+
+    virtual void clear_groups();
+
+    virtual void drop_partitions();
+
+    virtual void output(const Group &group, ValueDict &row) const;
+};
+
+/**
+ * @class SortKey - one ORDER BY term
+ */
+class SortKey {
+public:
+    SortKey(Identifier column_name, bool descending = false) : column_name(column_name), descending(descending) {}
+
+    virtual ~SortKey() {}
+
+    Identifier column_name;
+    bool descending;
+};
+
+/**
+ * @class Sort - ORDER BY as an external merge sort
+ *
+ *      Rows are buffered with a normalized key (the sort columns encoded so that comparing the
+ *      bytes gives the ORDER BY order) until the memory budget is used up; each full buffer is
+ *      sorted and written to a temporary table as a run. A run keeps a MAX_FAN_IN-th of the budget
+ *      in memory and spills the rest to disk, so the runs of a merge stay within the budget. The
+ *      runs, plus the last buffer which stays in memory, are then merged with a loser tree, in
+ *      several passes if there are more than MAX_FAN_IN of them. Input that fits into the budget is simply sorted in memory.
+ *      With a top_n (ORDER BY ... LIMIT n) only the best n rows are kept, in a bounded heap, and
+ *      nothing is ever written out. Rows with equal keys keep their input order.
+ */
+class Sort : public QueryOperator {
+public:
+    static const size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+    static const uint MAX_FAN_IN = 64;
+
+    // top_n < 0 sorts all rows
+    Sort(QueryOperator *child, const std::vector<SortKey> &sort_keys, size_t memory_budget = DEFAULT_MEMORY_BUDGET,
+         long top_n = -1);
+
+    virtual ~Sort();
+
+    virtual void open();
+
+    virtual bool next(ValueDict &row);
+
+    virtual void close();
+
+    virtual std::string describe() const;
+
+    virtual QueryOperator *get_child() const { return child; }
+
+    virtual void set_child(QueryOperator *child) { this->child = child; }
+
+    virtual double estimate_rows() const;
+
+    virtual size_t get_run_count() const { return runs_written; }
+
+    virtual std::string normalized_key(const ValueDict &row) const;
+
+protected:
+    struct Entry {
+        std::string key;
+        u_int64_t sequence;  // input order, to break ties
+        ValueDict row;
+
+        bool operator<(const Entry &other) const {
+            int compared = key.compare(other.key);
+            return compared < 0 || (compared == 0 && sequence < other.sequence);
+        }
+    };
+
+    // a sorted run being merged: a spilled temporary table, or the last buffer in memory
+    struct Run {
+        DbRelation *table;
+        Handles *handles;
+        size_t position;
+        std::vector<Entry> *memory;
+        Entry head;
+        bool exhausted;
+    };
+
+    QueryOperator *child;
+    std::vector<SortKey> sort_keys;
+    size_t memory_budget;
+    long top_n;
+    std::vector<Entry> buffer;
+    size_t buffer_memory;
+    size_t emitted;
+    std::vector<DbRelation *> spilled;
+    std::vector<Run> runs;
+    std::vector<int> tree;  // loser tree over runs: tree[0] is the winner, tree[1..] the losers
+    size_t runs_written;
+    bool merging;
+
+    virtual void add(ValueDict &row, u_int64_t sequence);
+
+    virtual void spill_buffer();
+
+    virtual DbRelation *write_run(std::vector<Entry> &entries);
+
+    virtual DbRelation *merge_runs(std::vector<DbRelation *> &tables);
+
+    virtual void start_merge(std::vector<DbRelation *> &tables, std::vector<Entry> *memory);
+
+    virtual void advance(Run &run);
+
+    virtual bool beats(int a, int b) const;
+
+    virtual void replay(int run);
+
+    virtual void end_merge();
+};
+
+/**
+ * @class Limit - passes on at most limit rows of its input, after skipping offset rows
+ */
+class Limit : public QueryOperator {
+public:
+    Limit(QueryOperator *child, u_int64_t limit, u_int64_t offset = 0);
+
+    virtual ~Limit();
+
+    virtual void open();
+
+    virtual bool next(ValueDict &row);
+
+    virtual void close();
+
+    virtual std::string describe() const;
+
+    virtual QueryOperator *get_child() const { return child; }
+
+    virtual void set_child(QueryOperator *child) { this->child = child; }
+
+    virtual double estimate_rows() const;
+
+protected:
+    QueryOperator *child;
+    u_int64_t limit;
+    u_int64_t offset;
+    u_int64_t produced;
+};
+
+/**
+ * @class Materialize - passes on the rows of its input, all of which it reads into a temporary
+ *      table (see MemoryTable) before the first one comes out
+ *
+ *      For INSERT INTO t SELECT ... FROM t, whose SELECT must not see the rows the INSERT adds.
+ */
+class Materialize : public QueryOperator {
+public:
+    static const size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+
+    Materialize(QueryOperator *child, size_t memory_budget = DEFAULT_MEMORY_BUDGET);
+
+    virtual ~Materialize();
+
+    virtual void open();
+
+    virtual bool next(ValueDict &row);
+
+    virtual void close();
+
+    virtual std::string describe() const;
+
+    virtual QueryOperator *get_child() const { return child; }
+
+    virtual void set_child(QueryOperator *child) { this->child = child; }
+
+protected:
+    QueryOperator *child;
+    size_t memory_budget;
+    DbRelation *table;  // the rows, once open
+    QueryOperator *scan;  // of the table
+};
+
+/**
+ * @class HashJoin - inner equi-join: the rows of the build input are hashed by their keys, then
+ *      each row of the probe input comes out joined with every build row with the same keys
+ *
+ *      The inputs' column names must not overlap (the planner qualifies them with their table).
+ *      Without keys every row joins every row (a cross product). The build input is kept in memory
+ *      whole, so the planner builds on the input it expects to be smaller.
+ */
+class HashJoin : public QueryOperator {
+public:
+    /**
+     * @param probe        input streamed through (the join's from now on, freed if it can't be made)
+     * @param build        input hashed (likewise)
+     * @param probe_keys   columns of the probe rows to match ...
+     * @param build_keys   ... to these columns of the build rows, in the same order
+     * @param selectivity  the share of all pairs of rows expected to join, for estimate_rows()
+     */
+    HashJoin(QueryOperator *probe, QueryOperator *build, const ColumnNames &probe_keys, const ColumnNames &build_keys,
+             double selectivity = 1.0);
+
+    virtual ~HashJoin();
+
+    virtual void open();
+
+    virtual bool next(ValueDict &row);
+
+    virtual void close();
+
+    virtual std::string describe() const;
+
+    virtual QueryOperator *get_child() const { return probe; }
+
+    virtual void set_child(QueryOperator *child) { this->probe = child; }
+
+    virtual std::vector<QueryOperator *> get_inputs() const { return {probe, build}; }
+
+    virtual void set_inputs(const std::vector<QueryOperator *> &inputs);
+
+    virtual double estimate_rows() const;
+
+    // the probe input streams: stream() joins a probe row
+    virtual bool streams() const { return true; }
+
+    // hash the build input
+    virtual void open_stream();
+
+    virtual void stream(const ValueDict &row, std::vector<ValueDict> &rows) const;
+
+    virtual void close_stream();
+
+protected:
+    QueryOperator *probe;
+    QueryOperator *build;
+    ColumnNames probe_keys;
+    ColumnNames build_keys;
+    double selectivity;
+    std::unordered_map<std::string, std::vector<ValueDict>> table;  // build rows by key
+    ValueDict probe_row;
+    const std::vector<ValueDict> *matches;  // build rows joining probe_row
+    size_t position;  // next of them to join
+
+    static std::string key(const ValueDict &row, const ColumnNames &key_names);
+};
+
+/**
+ * @class Instrument - the operator it wraps, counted and timed for EXPLAIN ANALYZE
+ *
+ *      Counts are inclusive, as the input is pulled from within the wrapped operator: the pages and
+ *      time of an operator include those of its input. Pages read are blocks heap files got from
+ *      Berkeley DB, hits blocks they had in memory (dirty ones, those of memory tables).
+ *      Operators a ParallelAggregate streams rows through on morsels aren't pulled from, so they
+ *      count nothing: their work shows in the aggregate's.
+ */
+class Instrument : public QueryOperator {
+public:
+    Instrument(QueryOperator *wrapped);
+
+    virtual ~Instrument();
+
+    virtual void open();
+
+    virtual bool next(ValueDict &row);
+
+    virtual void close();
+
+    virtual std::string describe() const { return wrapped->describe(); }
+
+    virtual QueryOperator *get_child() const { return wrapped->get_child(); }
+
+    virtual void set_child(QueryOperator *child) { wrapped->set_child(child); }
+
+    virtual std::vector<QueryOperator *> get_inputs() const { return wrapped->get_inputs(); }
+
+    virtual void set_inputs(const std::vector<QueryOperator *> &inputs) { wrapped->set_inputs(inputs); }
+
+    virtual double estimate_rows() const { return wrapped->estimate_rows(); }
+
+    virtual QueryOperator *get_wrapped() const { return wrapped; }
+
+    // what the wrapped operator did: rows, loops (opens), pages read, hits, wall and CPU time
+    virtual std::string report() const;
+
+    u_int64_t rows;
+    u_int64_t loops;
+    u_int64_t pages_read;
+    u_int64_t page_hits;
+    u_int64_t wall_ns;
+    u_int64_t cpu_ns;
+
+protected:
+    QueryOperator *wrapped;
+
+    // what the counters stood at when a call into the wrapped operator started
+    struct Mark {
+        u_int64_t pages_read;
+        u_int64_t page_hits;
+        u_int64_t wall_ns;
+        u_int64_t cpu_ns;
+    };
+
+    virtual Mark mark() const;
+
+    virtual void add_since(const Mark &start);
+};
+
+/**
+ * Wrap every operator of a plan in an Instrument.
+ * @param plan  the plan (now owned by the result)
+ * @returns     the instrumented plan (freed by caller)
+ */
+QueryOperator *instrument(QueryOperator *plan);
+
+/**
+ * The plan as a tree, an operator per line above its input, with the rows it is expected to produce
+ * and, for instrumented operators, their reports.
+ * @param plan  the plan
+ * @returns     the lines
+ */
+std::string explain(const QueryOperator *plan);
+
+bool test_query_operators();
@@ -0,0 +1,310 @@
+#include "schema_tables.h"
+
+using namespace std;
+
+const Identifier Tables::TABLE_NAME = "_tables";
+const Identifier Columns::TABLE_NAME = "_columns";
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|         COLUMNS          |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+ColumnNames Columns::column_names() {
+    ColumnNames names;
+    names.push_back("table_name");
+    names.push_back("column_name");
+    names.push_back("data_type");
+    return names;
+}
+
+ColumnAttributes Columns::column_attributes() {
+    return ColumnAttributes(3, ColumnAttribute(ColumnAttribute::TEXT));
+}
+
+Columns::Columns() : HeapTable(TABLE_NAME, column_names(), column_attributes()) {
+}
+
+/**
+    Add a column to the catalog, checking its type and that the table doesn't have it yet
+    @param row  table_name, column_name and data_type
+    @returns    handle of the new catalog row
+*/
+Handle Columns::insert(const ValueDict *row) {
+    string data_type = row->at("data_type").s;
+    if (data_type != "INT" && data_type != "TEXT")
+        throw DbRelationError("unknown data type " + data_type);
+    ValueDict where;
+    where["table_name"] = row->at("table_name");
+    where["column_name"] = row->at("column_name");
+    BlockID position = 0;
+    Handles *handles = select(&where, 1, position);
+    bool duplicate = !handles->empty();
+    delete handles;
+    if (duplicate)
+        throw DbRelationError("duplicate column " + row->at("table_name").s + "." + row->at("column_name").s);
+    return HeapTable::insert(row);
+}
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|          TABLES          |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+ColumnNames Tables::column_names() {
+    return ColumnNames(1, "table_name");
+}
+
+ColumnAttributes Tables::column_attributes() {
+    return ColumnAttributes(1, ColumnAttribute(ColumnAttribute::TEXT));
+}
+
+Tables::Tables() : HeapTable(TABLE_NAME, column_names(), column_attributes()) {
+}
+
+Tables::~Tables() {
+    for (auto const &entry: table_cache)
+        delete entry.second;
+}
+
+/**
+    Create both catalog files and describe them in themselves
+*/
+void Tables::create() {
+    HeapTable::create();
+    columns.create();
+    ValueDict row;
+    for (auto const &table_name: {TABLE_NAME, Columns::TABLE_NAME}) {
+        row["table_name"] = Value(table_name);
+        insert(&row);
+    }
+    ValueDict column;
+    column["data_type"] = Value("TEXT");
+    column["table_name"] = Value(TABLE_NAME);
+    for (auto const &column_name: column_names()) {
+        column["column_name"] = Value(column_name);
+        columns.insert(&column);
+    }
+    column["table_name"] = Value(Columns::TABLE_NAME);
+    for (auto const &column_name: Columns::column_names()) {
+        column["column_name"] = Value(column_name);
+        columns.insert(&column);
+    }
+}
+
+/**
+    Add a table to the catalog (its columns go into _columns separately)
+    @param row  table_name
+    @returns    handle of the new catalog row
+*/
+Handle Tables::insert(const ValueDict *row) {
+    if (exists(row->at("table_name").s))
+        throw DbRelationError(row->at("table_name").s + " already exists");
+    return HeapTable::insert(row);
+}
+
+/**
+    Remove a table from the catalog and from the cache of open relations
+    @param handle  the table's catalog row
+*/
+void Tables::del(const Handle handle) {
+    ColumnNames just_name(1, "table_name");
+    ValueDict *row = project(handle, &just_name);
+    Identifier table_name = row->at("table_name").s;
+    delete row;
+    forget(table_name);
+    HeapTable::del(handle);
+}
+
+/**
+    Check if the catalog knows a table
+    @param table_name  table to look for
+    @returns           true if there is a row for it in _tables
+*/
+bool Tables::exists(Identifier table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    BlockID position = 0;
+    Handles *handles = select(&where, 1, position);
+    bool found = !handles->empty();
+    delete handles;
+    return found;
+}
+
+/**
+    Look up the columns of a table, in the order they were defined
+    @param table_name         table to look up
+    @param column_names       filled with the column names
+    @param column_attributes  filled with the matching column types
+*/
+void Tables::get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = columns.select(&where);
+    for (auto const &handle: *handles) {
+        ValueDict *row = columns.project(handle);
+        column_names.push_back(row->at("column_name").s);
+        column_attributes.push_back(ColumnAttribute(row->at("data_type").s == "INT" ? ColumnAttribute::INT
+                                                                                    : ColumnAttribute::TEXT));
+        delete row;
+    }
+    delete handles;
+}
+
+/**
+    Get the relation for a table. The relation is built from the catalog the first time and then
+    kept; it is neither opened nor created here.
+    @param table_name  table to get
+    @returns           the table's relation (owned by the catalog)
+*/
+DbRelation &Tables::get_table(Identifier table_name) {
+    if (table_name == TABLE_NAME)
+        return *this;
+    if (table_name == Columns::TABLE_NAME)
+        return columns;
+    auto cached = table_cache.find(table_name);
+    if (cached != table_cache.end())
+        return *cached->second;
+
+    if (!exists(table_name))
+        throw DbRelationError("table " + table_name + " does not exist");
+    return new_table(table_name, ColumnTable::exists(table_name) ? COLUMN : HEAP);
+}
+
+/**
+    Build the relation for a table in the given storage engine, in place of any the catalog had
+    (for a table about to be created, whose files can't tell the engine yet)
+    @param table_name      table in the catalog
+    @param storage_engine  where its rows are kept
+    @returns               the table's relation (owned by the catalog)
+*/
+DbRelation &Tables::new_table(Identifier table_name, StorageEngine storage_engine) {
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    get_columns(table_name, column_names, column_attributes);
+    forget(table_name);
+    ArenaScope heap(nullptr);  // outlives the statement
+    DbRelation *table;
+    if (storage_engine == COLUMN)
+        table = new ColumnTable(table_name, column_names, column_attributes);
+    else
+        table = new HeapTable(table_name, column_names, column_attributes, DbBlock::BLOCK_SZ,
+                              storage_engine == PAX ? HeapFile::PAX : HeapFile::SLOTTED);
+    table_cache[table_name] = table;
+    return *table;
+}
+
+/**
+    Drop a table's relation from the cache (after the table itself was dropped)
+    @param table_name  table to forget
+*/
+void Tables::forget(Identifier table_name) {
+    auto cached = table_cache.find(table_name);
+    if (cached != table_cache.end()) {
+        delete cached->second;
+        table_cache.erase(cached);
+    }
+}
+
+/**
+    Make sure the catalog files exist, creating them in a new database environment
+*/
+void initialize_schema_tables() {
+    {
+        Tables existing;
+        try {
+            existing.open();
+            existing.close();
+            return;
+        } catch (DbException &e) {
+            // a new environment (a failed Berkeley DB handle can't be reused for the create)
+        }
+    }
+    Tables tables;
+    tables.create();
+    tables.close();
+}
+
+/**
+ * Testing function for the catalog.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_schema_tables() {
+    initialize_schema_tables();
+    Tables tables;
+    tables.open();
+    tables.get_columns_table().open();
+    if (!tables.exists(Tables::TABLE_NAME) || !tables.exists(Columns::TABLE_NAME))
+        return false;
+
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    tables.get_columns(Columns::TABLE_NAME, column_names, column_attributes);
+    if (column_names != Columns::column_names())
+        return false;
+
+    const Identifier table_name = "_test_schema_cpp";
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    Handle table_handle = tables.insert(&row);
+    try {
+        tables.insert(&row);
+        return false;
+    } catch (DbRelationError &e) {
+        // expected: already there
+    }
+    ValueDict column;
+    column["table_name"] = Value(table_name);
+    column["column_name"] = Value("a");
+    column["data_type"] = Value("INT");
+    Handle column_handle = tables.get_columns_table().insert(&column);
+    try {
+        column["column_name"] = Value("b");
+        column["data_type"] = Value("DATE");
+        tables.get_columns_table().insert(&column);
+        return false;
+    } catch (DbRelationError &e) {
+        // expected: not a type we know
+    }
+
+    DbRelation &table = tables.get_table(table_name);
+    if (&tables.get_table(table_name) != &table || table.get_column_names() != ColumnNames(1, "a")
+        || table.get_column_attributes()[0].get_data_type() != ColumnAttribute::INT)
+        return false;
+
+    // the files tell a column table from a heap table
+    tables.new_table(table_name, Tables::COLUMN).create();
+    tables.forget(table_name);
+    if (dynamic_cast<ColumnTable *>(&tables.get_table(table_name)) == nullptr)
+        return false;
+    tables.get_table(table_name).drop();
+
+    // a PAX table is a heap table whose first block tells the layout
+    tables.new_table(table_name, Tables::PAX).create();
+    tables.forget(table_name);
+    if (dynamic_cast<HeapTable *>(&tables.get_table(table_name)) == nullptr)
+        return false;
+    {
+        HeapFile file(table_name);
+        file.open();
+        bool pax = file.get_layout() == HeapFile::PAX;
+        file.close();
+        if (!pax)
+            return false;
+    }
+    tables.get_table(table_name).drop();
+
+    tables.get_columns_table().del(column_handle);
+    tables.del(table_handle);
+    if (tables.exists(table_name))
+        return false;
+    try {
+        tables.get_table(table_name);
+        return false;
+    } catch (DbRelationError &e) {
+        // expected: gone
+    }
+    return true;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file schema_tables.h - the catalog: which tables exist and what their columns are
+ *
+ * Two heap tables describe every table in the database, themselves included:
+ *      _tables  (table_name TEXT)
+ *      _columns (table_name TEXT, column_name TEXT, data_type TEXT)
+ * with data_type one of "INT" or "TEXT".
+ */
+#pragma once
+
+#include <map>
+#include "heap_storage.h"
+#include "column_storage.h"
+
+/**
+ * @class Columns - the _columns catalog table
+ */
+class Columns : public HeapTable {
+public:
+    static const Identifier TABLE_NAME;
+
+    Columns();
+
+    virtual ~Columns() {}
+
+    virtual Handle insert(const ValueDict *row);
+
+    static ColumnNames column_names();
+
+    static ColumnAttributes column_attributes();
+};
+
+/**
+ * @class Tables - the _tables catalog table, and the cache of open relations
+ *
+ *      get_table() hands out the one open DbRelation per table; it stays valid until the table is
+ *      dropped (forget()) or the program ends. Which storage engine a table is kept in is told by its
+ *      files; new_table() picks the engine for a table that is about to be created.
+ */
+class Tables : public HeapTable {
+public:
+    static const Identifier TABLE_NAME;
+
+    // where a table's rows are kept
+    enum StorageEngine {
+        HEAP,  // HeapTable, a row at a time
+        COLUMN,  // ColumnTable, a column at a time
+        PAX  // HeapTable on PAX pages (a heap table, as far as get_table() is concerned)
+    };
+
+    Tables();
+
+    virtual ~Tables();
+
+    virtual void create();
+
+    virtual Handle insert(const ValueDict *row);
+
+    virtual void del(const Handle handle);
+
+    virtual bool exists(Identifier table_name);
+
+    virtual void get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes);
+
+    virtual DbRelation &get_table(Identifier table_name);
+
+    virtual DbRelation &new_table(Identifier table_name, StorageEngine storage_engine);
+
+    virtual void forget(Identifier table_name);
+
+    virtual Columns &get_columns_table() { return columns; }
+
+    static ColumnNames column_names();
+
+    static ColumnAttributes column_attributes();
+
+protected:
+    Columns columns;
+    std::map<Identifier, DbRelation *> table_cache;
+};
+
+void initialize_schema_tables();
+
+bool test_schema_tables();
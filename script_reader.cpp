@@ -0,0 +1,213 @@
+#include "script_reader.h"
+#include <cctype>
+#include <sstream>
+
+using namespace std;
+using namespace hsql;
+
+/*
+            ------------------
+~~~~~~~~~~~~|  SCRIPTREADER  |~~~~~~~~~~~~
+            ------------------
+*/
+
+ScriptReader::ScriptReader(istream &in, size_t chunk_size) : in(in), position(0), chunk_size(chunk_size), line(1) {
+}
+
+bool ScriptReader::next(string &statement, uint &line) {
+    enum {
+        CODE, STRING, IDENTIFIER, LINE_COMMENT, BLOCK_COMMENT
+    } state = CODE;
+    statement.clear();
+    size_t end = 0;  // of the statement without trailing blanks
+    for (int c = get(); c != EOF; c = get()) {
+        if (state == LINE_COMMENT) {
+            if (c != '\n')
+                continue;
+            state = CODE;  // the line break stays
+        } else if (state == BLOCK_COMMENT) {
+            if (c != '*' || peek() != '/')
+                continue;
+            get();
+            state = CODE;
+            c = ' ';  // the comment separates like a blank
+        } else if (state == STRING || state == IDENTIFIER) {
+            statement += (char) c;  // a doubled quote just closes and reopens
+            end = statement.size();
+            if (c == (state == STRING ? '\'' : '"'))
+                state = CODE;
+            continue;
+        } else if (c == ';') {
+            if (end == 0)
+                continue;  // nothing between two semicolons
+            statement.resize(end);
+            return true;
+        } else if (c == '-' && peek() == '-') {
+            state = LINE_COMMENT;
+            continue;
+        } else if (c == '/' && peek() == '*') {
+            get();
+            state = BLOCK_COMMENT;
+            continue;
+        } else if (c == '\'') {
+            state = STRING;
+        } else if (c == '"') {
+            state = IDENTIFIER;
+        }
+        if (isspace(c) && end == 0)
+            continue;
+        if (end == 0)
+            line = this->line;
+        statement += (char) c;
+        if (!isspace(c))
+            end = statement.size();
+    }
+    statement.resize(end);
+    return end != 0;  // the last statement needs no semicolon
+}
+
+// The next character without taking it, reading another chunk if need be
+int ScriptReader::peek() {
+    if (this->position == this->chunk.size()) {
+        this->chunk.resize(this->chunk_size);
+        this->in.read(&this->chunk[0], (streamsize) this->chunk_size);
+        this->chunk.resize((size_t) this->in.gcount());
+        this->position = 0;
+        if (this->chunk.empty())
+            return EOF;
+    }
+    return (unsigned char) this->chunk[this->position];
+}
+
+int ScriptReader::get() {
+    int c = peek();
+    if (c != EOF) {
+        this->position++;
+        if (c == '\n')
+            this->line++;
+    }
+    return c;
+}
+
+/*
+            ------------------
+~~~~~~~~~~~~|   PARSEAHEAD   |~~~~~~~~~~~~
+            ------------------
+*/
+
+ParseAhead::ParseAhead(ScriptReader &reader, size_t max_ahead) :
+        reader(reader), max_ahead(max_ahead), done(false), stopping(false) {
+    this->parser = thread(&ParseAhead::parse_all, this);
+}
+
+ParseAhead::~ParseAhead() {
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->changed.notify_all();
+    this->parser.join();
+    for (auto const &statement: this->parsed)
+        delete statement.parse;
+}
+
+bool ParseAhead::next(ScriptStatement &statement) {
+    unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(lock, [this] { return !this->parsed.empty() || this->done; });
+    if (this->parsed.empty()) {
+        if (this->failure)
+            rethrow_exception(this->failure);
+        return false;
+    }
+    statement = this->parsed.front();
+    this->parsed.pop_front();
+    lock.unlock();
+    this->changed.notify_all();
+    return true;
+}
+
+// The parsing thread: read and parse statements while there is room for them
+void ParseAhead::parse_all() {
+    try {
+        ScriptStatement statement;
+        while (this->reader.next(statement.text, statement.line)) {
+            statement.parse = SQLParser::parseSQLString(statement.text);
+            unique_lock<std::mutex> lock(this->mutex);
+            this->changed.wait(lock, [this] { return this->parsed.size() < this->max_ahead || this->stopping; });
+            if (this->stopping) {
+                delete statement.parse;
+                break;
+            }
+            this->parsed.push_back(statement);
+            lock.unlock();
+            this->changed.notify_all();
+        }
+    } catch (...) {
+        lock_guard<std::mutex> lock(this->mutex);
+        this->failure = current_exception();
+    }
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        this->done = true;
+    }
+    this->changed.notify_all();
+}
+
+/**
+ * Test ScriptReader and ParseAhead: statements split where they should be, even across chunks
+ */
+bool test_script_reader() {
+    string script = "create table t (a int, b text);\n"
+                    "-- a comment; not a statement\n"
+                    "insert into t values (1, 'semi;colon');  insert into t values (2, 'it''s');\n"
+                    ";;\n"
+                    "/* a comment\n; over lines */ select \"odd;name\"\n"
+                    "  from t -- trailing\n"
+                    "  where a = 1;\n"
+                    "  quit  ";
+    const vector<string> expected = {"create table t (a int, b text)", "insert into t values (1, 'semi;colon')",
+                                     "insert into t values (2, 'it''s')",
+                                     "select \"odd;name\"\n  from t \n  where a = 1", "quit"};
+    const vector<uint> expected_lines = {1, 3, 3, 6, 9};
+    for (size_t chunk_size: {(size_t) 1, (size_t) 2, (size_t) 7, ScriptReader::CHUNK_SIZE}) {
+        istringstream in(script);
+        ScriptReader reader(in, chunk_size);
+        string statement;
+        uint line;
+        for (size_t i = 0; i < expected.size(); i++)
+            if (!reader.next(statement, line) || statement != expected[i] || line != expected_lines[i])
+                return false;
+        if (reader.next(statement, line))
+            return false;
+    }
+
+    // many more statements than are parsed ahead, in order
+    const int STATEMENTS = 5000;
+    string many;
+    for (int i = 0; i < STATEMENTS; i++)
+        many += "insert into t values (" + to_string(i) + ", 'x');\n";
+    istringstream in(many);
+    ScriptReader reader(in, 100);
+    {
+        ParseAhead statements(reader, 4);
+        ScriptStatement statement;
+        for (int i = 0; i < STATEMENTS; i++) {
+            if (!statements.next(statement) || statement.parse == nullptr || statement.line != (uint) i + 1
+                || statement.text != "insert into t values (" + to_string(i) + ", 'x')")
+                return false;
+            delete statement.parse;
+        }
+        if (statements.next(statement))
+            return false;
+    }
+
+    // stopped early: what was parsed ahead goes away with it
+    istringstream again(many);
+    ScriptReader early(again);
+    ParseAhead statements(early, 16);
+    ScriptStatement statement;
+    if (!statements.next(statement))
+        return false;
+    delete statement.parse;
+    return true;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file script_reader.h - reading SQL scripts a statement at a time, parsed ahead on another thread
+ *
+ * A ScriptReader splits a script into statements at the semicolons between them (not those within
+ * quotes or comments), reading its input a large chunk at a time rather than a line at a time.
+ * Comments (from -- to the end of the line, and from slash-star to star-slash) are left out of the
+ * statements.
+ * A ParseAhead runs the parser over the statements of a ScriptReader on a thread of its own,
+ * keeping up to max_ahead of them parsed ahead of the statement being executed, so executing a
+ * script doesn't wait for the parser (nor the parser for the disk).
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "SQLParser.h"
+
+/**
+ * @class ScriptReader - the statements of a script, one after the other
+ */
+class ScriptReader {
+public:
+    static const size_t CHUNK_SIZE = 1024 * 1024;
+
+    /**
+     * @param in          the script
+     * @param chunk_size  bytes to read at a time
+     */
+    ScriptReader(std::istream &in, size_t chunk_size = CHUNK_SIZE);
+
+    virtual ~ScriptReader() {}
+
+    ScriptReader(const ScriptReader &other) = delete;
+
+    ScriptReader &operator=(const ScriptReader &other) = delete;
+
+    /**
+     * The next statement of the script.
+     * @param statement  set to the statement, without its semicolon, comments or surrounding blanks
+     * @param line       set to the line of the script it starts on
+     * @returns          false when there are no more statements
+     */
+    virtual bool next(std::string &statement, uint &line);
+
+protected:
+    std::istream &in;
+    std::string chunk;
+    size_t position;  // next character of the chunk
+    size_t chunk_size;
+    uint line;  // of that character
+
+    virtual int peek();
+
+    virtual int get();
+};
+
+/**
+ * @class ScriptStatement - a statement of a script and its parse
+ */
+class ScriptStatement {
+public:
+    ScriptStatement() : line(0), parse(nullptr) {}
+
+    virtual ~ScriptStatement() {}
+
+    std::string text;
+    uint line;
+    hsql::SQLParserResult *parse;  // the receiver's to delete
+};
+
+/**
+ * @class ParseAhead - the statements of a script, parsed on another thread
+ */
+class ParseAhead {
+public:
+    static const size_t MAX_AHEAD = 1024;
+
+    /**
+     * Start parsing.
+     * @param reader     the script (only read by the parsing thread from now on)
+     * @param max_ahead  most statements to parse ahead of the one executed
+     */
+    ParseAhead(ScriptReader &reader, size_t max_ahead = MAX_AHEAD);
+
+    // stops parsing, and deletes what has been parsed and not taken
+    virtual ~ParseAhead();
+
+    ParseAhead(const ParseAhead &other) = delete;
+
+    ParseAhead &operator=(const ParseAhead &other) = delete;
+
+    /**
+     * The next statement of the script, as soon as it is parsed.
+     * @param statement  set to the statement (its parse is now the caller's)
+     * @returns          false when there are no more statements
+     */
+    virtual bool next(ScriptStatement &statement);
+
+protected:
+    ScriptReader &reader;
+    size_t max_ahead;
+    std::deque<ScriptStatement> parsed;
+    bool done;  // all statements parsed (or reading failed)
+    bool stopping;  // parse no more
+    std::exception_ptr failure;  // what reading the script threw, for next() to throw
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread parser;
+
+    virtual void parse_all();
+};
+
+bool test_script_reader();
@@ -5,6 +5,9 @@
 	@ Seattle University, cpsc4300/5300, 2020 Spring
 */
 
+#include <algorithm>
+#include <fstream>
+#include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +15,13 @@
 #include "SQLParser.h"
 #include "sqlhelper.h"
 #include "heap_storage.h"
+#include "memory_storage.h"
+#include "statement_cache.h"
+#include "storage_stats.h"
+#include "arena.h"
+#include "sql_exec.h"
+#include "script_reader.h"
+#include "flusher.h"
 
 
 using namespace std;
@@ -89,6 +99,9 @@ string expressionToString(Expr *expr) {
     	case kExprOperator:
       		result += operatorExpressionToString(expr);
       		break;
+    	case kExprPlaceholder:
+      		result += "?";
+      		break;
     	default:
       		result += "Unrecognized expression type %d\n";
       		break;
@@ -278,6 +291,19 @@ string executeInsertStatement(const InsertStatement *stmt) {
 
 }
 
+/* 
+	Excute a Delete Statement
+	@param 		stmt Hyrise AST for DeleteStatement
+	@returns	a string of the SQL statement
+ */
+string executeDeleteStatement(const DeleteStatement *stmt) {
+	string result = "DELETE FROM ";
+	result += string(stmt->tableName);
+	if(stmt->expr != NULL)
+		result += " WHERE " + expressionToString(stmt->expr);
+	return result;
+}
+
 /* 
 	Excute a SQL Statement
 	@param 		stmt Hyrise AST for SQL Statement
@@ -291,6 +317,8 @@ string execute(const SQLStatement *stmt) {
 			return executeCreateStatement((const CreateStatement*) stmt);
 		case kStmtInsert:
 			return executeInsertStatement((const InsertStatement*) stmt);
+		case kStmtDelete:
+			return executeDeleteStatement((const DeleteStatement*) stmt);
 		default:
 			return "Not Implemented";
 	}
@@ -298,16 +326,457 @@ string execute(const SQLStatement *stmt) {
 
 
 
-int main(int argc, char **argv) {
-	
+/*
+	Check if a shell line starts with the given keyword (case insensitive)
+	@param query	line typed by the user
+	@param keyword	upper case keyword to look for
+	@param rest		set to the rest of the line after the keyword
+	@return		true if the line starts with the keyword
+*/
+bool startsWithKeyword(const string &query, const string &keyword, string &rest) {
+	string normalized = StatementCache::normalize(query);
+	if(normalized.size() < keyword.size())
+		return false;
+	for(uint i = 0; i < keyword.size(); i++)
+		if(toupper(normalized[i]) != keyword[i])
+			return false;
+	if(normalized.size() > keyword.size() && normalized[keyword.size()] != ' ')
+		return false;
+	rest = normalized.size() > keyword.size() ? normalized.substr(keyword.size() + 1) : "";
+	return true;
+}
+
+/*
+	Execute every statement of a parse and print each statement and its results
+	@param sqlresult	a valid parse
+	@param quiet	don't print the statements, nor the results without rows
+	@param line		line of the script the statements are on (0 if not from a script)
+	@param cache	statement cache the parse came from, whose plans the SELECTs reuse (NULL if none)
+	@return		true if any of the statements was DDL
+*/
+bool executeParseResult(const SQLParserResult *sqlresult, bool quiet = false, uint line = 0,
+                        StatementCache *cache = NULL) {
+	bool ddl = false;
+	for(uint i = 0; i < sqlresult->size(); ++i) {
+		const SQLStatement *stmt = sqlresult->getStatement(i);
+		if(!quiet)
+			cout << execute(stmt) << endl;
+		ddl = ddl || StatementCache::is_ddl(stmt);
+		try {
+			QueryOperator *plan = cache == NULL ? NULL : cache->get_plan(sqlresult, i);
+			QueryResult *result = plan != NULL ? SQLExec::run(plan) : SQLExec::execute(stmt);
+			if(!quiet || result->get_column_names() != nullptr)
+				cout << *result << endl;
+			delete result;
+		} catch(SQLExecError &e) {
+			cout << "Error" << (line == 0 ? "" : " at line " + to_string(line)) << ": " << e.what() << endl;
+		}
+	}
+	return ddl;
+}
+
+/*
+	Handle PREPARE, EXECUTE and DEALLOCATE, which the shell implements on top of the parser
+		PREPARE <name> FROM <statement with ? placeholders>
+		EXECUTE <name> [(<value>, ...)]
+		DEALLOCATE [PREPARE] <name>
+	@param query	line typed by the user
+	@param cache	statement cache holding the prepared statements
+	@return		true if the line was one of these commands
+*/
+bool executePreparedCommand(const string &query, StatementCache &cache) {
+	string rest;
+	if(startsWithKeyword(query, "PREPARE", rest)) {
+		size_t space = rest.find(' ');
+		string name = rest.substr(0, space);
+		string body = space == string::npos ? "" : rest.substr(space + 1);
+		string from;
+		if(!startsWithKeyword(body, "FROM", from) && !startsWithKeyword(body, "AS", from))
+			throw StatementCacheError("expected PREPARE <name> FROM <statement>");
+		if(from.size() >= 2 && from.front() == '\'' && from.back() == '\'')
+			from = from.substr(1, from.size() - 2);
+		cache.prepare(name, from);
+		cout << "PREPARE " << name << " (" << cache.get_prepared(name)->param_count() << " parameters)" << endl;
+		return true;
+	}
+	if(startsWithKeyword(query, "EXECUTE", rest)) {
+		size_t start = rest.find_first_of(" (");
+		string name = rest.substr(0, start);
+		PreparedStatement *prepared = cache.get_prepared(name);
+		prepared->bind(StatementCache::parse_parameters(start == string::npos ? "" : rest.substr(start)));
+		bool ddl;
+		try {
+			ddl = executeParseResult(prepared->get_parse());
+		} catch(...) {
+			prepared->unbind();
+			throw;
+		}
+		prepared->unbind();
+		if(ddl)
+			cache.invalidate();
+		return true;
+	}
+	if(startsWithKeyword(query, "DEALLOCATE", rest)) {
+		string name;
+		if(!startsWithKeyword(rest, "PREPARE", name))
+			name = rest;
+		cache.get_prepared(name);  // complain about unknown names
+		cache.deallocate(name);
+		cout << "DEALLOCATE " << name << endl;
+		return true;
+	}
+	return false;
+}
+
+/*
+	Handle the storage statistics commands
+		SHOW STATS [<table>]
+		RESET STATS [<table>]
+	The totals also cover the statement arena.
+	@param query		line typed by the user
+	@param statement_arena	arena the shell runs statements in
+	@return		true if the line was one of these commands
+*/
+bool executeStatsCommand(const string &query, Arena &statement_arena) {
+	string rest, table_name;
+	if(startsWithKeyword(query, "SHOW", rest) && startsWithKeyword(rest, "STATS", table_name)) {
+		cout << StorageStats::report(table_name) << endl;
+		if(table_name.empty())
+			cout << statement_arena.report() << endl;
+		return true;
+	}
+	if(startsWithKeyword(query, "RESET", rest) && startsWithKeyword(rest, "STATS", table_name)) {
+		StorageStats::reset(table_name);
+		if(table_name.empty())
+			statement_arena.reset_stats();
+		cout << "RESET STATS " << table_name << endl;
+		return true;
+	}
+	return false;
+}
+
+/*
+	Handle VACUUM, which the parser doesn't know
+		VACUUM [<table>]		compact a table (or all tables) now
+		VACUUM ONLINE <table>	compact a table a little after every statement
+	@param query	line typed by the user
+	@return		true if the line was one of these commands
+*/
+bool executeVacuumCommand(const string &query) {
+	string rest, table_name;
+	if(!startsWithKeyword(query, "VACUUM", rest))
+		return false;
+	try {
+		QueryResult *result;
+		if(startsWithKeyword(rest, "ONLINE", table_name))
+			result = SQLExec::vacuum_online(table_name);
+		else
+			result = SQLExec::vacuum(rest);
+		cout << *result << endl;
+		delete result;
+	} catch(SQLExecError &e) {
+		cout << "Error: " << e.what() << endl;
+	}
+	return true;
+}
+
+/*
+	Handle EXPLAIN, which the parser doesn't know
+		EXPLAIN <select>		the plan, an operator per line above its input, with the rows expected
+		EXPLAIN ANALYZE <select>	run the query and show what each operator did
+	@param query	line typed by the user
+	@return		true if the line was one of these commands
+*/
+bool executeExplainCommand(const string &query) {
+	string rest, select;
+	if(!startsWithKeyword(query, "EXPLAIN", rest))
+		return false;
+	bool analyze = startsWithKeyword(rest, "ANALYZE", select);
+	if(!analyze)
+		select = rest;
+	SQLParserResult *sqlresult = SQLParser::parseSQLString(select);
+	if(!sqlresult->isValid() || sqlresult->size() != 1 || sqlresult->getStatement(0)->type() != kStmtSelect) {
+		cout << "Error: EXPLAIN needs a SELECT" << endl;
+		delete sqlresult;
+		return true;
+	}
+	const SQLStatement *stmt = sqlresult->getStatement(0);
+	cout << "EXPLAIN " << (analyze ? "ANALYZE " : "") << execute(stmt) << endl;
+	try {
+		QueryResult *result = SQLExec::explain((const SelectStatement *) stmt, analyze);
+		cout << *result << endl;
+		delete result;
+	} catch(SQLExecError &e) {
+		cout << "Error: " << e.what() << endl;
+	}
+	delete sqlresult;
+	return true;
+}
+
+/*
+	Handle CHECKPOINT, which the parser doesn't know: write back every block put since the last
+	write-back (they are written back anyway after a while, see HeapFile::flush_interval_ms)
+	@param query	line typed by the user
+	@return		true if the line was this command
+*/
+bool executeCheckpointCommand(const string &query) {
+	string rest;
+	if(!startsWithKeyword(query, "CHECKPOINT", rest) || !rest.empty())
+		return false;
+	try {
+		QueryResult *result = SQLExec::checkpoint();
+		cout << *result << endl;
+		delete result;
+	} catch(SQLExecError &e) {
+		cout << "Error: " << e.what() << endl;
+	}
+	return true;
+}
+
+/*
+	Handle the Bloom filter commands, which the parser doesn't know
+		CREATE BLOOM FILTER ON <table> (<column>, ...)	filter blocks on TEXT columns
+		DROP BLOOM FILTER ON <table>
+		SHOW BLOOM FILTER ON <table>			how many blocks the filters let scans skip
+	@param query	line typed by the user
+	@return		true if the line was one of these commands
+*/
+bool executeBloomCommand(const string &query) {
+	string rest, filter, on, table_name;
+	if(!startsWithKeyword(query, "CREATE", rest) && !startsWithKeyword(query, "DROP", rest)
+	   && !startsWithKeyword(query, "SHOW", rest))
+		return false;
+	if(!startsWithKeyword(rest, "BLOOM", filter) || !startsWithKeyword(filter, "FILTER", on)
+	   || !startsWithKeyword(on, "ON", table_name))
+		return false;
+	char command = (char) toupper(StatementCache::normalize(query)[0]);
+	try {
+		QueryResult *result;
+		if(command == 'C') {
+			size_t open = table_name.find('('), close = table_name.rfind(')');
+			if(open == string::npos || close == string::npos || close < open) {
+				cout << "Error: CREATE BLOOM FILTER needs a list of columns" << endl;
+				return true;
+			}
+			ColumnNames column_names;
+			stringstream columns(table_name.substr(open + 1, close - open - 1));
+			string column_name;
+			while(getline(columns, column_name, ','))
+				column_names.push_back(StatementCache::normalize(column_name));
+			result = SQLExec::create_bloom_filter(StatementCache::normalize(table_name.substr(0, open)), column_names);
+		} else if(command == 'D') {
+			result = SQLExec::drop_bloom_filter(table_name);
+		} else {
+			result = SQLExec::show_bloom_filter(table_name);
+		}
+		cout << *result << endl;
+		delete result;
+	} catch(SQLExecError &e) {
+		cout << "Error: " << e.what() << endl;
+	}
+	return true;
+}
+
+/*
+	Handle the storage engine clause of CREATE TABLE, which the parser doesn't know
+		CREATE TABLE ... USING HEAP		rows kept a row at a time (the default)
+		CREATE TABLE ... USING COLUMN	rows kept a column at a time
+		CREATE TABLE ... USING PAX		rows kept a row at a time, on PAX pages
+	The statement without the clause goes through the parser as usual.
+	@param query	line typed by the user
+	@return		true if the line was such a statement
+*/
+bool executeCreateUsingCommand(const string &query) {
+	string rest;
+	if(!startsWithKeyword(query, "CREATE", rest))
+		return false;
+	string normalized = StatementCache::normalize(query);
+	string upper = normalized;
+	transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+	size_t using_clause = upper.rfind(" USING ");
+	if(using_clause == string::npos)
+		return false;
+	string engine = upper.substr(using_clause + 7);
+	Tables::StorageEngine storage_engine;
+	if(engine == "HEAP")
+		storage_engine = Tables::HEAP;
+	else if(engine == "COLUMN")
+		storage_engine = Tables::COLUMN;
+	else if(engine == "PAX")
+		storage_engine = Tables::PAX;
+	else {
+		cout << "Error: unknown storage engine " << normalized.substr(using_clause + 7) << endl;
+		return true;
+	}
+
+	SQLParserResult *sqlresult = SQLParser::parseSQLString(normalized.substr(0, using_clause));
+	if(!sqlresult->isValid() || sqlresult->size() != 1 || sqlresult->getStatement(0)->type() != kStmtCreate) {
+		cout << "invalid SQL: " << query << endl;
+		delete sqlresult;
+		return true;
+	}
+	const SQLStatement *stmt = sqlresult->getStatement(0);
+	cout << execute(stmt) << " USING " << engine << endl;
+	try {
+		QueryResult *result = SQLExec::execute(stmt, storage_engine);
+		cout << *result << endl;
+		delete result;
+	} catch(SQLExecError &e) {
+		cout << "Error: " << e.what() << endl;
+	}
+	delete sqlresult;
+	return true;
+}
+
+/*
+	Handle the commands the shell implements itself rather than the parser and SQLExec::execute
+	@param query		line typed by the user (or statement of a script)
+	@param cache		statement cache holding the prepared statements
+	@param statement_arena	arena the shell runs statements in
+	@return		true if the line was one of these commands
+*/
+bool executeShellCommand(const string &query, StatementCache &cache, Arena &statement_arena) {
+	if(executeStatsCommand(query, statement_arena))
+		return true;
+	ArenaScope arena_scope(&statement_arena);
+	if(executeVacuumCommand(query) || executeBloomCommand(query) || executeCheckpointCommand(query)
+	   || executeExplainCommand(query))
+		return true;
+	if(executeCreateUsingCommand(query)) {
+		cache.invalidate();
+		return true;
+	}
+	try {
+		return executePreparedCommand(query, cache);
+	} catch(StatementCacheError &e) {
+		cout << "Error: " << e.what() << endl;
+		return true;
+	}
+}
+
+/*
+	The statement of a script, if it is an INSERT ... VALUES (and nothing else)
+	@param statement	statement of a script
+	@return		the INSERT, or NULL
+*/
+const InsertStatement *valuesInsert(const ScriptStatement &statement) {
+	if(!statement.parse->isValid() || statement.parse->size() != 1
+	   || statement.parse->getStatement(0)->type() != kStmtInsert)
+		return NULL;
+	const InsertStatement *insert = (const InsertStatement *) statement.parse->getStatement(0);
+	return insert->type == InsertStatement::kInsertValues ? insert : NULL;
+}
+
+/*
+	Check if two INSERTs fill in the same columns of the same table
+*/
+bool sameColumns(const InsertStatement *insert, const InsertStatement *other) {
+	if(strcmp(insert->tableName, other->tableName) != 0)
+		return false;
+	if(insert->columns == NULL || other->columns == NULL)
+		return insert->columns == other->columns;
+	if(insert->columns->size() != other->columns->size())
+		return false;
+	for(uint i = 0; i < insert->columns->size(); i++)
+		if(strcmp((*insert->columns)[i], (*other->columns)[i]) != 0)
+			return false;
+	return true;
+}
+
+/*
+	Run INSERT ... VALUES statements of a script (into the same table and columns) as one bulk insert
+	@param inserts		the statements, cleared once run
+	@param quiet		don't print the statements, nor how many rows went in
+	@param statement_arena	arena the shell runs statements in
+*/
+void executeInserts(vector<ScriptStatement> &inserts, bool quiet, Arena &statement_arena) {
+	if(inserts.empty())
+		return;
+	statement_arena.reset();
+	ArenaScope arena_scope(&statement_arena);
+	vector<const InsertStatement *> statements;
+	for(auto const &insert: inserts) {
+		statements.push_back(valuesInsert(insert));
+		if(!quiet)
+			cout << execute(statements.back()) << endl;
+	}
+	vector<string> errors;
+	QueryResult *result = SQLExec::insert_values(statements, errors);
+	for(uint i = 0; i < errors.size(); i++)
+		if(!errors[i].empty())
+			cout << "Error at line " << inserts[i].line << ": " << errors[i] << endl;
+	if(!quiet)
+		cout << *result << endl;
+	delete result;
+	for(auto const &insert: inserts)
+		delete insert.parse;
+	inserts.clear();
+}
+
+/*
+	Run a script: statements separated by semicolons, read a chunk at a time and parsed ahead on
+	another thread. Runs of INSERT ... VALUES into the same table go in as bulk inserts.
+	@param in		the script
+	@param quiet		don't print the statements, nor the results without rows
+	@param cache		statement cache holding the prepared statements
+	@param statement_arena	arena the shell runs statements in
+*/
+void executeScript(istream &in, bool quiet, StatementCache &cache, Arena &statement_arena) {
+	ScriptReader reader(in);
+	ParseAhead statements(reader);
+	vector<ScriptStatement> inserts;  // not run yet
+	ScriptStatement statement;
+	while(statements.next(statement)) {
+		const InsertStatement *insert = valuesInsert(statement);
+		if(!inserts.empty() && (insert == NULL || inserts.size() == SQLExec::INSERT_BATCH_ROWS
+		                        || !sameColumns(insert, valuesInsert(inserts.front()))))
+			executeInserts(inserts, quiet, statement_arena);
+		if(insert != NULL) {
+			inserts.push_back(statement);
+			continue;
+		}
+		statement_arena.reset();
+		SQLExec::background_vacuum();
+		ColumnTable::flush_expired();
+		HeapFile::flush_expired();
+		if(statement.text == "quit") {
+			delete statement.parse;
+			break;  // the statements parsed ahead go with the ParseAhead
+		}
+		if(executeShellCommand(statement.text, cache, statement_arena)) {
+			delete statement.parse;
+			continue;
+		}
+		ArenaScope arena_scope(&statement_arena);
+		if(!statement.parse->isValid())
+			cout << "invalid SQL at line " << statement.line << ": " << statement.text << endl;
+		else if(executeParseResult(statement.parse, quiet, statement.line))
+			cache.invalidate();
+		delete statement.parse;
+	}
+	executeInserts(inserts, quiet, statement_arena);
+}
 
-	if(argc != 2) {
-		cerr << "Usage: cpsc5300: dbenvpath" << endl;
+int main(int argc, char **argv) {
+	const char *usage = "Usage: cpsc5300: dbenvpath [-f script | -f -] [-q]";
+	string script;  // file to run instead of reading lines from the user ("-" for standard input)
+	bool quiet = false;
+	for(int i = 2; i < argc; i++) {
+		if(strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			script = argv[++i];
+		else if(strcmp(argv[i], "-q") == 0)
+			quiet = true;
+		else
+			argc = 0;
+	}
+	if(argc < 2) {
+		cerr << usage << endl;
 		return 1;
 	}
 
 	char *envHome = argv[1];
-	cout << "(sql 5300: running with database environment at " << envHome << endl;
+	if(!quiet)
+		cout << "(sql 5300: running with database environment at " << envHome << endl;
 
 	DbEnv env(0U);
 	env.set_message_stream(&cout);
@@ -321,33 +790,74 @@ int main(int argc, char **argv) {
 	}
 
 	_DB_ENV = &env;
+	StatementCache statement_cache;
+	Arena statement_arena;
+
+	if(!script.empty()) {
+		ifstream file;
+		if(script != "-") {
+			file.open(script.c_str(), ios::binary);
+			if(!file) {
+				cerr << "(cpsc5300: can't read " << script << ")" << endl;
+				return 1;
+			}
+		}
+		executeScript(script == "-" ? cin : file, quiet, statement_cache, statement_arena);
+		ColumnTable::checkpoint();
+		HeapFile::checkpoint();
+		return EXIT_SUCCESS;
+	}
 
+	Flusher flusher;
 	while(true) {
+		// whatever the last statement allocated in the storage layer goes away at once
+		statement_arena.reset();
+		SQLExec::background_vacuum();
+		ColumnTable::flush_expired();
+		HeapFile::flush_expired();
 		cout << "SQL> ";
 		string query;
-		getline(cin, query);
+		flusher.idle();  // what is due is written back while the user types
+		if(!getline(cin, query))
+			query = "quit";  // end of input
+		flusher.busy();
 		if(query.length() == 0)
 			continue;
-		if(query == "quit")
+		if(query == "quit") {
+			ColumnTable::checkpoint();
+			HeapFile::checkpoint();
 			break;
+		}
 		if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
+            cout << "test_statement_cache: " << (test_statement_cache() ? "ok" : "failed") << endl;
+            cout << "test_storage_stats: " << (test_storage_stats() ? "ok" : "failed") << endl;
+            cout << "test_arena: " << (test_arena() ? "ok" : "failed") << endl;
+            cout << "test_schema_tables: " << (test_schema_tables() ? "ok" : "failed") << endl;
+            cout << "test_query_operators: " << (test_query_operators() ? "ok" : "failed") << endl;
+            cout << "test_join_order: " << (test_join_order() ? "ok" : "failed") << endl;
+            cout << "test_morsel: " << (test_morsel() ? "ok" : "failed") << endl;
+            cout << "test_flusher: " << (test_flusher() ? "ok" : "failed") << endl;
+            cout << "test_script_reader: " << (test_script_reader() ? "ok" : "failed") << endl;
+            cout << "test_column_storage: " << (test_column_storage() ? "ok" : "failed") << endl;
+            cout << "test_memory_storage: " << (test_memory_storage() ? "ok" : "failed") << endl;
             continue;
         }
-		SQLParserResult *sqlresult = SQLParser::parseSQLString(query);
+		if(executeShellCommand(query, statement_cache, statement_arena))
+			continue;
+		ArenaScope arena_scope(&statement_arena);
+
+		// repeated statements come straight out of the cache without being parsed (or planned) again
+		const SQLParserResult *sqlresult = statement_cache.get(query);
 
 		if(!sqlresult->isValid()) {
 			cout << "invalid SQL: " << query << endl;
-			delete sqlresult;
 			continue;
 		}
 
 		// excute the statement
-
-		for ( uint i = 0; i < sqlresult->size(); ++i) {
-			cout << execute(sqlresult->getStatement(i)) << endl;
-		}
-		delete sqlresult;
+		if(executeParseResult(sqlresult, quiet, 0, &statement_cache))
+			statement_cache.invalidate();
 	}
 	
 	
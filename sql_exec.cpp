@@ -0,0 +1,1008 @@
+#include "sql_exec.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+
+using namespace std;
+using namespace hsql;
+
+Tables *SQLExec::tables = nullptr;
+std::vector<Identifier> SQLExec::vacuuming;
+
+// make query result be printable
+ostream &operator<<(ostream &out, const QueryResult &qres) {
+    if (qres.column_names != nullptr) {
+        for (auto const &column_name: *qres.column_names)
+            out << column_name << " ";
+        out << endl << "+";
+        for (uint i = 0; i < qres.column_names->size(); i++)
+            out << "----------+";
+        out << endl;
+        for (auto const &row: *qres.rows) {
+            for (auto const &column_name: *qres.column_names) {
+                auto found = row->find(column_name);
+                if (found == row->end()) {
+                    out << "NULL";
+                } else {
+                    const Value &value = found->second;
+                    switch (value.data_type) {
+                        case ColumnAttribute::INT:
+                            out << value.n;
+                            break;
+                        case ColumnAttribute::TEXT:
+                            out << "\"" << value.s << "\"";
+                            break;
+                        default:
+                            out << "???";
+                    }
+                }
+                out << " ";
+            }
+            out << endl;
+        }
+    }
+    out << qres.message;
+    return out;
+}
+
+QueryResult::~QueryResult() {
+    if (rows != nullptr)
+        for (auto row: *rows)
+            delete row;
+    delete rows;
+    delete column_names;
+    delete column_attributes;
+}
+
+/**
+    Open the catalog, creating it in a new environment
+    @returns  the catalog
+*/
+Tables &SQLExec::get_tables() {
+    if (tables == nullptr) {
+        ArenaScope heap(nullptr);  // lives as long as the program
+        initialize_schema_tables();
+        tables = new Tables();
+        tables->open();
+        tables->get_columns_table().open();
+    }
+    return *tables;
+}
+
+QueryResult *SQLExec::execute(const SQLStatement *statement) {
+    return execute(statement, Tables::HEAP);
+}
+
+QueryResult *SQLExec::execute(const SQLStatement *statement, Tables::StorageEngine storage_engine) {
+    try {
+        switch (statement->type()) {
+            case kStmtCreate:
+                return create((const CreateStatement *) statement, storage_engine);
+            case kStmtDrop:
+                return drop((const DropStatement *) statement);
+            case kStmtInsert:
+                return insert((const InsertStatement *) statement);
+            case kStmtSelect:
+                return select((const SelectStatement *) statement);
+            case kStmtDelete:
+                return del((const DeleteStatement *) statement);
+            default:
+                return new QueryResult("not implemented");
+        }
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+/**
+    Convert a literal in the parse tree to a Value
+    @param expr  an INT or string literal
+    @returns     the value
+*/
+Value SQLExec::literal(const Expr *expr) {
+    switch (expr->type) {
+        case kExprLiteralInt:
+            if (expr->ival > INT32_MAX || expr->ival < INT32_MIN)
+                throw SQLExecError("integer literal out of range: " + to_string(expr->ival));
+            return Value((int32_t) expr->ival);
+        case kExprLiteralString:
+            return Value(string(expr->name));
+        default:
+            throw SQLExecError("only INT and TEXT literals are supported");
+    }
+}
+
+QueryResult *SQLExec::create(const CreateStatement *statement, Tables::StorageEngine storage_engine) {
+    if (statement->type != CreateStatement::kTable)
+        return new QueryResult("only CREATE TABLE is implemented");
+    Tables &catalog = get_tables();
+    Identifier table_name = statement->tableName;
+    if (catalog.exists(table_name)) {
+        if (statement->ifNotExists)
+            return new QueryResult("table " + table_name + " already exists");
+        throw SQLExecError("table " + table_name + " already exists");
+    }
+
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    Handle table_handle = catalog.insert(&row);
+    Handles column_handles;
+    try {
+        for (ColumnDefinition *column: *statement->columns) {
+            row["column_name"] = Value(string(column->name));
+            switch (column->type) {
+                case ColumnDefinition::INT:
+                    row["data_type"] = Value("INT");
+                    break;
+                case ColumnDefinition::TEXT:
+                    row["data_type"] = Value("TEXT");
+                    break;
+                default:
+                    throw SQLExecError("column " + string(column->name) + ": only INT and TEXT are supported");
+            }
+            column_handles.push_back(catalog.get_columns_table().insert(&row));
+        }
+        catalog.new_table(table_name, storage_engine).create();
+    } catch (...) {
+        // undo the catalog entries
+        for (auto const &handle: column_handles)
+            catalog.get_columns_table().del(handle);
+        catalog.del(table_handle);
+        throw;
+    }
+    return new QueryResult("created " + table_name);
+}
+
+QueryResult *SQLExec::drop(const DropStatement *statement) {
+    if (statement->type != DropStatement::kTable)
+        return new QueryResult("only DROP TABLE is implemented");
+    Tables &catalog = get_tables();
+    Identifier table_name = statement->name;
+    if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME)
+        throw SQLExecError("cannot drop a schema table");
+
+    catalog.get_table(table_name).drop();
+
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = catalog.get_columns_table().select(&where);
+    catalog.get_columns_table().del(handles);
+    delete handles;
+    handles = catalog.select(&where);
+    for (auto const &handle: *handles)
+        catalog.del(handle);  // also forgets the relation
+    delete handles;
+    return new QueryResult("dropped " + table_name);
+}
+
+/**
+    The columns an INSERT fills in: those it names, or else all of the table's
+    @param statement          the INSERT
+    @param table              the table it inserts into
+    @param column_names       set to the columns
+    @param column_attributes  set to their attributes
+*/
+void SQLExec::insert_columns(const InsertStatement *statement, const DbRelation &table, ColumnNames &column_names,
+                             ColumnAttributes &column_attributes) {
+    column_names.clear();
+    column_attributes.clear();
+    if (statement->columns != nullptr)
+        for (char *column_name: *statement->columns)
+            column_names.push_back(column_name);
+    else
+        column_names = table.get_column_names();
+    for (auto const &column_name: column_names) {
+        auto found = find(table.get_column_names().begin(), table.get_column_names().end(), column_name);
+        if (found == table.get_column_names().end())
+            throw SQLExecError("unknown column " + column_name);
+        column_attributes.push_back(table.get_column_attributes()[found - table.get_column_names().begin()]);
+    }
+}
+
+/**
+    The row of an INSERT ... VALUES
+    @param statement          the INSERT
+    @param column_names       the columns it fills in
+    @param column_attributes  their attributes
+    @param row                set to the values by column
+*/
+void SQLExec::insert_row(const InsertStatement *statement, const ColumnNames &column_names,
+                         const ColumnAttributes &column_attributes, ValueDict &row) {
+    if (statement->values->size() != column_names.size())
+        throw SQLExecError("INSERT has " + to_string(statement->values->size()) + " values for "
+                           + to_string(column_names.size()) + " columns");
+    row.clear();
+    for (uint i = 0; i < column_names.size(); i++) {
+        Value value = literal((*statement->values)[i]);
+        if (value.data_type != column_attributes[i].get_data_type())
+            throw SQLExecError("wrong type of value for column " + column_names[i]);
+        row[column_names[i]] = value;
+    }
+}
+
+// Whether a plan scans the given table
+static bool reads_table(const QueryOperator *plan, const DbRelation &table) {
+    const TableScan *scan = dynamic_cast<const TableScan *>(plan);
+    if (scan != nullptr && scan->get_relation().get_table_name() == table.get_table_name())
+        return true;
+    for (auto input: plan->get_inputs())
+        if (reads_table(input, table))
+            return true;
+    return false;
+}
+
+QueryResult *SQLExec::insert(const InsertStatement *statement) {
+    DbRelation &table = get_tables().get_table(statement->tableName);
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    insert_columns(statement, table, column_names, column_attributes);
+    table.open();
+
+    uint count = 0;
+    ValueDict row;
+    if (statement->type == InsertStatement::kInsertValues) {
+        insert_row(statement, column_names, column_attributes, row);
+        table.insert(&row);
+        count++;
+    } else {
+        QueryOperator *plan = plan_select(statement->select);
+        // a SELECT from the table itself is read to the end first, or the scan would pick up the rows inserted
+        if (reads_table(plan, table))
+            plan = new Materialize(plan);
+        try {
+            if (plan->get_column_names().size() != column_names.size())
+                throw SQLExecError("INSERT ... SELECT has " + to_string(plan->get_column_names().size())
+                                   + " columns for " + to_string(column_names.size()));
+            for (uint i = 0; i < column_names.size(); i++)
+                if (plan->get_column_attributes()[i].get_data_type() != column_attributes[i].get_data_type())
+                    throw SQLExecError("wrong type of value for column " + column_names[i]);
+            // handed to the table a batch at a time, which a column table writes a segment at a time
+            plan->open();
+            ValueDict selected;
+            vector<ValueDict *> batch;
+            try {
+                while (plan->next(selected)) {
+                    ValueDict *batch_row = new ValueDict();
+                    for (uint i = 0; i < column_names.size(); i++)
+                        (*batch_row)[column_names[i]] = selected.at(plan->get_column_names()[i]);
+                    batch.push_back(batch_row);
+                    if (batch.size() == INSERT_BATCH_ROWS) {
+                        table.insert(&batch);
+                        count += batch.size();
+                        for (auto batch_row: batch)
+                            delete batch_row;
+                        batch.clear();
+                    }
+                }
+                table.insert(&batch);
+                count += batch.size();
+            } catch (...) {
+                for (auto batch_row: batch)
+                    delete batch_row;
+                throw;
+            }
+            for (auto batch_row: batch)
+                delete batch_row;
+            plan->close();
+        } catch (...) {
+            delete plan;
+            throw;
+        }
+        delete plan;
+    }
+    return new QueryResult("successfully inserted " + to_string(count) + " row" + (count == 1 ? "" : "s")
+                           + " into " + statement->tableName);
+}
+
+QueryResult *SQLExec::insert_values(const vector<const InsertStatement *> &statements, vector<string> &errors) {
+    errors.assign(statements.size(), "");
+    if (statements.empty())
+        return new QueryResult("successfully inserted 0 rows");
+    uint count = 0;
+    uint next = 0;  // the first statement not handed to the table yet
+    try {
+        DbRelation &table = get_tables().get_table(statements.front()->tableName);
+        ColumnNames column_names;
+        ColumnAttributes column_attributes;
+        insert_columns(statements.front(), table, column_names, column_attributes);
+        table.open();
+        vector<ValueDict *> batch;
+        vector<uint> batch_statements;  // the statement of each row of the batch
+        for (uint i = 0; i < statements.size(); i++) {
+            ValueDict row;
+            try {
+                insert_row(statements[i], column_names, column_attributes, row);
+            } catch (SQLExecError &e) {
+                errors[i] = e.what();
+                continue;
+            }
+            batch.push_back(new ValueDict(row));
+            batch_statements.push_back(i);
+            if (batch.size() == INSERT_BATCH_ROWS) {
+                count += insert_batch(table, batch, batch_statements, errors);
+                next = i + 1;
+            }
+        }
+        count += insert_batch(table, batch, batch_statements, errors);
+    } catch (SQLExecError &e) {
+        errors.assign(statements.size(), e.what());  // the table or columns, the same for every statement
+    } catch (DbRelationError &e) {
+        errors.assign(statements.size(), string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        for (uint i = next; i < statements.size(); i++)
+            if (errors[i].empty())
+                errors[i] = string("DbException: ") + e.what();
+    }
+    return new QueryResult("successfully inserted " + to_string(count) + " row" + (count == 1 ? "" : "s")
+                           + " into " + statements.front()->tableName);
+}
+
+/**
+    Hand a batch of rows to the table at once. If the table won't take one of them (it then takes
+    none), they go in one at a time instead, so that only the statements whose rows it won't take
+    are left out. The batch is emptied either way.
+    @param table             the table
+    @param batch             the rows
+    @param batch_statements  the statement of each row
+    @param errors            set to why a statement was left out, by statement
+    @returns                 how many rows went in
+*/
+uint SQLExec::insert_batch(DbRelation &table, vector<ValueDict *> &batch, vector<uint> &batch_statements,
+                           vector<string> &errors) {
+    uint count = 0;
+    try {
+        try {
+            table.insert(&batch);
+            count = batch.size();
+        } catch (DbRelationError &e) {
+            for (uint i = 0; i < batch.size(); i++) {
+                try {
+                    table.insert(batch[i]);
+                    count++;
+                } catch (DbRelationError &e) {
+                    errors[batch_statements[i]] = string("DbRelationError: ") + e.what();
+                }
+            }
+        }
+    } catch (...) {
+        for (auto batch_row: batch)
+            delete batch_row;
+        batch.clear();
+        batch_statements.clear();
+        throw;
+    }
+    for (auto batch_row: batch)
+        delete batch_row;
+    batch.clear();
+    batch_statements.clear();
+    return count;
+}
+
+/**
+    Split a WHERE clause into the equalities the table scan can check and comparisons for a filter
+    @param expr         the where clause (a conjunction of <column> <op> <literal>)
+    @param table        table the columns belong to
+    @param where        gets the <column> = <literal> terms
+    @param comparisons  gets the other terms
+*/
+void SQLExec::where_clause(const Expr *expr, const DbRelation &table, ValueDict &where,
+                           vector<Comparison> &comparisons) {
+    if (expr->type != kExprOperator)
+        throw SQLExecError("unsupported WHERE clause");
+    if (expr->opType == Expr::AND) {
+        where_clause(expr->expr, table, where, comparisons);
+        where_clause(expr->expr2, table, where, comparisons);
+        return;
+    }
+
+    Comparison::Op op;
+    if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '=')
+        op = Comparison::EQ;
+    else if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '<')
+        op = Comparison::LT;
+    else if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '>')
+        op = Comparison::GT;
+    else if (expr->opType == Expr::NOT_EQUALS)
+        op = Comparison::NE;
+    else if (expr->opType == Expr::LESS_EQ)
+        op = Comparison::LE;
+    else if (expr->opType == Expr::GREATER_EQ)
+        op = Comparison::GE;
+    else
+        throw SQLExecError("unsupported operator in WHERE clause");
+
+    const Expr *column = expr->expr, *value = expr->expr2;
+    if (column->type != kExprColumnRef) {
+        // literal <op> column: swap the sides
+        swap(column, value);
+        static const Comparison::Op MIRRORED[] = {Comparison::EQ, Comparison::NE, Comparison::GT, Comparison::GE,
+                                                  Comparison::LT, Comparison::LE};
+        op = MIRRORED[op];
+    }
+    if (column->type != kExprColumnRef || !value->isLiteral())
+        throw SQLExecError("WHERE clause terms must compare a column to a literal");
+
+    Identifier column_name = column->name;
+    const ColumnNames &column_names = table.get_column_names();
+    auto found = find(column_names.begin(), column_names.end(), column_name);
+    if (found == column_names.end())
+        throw SQLExecError("unknown column " + column_name);
+    Value operand = literal(value);
+    if (operand.data_type != table.get_column_attributes()[found - column_names.begin()].get_data_type())
+        throw SQLExecError("wrong type of value for column " + column_name);
+    if (op == Comparison::EQ && where.find(column_name) == where.end())
+        where[column_name] = operand;
+    else
+        comparisons.push_back(Comparison(column_name, op, operand));
+}
+
+// Bounds the INT comparisons put on their columns, for the scan to skip blocks by
+static IntRanges int_ranges(const vector<Comparison> &comparisons) {
+    IntRanges ranges;
+    for (auto const &comparison: comparisons) {
+        if (comparison.value.data_type != ColumnAttribute::INT || comparison.op == Comparison::NE)
+            continue;
+        int64_t n = comparison.value.n, low = INT32_MIN, high = INT32_MAX;
+        if (comparison.op == Comparison::EQ || comparison.op == Comparison::GE)
+            low = n;
+        if (comparison.op == Comparison::EQ || comparison.op == Comparison::LE)
+            high = n;
+        if (comparison.op == Comparison::GT)
+            low = n + 1;
+        if (comparison.op == Comparison::LT)
+            high = n - 1;
+        auto &range = ranges.insert(make_pair(comparison.column_name, make_pair(INT32_MIN, INT32_MAX))).first->second;
+        if (low > high || low > range.second || high < range.first)
+            range = make_pair(INT32_MAX, INT32_MIN);  // nothing qualifies
+        else
+            range = make_pair((int32_t) max(low, (int64_t) range.first), (int32_t) min(high, (int64_t) range.second));
+    }
+    return ranges;
+}
+
+// Name of a select-list expression in the result
+static Identifier output_name(const Expr *expr) {
+    if (expr->alias != nullptr)
+        return expr->alias;
+    if (expr->type == kExprFunctionRef) {
+        string function = expr->name;
+        transform(function.begin(), function.end(), function.begin(), ::toupper);
+        return function + "(" + (expr->expr->type == kExprStar ? string("*") : string(expr->expr->name)) + ")";
+    }
+    return expr->name;
+}
+
+// The tables of a FROM clause, and the ON conditions of the (inner) joins between them
+static void from_clause(const TableRef *table_ref, vector<const TableRef *> &table_refs,
+                        vector<const Expr *> &conditions) {
+    switch (table_ref->type) {
+        case kTableName:
+            table_refs.push_back(table_ref);
+            break;
+        case kTableCrossProduct:
+            for (const TableRef *item: *table_ref->list)
+                from_clause(item, table_refs, conditions);
+            break;
+        case kTableJoin:
+            if (table_ref->join->type != kJoinInner && table_ref->join->type != kJoinCross)
+                throw SQLExecError("only inner joins are supported");
+            from_clause(table_ref->join->left, table_refs, conditions);
+            from_clause(table_ref->join->right, table_refs, conditions);
+            if (table_ref->join->condition != nullptr)
+                conditions.push_back(table_ref->join->condition);
+            break;
+        default:
+            throw SQLExecError("only tables are supported in FROM");
+    }
+}
+
+/**
+    Build the operator tree for a SELECT:
+        [Projection] [Limit] [Sort] [HashAggregate] <input>
+    The input of a single table is
+        [Filter] TableScan
+    and that of several a tree of HashJoins (see order_joins) over one
+        Projection [Filter] TableScan
+    of each table, naming its columns <table>.<column> (by the table's alias, if it has one).
+    The HashAggregate is a ParallelAggregate when its input streams down to a big enough heap
+    table (see morsel.h) and there is more than one core to run it on.
+    ORDER BY with a LIMIT only keeps the best LIMIT + OFFSET rows while sorting.
+    Without ORDER BY (or grouping or joins) a LIMIT stops the scan once enough rows came out of it.
+    The scans only decode the columns the query uses and check the equalities of the WHERE clause
+    (and ON conditions) on their table; equalities between columns of two tables are what the
+    tables are joined on.
+    @param statement  the SELECT
+    @returns          the plan (freed by caller)
+*/
+QueryOperator *SQLExec::plan_select(const SelectStatement *statement) {
+    if (statement->fromTable == nullptr)
+        throw SQLExecError("SELECT without FROM is not supported");
+    if (statement->groupBy != nullptr && statement->groupBy->having != nullptr)
+        throw SQLExecError("HAVING is not supported");
+    vector<const TableRef *> table_refs;
+    vector<const Expr *> conditions;
+    from_clause(statement->fromTable, table_refs, conditions);
+    if (statement->whereClause != nullptr)
+        conditions.push_back(statement->whereClause);
+    vector<DbRelation *> tables;
+    vector<Identifier> table_names;  // as the query calls them
+    for (auto table_ref: table_refs) {
+        Identifier table_name = table_ref->getName();
+        if (find(table_names.begin(), table_names.end(), table_name) != table_names.end())
+            throw SQLExecError("table " + table_name + " is in FROM twice (give it an alias)");
+        table_names.push_back(table_name);
+        tables.push_back(&get_tables().get_table(table_ref->name));
+    }
+    bool joining = tables.size() > 1;
+
+    // the columns of the tables, by their names in the plan
+    auto plan_name = [joining, &table_names](uint table, const Identifier &column_name) {
+        return joining ? table_names[table] + "." + column_name : column_name;
+    };
+    map<Identifier, pair<uint, Identifier> > columns;  // table and column of each
+    map<Identifier, uint> column_counts;  // how many tables have a column of a name
+    for (uint i = 0; i < tables.size(); i++)
+        for (auto const &column_name: tables[i]->get_column_names()) {
+            columns[plan_name(i, column_name)] = make_pair(i, column_name);
+            column_counts[column_name]++;
+        }
+    auto resolve = [&](const Expr *expr) {
+        Identifier column_name = expr->name;
+        for (uint i = 0; i < tables.size(); i++) {
+            if (expr->table != nullptr && table_names[i] != expr->table)
+                continue;
+            const ColumnNames &table_columns = tables[i]->get_column_names();
+            if (find(table_columns.begin(), table_columns.end(), column_name) == table_columns.end())
+                continue;
+            if (expr->table == nullptr && column_counts.at(column_name) > 1)
+                throw SQLExecError("column " + column_name + " is ambiguous");
+            return plan_name(i, column_name);
+        }
+        throw SQLExecError("unknown column " + (expr->table == nullptr ? "" : string(expr->table) + ".")
+                           + column_name);
+    };
+    // what the result calls a column: just the column, unless other tables have one of that name
+    auto result_name = [&columns, &column_counts](const Identifier &name) {
+        const Identifier &column_name = columns.at(name).second;
+        return column_counts.at(column_name) > 1 ? name : column_name;
+    };
+
+    // what the select list asks for
+    ColumnNames input_names, output_names, group_by;
+    vector<AggregateSpec> aggregates;
+    for (Expr *expr: *statement->selectList) {
+        if (expr->type == kExprStar) {
+            for (uint i = 0; i < tables.size(); i++)
+                for (auto const &column_name: tables[i]->get_column_names()) {
+                    input_names.push_back(plan_name(i, column_name));
+                    output_names.push_back(result_name(input_names.back()));
+                }
+        } else if (expr->type == kExprColumnRef) {
+            input_names.push_back(resolve(expr));
+            output_names.push_back(expr->alias != nullptr ? expr->alias : result_name(input_names.back()));
+        } else if (expr->type == kExprFunctionRef) {
+            string function = expr->name;
+            transform(function.begin(), function.end(), function.begin(), ::toupper);
+            static const vector<string> FUNCTIONS = {"COUNT", "SUM", "MIN", "MAX", "AVG"};
+            auto found = find(FUNCTIONS.begin(), FUNCTIONS.end(), function);
+            if (found == FUNCTIONS.end())
+                throw SQLExecError("unknown function " + function);
+            if (expr->distinct)
+                throw SQLExecError(function + "(DISTINCT ...) is not supported");
+            Identifier argument;
+            if (expr->expr->type == kExprColumnRef)
+                argument = resolve(expr->expr);
+            else if (expr->expr->type != kExprStar || function != "COUNT")
+                throw SQLExecError(function + " needs a column");
+            Identifier name = output_name(expr);
+            aggregates.push_back(AggregateSpec((AggregateSpec::Function) (found - FUNCTIONS.begin()), argument, name));
+            input_names.push_back(name);
+            output_names.push_back(name);
+        } else {
+            throw SQLExecError("only columns and aggregates are supported in the select list");
+        }
+    }
+    if (statement->groupBy != nullptr)
+        for (Expr *expr: *statement->groupBy->columns) {
+            if (expr->type != kExprColumnRef)
+                throw SQLExecError("only columns are supported in GROUP BY");
+            group_by.push_back(resolve(expr));
+        }
+    bool aggregating = !aggregates.empty() || !group_by.empty();
+    if (aggregating)
+        for (auto const &column_name: input_names)
+            if (find(group_by.begin(), group_by.end(), column_name) == group_by.end()
+                && find_if(aggregates.begin(), aggregates.end(), [&column_name](const AggregateSpec &aggregate) {
+                    return aggregate.output_name == column_name;
+                }) == aggregates.end())
+                throw SQLExecError("column " + column_name + " must be in GROUP BY or in an aggregate");
+
+    // ORDER BY terms name a select-list entry (by alias) or a column
+    vector<SortKey> sort_keys;
+    if (statement->order != nullptr)
+        for (OrderDescription *order: *statement->order) {
+            if (order->expr->type != kExprColumnRef && order->expr->type != kExprFunctionRef)
+                throw SQLExecError("only columns and aggregates are supported in ORDER BY");
+            Identifier name = output_name(order->expr);
+            auto found = output_names.end();
+            if (order->expr->type == kExprFunctionRef || order->expr->table == nullptr)
+                found = find(output_names.begin(), output_names.end(), name);
+            if (found != output_names.end())
+                name = input_names[found - output_names.begin()];
+            else if (order->expr->type == kExprColumnRef)
+                name = resolve(order->expr);
+            if (found == output_names.end() && aggregating && find(group_by.begin(), group_by.end(), name) == group_by.end())
+                throw SQLExecError("ORDER BY " + name + " must be in the select list or GROUP BY");
+            sort_keys.push_back(SortKey(name, order->type == kOrderDesc));
+        }
+    u_int64_t limit = 0, offset = 0;
+    bool limited = statement->limit != nullptr && statement->limit->limit >= 0;
+    if (limited) {
+        limit = (u_int64_t) statement->limit->limit;
+        offset = statement->limit->offset > 0 ? (u_int64_t) statement->limit->offset : 0;
+    }
+
+    // the terms of the WHERE clause and ON conditions, each for the table it is about or a join
+    vector<ValueDict> wheres(tables.size());
+    vector<vector<Comparison> > comparisons(tables.size());
+    vector<JoinPredicate> predicates;
+    vector<const Expr *> terms(conditions.rbegin(), conditions.rend());  // the next one last
+    while (!terms.empty()) {
+        const Expr *term = terms.back();
+        terms.pop_back();
+        if (term->type != kExprOperator)
+            throw SQLExecError("unsupported WHERE clause");
+        if (term->opType == Expr::AND) {
+            terms.push_back(term->expr2);
+            terms.push_back(term->expr);
+            continue;
+        }
+        const Expr *column = term->expr, *other = term->expr2;
+        if (column->type != kExprColumnRef && other != nullptr && other->type == kExprColumnRef)
+            swap(column, other);
+        if (column->type != kExprColumnRef)
+            throw SQLExecError("WHERE clause terms must compare a column to a literal");
+        if (other != nullptr && other->type == kExprColumnRef) {
+            Identifier left = resolve(column), right = resolve(other);
+            if (columns.at(left).first == columns.at(right).first)
+                throw SQLExecError("WHERE clause terms must compare a column to a literal");
+            if (term->opType != Expr::SIMPLE_OP || term->opChar != '=')
+                throw SQLExecError("only equalities can join tables");
+            predicates.push_back(JoinPredicate(left, right));
+            continue;
+        }
+        uint table = columns.at(resolve(column)).first;
+        where_clause(term, *tables[table], wheres[table], comparisons[table]);
+    }
+
+    // decode only the columns somebody looks at
+    vector<ColumnNames> scan_columns(tables.size());
+    auto use = [&columns, &scan_columns](const Identifier &name) {
+        auto found = columns.find(name);
+        if (found == columns.end())
+            throw SQLExecError("unknown column " + name);
+        ColumnNames &scanned = scan_columns[found->second.first];
+        if (find(scanned.begin(), scanned.end(), found->second.second) == scanned.end())
+            scanned.push_back(found->second.second);
+    };
+    if (aggregating) {
+        for (auto const &column_name: group_by)
+            use(column_name);
+        for (auto const &aggregate: aggregates)
+            if (!aggregate.column_name.empty())
+                use(aggregate.column_name);
+    } else {
+        for (auto const &column_name: input_names)
+            use(column_name);
+        for (auto const &sort_key: sort_keys)
+            use(sort_key.column_name);
+    }
+    for (uint i = 0; i < tables.size(); i++)
+        for (auto const &comparison: comparisons[i])
+            use(plan_name(i, comparison.column_name));
+    for (auto const &predicate: predicates) {
+        use(predicate.left);
+        use(predicate.right);
+    }
+    for (uint i = 0; i < tables.size(); i++)
+        if (scan_columns[i].empty())
+            scan_columns[i].push_back(tables[i]->get_column_names().front());  // COUNT(*) still needs to see every row
+
+    vector<QueryOperator *> inputs;
+    try {
+        for (uint i = 0; i < tables.size(); i++) {
+            tables[i]->open();
+            TableScan *scan = new TableScan(*tables[i], &wheres[i], &scan_columns[i]);
+            scan->set_ranges(int_ranges(comparisons[i]));
+            if (limited && !joining && !aggregating && !statement->selectDistinct && sort_keys.empty())
+                scan->set_limit((size_t) (limit + offset));  // a Filter may still need more, the scan keeps going then
+            inputs.push_back(scan);
+            if (!comparisons[i].empty())
+                inputs.back() = new Filter(inputs.back(), comparisons[i]);
+            if (joining) {
+                ColumnNames names;
+                for (auto const &column_name: scan_columns[i])
+                    names.push_back(plan_name(i, column_name));
+                inputs.back() = new Projection(inputs.back(), scan_columns[i], names);
+            }
+        }
+    } catch (...) {
+        for (auto input: inputs)
+            delete input;
+        throw;
+    }
+    QueryOperator *plan = joining ? order_joins(inputs, predicates) : inputs.front();
+    try {
+        if (aggregating || statement->selectDistinct) {
+            const ColumnNames &keys = aggregating ? group_by : input_names;
+            if (ParallelAggregate::parallel(plan))
+                plan = new ParallelAggregate(plan, keys, aggregates, plan->get_column_names(),
+                                             plan->get_column_attributes());
+            else
+                plan = new HashAggregate(plan, keys, aggregates, plan->get_column_names(),
+                                         plan->get_column_attributes());
+        }
+        if (!sort_keys.empty())
+            plan = new Sort(plan, sort_keys, Sort::DEFAULT_MEMORY_BUDGET, limited ? (long) (limit + offset) : -1);
+        if (limited)
+            plan = new Limit(plan, limit, offset);
+        if (plan->get_column_names() != output_names || input_names != output_names)
+            plan = new Projection(plan, input_names, output_names);
+    } catch (...) {
+        delete plan;
+        throw;
+    }
+    return plan;
+}
+
+QueryResult *SQLExec::select(const SelectStatement *statement) {
+    QueryOperator *plan = plan_select(statement);
+    QueryResult *result;
+    try {
+        result = run(plan);
+    } catch (...) {
+        delete plan;
+        throw;
+    }
+    delete plan;
+    return result;
+}
+
+QueryResult *SQLExec::run(QueryOperator *plan) {
+    vector<ValueDict *> *rows = new vector<ValueDict *>();
+    try {
+        try {
+            plan->open();
+            ValueDict row;
+            while (plan->next(row))
+                rows->push_back(new ValueDict(move(row)));
+            plan->close();
+        } catch (...) {
+            for (auto row: *rows)
+                delete row;
+            delete rows;
+            plan->close();  // so that it can be opened again
+            throw;
+        }
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+    return new QueryResult(new ColumnNames(plan->get_column_names()),
+                           new ColumnAttributes(plan->get_column_attributes()), rows,
+                           "successfully returned " + to_string(rows->size()) + " rows");
+}
+
+QueryResult *SQLExec::explain(const SelectStatement *statement, bool analyze) {
+    try {
+        QueryOperator *plan = plan_select(statement);
+        if (analyze) {
+            plan = instrument(plan);
+            try {
+                plan->open();
+                ValueDict row;
+                while (plan->next(row))
+                    continue;
+                plan->close();
+            } catch (...) {
+                delete plan;
+                throw;
+            }
+        }
+        string text = ::explain(plan);
+        delete plan;
+        return new QueryResult(text);
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+/**
+    DELETE FROM t [WHERE ...]: the equalities pick the candidate rows in the scan, the other
+    comparisons are checked on just the columns they need, and then all the rows go at once
+    (one write per block touched).
+    @param statement  the DELETE
+    @returns          how many rows were deleted
+*/
+QueryResult *SQLExec::del(const DeleteStatement *statement) {
+    Identifier table_name = statement->tableName;
+    if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME)
+        throw SQLExecError("cannot delete from a schema table");
+    DbRelation &table = get_tables().get_table(table_name);
+    ValueDict where;
+    vector<Comparison> comparisons;
+    if (statement->expr != nullptr)
+        where_clause(statement->expr, table, where, comparisons);
+    table.open();
+
+    Handles *handles = where.empty() ? table.select() : table.select(&where);
+    if (!comparisons.empty()) {
+        ColumnNames column_names;
+        for (auto const &comparison: comparisons)
+            if (find(column_names.begin(), column_names.end(), comparison.column_name) == column_names.end())
+                column_names.push_back(comparison.column_name);
+        Handles *matching = new Handles();
+        for (auto const &handle: *handles) {
+            ValueDict *row = table.project(handle, &column_names);
+            if (all_of(comparisons.begin(), comparisons.end(), [row](const Comparison &comparison) {
+                return comparison.matches(*row);
+            }))
+                matching->push_back(handle);
+            delete row;
+        }
+        delete handles;
+        handles = matching;
+    }
+    size_t count = handles->size();
+    try {
+        table.del(handles);
+    } catch (...) {
+        delete handles;
+        throw;
+    }
+    delete handles;
+    return new QueryResult("successfully deleted " + to_string(count) + " row" + (count == 1 ? "" : "s")
+                           + " from " + table_name);
+}
+
+QueryResult *SQLExec::vacuum(const Identifier &table_name) {
+    try {
+        Tables &catalog = get_tables();
+        ColumnNames table_names;
+        if (table_name.empty()) {
+            Handles *handles = catalog.select();
+            for (auto const &handle: *handles) {
+                ValueDict *row = catalog.project(handle);
+                table_names.push_back(row->at("table_name").s);
+                delete row;
+            }
+            delete handles;
+        } else {
+            table_names.push_back(table_name);
+        }
+        string message;
+        for (auto const &name: table_names) {
+            DbRelation &table = catalog.get_table(name);
+            table.open();
+            u_int32_t freed = table.vacuum();
+            message += (message.empty() ? "" : "\n") + string("vacuumed ") + name + ": " + to_string(freed) + " block"
+                       + (freed == 1 ? "" : "s") + " freed";
+        }
+        return new QueryResult(message);
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+QueryResult *SQLExec::vacuum_online(const Identifier &table_name) {
+    if (table_name.empty())
+        throw SQLExecError("VACUUM ONLINE needs a table");
+    if (!get_tables().exists(table_name))
+        throw SQLExecError("table " + table_name + " does not exist");
+    if (find(vacuuming.begin(), vacuuming.end(), table_name) == vacuuming.end())
+        vacuuming.push_back(table_name);
+    return new QueryResult("vacuuming " + table_name + " in the background");
+}
+
+QueryResult *SQLExec::checkpoint() {
+    try {
+        ColumnTable::checkpoint();  // into dirty blocks, written with the rest
+        u_int32_t written = HeapFile::checkpoint();
+        return new QueryResult("checkpoint: " + to_string(written) + " block" + (written == 1 ? "" : "s")
+                               + " written");
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+// The heap table of that name; Bloom filters are only kept for heap tables.
+HeapTable &SQLExec::get_heap_table(const Identifier &table_name) {
+    if (!get_tables().exists(table_name))
+        throw SQLExecError("table " + table_name + " does not exist");
+    HeapTable *table = dynamic_cast<HeapTable *>(&get_tables().get_table(table_name));
+    if (table == nullptr)
+        throw SQLExecError(table_name + " is not a heap table");
+    return *table;
+}
+
+QueryResult *SQLExec::create_bloom_filter(const Identifier &table_name, const ColumnNames &column_names) {
+    try {
+        HeapTable &table = get_heap_table(table_name);
+        table.create_bloom_filter(column_names);
+        BloomStats stats;
+        table.get_bloom_columns(&stats);
+        return new QueryResult("created Bloom filter on " + table_name + ": " + to_string(stats.blocks) + " block"
+                               + (stats.blocks == 1 ? "" : "s"));
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+QueryResult *SQLExec::drop_bloom_filter(const Identifier &table_name) {
+    try {
+        HeapTable &table = get_heap_table(table_name);
+        if (table.get_bloom_columns().empty())
+            throw SQLExecError(table_name + " has no Bloom filter");
+        table.drop_bloom_filter();
+        return new QueryResult("dropped Bloom filter on " + table_name);
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+QueryResult *SQLExec::show_bloom_filter(const Identifier &table_name) {
+    try {
+        HeapTable &table = get_heap_table(table_name);
+        BloomStats stats;
+        ColumnNames column_names = table.get_bloom_columns(&stats);
+        if (column_names.empty())
+            return new QueryResult(table_name + " has no Bloom filter");
+        string message = "Bloom filter on " + table_name + " (";
+        for (uint i = 0; i < column_names.size(); i++)
+            message += (i == 0 ? "" : ", ") + column_names[i];
+        char rate[32];
+        snprintf(rate, sizeof(rate), "%.2f%%", 100.0 * stats.false_positive_rate());
+        message += "): " + to_string(stats.blocks) + " blocks, " + to_string(stats.probes) + " probes, "
+                   + to_string(stats.skipped) + " blocks skipped, " + to_string(stats.false_positives)
+                   + " false positives (" + rate + ")";
+        return new QueryResult(message);
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+/**
+    One round of the online vacuums. A table is done once a step says there is nothing left to
+    move (or once it is gone). Nothing in the tree keeps handles across statements yet, so the
+    relocations aren't passed on to anyone.
+    @param max_rows  how many rows each table may move in this round
+*/
+void SQLExec::background_vacuum(size_t max_rows) {
+    for (auto table_name = vacuuming.begin(); table_name != vacuuming.end();) {
+        bool more;
+        try {
+            DbRelation &table = get_tables().get_table(*table_name);
+            table.open();
+            more = table.vacuum_step(max_rows);  // no index to tell where rows moved (see sql_exec.h)
+        } catch (DbRelationError &e) {
+            more = false;  // dropped meanwhile
+        } catch (DbException &e) {
+            more = false;  // Berkeley DB failed; the table is left as far as it got
+        }
+        table_name = more ? table_name + 1 : vacuuming.erase(table_name);
+    }
+}
@@ -0,0 +1,198 @@
+/**
+ * @file sql_exec.h - executes parsed SQL statements against the catalog and the storage engines
+ *
+ * Supported so far:
+ *      CREATE TABLE [IF NOT EXISTS] t (c INT|TEXT, ...) [USING HEAP|COLUMN|PAX]  (USING is up to the caller)
+ *      DROP TABLE t
+ *      INSERT INTO t [(c, ...)] VALUES (...) | SELECT ...
+ *      SELECT [DISTINCT] * | c [AS x] | COUNT(*) | COUNT/SUM/MIN/MAX/AVG(c) [AS x], ...
+ *          FROM t [[AS] a], ... | t [JOIN u ON t.c = u.c ...]
+ *          [WHERE c <op> literal | t.c = u.c [AND ...]] [GROUP BY c, ...] [ORDER BY c [DESC], ...]
+ *          [LIMIT n [OFFSET m]]
+ *      DELETE FROM t [WHERE c <op> literal [AND ...]]
+ */
+#pragma once
+
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "SQLParser.h"
+#include "schema_tables.h"
+#include "query_operators.h"
+#include "join_order.h"
+#include "morsel.h"
+
+/**
+ * @class SQLExecError - exception for SQLExec methods
+ */
+class SQLExecError : public std::runtime_error {
+public:
+    explicit SQLExecError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class QueryResult - data returned by SQLExec::execute: the rows of a SELECT and/or a message
+ */
+class QueryResult {
+public:
+    QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
+                                       message(message) {}
+
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, std::vector<ValueDict *> *rows,
+                std::string message) : column_names(column_names), column_attributes(column_attributes), rows(rows),
+                                       message(message) {}
+
+    virtual ~QueryResult();
+
+    QueryResult(const QueryResult &other) = delete;
+
+    QueryResult &operator=(const QueryResult &other) = delete;
+
+    ColumnNames *get_column_names() const { return column_names; }
+
+    ColumnAttributes *get_column_attributes() const { return column_attributes; }
+
+    std::vector<ValueDict *> *get_rows() const { return rows; }
+
+    const std::string &get_message() const { return message; }
+
+    friend std::ostream &operator<<(std::ostream &stream, const QueryResult &qres);
+
+protected:
+    ColumnNames *column_names;
+    ColumnAttributes *column_attributes;
+    std::vector<ValueDict *> *rows;
+    std::string message;
+};
+
+/**
+ * @class SQLExec - executes a parsed SQL statement
+ */
+class SQLExec {
+public:
+    /**
+     * Execute the given SQL statement.
+     * @param statement   the hsql parse tree to execute
+     * @returns           the query result (freed by caller)
+     */
+    static QueryResult *execute(const hsql::SQLStatement *statement);
+
+    /**
+     * Execute the given SQL statement, keeping a table it creates in the given storage engine.
+     * @param statement       the hsql parse tree to execute
+     * @param storage_engine  where the rows of a new table go (HEAP for the other execute)
+     * @returns               the query result (freed by caller)
+     */
+    static QueryResult *execute(const hsql::SQLStatement *statement, Tables::StorageEngine storage_engine);
+
+    // build the operator tree for a SELECT (freed by caller)
+    static QueryOperator *plan_select(const hsql::SelectStatement *statement);
+
+    /**
+     * Run a SELECT's plan, e.g. one kept from an earlier run (see StatementCache::get_plan).
+     * @param plan  the plan from plan_select, closed (still the caller's, and closed again after)
+     * @returns     the query result (freed by caller)
+     */
+    static QueryResult *run(QueryOperator *plan);
+
+    /**
+     * EXPLAIN [ANALYZE] SELECT ...: the plan of a query, and with ANALYZE what each operator did.
+     * @param statement  the SELECT
+     * @param analyze    run the query (its rows are thrown away) and report on each operator
+     * @returns          the query result (freed by caller)
+     */
+    static QueryResult *explain(const hsql::SelectStatement *statement, bool analyze);
+
+    static const size_t INSERT_BATCH_ROWS = 1024;
+
+    /**
+     * Many INSERT INTO t [(c, ...)] VALUES (...) at once, handed to the table INSERT_BATCH_ROWS rows at
+     * a time. A statement whose values don't fit its columns, or whose row the table won't take, is
+     * left out; the others still go in, as if run one at a time. If Berkeley DB fails, the statements
+     * from the batch it failed on are left out.
+     * @param statements  INSERT ... VALUES statements, all into the same table and columns
+     * @param errors      set to why each statement was left out, or "" for those inserted
+     * @returns           the query result (freed by caller)
+     */
+    static QueryResult *insert_values(const std::vector<const hsql::InsertStatement *> &statements,
+                                      std::vector<std::string> &errors);
+
+    static const size_t VACUUM_STEP_ROWS = 100;
+
+    /**
+     * VACUUM [t]: compact one table (or all tables, for an empty name) right away.
+     * @param table_name  table to compact, or empty for all
+     * @returns           the query result (freed by caller)
+     */
+    static QueryResult *vacuum(const Identifier &table_name);
+
+    /**
+     * VACUUM ONLINE t: compact a table a few rows at a time, in background_vacuum().
+     * @param table_name  table to compact
+     * @returns           the query result (freed by caller)
+     */
+    static QueryResult *vacuum_online(const Identifier &table_name);
+
+    // move up to max_rows rows of each table with an online vacuum going, between statements (one
+    // that fails is left as far as it got, and stops being vacuumed). The new handles of the rows
+    // that move are not passed on: nothing keeps handles from one statement to the next, there
+    // being no indexes yet; an index on a heap table will have to take them from vacuum_step.
+    static void background_vacuum(size_t max_rows = VACUUM_STEP_ROWS);
+
+    /**
+     * CHECKPOINT: write back the blocks put and not written to Berkeley DB yet, of every table.
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *checkpoint();
+
+    /**
+     * CREATE BLOOM FILTER ON t (c, ...): keep Bloom filters on TEXT columns of a heap table.
+     * @param table_name    the table
+     * @param column_names  its columns to filter on
+     * @returns             the query result (freed by caller)
+     */
+    static QueryResult *create_bloom_filter(const Identifier &table_name, const ColumnNames &column_names);
+
+    // DROP BLOOM FILTER ON t
+    static QueryResult *drop_bloom_filter(const Identifier &table_name);
+
+    // SHOW BLOOM FILTER ON t: the columns filtered on, and how many blocks the filters let scans skip
+    static QueryResult *show_bloom_filter(const Identifier &table_name);
+
+protected:
+    // the one copy of the catalog, opened on first use
+    static Tables *tables;
+
+    static Tables &get_tables();
+
+    // a table, which has to be a heap table
+    static HeapTable &get_heap_table(const Identifier &table_name);
+
+    // tables with an online vacuum going
+    static std::vector<Identifier> vacuuming;
+
+    static QueryResult *create(const hsql::CreateStatement *statement, Tables::StorageEngine storage_engine);
+
+    static QueryResult *drop(const hsql::DropStatement *statement);
+
+    static QueryResult *insert(const hsql::InsertStatement *statement);
+
+    static QueryResult *select(const hsql::SelectStatement *statement);
+
+    static QueryResult *del(const hsql::DeleteStatement *statement);
+
+    static Value literal(const hsql::Expr *expr);
+
+    static void insert_columns(const hsql::InsertStatement *statement, const DbRelation &table,
+                               ColumnNames &column_names, ColumnAttributes &column_attributes);
+
+    static void insert_row(const hsql::InsertStatement *statement, const ColumnNames &column_names,
+                           const ColumnAttributes &column_attributes, ValueDict &row);
+
+    static uint insert_batch(DbRelation &table, std::vector<ValueDict *> &batch, std::vector<uint> &batch_statements,
+                             std::vector<std::string> &errors);
+
+    static void where_clause(const hsql::Expr *expr, const DbRelation &table, ValueDict &where,
+                             std::vector<Comparison> &comparisons);
+};
@@ -0,0 +1,462 @@
+#include "statement_cache.h"
+#include "sql_exec.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace hsql;
+
+/*
+            ---------------------------
+~~~~~~~~~~~~|   PREPARED STATEMENT     |~~~~~~~~~~~~
+            ---------------------------
+*/
+
+static void collect_placeholders(Expr *expr, vector<Expr *> &placeholders);
+
+static void collect_placeholders(const SelectStatement *stmt, vector<Expr *> &placeholders);
+
+// Gather the placeholders in a table reference (join conditions and sub-selects)
+static void collect_placeholders(const TableRef *table, vector<Expr *> &placeholders) {
+    if (table == nullptr)
+        return;
+    switch (table->type) {
+        case kTableSelect:
+            collect_placeholders(table->select, placeholders);
+            break;
+        case kTableJoin:
+            collect_placeholders(table->join->left, placeholders);
+            collect_placeholders(table->join->right, placeholders);
+            collect_placeholders(table->join->condition, placeholders);
+            break;
+        case kTableCrossProduct:
+            for (TableRef *tbl : *table->list)
+                collect_placeholders(tbl, placeholders);
+            break;
+        default:
+            break;
+    }
+}
+
+// Gather the placeholders in an expression tree
+static void collect_placeholders(Expr *expr, vector<Expr *> &placeholders) {
+    if (expr == nullptr)
+        return;
+    if (expr->type == kExprPlaceholder) {
+        placeholders.push_back(expr);
+        return;
+    }
+    collect_placeholders(expr->expr, placeholders);
+    collect_placeholders(expr->expr2, placeholders);
+    if (expr->exprList != nullptr)
+        for (Expr *e : *expr->exprList)
+            collect_placeholders(e, placeholders);
+    if (expr->select != nullptr)
+        collect_placeholders(expr->select, placeholders);
+}
+
+// Gather the placeholders in every clause of a select
+static void collect_placeholders(const SelectStatement *stmt, vector<Expr *> &placeholders) {
+    if (stmt == nullptr)
+        return;
+    for (Expr *expr : *stmt->selectList)
+        collect_placeholders(expr, placeholders);
+    collect_placeholders(stmt->fromTable, placeholders);
+    collect_placeholders(stmt->whereClause, placeholders);
+    if (stmt->groupBy != nullptr) {
+        if (stmt->groupBy->columns != nullptr)
+            for (Expr *expr : *stmt->groupBy->columns)
+                collect_placeholders(expr, placeholders);
+        collect_placeholders(stmt->groupBy->having, placeholders);
+    }
+    if (stmt->order != nullptr)
+        for (OrderDescription *order : *stmt->order)
+            collect_placeholders(order->expr, placeholders);
+    collect_placeholders(stmt->unionSelect, placeholders);
+}
+
+// Gather the placeholders of any statement type we know how to execute
+static void collect_placeholders(const SQLStatement *stmt, vector<Expr *> &placeholders) {
+    switch (stmt->type()) {
+        case kStmtSelect:
+            collect_placeholders((const SelectStatement *) stmt, placeholders);
+            break;
+        case kStmtInsert: {
+            const InsertStatement *insert = (const InsertStatement *) stmt;
+            if (insert->values != nullptr)
+                for (Expr *expr : *insert->values)
+                    collect_placeholders(expr, placeholders);
+            collect_placeholders(insert->select, placeholders);
+            break;
+        }
+        case kStmtDelete:
+            collect_placeholders(((const DeleteStatement *) stmt)->expr, placeholders);
+            break;
+        case kStmtUpdate: {
+            const UpdateStatement *update = (const UpdateStatement *) stmt;
+            if (update->updates != nullptr)
+                for (UpdateClause *clause : *update->updates)
+                    collect_placeholders(clause->value, placeholders);
+            collect_placeholders(update->where, placeholders);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+    Parse the query and find its placeholders
+    @param query  statement text with '?' placeholders
+    @throws       StatementCacheError if the query is not valid SQL
+*/
+PreparedStatement::PreparedStatement(const string &query) : parse(nullptr), placeholders() {
+    this->parse = SQLParser::parseSQLString(query);
+    if (!this->parse->isValid()) {
+        delete this->parse;
+        throw StatementCacheError("invalid SQL: " + query);
+    }
+    for (uint i = 0; i < this->parse->size(); i++)
+        collect_placeholders(this->parse->getStatement(i), this->placeholders);
+
+    // the parser numbers placeholders by their position in the text, so this puts them in written order
+    stable_sort(this->placeholders.begin(), this->placeholders.end(),
+                [](const Expr *a, const Expr *b) { return a->ival < b->ival; });
+}
+
+PreparedStatement::~PreparedStatement() {
+    unbind();
+    delete this->parse;
+}
+
+/**
+    Turn each placeholder into a literal with the corresponding parameter value
+    @param params  one value per placeholder, in order
+    @throws        StatementCacheError if the number of values doesn't match
+*/
+void PreparedStatement::bind(const vector<Value> &params) {
+    if (params.size() != this->placeholders.size())
+        throw StatementCacheError("expected " + to_string(this->placeholders.size()) + " parameters, got "
+                                  + to_string(params.size()));
+    unbind();
+    for (uint i = 0; i < params.size(); i++) {
+        Expr *expr = this->placeholders[i];
+        expr->ival2 = expr->ival;  // remember the placeholder's position for unbind
+        if (params[i].data_type == ColumnAttribute::INT) {
+            expr->type = kExprLiteralInt;
+            expr->ival = params[i].n;
+        } else {
+            expr->type = kExprLiteralString;
+            expr->name = strdup(params[i].s.c_str());
+        }
+    }
+}
+
+/**
+    Turn the bound literals back into placeholders
+*/
+void PreparedStatement::unbind() {
+    for (Expr *expr : this->placeholders) {
+        if (expr->type == kExprPlaceholder)
+            continue;
+        if (expr->type == kExprLiteralString) {
+            free(expr->name);
+            expr->name = nullptr;
+        }
+        expr->type = kExprPlaceholder;
+        expr->ival = expr->ival2;
+    }
+}
+
+/*
+            -------------------------
+~~~~~~~~~~~~|   STATEMENT CACHE     |~~~~~~~~~~~~
+            -------------------------
+*/
+
+StatementCache::StatementCache(size_t capacity) : capacity(capacity), lru(), index(), parses(), prepared(), hits(0),
+                                                  misses(0), plan_hits(0) {
+}
+
+StatementCache::~StatementCache() {
+    invalidate();
+    for (auto const &entry : this->prepared)
+        delete entry.second;
+}
+
+/**
+    Get the parse of a query, parsing it only if it is not already cached
+    @param query  the query text as typed
+    @returns      the parse result (owned by the cache, possibly not valid)
+*/
+const SQLParserResult *StatementCache::get(const string &query) {
+    string key = normalize(query);
+    auto found = this->index.find(key);
+    if (found != this->index.end()) {
+        this->hits++;
+        this->lru.splice(this->lru.begin(), this->lru, found->second);
+        return found->second->parse;
+    }
+
+    this->misses++;
+    SQLParserResult *parse = SQLParser::parseSQLString(key);
+    this->lru.push_front(Entry{key, parse, map<uint, QueryOperator *>()});
+    this->index[key] = this->lru.begin();
+    this->parses[parse] = this->lru.begin();
+    if (this->lru.size() > this->capacity) {
+        Entry &victim = this->lru.back();
+        this->index.erase(victim.query);
+        this->parses.erase(victim.parse);
+        free_entry(victim);
+        this->lru.pop_back();
+    }
+    return parse;
+}
+
+/**
+    Get the plan of a SELECT in a cached parse, planning it only the first time it is asked for.
+    The plan is opened and closed again for each run, and goes with the parse.
+    @param parse  the parse result, as returned by get()
+    @param i      which of its statements
+    @returns      the plan (owned by the cache), or nullptr if the statement is not a SELECT or the
+                  parse did not come from get()
+    @throws       SQLExecError if the SELECT can't be planned
+*/
+QueryOperator *StatementCache::get_plan(const SQLParserResult *parse, uint i) {
+    auto found = this->parses.find(parse);
+    if (found == this->parses.end() || parse->getStatement(i)->type() != kStmtSelect)
+        return nullptr;
+    map<uint, QueryOperator *> &plans = found->second->plans;
+    auto plan = plans.find(i);
+    if (plan != plans.end()) {
+        this->plan_hits++;
+        return plan->second;
+    }
+    QueryOperator *built;
+    try {
+        built = SQLExec::plan_select((const SelectStatement *) parse->getStatement(i));
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+    plans[i] = built;
+    return built;
+}
+
+/**
+    Forget all cached parses and plans, e.g. after DDL has changed the tables they refer to.
+    Prepared statements are kept; they are bound against the current tables on each EXECUTE.
+*/
+void StatementCache::invalidate() {
+    for (auto &entry : this->lru)
+        free_entry(entry);
+    this->lru.clear();
+    this->index.clear();
+    this->parses.clear();
+}
+
+// free the parse and plans of an entry about to be dropped
+void StatementCache::free_entry(Entry &entry) {
+    for (auto const &plan : entry.plans)
+        delete plan.second;
+    delete entry.parse;
+}
+
+/**
+    Execute: PREPARE <name> FROM <query>
+    @param name   name for the prepared statement (replaces any existing one)
+    @param query  statement text with '?' placeholders
+*/
+void StatementCache::prepare(const string &name, const string &query) {
+    PreparedStatement *statement = new PreparedStatement(normalize(query));
+    deallocate(name);
+    this->prepared[name] = statement;
+}
+
+/**
+    Look up a statement created with PREPARE
+    @param name  name given to PREPARE
+    @returns     the prepared statement
+    @throws      StatementCacheError if there is no such prepared statement
+*/
+PreparedStatement *StatementCache::get_prepared(const string &name) {
+    auto found = this->prepared.find(name);
+    if (found == this->prepared.end())
+        throw StatementCacheError("unknown prepared statement " + name);
+    return found->second;
+}
+
+/**
+    Execute: DEALLOCATE <name>
+    @param name  name given to PREPARE
+*/
+void StatementCache::deallocate(const string &name) {
+    auto found = this->prepared.find(name);
+    if (found == this->prepared.end())
+        return;
+    delete found->second;
+    this->prepared.erase(found);
+}
+
+/**
+    Canonical form of a query used as the cache key: whitespace runs outside of quotes are
+    collapsed to a single blank and leading/trailing blanks and semicolons are dropped.
+    @param query  query text as typed
+    @returns      normalized query text
+*/
+string StatementCache::normalize(const string &query) {
+    string result;
+    char quote = 0;
+    bool pending_space = false;
+    for (char c : query) {
+        if (quote == 0 && isspace((unsigned char) c)) {
+            pending_space = !result.empty();
+            continue;
+        }
+        if (pending_space)
+            result += ' ';
+        pending_space = false;
+        if (quote == 0 && (c == '\'' || c == '"'))
+            quote = c;
+        else if (c == quote)
+            quote = 0;
+        result += c;
+    }
+    while (!result.empty() && (result.back() == ';' || result.back() == ' '))
+        result.pop_back();
+    return result;
+}
+
+/**
+    Parse the argument list of EXECUTE, e.g. "(12, 'abc')"
+    @param text  comma-separated integer and quoted string literals, optionally in parentheses
+    @returns     the values in order
+    @throws      StatementCacheError if a value is not a valid literal
+*/
+vector<Value> StatementCache::parse_parameters(const string &text) {
+    vector<Value> params;
+    string list = normalize(text);
+    if (!list.empty() && list.front() == '(' && list.back() == ')')
+        list = list.substr(1, list.size() - 2);
+
+    uint i = 0;
+    while (i < list.size()) {
+        while (i < list.size() && list[i] == ' ')
+            i++;
+        if (i == list.size())
+            break;
+        if (list[i] == '\'') {
+            string s;
+            for (i++; i < list.size(); i++) {
+                if (list[i] == '\'') {
+                    if (i + 1 < list.size() && list[i + 1] == '\'') {
+                        s += '\'';
+                        i++;
+                    } else
+                        break;
+                } else
+                    s += list[i];
+            }
+            if (i == list.size())
+                throw StatementCacheError("unterminated string parameter");
+            i++;
+            params.push_back(Value(s));
+        } else {
+            size_t end = list.find(',', i);
+            string token = list.substr(i, end == string::npos ? string::npos : end - i);
+            while (!token.empty() && token.back() == ' ')
+                token.pop_back();
+            char *stop;
+            long n = strtol(token.c_str(), &stop, 10);
+            if (token.empty() || *stop != '\0')
+                throw StatementCacheError("parameter must be an integer or a quoted string: " + token);
+            params.push_back(Value((int32_t) n));
+            i = end == string::npos ? list.size() : end;
+        }
+        while (i < list.size() && list[i] == ' ')
+            i++;
+        if (i < list.size()) {
+            if (list[i] != ',')
+                throw StatementCacheError("expected ',' between parameters");
+            i++;
+        }
+    }
+    return params;
+}
+
+/**
+    Check if a statement changes table definitions (and so invalidates cached plans)
+    @param stmt  statement to check
+    @returns     true for CREATE, DROP, ALTER, and RENAME
+*/
+bool StatementCache::is_ddl(const SQLStatement *stmt) {
+    switch (stmt->type()) {
+        case kStmtCreate:
+        case kStmtDrop:
+        case kStmtAlter:
+        case kStmtRename:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Testing function for StatementCache.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_statement_cache() {
+    if (StatementCache::normalize("  select *\n  from\tfoo ;") != "select * from foo")
+        return false;
+    if (StatementCache::normalize("select 'a  b' from foo") != "select 'a  b' from foo")
+        return false;
+
+    vector<Value> params = StatementCache::parse_parameters("(12, 'it''s, ok', -3)");
+    if (params.size() != 3 || params[0].n != 12 || params[1].s != "it's, ok" || params[2].n != -3)
+        return false;
+    try {
+        StatementCache::parse_parameters("(12, abc)");
+        return false;
+    } catch (StatementCacheError &e) {
+        // expected
+    }
+
+    StatementCache cache(2);
+    const SQLParserResult *first = cache.get("select * from foo");
+    if (cache.get("select *   from foo;") != first || cache.get_hits() != 1 || cache.get_misses() != 1)
+        return false;
+    cache.get("select a from foo");
+    cache.get("select b from foo");  // evicts the first query
+    if (cache.size() != 2)
+        return false;
+    cache.get("select * from foo");
+    if (cache.get_misses() != 4)
+        return false;
+    cache.invalidate();
+    if (cache.size() != 0)
+        return false;
+
+    // a SELECT is planned once and its plan run again each time
+    StatementCache plan_cache;
+    const char *queries[] = {"create table _test_plan_cache (a int)", "insert into _test_plan_cache values (1)",
+                             "insert into _test_plan_cache values (2)"};
+    for (auto query : queries)
+        delete SQLExec::execute(plan_cache.get(query)->getStatement(0));
+    const SQLParserResult *select = plan_cache.get("select a from _test_plan_cache");
+    QueryOperator *plan = plan_cache.get_plan(select, 0);
+    bool ok = plan != nullptr && plan_cache.get_plan(select, 0) == plan && plan_cache.get_plan_hits() == 1
+              && plan_cache.get_plan(plan_cache.get(queries[1]), 0) == nullptr;
+    for (int run = 0; ok && run < 2; run++) {
+        QueryResult *result = SQLExec::run(plan);
+        ok = result->get_rows()->size() == 2;
+        delete result;
+    }
+    PreparedStatement uncached("select a from _test_plan_cache");
+    ok = ok && plan_cache.get_plan(uncached.get_parse(), 0) == nullptr;
+    delete SQLExec::execute(plan_cache.get("drop table _test_plan_cache")->getStatement(0));
+    plan_cache.invalidate();
+    return ok;
+}
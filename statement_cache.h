@@ -0,0 +1,128 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SQLParser.h"
+#include "storage_engine.h"
+#include "query_operators.h"
+
+/**
+ * @class StatementCacheError - generic exception class for the statement cache and prepared statements
+ */
+class StatementCacheError : public std::runtime_error {
+public:
+    explicit StatementCacheError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class PreparedStatement - a parsed statement with '?' placeholders that can be executed repeatedly
+ *
+ *      The statement is parsed once by PREPARE. Each EXECUTE binds the parameter values directly into
+ *      the placeholder nodes of the parse tree, runs the statements, and then unbinds them again so the
+ *      same tree can be reused with the next set of values.
+ *      Placeholders are numbered left to right in the order they appear in the query text.
+ */
+class PreparedStatement {
+public:
+    PreparedStatement(const std::string &query);
+
+    virtual ~PreparedStatement();
+
+    PreparedStatement(const PreparedStatement &other) = delete;
+
+    PreparedStatement(PreparedStatement &&temp) = delete;
+
+    PreparedStatement &operator=(const PreparedStatement &other) = delete;
+
+    PreparedStatement &operator=(PreparedStatement &&temp) = delete;
+
+    virtual const hsql::SQLParserResult *get_parse() const { return parse; }
+
+    virtual size_t param_count() const { return placeholders.size(); }
+
+    virtual void bind(const std::vector<Value> &params);
+
+    virtual void unbind();
+
+protected:
+    hsql::SQLParserResult *parse;
+    std::vector<hsql::Expr *> placeholders;
+};
+
+/**
+ * @class StatementCache - LRU cache of parsed statements keyed by normalized query text
+ *
+ *      The shell looks every line up here before calling the parser, so a statement that was seen
+ *      recently is neither parsed nor walked again. Entries (including ones that failed to parse) are
+ *      owned by the cache and stay valid until the next call to get() or invalidate().
+ *      The plan of each SELECT in an entry is kept with it once built (see get_plan), so a repeated
+ *      query is not planned again either; DDL has to invalidate() the cache, as the plans point at
+ *      the tables. A kept plan stays in the join order it was given when it was built.
+ *      Also holds the named statements created with PREPARE.
+ */
+class StatementCache {
+public:
+    static const size_t DEFAULT_CAPACITY = 128;
+
+    StatementCache(size_t capacity = DEFAULT_CAPACITY);
+
+    virtual ~StatementCache();
+
+    StatementCache(const StatementCache &other) = delete;
+
+    StatementCache(StatementCache &&temp) = delete;
+
+    StatementCache &operator=(const StatementCache &other) = delete;
+
+    StatementCache &operator=(StatementCache &&temp) = delete;
+
+    virtual const hsql::SQLParserResult *get(const std::string &query);
+
+    virtual QueryOperator *get_plan(const hsql::SQLParserResult *parse, uint i);
+
+    virtual void invalidate();
+
+    virtual void prepare(const std::string &name, const std::string &query);
+
+    virtual PreparedStatement *get_prepared(const std::string &name);
+
+    virtual void deallocate(const std::string &name);
+
+    virtual size_t size() const { return lru.size(); }
+
+    virtual u_int64_t get_hits() const { return hits; }
+
+    virtual u_int64_t get_misses() const { return misses; }
+
+    virtual u_int64_t get_plan_hits() const { return plan_hits; }
+
+    static std::string normalize(const std::string &query);
+
+    static std::vector<Value> parse_parameters(const std::string &text);
+
+    static bool is_ddl(const hsql::SQLStatement *stmt);
+
+protected:
+    // a query's parse, and the plans of those of its SELECTs run so far (by statement number)
+    struct Entry {
+        std::string query;
+        hsql::SQLParserResult *parse;
+        std::map<uint, QueryOperator *> plans;
+    };
+
+    size_t capacity;
+    std::list<Entry> lru;  // most recently used at the front
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::unordered_map<const hsql::SQLParserResult *, std::list<Entry>::iterator> parses;
+    std::map<std::string, PreparedStatement *> prepared;
+    u_int64_t hits;
+    u_int64_t misses;
+    u_int64_t plan_hits;
+
+    static void free_entry(Entry &entry);
+};
+
+bool test_statement_cache();
@@ -14,6 +14,7 @@
  * Accessors:
  * 	get_block()
  * 	get_data()
+ * 	get_block_size()
  * 	get_block_id()
  */
 
@@ -56,6 +57,7 @@
 #include <utility>
 #include <vector>
 #include "db_cxx.h"
+#include "arena.h"
 
 /**
  * Global variable to hold dbenv.
@@ -67,15 +69,17 @@ extern DbEnv *_DB_ENV;
  */
 typedef u_int16_t RecordID;
 typedef u_int32_t BlockID;
-typedef std::vector<RecordID> RecordIDs;
+typedef std::vector<RecordID, ArenaAllocator<RecordID>> RecordIDs;
 typedef std::length_error DbBlockNoRoomError;
 
 class DbBlock {
 public:
     /**
-     * our blocks are 4kB
+     * our blocks are 4kB by default; each file can pick its own size from MIN_BLOCK_SZ to MAX_BLOCK_SZ
      */
     static const uint BLOCK_SZ = 4096;
+    static const uint MIN_BLOCK_SZ = 4096;
+    static const uint MAX_BLOCK_SZ = 1 << 20;
 
     /**
      * ctor/dtor (subclasses should handle the big-5)
@@ -84,6 +88,13 @@ public:
 
     virtual ~DbBlock() {}
 
+    /**
+     * Blocks only live as long as the statement using them, so they come from its arena (if any).
+     */
+    static void *operator new(size_t size) { return arena_allocate(size); }
+
+    static void operator delete(void *p) { arena_free(p); }
+
     /**
      * Reinitialize this block to an empty new block.
      */
@@ -137,6 +148,12 @@ public:
      */
     virtual void *get_data() { return block.get_data(); }
 
+    /**
+     * Size of this block in bytes (the same for every block of a file).
+     * @returns  number of bytes in the block
+     */
+    virtual uint get_block_size() { return block.get_size(); }
+
     /**
      * Get this block's BlockID within its DbFile.
      * @returns this block's id
@@ -149,7 +166,7 @@ protected:
 };
 
 // convenience type alias
-typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<BlockID, ArenaAllocator<BlockID>> BlockIDs;  // FIXME: will need to turn this into an iterator at some point
 
 
 class DbFile {
@@ -223,7 +240,7 @@ public:
 
     virtual ~ColumnAttribute() {}
 
-    virtual DataType get_data_type() { return data_type; }
+    virtual DataType get_data_type() const { return data_type; }
 
     virtual void set_data_type(DataType data_type) { this->data_type = data_type; }
 
@@ -245,7 +262,20 @@ public:
 
     Value(int32_t n) : n(n) { data_type = ColumnAttribute::INT; }
 
-    Value(std::string s) : s(s) { data_type = ColumnAttribute::TEXT; }
+    Value(std::string s) : n(0), s(s) { data_type = ColumnAttribute::TEXT; }
+
+    bool operator==(const Value &other) const {
+        return data_type == other.data_type && (data_type == ColumnAttribute::INT ? n == other.n : s == other.s);
+    }
+
+    bool operator!=(const Value &other) const { return !(*this == other); }
+
+    // INTs order numerically, TEXTs by bytes, and all INTs before all TEXTs
+    bool operator<(const Value &other) const {
+        if (data_type != other.data_type)
+            return data_type < other.data_type;
+        return data_type == ColumnAttribute::INT ? n < other.n : s < other.s;
+    }
 };
 
 // More type aliases
@@ -253,8 +283,10 @@ typedef std::string Identifier;
 typedef std::vector<Identifier> ColumnNames;
 typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
-typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
-typedef std::map<Identifier, Value> ValueDict;
+typedef std::vector<Handle, ArenaAllocator<Handle>> Handles;  // FIXME: will need to turn this into an iterator at some point
+typedef std::map<Identifier, Value, std::less<Identifier>, ArenaAllocator<std::pair<const Identifier, Value>>> ValueDict;
+typedef std::vector<std::pair<Handle, Handle>> Relocations;  // (old handle, new handle) of rows that moved
+typedef std::map<Identifier, std::pair<int32_t, int32_t>> IntRanges;  // (low, high), both inclusive, per INT column
 
 
 /**
@@ -310,6 +342,16 @@ public:
      */
     virtual Handle insert(const ValueDict *row) = 0;
 
+    /**
+     * Execute: INSERT INTO <table_name> ... for many rows at once.
+     * Relations that can do better than one row at a time override this.
+     * @param rows  dictionaries keyed by column names
+     */
+    virtual void insert(const std::vector<ValueDict *> *rows) {
+        for (auto const &row: *rows)
+            insert(row);
+    }
+
     /**
      * Conceptually, execute: UPDATE INTO <table_name> SET <new_valus> WHERE <handle>
      * where handle is sufficient to identify one specific record (e.g., returned
@@ -327,6 +369,16 @@ public:
      */
     virtual void del(const Handle handle) = 0;
 
+    /**
+     * Conceptually, execute: DELETE FROM <table_name> WHERE <handle> IN <handles>
+     * Relations that can do better than one row at a time override this.
+     * @param handles  the rows to delete
+     */
+    virtual void del(const Handles *handles) {
+        for (auto const &handle: *handles)
+            del(handle);
+    }
+
     /**
      * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE 1
      * @returns  a pointer to a list of handles for qualifying rows (caller frees)
@@ -340,6 +392,30 @@ public:
      */
     virtual Handles *select(const ValueDict *where) = 0;
 
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where> LIMIT <limit>,
+     * continuing a scan from position so that it can stop early and resume later.
+     * Relations that can't scan incrementally return all qualifying rows at once.
+     * @param where     where-clause predicates (nullptr for all rows)
+     * @param limit     how many handles the caller wants (more may be returned)
+     * @param position  in: where to continue (0 to start); out: where to continue next, 0 at the end
+     * @returns         a pointer to a list of handles for qualifying rows (freed by caller)
+     */
+    virtual Handles *select(const ValueDict *where, size_t limit, BlockID &position) {
+        position = 0;
+        return where == nullptr ? select() : select(where);
+    }
+
+    /**
+     * Like select(where, limit, position), with a hint that qualifying rows also lie within the given
+     * ranges, so a relation can skip the parts of the table that can't have any (e.g. by zone maps).
+     * Rows outside the ranges may still be returned; the caller checks them itself.
+     * @param ranges  bounds on INT columns (nullptr for none)
+     */
+    virtual Handles *select(const ValueDict *where, const IntRanges *ranges, size_t limit, BlockID &position) {
+        return select(where, limit, position);
+    }
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -356,6 +432,40 @@ public:
      */
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) = 0;
 
+    /**
+     * VACUUM, offline: rewrite the relation's storage so it takes no more space than its rows need.
+     * Handles held from before are no longer valid afterwards.
+     * @returns  how many blocks were given back
+     */
+    virtual u_int32_t vacuum() { return 0; }
+
+    /**
+     * VACUUM, online: one small step of compacting the relation while it stays in use.
+     * @param max_rows   how many rows the step may move
+     * @param relocated  if not nullptr, gets (old handle, new handle) of every row that moved,
+     *                   so that anything holding handles (like an index) can be repointed
+     * @returns          true if there is more to do
+     */
+    virtual bool vacuum_step(size_t max_rows, Relocations *relocated = nullptr) { return false; }
+
+    /**
+     * About how many rows the relation has, for planning (and EXPLAIN). This one counts them all;
+     * relations that can guess more cheaply do.
+     * @returns  the estimate
+     */
+    virtual u_int64_t estimate_row_count() {
+        Handles *handles = select();
+        u_int64_t count = handles->size();
+        delete handles;
+        return count;
+    }
+
+    virtual const Identifier &get_table_name() const { return table_name; }
+
+    virtual const ColumnNames &get_column_names() const { return column_names; }
+
+    virtual const ColumnAttributes &get_column_attributes() const { return column_attributes; }
+
 protected:
     Identifier table_name;
     ColumnNames column_names;
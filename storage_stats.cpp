@@ -0,0 +1,313 @@
+#include "storage_stats.h"
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+static const char *STATS_OP_NAMES[NUM_STATS_OPS] = {
+        "HeapFile::get",
+        "HeapFile::put",
+        "HeapFile::get_new",
+        "HeapFile::write",
+        "SlottedPage::add",
+        "SlottedPage::slide",
+        "HeapTable::marshal",
+        "HeapTable::unmarshal"
+};
+
+/**
+ * Counters for one entry point. Only the owning thread writes them, so relaxed loads and stores
+ * are enough (no locked read-modify-write on the hot path); readers may see slightly stale values.
+ */
+struct OpStats {
+    atomic<u_int64_t> calls;
+    atomic<u_int64_t> total_ns;
+    atomic<u_int64_t> max_ns;
+    atomic<u_int64_t> buckets[StorageStats::NUM_BUCKETS];
+
+    OpStats() : calls(0), total_ns(0), max_ns(0) {
+        for (auto &bucket : buckets)
+            bucket.store(0, memory_order_relaxed);
+    }
+
+    static void bump(atomic<u_int64_t> &counter, u_int64_t n) {
+        counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+
+    void record(u_int64_t ns) {
+        bump(calls, 1);
+        bump(total_ns, ns);
+        if (ns > max_ns.load(memory_order_relaxed))
+            max_ns.store(ns, memory_order_relaxed);
+        uint bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+        bump(buckets[bucket < StorageStats::NUM_BUCKETS ? bucket : StorageStats::NUM_BUCKETS - 1], 1);
+    }
+
+    void reset() {
+        calls.store(0, memory_order_relaxed);
+        total_ns.store(0, memory_order_relaxed);
+        max_ns.store(0, memory_order_relaxed);
+        for (auto &bucket : buckets)
+            bucket.store(0, memory_order_relaxed);
+    }
+};
+
+// Plain (non-atomic) sum of OpStats used while building a report
+struct OpTotals {
+    u_int64_t calls;
+    u_int64_t total_ns;
+    u_int64_t max_ns;
+    u_int64_t buckets[StorageStats::NUM_BUCKETS];
+
+    OpTotals() : calls(0), total_ns(0), max_ns(0), buckets() {}
+
+    void add(const OpStats &op) {
+        calls += op.calls.load(memory_order_relaxed);
+        total_ns += op.total_ns.load(memory_order_relaxed);
+        u_int64_t m = op.max_ns.load(memory_order_relaxed);
+        if (m > max_ns)
+            max_ns = m;
+        for (uint i = 0; i < StorageStats::NUM_BUCKETS; i++)
+            buckets[i] += op.buckets[i].load(memory_order_relaxed);
+    }
+
+    // upper bound of the bucket holding the given quantile, in nanoseconds
+    u_int64_t percentile(double q) const {
+        u_int64_t target = (u_int64_t) (q * calls), seen = 0;
+        for (uint i = 0; i < StorageStats::NUM_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen > target)
+                return 1ULL << (i + 1);
+        }
+        return max_ns;
+    }
+};
+
+struct TableOps {
+    OpStats ops[NUM_STATS_OPS];
+};
+
+struct ThreadStats;
+
+// Registry shared by all threads (only touched when registering and reporting)
+static mutex &registry_lock() {
+    static mutex lock;
+    return lock;
+}
+
+static map<string, int> table_ids;
+static vector<string> table_names(1, "");  // id 0: work not attributed to any table
+static set<ThreadStats *> live_threads;
+static vector<TableOps *> retired;  // counts from threads that have exited
+
+/**
+ * Counters of one thread, indexed by table id. Only the owning thread adds tables; it does so
+ * under the lock so that a concurrent report never sees the vector being reallocated.
+ */
+struct ThreadStats {
+    mutex lock;
+    vector<TableOps *> tables;
+
+    ThreadStats() {
+        lock_guard<mutex> guard(registry_lock());
+        live_threads.insert(this);
+    }
+
+    ~ThreadStats() {
+        lock_guard<mutex> guard(registry_lock());
+        live_threads.erase(this);
+        while (retired.size() < tables.size())
+            retired.push_back(new TableOps());
+        for (uint id = 0; id < tables.size(); id++) {
+            for (uint op = 0; op < NUM_STATS_OPS; op++) {
+                OpStats &from = tables[id]->ops[op], &to = retired[id]->ops[op];
+                OpStats::bump(to.calls, from.calls.load(memory_order_relaxed));
+                OpStats::bump(to.total_ns, from.total_ns.load(memory_order_relaxed));
+                if (from.max_ns.load(memory_order_relaxed) > to.max_ns.load(memory_order_relaxed))
+                    to.max_ns.store(from.max_ns.load(memory_order_relaxed), memory_order_relaxed);
+                for (uint b = 0; b < StorageStats::NUM_BUCKETS; b++)
+                    OpStats::bump(to.buckets[b], from.buckets[b].load(memory_order_relaxed));
+            }
+            delete tables[id];
+        }
+    }
+
+    TableOps *get(int table_id) {
+        if ((uint) table_id >= tables.size()) {
+            lock_guard<mutex> guard(lock);
+            while (tables.size() <= (uint) table_id)
+                tables.push_back(new TableOps());
+        }
+        return tables[table_id];
+    }
+};
+
+static thread_local ThreadStats thread_stats;
+static thread_local int current_table = 0;
+
+/**
+    Register a table by name (idempotent)
+    @param table_name  name of the table
+    @returns           the id to pass to STATS_TABLE_SCOPE
+*/
+int StorageStats::table_id(const string &table_name) {
+    lock_guard<mutex> guard(registry_lock());
+    auto found = table_ids.find(table_name);
+    if (found != table_ids.end())
+        return found->second;
+    int id = (int) table_names.size();
+    table_names.push_back(table_name);
+    table_ids[table_name] = id;
+    return id;
+}
+
+/**
+    Record one call of an entry point for the current table on this thread
+    @param op           which entry point
+    @param nanoseconds  how long the call took
+*/
+void StorageStats::record(StatsOp op, u_int64_t nanoseconds) {
+    thread_stats.get(current_table)->ops[op].record(nanoseconds);
+}
+
+int StorageStats::get_current_table() {
+    return current_table;
+}
+
+void StorageStats::set_current_table(int table_id) {
+    current_table = table_id;
+}
+
+// Apply fn to every TableOps (live threads and retired) for the table id, or all ids if id < 0
+template<typename Fn>
+static void for_each_table_ops(int table_id, Fn fn) {
+    for (ThreadStats *thread : live_threads) {
+        lock_guard<mutex> guard(thread->lock);
+        for (uint id = 0; id < thread->tables.size(); id++)
+            if (table_id < 0 || (int) id == table_id)
+                fn(*thread->tables[id]);
+    }
+    for (uint id = 0; id < retired.size(); id++)
+        if (table_id < 0 || (int) id == table_id)
+            fn(*retired[id]);
+}
+
+/**
+    Format the counters as a table, one line per entry point
+    @param table_name  table to report on, or "" for totals across all tables
+    @returns           the report (times in microseconds)
+*/
+string StorageStats::report(const string &table_name) {
+    if (!enabled())
+        return "storage statistics are compiled out (NO_STORAGE_STATS)";
+
+    lock_guard<mutex> guard(registry_lock());
+    int table_id = -1;
+    if (!table_name.empty()) {
+        auto found = table_ids.find(table_name);
+        if (found == table_ids.end())
+            return "no statistics for table " + table_name;
+        table_id = found->second;
+    }
+
+    OpTotals totals[NUM_STATS_OPS];
+    for_each_table_ops(table_id, [&totals](const TableOps &table) {
+        for (uint op = 0; op < NUM_STATS_OPS; op++)
+            totals[op].add(table.ops[op]);
+    });
+
+    char line[200];
+    snprintf(line, sizeof(line), "%-20s %12s %14s %10s %10s %10s %10s",
+             "operation", "calls", "total_us", "avg_us", "p50_us", "p99_us", "max_us");
+    string result(line);
+    for (uint op = 0; op < NUM_STATS_OPS; op++) {
+        const OpTotals &t = totals[op];
+        snprintf(line, sizeof(line), "\n%-20s %12llu %14.1f %10.2f %10.2f %10.2f %10.2f", STATS_OP_NAMES[op],
+                 (unsigned long long) t.calls, t.total_ns / 1000.0,
+                 t.calls == 0 ? 0.0 : t.total_ns / 1000.0 / t.calls,
+                 t.calls == 0 ? 0.0 : t.percentile(0.5) / 1000.0,
+                 t.calls == 0 ? 0.0 : t.percentile(0.99) / 1000.0, t.max_ns / 1000.0);
+        result += line;
+    }
+    return result;
+}
+
+/**
+    Total number of calls recorded for an entry point
+    @param table_name  table to count, or "" for all tables
+    @param op          which entry point
+    @returns           number of calls since the last reset
+*/
+u_int64_t StorageStats::calls(const string &table_name, StatsOp op) {
+    lock_guard<mutex> guard(registry_lock());
+    int table_id = -1;
+    if (!table_name.empty()) {
+        auto found = table_ids.find(table_name);
+        if (found == table_ids.end())
+            return 0;
+        table_id = found->second;
+    }
+    OpTotals total;
+    for_each_table_ops(table_id, [&total, op](const TableOps &table) { total.add(table.ops[op]); });
+    return total.calls;
+}
+
+/**
+    Zero the counters
+    @param table_name  table to reset, or "" for all tables
+*/
+void StorageStats::reset(const string &table_name) {
+    lock_guard<mutex> guard(registry_lock());
+    int table_id = -1;
+    if (!table_name.empty()) {
+        auto found = table_ids.find(table_name);
+        if (found == table_ids.end())
+            return;
+        table_id = found->second;
+    }
+    for_each_table_ops(table_id, [](TableOps &table) {
+        for (auto &op : table.ops)
+            op.reset();
+    });
+}
+
+/**
+    Check if the instrumentation was compiled in
+    @returns false if built with NO_STORAGE_STATS
+*/
+bool StorageStats::enabled() {
+#ifndef NO_STORAGE_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Testing function for StorageStats.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_storage_stats() {
+    if (!StorageStats::enabled())
+        return true;
+    int id = StorageStats::table_id("_test_stats");
+    if (StorageStats::table_id("_test_stats") != id)
+        return false;
+    StorageStats::reset("_test_stats");
+    {
+        StatsTableScope scope(id);
+        StorageStats::record(STATS_HEAPFILE_GET, 1500);
+        StorageStats::record(STATS_HEAPFILE_GET, 3000);
+    }
+    if (StorageStats::get_current_table() != 0)
+        return false;
+    if (StorageStats::calls("_test_stats", STATS_HEAPFILE_GET) != 2)
+        return false;
+    if (StorageStats::report("_test_stats").find("HeapFile::get") == string::npos)
+        return false;
+    StorageStats::reset("_test_stats");
+    return StorageStats::calls("_test_stats", STATS_HEAPFILE_GET) == 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file storage_stats.h - low-overhead instrumentation of the heap storage engine
+ *
+ * Call counts and log2-bucketed latency histograms for the storage entry points, kept per thread
+ * (so the hot path never takes a lock or a contended cache line) and per table, and summed up
+ * only when a report is requested with SHOW STATS [table].
+ *
+ * Compile with -DNO_STORAGE_STATS (make STORAGE_STATS=no) to remove the instrumentation entirely:
+ * the STATS_* macros then expand to nothing.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <sys/types.h>
+
+/**
+ * Instrumented storage entry points
+ */
+enum StatsOp {
+    STATS_HEAPFILE_GET,
+    STATS_HEAPFILE_PUT,
+    STATS_HEAPFILE_GET_NEW,
+    STATS_HEAPFILE_WRITE,  // a dirty block written back to Berkeley DB
+    STATS_SLOTTEDPAGE_ADD,
+    STATS_SLOTTEDPAGE_SLIDE,
+    STATS_HEAPTABLE_MARSHAL,
+    STATS_HEAPTABLE_UNMARSHAL,
+    NUM_STATS_OPS
+};
+
+/**
+ * @class StorageStats - registry of the per-thread, per-table counters
+ *
+ *      Tables are registered once by name (e.g. in the HeapFile constructor) and then referred to
+ *      by a small integer id. The storage code marks which table it is working for with
+ *      STATS_TABLE_SCOPE(id); everything timed with STATS_TIMER(op) inside that scope, including
+ *      SlottedPage calls which don't know their table, is charged to that table.
+ */
+class StorageStats {
+public:
+    // latency buckets: bucket i counts calls taking [2^i, 2^(i+1)) nanoseconds
+    static const uint NUM_BUCKETS = 40;
+
+    static int table_id(const std::string &table_name);
+
+    static void record(StatsOp op, u_int64_t nanoseconds);
+
+    static int get_current_table();
+
+    static void set_current_table(int table_id);
+
+    static std::string report(const std::string &table_name = "");
+
+    static u_int64_t calls(const std::string &table_name, StatsOp op);
+
+    static void reset(const std::string &table_name = "");
+
+    static bool enabled();
+};
+
+/**
+ * @class StatsTimer - times its own lifetime and records it against the current table
+ */
+class StatsTimer {
+public:
+    StatsTimer(StatsOp op) : op(op), start(std::chrono::steady_clock::now()) {}
+
+    ~StatsTimer() {
+        StorageStats::record(op, (u_int64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+    }
+
+    StatsTimer(const StatsTimer &other) = delete;
+
+    StatsTimer &operator=(const StatsTimer &other) = delete;
+
+protected:
+    StatsOp op;
+    std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * @class StatsTableScope - charges everything recorded during its lifetime to the given table
+ */
+class StatsTableScope {
+public:
+    StatsTableScope(int table_id) : saved(StorageStats::get_current_table()) {
+        StorageStats::set_current_table(table_id);
+    }
+
+    ~StatsTableScope() { StorageStats::set_current_table(saved); }
+
+    StatsTableScope(const StatsTableScope &other) = delete;
+
+    StatsTableScope &operator=(const StatsTableScope &other) = delete;
+
+protected:
+    int saved;
+};
+
+#ifndef NO_STORAGE_STATS
+#define STATS_TIMER(op) StatsTimer _stats_timer(op)
+#define STATS_TABLE_SCOPE(table_id) StatsTableScope _stats_table_scope(table_id)
+#else
+#define STATS_TIMER(op)
+#define STATS_TABLE_SCOPE(table_id)
+#endif
+
+bool test_storage_stats();